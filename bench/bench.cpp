@@ -0,0 +1,909 @@
+// Throughput benchmarks for CPU::Execute.
+//
+// Each benchmark loads a guest program into a fresh machine, runs it to its
+// BRK, checks the answer, and repeats until --min-time has been spent. Whole
+// kernels show real-world throughput; the family/* loops each repeat one
+// kind of instruction to show what that handler costs.
+//
+// Output is a table by default, or JSON laid out like Google Benchmark's
+// (--json, or --out=FILE) so runs can be stored and compared across commits.
+// --profile instead runs each benchmark once under the Profiler and prints
+// where its cycles went, then once under an IdleLog for the idle loops
+// Execute skipped; --trace=FILE runs each with and without a Tracer
+// writing to FILE and prints what tracing cost; --exact likewise compares
+// CPU::Execute with CycleExact::Execute calling a bus hook every cycle, and
+// --cache with BlockCache::Execute. --lockstep runs each on 8, 16 and 32
+// machines, one after another and together in a Lockstep. --startup times
+// getting a machine ready to run instead: powering on, forking and
+// resetting.
+//
+//   ./bin/bench [--json] [--out=FILE] [--filter=SUBSTRING] [--min-time=SECONDS]
+//               [--profile] [--trace=FILE] [--exact] [--cache] [--lockstep]
+//               [--startup]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <memory>
+#include "6502_emulator.hpp"
+#include "block_cache.hpp"
+#include "cycle_exact.hpp"
+#include "lockstep.hpp"
+#include "profiler.hpp"
+#include "trace.hpp"
+
+namespace {
+
+constexpr Word program_loc = 0x0200;
+
+struct Benchmark {
+    std::string name;
+    void (*load)(Mem &mem);
+    bool (*check)(const Mem &mem); // nullptr when there is nothing to check
+};
+
+void LoadProgram(Mem &mem, const std::vector<Byte> &program, Word at = program_loc) {
+    mem.Load(at, program.data(), static_cast<u32>(program.size()));
+}
+
+// The Fibonacci loop from the demo, 255 steps, repeated 256 times.
+void LoadFibonacci(Mem &mem) {
+    LoadProgram(mem, {
+        0xA0, 0x00,       // LDY #0
+        // outer:
+        0xA9, 0x00,       // LDA #0
+        0x85, 0x11,       // STA $11 (result)
+        0xA9, 0x01,       // LDA #1
+        0x85, 0x12,       // STA $12 (prev)
+        0xA2, 0xFF,       // LDX #255
+        // loop:
+        0x18,             // CLC
+        0xA5, 0x11,       // LDA $11
+        0x65, 0x12,       // ADC $12
+        0x85, 0x13,       // STA $13 (sum)
+        0xA5, 0x11,       // LDA $11
+        0x85, 0x12,       // STA $12
+        0xA5, 0x13,       // LDA $13
+        0x85, 0x11,       // STA $11
+        0xCA,             // DEX
+        0xD0, 0xEE,       // BNE loop
+        0x88,             // DEY
+        0xD0, 0xE1,       // BNE outer
+        0x00              // BRK
+    });
+}
+
+bool CheckFibonacci(const Mem &mem) {
+    Byte result = 0, prev = 1;
+    for (int i = 0; i < 255; ++i) {
+        Byte sum = static_cast<Byte>(result + prev);
+        prev = result;
+        result = sum;
+    }
+    return mem[0x11] == result;
+}
+
+// Copies 4 KiB from $1000 to $2000 through (zp),Y pointers.
+void LoadMemcpy(Mem &mem) {
+    for (Word i = 0; i < 0x1000; ++i) {
+        mem[0x1000 + i] = static_cast<Byte>(i * 7 + (i >> 8));
+    }
+    LoadProgram(mem, {
+        0xA9, 0x00,       // LDA #0
+        0x85, 0xFB,       // STA $FB (src)
+        0x85, 0xFD,       // STA $FD (dst)
+        0xA9, 0x10,       // LDA #$10
+        0x85, 0xFC,       // STA $FC
+        0xA9, 0x20,       // LDA #$20
+        0x85, 0xFE,       // STA $FE
+        0xA2, 0x10,       // LDX #16 (pages)
+        0xA0, 0x00,       // LDY #0
+        // loop:
+        0xB1, 0xFB,       // LDA ($FB),Y
+        0x91, 0xFD,       // STA ($FD),Y
+        0xC8,             // INY
+        0xD0, 0xF9,       // BNE loop
+        0xE6, 0xFC,       // INC $FC
+        0xE6, 0xFE,       // INC $FE
+        0xCA,             // DEX
+        0xD0, 0xF2,       // BNE loop
+        0x00              // BRK
+    });
+}
+
+bool CheckMemcpy(const Mem &mem) {
+    for (Word i = 0; i < 0x1000; ++i) {
+        if (mem[0x2000 + i] != mem[0x1000 + i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Fills 4 KiB at $3000 with $A5.
+void LoadMemset(Mem &mem) {
+    LoadProgram(mem, {
+        0xA9, 0x00,       // LDA #0
+        0x85, 0xFB,       // STA $FB
+        0xA9, 0x30,       // LDA #$30
+        0x85, 0xFC,       // STA $FC
+        0xA9, 0xA5,       // LDA #$A5
+        0xA2, 0x10,       // LDX #16 (pages)
+        0xA0, 0x00,       // LDY #0
+        // loop:
+        0x91, 0xFB,       // STA ($FB),Y
+        0xC8,             // INY
+        0xD0, 0xFB,       // BNE loop
+        0xE6, 0xFC,       // INC $FC
+        0xCA,             // DEX
+        0xD0, 0xF6,       // BNE loop
+        0x00              // BRK
+    });
+}
+
+bool CheckMemset(const Mem &mem) {
+    for (Word i = 0; i < 0x1000; ++i) {
+        if (mem[0x3000 + i] != 0xA5) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Sieve of Eratosthenes over 0-4095; flags at $1000, nonzero = composite.
+void LoadSieve(Mem &mem) {
+    LoadProgram(mem, {
+        0xA9, 0x02,       // LDA #2
+        0x85, 0x10,       // STA $10 (i)
+        // outer:
+        0xA6, 0x10,       // LDX $10
+        0xBD, 0x00, 0x10, // LDA $1000,X
+        0xD0, 0x21,       // BNE next
+        0x8A,             // TXA
+        0x18,             // CLC
+        0x65, 0x10,       // ADC $10
+        0x85, 0xFB,       // STA $FB (j = 2i)
+        0xA9, 0x10,       // LDA #$10
+        0x85, 0xFC,       // STA $FC
+        0xA0, 0x00,       // LDY #0
+        // inner:
+        0xA9, 0x01,       // LDA #1
+        0x91, 0xFB,       // STA ($FB),Y
+        0xA5, 0xFB,       // LDA $FB
+        0x18,             // CLC
+        0x65, 0x10,       // ADC $10 (j += i)
+        0x85, 0xFB,       // STA $FB
+        0x90, 0xF3,       // BCC inner
+        0xE6, 0xFC,       // INC $FC
+        0xA5, 0xFC,       // LDA $FC
+        0xC9, 0x20,       // CMP #$20
+        0x90, 0xEB,       // BCC inner
+        // next:
+        0xE6, 0x10,       // INC $10
+        0xA5, 0x10,       // LDA $10
+        0xC9, 0x40,       // CMP #64
+        0x90, 0xD0,       // BCC outer
+        0x00              // BRK
+    });
+}
+
+bool CheckSieve(const Mem &mem) {
+    for (int n = 2; n < 0x1000; ++n) {
+        bool prime = true;
+        for (int d = 2; d * d <= n; ++d) {
+            if (n % d == 0) {
+                prime = false;
+                break;
+            }
+        }
+        if ((mem[0x1000 + n] == 0) != prime) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Bitwise CRC-16/CCITT (polynomial $1021, initial $FFFF) of 1 KiB at $1000.
+void LoadCrc16(Mem &mem) {
+    for (Word i = 0; i < 0x400; ++i) {
+        mem[0x1000 + i] = static_cast<Byte>(i ^ (i >> 3));
+    }
+    LoadProgram(mem, {
+        0xA9, 0xFF,       // LDA #$FF
+        0x85, 0x10,       // STA $10 (crc low)
+        0x85, 0x11,       // STA $11 (crc high)
+        0xA9, 0x00,       // LDA #0
+        0x85, 0xFB,       // STA $FB
+        0xA9, 0x10,       // LDA #$10
+        0x85, 0xFC,       // STA $FC
+        0xA2, 0x04,       // LDX #4 (pages)
+        0xA0, 0x00,       // LDY #0
+        // byte:
+        0xB1, 0xFB,       // LDA ($FB),Y
+        0x45, 0x11,       // EOR $11
+        0x85, 0x11,       // STA $11
+        0x8A,             // TXA
+        0x48,             // PHA
+        0xA2, 0x08,       // LDX #8
+        // bit:
+        0x06, 0x10,       // ASL $10
+        0x26, 0x11,       // ROL $11
+        0x90, 0x0C,       // BCC nox
+        0xA5, 0x10,       // LDA $10
+        0x49, 0x21,       // EOR #$21
+        0x85, 0x10,       // STA $10
+        0xA5, 0x11,       // LDA $11
+        0x49, 0x10,       // EOR #$10
+        0x85, 0x11,       // STA $11
+        // nox:
+        0xCA,             // DEX
+        0xD0, 0xEB,       // BNE bit
+        0x68,             // PLA
+        0xAA,             // TAX
+        0xC8,             // INY
+        0xD0, 0xDC,       // BNE byte
+        0xE6, 0xFC,       // INC $FC
+        0xCA,             // DEX
+        0xD0, 0xD7,       // BNE byte
+        0x00              // BRK
+    });
+}
+
+bool CheckCrc16(const Mem &mem) {
+    Word crc = 0xFFFF;
+    for (Word i = 0; i < 0x400; ++i) {
+        crc ^= static_cast<Word>(mem[0x1000 + i] << 8);
+        for (int bit = 0; bit < 8; ++bit) {
+            crc = (crc & 0x8000) ? static_cast<Word>((crc << 1) ^ 0x1021) : static_cast<Word>(crc << 1);
+        }
+    }
+    return mem[0x10] == (crc & 0xFF) && mem[0x11] == (crc >> 8);
+}
+
+// Shift-and-add 16x16 -> 32 bit multiply of k * 257 by $ABCD for k = 0-255,
+// summing the low words of the products.
+void LoadMultiply(Mem &mem) {
+    LoadProgram(mem, {
+        0xA9, 0x00,       // LDA #0
+        0x85, 0x28,       // STA $28 (sum)
+        0x85, 0x29,       // STA $29
+        0x85, 0x2A,       // STA $2A (k)
+        // loop:
+        0xA5, 0x2A,       // LDA $2A
+        0x85, 0x20,       // STA $20 (multiplicand)
+        0x85, 0x21,       // STA $21
+        0xA9, 0xCD,       // LDA #$CD
+        0x85, 0x22,       // STA $22 (multiplier)
+        0xA9, 0xAB,       // LDA #$AB
+        0x85, 0x23,       // STA $23
+        0x20, 0x40, 0x02, // JSR mul
+        0x18,             // CLC
+        0xA5, 0x28,       // LDA $28
+        0x65, 0x24,       // ADC $24
+        0x85, 0x28,       // STA $28
+        0xA5, 0x29,       // LDA $29
+        0x65, 0x25,       // ADC $25
+        0x85, 0x29,       // STA $29
+        0xE6, 0x2A,       // INC $2A
+        0xD0, 0xDE,       // BNE loop
+        0x00              // BRK
+    });
+    LoadProgram(mem, {
+        // mul: $24-$27 = $20-$21 * $22-$23
+        0xA9, 0x00,       // LDA #0
+        0x85, 0x26,       // STA $26
+        0x85, 0x27,       // STA $27
+        0xA2, 0x10,       // LDX #16
+        // mloop:
+        0x46, 0x23,       // LSR $23
+        0x66, 0x22,       // ROR $22
+        0x90, 0x0D,       // BCC noadd
+        0xA5, 0x26,       // LDA $26
+        0x18,             // CLC
+        0x65, 0x20,       // ADC $20
+        0x85, 0x26,       // STA $26
+        0xA5, 0x27,       // LDA $27
+        0x65, 0x21,       // ADC $21
+        0x85, 0x27,       // STA $27
+        // noadd:
+        0x66, 0x27,       // ROR $27
+        0x66, 0x26,       // ROR $26
+        0x66, 0x25,       // ROR $25
+        0x66, 0x24,       // ROR $24
+        0xCA,             // DEX
+        0xD0, 0xE2,       // BNE mloop
+        0x60              // RTS
+    }, 0x0240);
+}
+
+bool CheckMultiply(const Mem &mem) {
+    Word sum = 0;
+    u32 product = 0;
+    for (u32 k = 0; k < 256; ++k) {
+        product = k * 257 * 0xABCD;
+        sum = static_cast<Word>(sum + product);
+    }
+    u32 last = mem[0x24] | (mem[0x25] << 8) | (mem[0x26] << 16) | (static_cast<u32>(mem[0x27]) << 24);
+    return mem[0x28] == (sum & 0xFF) && mem[0x29] == (sum >> 8) && last == product;
+}
+
+// family/*: 32 copies of one instruction in a loop run 256 times.
+std::vector<Byte> FamilyLoop(std::vector<Byte> setup, const std::vector<Byte> &body) {
+    std::vector<Byte> program = std::move(setup);
+    program.insert(program.end(), {0xA2, 0x00}); // LDX #0
+    size_t loop = program.size();
+    for (int i = 0; i < 32; ++i) {
+        program.insert(program.end(), body.begin(), body.end());
+    }
+    program.push_back(0xCA); // DEX
+    program.push_back(0xD0); // BNE loop
+    program.push_back(static_cast<Byte>(loop - (program.size() + 1)));
+    program.push_back(0x00); // BRK
+    return program;
+}
+
+#define EMU6502_FAMILY(Name, Setup, ...)                                      \
+    void LoadFamily_##Name(Mem &mem) {                                          \
+        mem[0xFB] = 0x00;                                                       \
+        mem[0xFC] = 0x10;                                                       \
+        mem[0x0300] = 0x60; /* RTS for jsr */                                   \
+        LoadProgram(mem, FamilyLoop(std::vector<Byte> Setup, {__VA_ARGS__}));   \
+    }
+
+EMU6502_FAMILY(load_imm, ({}), 0xA9, 0x01)                   // LDA #1
+EMU6502_FAMILY(load_zp, ({}), 0xA5, 0x10)                    // LDA $10
+EMU6502_FAMILY(load_abs_x, ({}), 0xBD, 0x00, 0x10)           // LDA $1000,X
+EMU6502_FAMILY(load_ind_y, ({0xA0, 0x00}), 0xB1, 0xFB)       // LDA ($FB),Y
+EMU6502_FAMILY(store_zp, ({}), 0x85, 0x10)                   // STA $10
+EMU6502_FAMILY(store_abs, ({}), 0x8D, 0x00, 0x10)            // STA $1000
+EMU6502_FAMILY(alu, ({}), 0x69, 0x01)                        // ADC #1
+EMU6502_FAMILY(compare, ({}), 0xC9, 0x01)                    // CMP #1
+EMU6502_FAMILY(rmw_zp, ({}), 0xE6, 0x10)                     // INC $10
+EMU6502_FAMILY(shift_a, ({}), 0x0A)                          // ASL A
+EMU6502_FAMILY(register, ({}), 0xC8)                         // INY
+EMU6502_FAMILY(branch_taken, ({}), 0xD0, 0x00)               // BNE *+2, X is never 0
+EMU6502_FAMILY(branch_not_taken, ({}), 0xF0, 0x00)           // BEQ *+2
+EMU6502_FAMILY(stack, ({}), 0x48, 0x68)                      // PHA, PLA
+EMU6502_FAMILY(jsr_rts, ({}), 0x20, 0x00, 0x03)              // JSR $0300
+
+#undef EMU6502_FAMILY
+
+#define EMU6502_FAMILY_ENTRY(Name) {"family/" #Name, LoadFamily_##Name, nullptr}
+
+const std::vector<Benchmark> benchmarks = {
+    {"kernel/fibonacci", LoadFibonacci, CheckFibonacci},
+    {"kernel/memcpy", LoadMemcpy, CheckMemcpy},
+    {"kernel/memset", LoadMemset, CheckMemset},
+    {"kernel/sieve", LoadSieve, CheckSieve},
+    {"kernel/crc16", LoadCrc16, CheckCrc16},
+    {"kernel/multiply16", LoadMultiply, CheckMultiply},
+    EMU6502_FAMILY_ENTRY(load_imm),
+    EMU6502_FAMILY_ENTRY(load_zp),
+    EMU6502_FAMILY_ENTRY(load_abs_x),
+    EMU6502_FAMILY_ENTRY(load_ind_y),
+    EMU6502_FAMILY_ENTRY(store_zp),
+    EMU6502_FAMILY_ENTRY(store_abs),
+    EMU6502_FAMILY_ENTRY(alu),
+    EMU6502_FAMILY_ENTRY(compare),
+    EMU6502_FAMILY_ENTRY(rmw_zp),
+    EMU6502_FAMILY_ENTRY(shift_a),
+    EMU6502_FAMILY_ENTRY(register),
+    EMU6502_FAMILY_ENTRY(branch_taken),
+    EMU6502_FAMILY_ENTRY(branch_not_taken),
+    EMU6502_FAMILY_ENTRY(stack),
+    EMU6502_FAMILY_ENTRY(jsr_rts),
+};
+
+#undef EMU6502_FAMILY_ENTRY
+
+struct Result {
+    std::string name;
+    u64 iterations = 0;
+    double real_seconds = 0;
+    double cpu_seconds = 0;
+    u64 instructions = 0; // per iteration
+    s32 cycles = 0;       // per iteration
+    bool ok = true;
+};
+
+double CpuSeconds() {
+    return static_cast<double>(std::clock()) / CLOCKS_PER_SEC;
+}
+
+Result Run(const Benchmark &benchmark, double min_time) {
+    Result result;
+    result.name = benchmark.name;
+
+    Mem image;
+    CPU boot;
+    boot.PowerOn(image);
+    benchmark.load(image);
+    boot.PC = program_loc;
+
+    constexpr s32 budget = 1 << 30;
+    while (result.real_seconds < min_time) {
+        // Each iteration starts from a copy of the loaded image; with
+        // copy-on-write pages that is cheap, and it stays out of the timing.
+        Mem mem = image;
+        CPU cpu = boot;
+
+        auto real_start = std::chrono::steady_clock::now();
+        double cpu_start = CpuSeconds();
+        CPU::ExecResult exec = cpu.Execute(budget, mem);
+        result.cpu_seconds += CpuSeconds() - cpu_start;
+        result.real_seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - real_start).count();
+
+        if (result.iterations == 0) {
+            result.instructions = exec.InstructionsRetired;
+            result.cycles = exec.CyclesConsumed;
+            result.ok = exec.Reason == CPU::StopReason::Brk && (!benchmark.check || benchmark.check(mem));
+            if (!result.ok) {
+                result.iterations = 1;
+                break;
+            }
+        }
+        result.iterations++;
+    }
+    return result;
+}
+
+// Runs the benchmark once with the profiler attached and prints its report.
+bool Profile(const Benchmark &benchmark) {
+    Mem mem;
+    CPU cpu;
+    cpu.PowerOn(mem);
+    benchmark.load(mem);
+    cpu.PC = program_loc;
+
+    Profiler profile;
+    CPU::ExecResult exec = cpu.Execute(1 << 30, mem, profile);
+    bool ok = exec.Reason == CPU::StopReason::Brk && (!benchmark.check || benchmark.check(mem));
+
+    // The Profiler stops Execute skipping idle loops; run again to list them.
+    Mem idle_mem;
+    CPU idle_cpu;
+    idle_cpu.PowerOn(idle_mem);
+    benchmark.load(idle_mem);
+    idle_cpu.PC = program_loc;
+    IdleLog idle;
+    CPU::ExecResult idle_exec = idle_cpu.Execute(1 << 30, idle_mem, idle);
+    ok = ok && idle_exec.CyclesConsumed == exec.CyclesConsumed &&
+         idle_exec.InstructionsRetired == exec.InstructionsRetired;
+
+    std::cout << "== " << benchmark.name << (ok ? "" : "  WRONG RESULT") << "\n";
+    profile.Report(std::cout, 10);
+    std::cout << "\n";
+    idle.Report(std::cout);
+    std::cout << "\n";
+    return ok;
+}
+
+// Times the benchmark without and with the tracer attached, repeating it
+// until about a million instructions have run each way.
+bool TraceOverhead(const Benchmark &benchmark, Tracer &trace) {
+    Mem image;
+    CPU boot;
+    boot.PowerOn(image);
+    benchmark.load(image);
+    boot.PC = program_loc;
+
+    double seconds[2] = {};
+    u64 instructions[2] = {};
+    bool ok = true;
+    for (int traced = 0; traced < 2; ++traced) {
+        do {
+            Mem mem = image;
+            CPU cpu = boot;
+            auto start = std::chrono::steady_clock::now();
+            CPU::ExecResult exec = traced ? cpu.Execute(1 << 30, mem, trace) : cpu.Execute(1 << 30, mem);
+            seconds[traced] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            instructions[traced] += exec.InstructionsRetired;
+            ok = ok && exec.Reason == CPU::StopReason::Brk && (!benchmark.check || benchmark.check(mem));
+        } while (traced ? instructions[1] < instructions[0] : instructions[0] < 1000000);
+    }
+    double untraced_ns = seconds[0] * 1e9 / instructions[0];
+    double traced_ns = seconds[1] * 1e9 / instructions[1];
+    std::printf("%-28s %12.3f %12.3f %8.2fx%s\n", benchmark.name.c_str(), untraced_ns, traced_ns,
+                traced_ns / untraced_ns, ok ? "" : "  WRONG RESULT");
+    return ok;
+}
+
+// Bus hook standing in for an attached device: counts the cycles it sees.
+struct CycleCounter {
+    static constexpr bool Enabled = true;
+    u64 cycles = 0;
+    void Cycle(Word, Byte, BusOp) { cycles++; }
+};
+
+// Times the benchmark on CPU::Execute and on CycleExact::Execute with a
+// hook, repeating it until about a million instructions have run each way,
+// and checks that both modes, and the hook, count the same cycles.
+bool ExactOverhead(const Benchmark &benchmark) {
+    Mem image;
+    CPU boot;
+    boot.PowerOn(image);
+    benchmark.load(image);
+    boot.PC = program_loc;
+
+    double seconds[2] = {};
+    u64 instructions[2] = {};
+    s32 cycles[2] = {};
+    CycleCounter counter;
+    bool ok = true;
+    for (int exact = 0; exact < 2; ++exact) {
+        do {
+            Mem mem = image;
+            CPU cpu = boot;
+            u64 counted = counter.cycles;
+            auto start = std::chrono::steady_clock::now();
+            CPU::ExecResult exec = exact ? CycleExact::Execute(cpu, 1 << 30, mem, counter) : cpu.Execute(1 << 30, mem);
+            seconds[exact] += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            instructions[exact] += exec.InstructionsRetired;
+            cycles[exact] = exec.CyclesConsumed;
+            ok = ok && exec.Reason == CPU::StopReason::Brk && (!benchmark.check || benchmark.check(mem));
+            ok = ok && (!exact || counter.cycles - counted == (u64)exec.CyclesConsumed);
+        } while (exact ? instructions[1] < instructions[0] : instructions[0] < 1000000);
+    }
+    ok = ok && cycles[0] == cycles[1];
+    double fast_ns = seconds[0] * 1e9 / instructions[0];
+    double exact_ns = seconds[1] * 1e9 / instructions[1];
+    std::printf("%-28s %12.3f %12.3f %8.2fx%s\n", benchmark.name.c_str(), fast_ns, exact_ns,
+                exact_ns / fast_ns, ok ? "" : "  WRONG RESULT");
+    return ok;
+}
+
+// Times the benchmark on CPU::Execute and on a BlockCache, alternating
+// between them so drifting machine speed hits both alike, until each has
+// run at least five times and about a million instructions, and compares
+// their fastest runs. Each run gets a fresh cache, so decoding is timed too.
+bool CacheSpeedup(const Benchmark &benchmark) {
+    Mem image;
+    CPU boot;
+    boot.PowerOn(image);
+    benchmark.load(image);
+    boot.PC = program_loc;
+
+    double best_ns[2] = {1e30, 1e30};
+    u64 instructions = 0;
+    s32 cycles[2] = {};
+    bool ok = true;
+    for (int round = 0; round < 5 || instructions < 1000000; ++round) {
+        for (int cached = 0; cached < 2; ++cached) {
+            Mem mem = image;
+            CPU cpu = boot;
+            auto cache = std::make_unique<BlockCache>();
+            auto start = std::chrono::steady_clock::now();
+            CPU::ExecResult exec = cached ? cache->Execute(cpu, 1 << 30, mem) : cpu.Execute(1 << 30, mem);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            best_ns[cached] = std::min(best_ns[cached], seconds * 1e9 / exec.InstructionsRetired);
+            instructions += cached ? 0 : exec.InstructionsRetired;
+            cycles[cached] = exec.CyclesConsumed;
+            ok = ok && exec.Reason == CPU::StopReason::Brk && (!benchmark.check || benchmark.check(mem));
+        }
+    }
+    ok = ok && cycles[0] == cycles[1];
+    std::printf("%-28s %12.3f %12.3f %8.2fx%s\n", benchmark.name.c_str(), best_ns[0], best_ns[1],
+                best_ns[0] / best_ns[1], ok ? "" : "  WRONG RESULT");
+    return ok;
+}
+
+// Times the benchmark on Lanes machines, run one after another by
+// CPU::Execute and together by a Lockstep, alternating between the two
+// like CacheSpeedup, and prints the best aggregate ns per instruction of
+// each. Every lane runs the same image, so this is the case where lanes
+// never diverge; loading and saving lanes is not timed.
+template <int Lanes>
+bool LockstepSpeedup(const Benchmark &benchmark) {
+    Mem image;
+    CPU boot;
+    boot.PowerOn(image);
+    benchmark.load(image);
+    boot.PC = program_loc;
+
+    auto lockstep = std::make_unique<Lockstep<Lanes>>();
+    double best_ns[2] = {1e30, 1e30};
+    u64 instructions = 0;
+    bool ok = true;
+    for (int round = 0; round < 5 || instructions < 4000000; ++round) {
+        std::vector<Mem> mems(Lanes, image);
+        std::vector<CPU> cpus(Lanes, boot);
+        u64 retired = 0;
+        auto start = std::chrono::steady_clock::now();
+        for (int lane = 0; lane < Lanes; ++lane) {
+            retired += cpus[lane].Execute(1 << 30, mems[lane]).InstructionsRetired;
+        }
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best_ns[0] = std::min(best_ns[0], seconds * 1e9 / retired);
+        instructions += retired;
+
+        for (int lane = 0; lane < Lanes; ++lane) {
+            ok = lockstep->LoadLane(lane, boot, image) && ok;
+        }
+        start = std::chrono::steady_clock::now();
+        lockstep->Execute(1 << 30);
+        seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        u64 lockstep_retired = 0;
+        for (int lane = 0; lane < Lanes; ++lane) {
+            CPU::ExecResult exec = lockstep->Result(lane);
+            lockstep_retired += exec.InstructionsRetired;
+            ok = ok && exec.Reason == CPU::StopReason::Brk;
+        }
+        best_ns[1] = std::min(best_ns[1], seconds * 1e9 / lockstep_retired);
+        ok = ok && lockstep_retired == retired;
+    }
+    Mem mem = image;
+    CPU cpu = boot;
+    lockstep->SaveLane(Lanes - 1, cpu, mem);
+    ok = ok && (!benchmark.check || benchmark.check(mem));
+    std::printf("%-28s %5d %12.3f %12.3f %8.2fx%s\n", benchmark.name.c_str(), Lanes, best_ns[0], best_ns[1],
+                best_ns[0] / best_ns[1], ok ? "" : "  WRONG RESULT");
+    return ok;
+}
+
+// Times one way of getting a machine ready to run, repeated in batches
+// until min_time has passed, and prints the cost per machine.
+template <typename F>
+void TimeStartup(const char *name, double min_time, F &&start) {
+    constexpr int batch = 1000;
+    u64 machines = 0;
+    volatile Word sink = 0; // keeps the work from being optimized away
+    double seconds = 0;
+    while (seconds < min_time) {
+        auto begin = std::chrono::steady_clock::now();
+        for (int i = 0; i < batch; ++i) {
+            sink = static_cast<Word>(sink + start());
+        }
+        seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        machines += batch;
+    }
+    std::printf("%-28s %12.1f %12llu\n", name, seconds * 1e9 / machines, static_cast<unsigned long long>(machines));
+}
+
+// What starting a machine costs, beside running it: a fresh machine under
+// each RAM policy, forking one from a loaded image, and a warm reset.
+void Startup(const std::string &filter, double min_time) {
+    Mem image;
+    CPU boot;
+    boot.PowerOn(image);
+    LoadFibonacci(image);
+    boot.PC = program_loc;
+
+    std::printf("%-28s %12s %12s\n", "Startup", "ns/machine", "Machines");
+    auto run = [&](const char *name, auto &&start) {
+        if (std::string(name).find(filter) != std::string::npos) {
+            TimeStartup(name, min_time, start);
+        }
+    };
+    auto power_on = [](Mem::RamInit ram) {
+        return [ram] {
+            Mem mem;
+            CPU cpu;
+            cpu.PowerOn(mem, ram);
+            return static_cast<Word>(cpu.SP + mem.Read(0x1234));
+        };
+    };
+    run("startup/power_on_zero", power_on(Mem::RamInit::Zero));
+    run("startup/power_on_pattern", power_on(Mem::RamInit::Pattern));
+    run("startup/power_on_untouched", power_on(Mem::RamInit::Untouched));
+    run("startup/fork_image", [&] {
+        Mem mem = image;
+        CPU cpu = boot;
+        return static_cast<Word>(cpu.PC + mem.Read(program_loc));
+    });
+    Mem mem = image;
+    CPU cpu = boot;
+    run("startup/warm_reset", [&] {
+        cpu.Reset(mem);
+        return cpu.SP;
+    });
+    run("startup/reinitialize", [&] {
+        mem[0x0010] = 1; // dirty a page so there is something to clear
+        mem.Initialize();
+        return static_cast<Word>(mem.Read(0x0010));
+    });
+}
+
+double NsPerIteration(const Result &r) { return r.real_seconds * 1e9 / r.iterations; }
+double CpuNsPerIteration(const Result &r) { return r.cpu_seconds * 1e9 / r.iterations; }
+double NsPerInstruction(const Result &r) { return NsPerIteration(r) / r.instructions; }
+double EmulatedMhz(const Result &r) { return r.cycles / (NsPerIteration(r) * 1e-9) / 1e6; }
+
+void PrintTable(const std::vector<Result> &results) {
+    std::printf("%-28s %12s %12s %10s %12s %10s\n", "Benchmark", "Time", "CPU", "Iterations", "ns/inst", "MHz");
+    std::printf("%s\n", std::string(89, '-').c_str());
+    for (const Result &r : results) {
+        std::printf("%-28s %9.0f ns %9.0f ns %10llu %12.3f %10.1f%s\n", r.name.c_str(), NsPerIteration(r),
+                    CpuNsPerIteration(r), static_cast<unsigned long long>(r.iterations), NsPerInstruction(r),
+                    EmulatedMhz(r), r.ok ? "" : "  WRONG RESULT");
+    }
+}
+
+std::string Json(const std::vector<Result> &results) {
+    std::ostringstream out;
+    char date[64] = "";
+    std::time_t now = std::time(nullptr);
+    std::strftime(date, sizeof date, "%Y-%m-%dT%H:%M:%S", std::localtime(&now));
+
+    out << "{\n  \"context\": {\n";
+    out << "    \"date\": \"" << date << "\",\n";
+    out << "    \"num_cpus\": " << std::thread::hardware_concurrency() << ",\n";
+#ifdef NDEBUG
+    out << "    \"library_build_type\": \"release\"\n";
+#else
+    out << "    \"library_build_type\": \"debug\"\n";
+#endif
+    out << "  },\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result &r = results[i];
+        char line[512];
+        std::snprintf(line, sizeof line,
+                      "    {\n"
+                      "      \"name\": \"%s\",\n"
+                      "      \"run_type\": \"iteration\",\n"
+                      "      \"iterations\": %llu,\n"
+                      "      \"real_time\": %.1f,\n"
+                      "      \"cpu_time\": %.1f,\n"
+                      "      \"time_unit\": \"ns\",\n"
+                      "      \"instructions\": %llu,\n"
+                      "      \"cycles\": %d,\n"
+                      "      \"ns_per_instruction\": %.4f,\n"
+                      "      \"emulated_mhz\": %.2f,\n"
+                      "      \"correct\": %s\n"
+                      "    }%s\n",
+                      r.name.c_str(), static_cast<unsigned long long>(r.iterations), NsPerIteration(r),
+                      CpuNsPerIteration(r), static_cast<unsigned long long>(r.instructions), r.cycles,
+                      NsPerInstruction(r), EmulatedMhz(r), r.ok ? "true" : "false",
+                      i + 1 < results.size() ? "," : "");
+        out << line;
+    }
+    out << "  ]\n}\n";
+    return out.str();
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    bool json = false;
+    std::string out_path;
+    std::string filter;
+    double min_time = 0.5;
+    bool profile = false;
+    bool startup = false;
+    bool exact = false;
+    bool cache = false;
+    bool lockstep = false;
+    std::string trace_path;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--json") {
+            json = true;
+        } else if (arg.rfind("--out=", 0) == 0) {
+            out_path = arg.substr(6);
+        } else if (arg.rfind("--filter=", 0) == 0) {
+            filter = arg.substr(9);
+        } else if (arg.rfind("--min-time=", 0) == 0) {
+            min_time = std::atof(arg.c_str() + 11);
+        } else if (arg == "--profile") {
+            profile = true;
+        } else if (arg == "--startup") {
+            startup = true;
+        } else if (arg == "--exact") {
+            exact = true;
+        } else if (arg == "--cache") {
+            cache = true;
+        } else if (arg == "--lockstep") {
+            lockstep = true;
+        } else if (arg.rfind("--trace=", 0) == 0) {
+            trace_path = arg.substr(8);
+        } else {
+            std::cerr << "usage: " << argv[0]
+                      << " [--json] [--out=FILE] [--filter=SUBSTRING] [--min-time=SECONDS] [--profile]"
+                         " [--trace=FILE] [--exact] [--cache] [--lockstep] [--startup]\n";
+            return 2;
+        }
+    }
+
+    if (!trace_path.empty()) {
+        Tracer trace;
+        if (!trace.Open(trace_path.c_str())) {
+            std::cerr << "cannot create " << trace_path << "\n";
+            return 1;
+        }
+        std::printf("%-28s %12s %12s %9s\n", "Benchmark", "ns/inst", "traced", "overhead");
+        bool ok = true;
+        for (const Benchmark &benchmark : benchmarks) {
+            if (benchmark.name.find(filter) != std::string::npos) {
+                ok = TraceOverhead(benchmark, trace) && ok;
+            }
+        }
+        if (!trace.Close()) {
+            std::cerr << "failed writing " << trace_path << "\n";
+            return 1;
+        }
+        return ok ? 0 : 1;
+    }
+
+    if (exact) {
+        std::printf("%-28s %12s %12s %9s\n", "Benchmark", "ns/inst", "exact", "overhead");
+        bool ok = true;
+        for (const Benchmark &benchmark : benchmarks) {
+            if (benchmark.name.find(filter) != std::string::npos) {
+                ok = ExactOverhead(benchmark) && ok;
+            }
+        }
+        return ok ? 0 : 1;
+    }
+
+    if (cache) {
+        std::printf("%-28s %12s %12s %9s\n", "Benchmark", "ns/inst", "cached", "speedup");
+        bool ok = true;
+        for (const Benchmark &benchmark : benchmarks) {
+            if (benchmark.name.find(filter) != std::string::npos) {
+                ok = CacheSpeedup(benchmark) && ok;
+            }
+        }
+        return ok ? 0 : 1;
+    }
+
+    if (lockstep) {
+        std::printf("%-28s %5s %12s %12s %9s\n", "Benchmark", "lanes", "ns/inst", "lockstep", "speedup");
+        bool ok = true;
+        for (const Benchmark &benchmark : benchmarks) {
+            if (benchmark.name.find(filter) != std::string::npos) {
+                ok = LockstepSpeedup<8>(benchmark) && ok;
+                ok = LockstepSpeedup<16>(benchmark) && ok;
+                ok = LockstepSpeedup<32>(benchmark) && ok;
+            }
+        }
+        return ok ? 0 : 1;
+    }
+
+    if (startup) {
+        Startup(filter, min_time);
+        return 0;
+    }
+
+    if (profile) {
+        bool ok = true;
+        for (const Benchmark &benchmark : benchmarks) {
+            if (benchmark.name.find(filter) != std::string::npos) {
+                ok = Profile(benchmark) && ok;
+            }
+        }
+        return ok ? 0 : 1;
+    }
+
+    std::vector<Result> results;
+    for (const Benchmark &benchmark : benchmarks) {
+        if (benchmark.name.find(filter) == std::string::npos) {
+            continue;
+        }
+        results.push_back(Run(benchmark, min_time));
+    }
+
+    if (json) {
+        std::cout << Json(results);
+    } else {
+        PrintTable(results);
+    }
+    if (!out_path.empty()) {
+        std::ofstream(out_path) << Json(results);
+    }
+
+    for (const Result &r : results) {
+        if (!r.ok) {
+            std::cerr << r.name << " computed the wrong result\n";
+            return 1;
+        }
+    }
+    return 0;
+}
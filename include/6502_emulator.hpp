@@ -1,32 +1,649 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cstdio>
 #include <cstdlib>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
 
 using Byte = std::uint8_t;
 using SByte = std::int8_t;
 using Word = std::uint16_t;
 using u32 = std::uint32_t;
+using s32 = std::int32_t;
+using u64 = std::uint64_t;
+
+// The interpreter relies on the memory accessors being inlined into its
+// dispatch loop and on their rare slow paths staying out of it, and out of
+// the way of the fast ones. Compilers don't reliably decide that on their
+// own inside a function as large as CPU::Execute.
+#if defined(_MSC_VER)
+#define EMU6502_ALWAYS_INLINE __forceinline
+#define EMU6502_COLD __declspec(noinline)
+#define EMU6502_LIKELY(X) (X)
+#define EMU6502_UNLIKELY(X) (X)
+#else
+#define EMU6502_ALWAYS_INLINE inline __attribute__((always_inline))
+#define EMU6502_COLD __attribute__((noinline, cold))
+#define EMU6502_LIKELY(X) __builtin_expect(!!(X), 1)
+#define EMU6502_UNLIKELY(X) __builtin_expect(!!(X), 0)
+#endif
+
+// A memory-mapped peripheral. Mem hands it every read and write that falls
+// in the pages it is mapped at, with the full address.
+struct Device
+{
+  virtual ~Device() = default;
+  virtual Byte Read(Word Address) = 0;
+  virtual void Write(Word Address, Byte Value) = 0;
+};
+
+// PC breakpoints and write watchpoints, armed on a Mem with Mem::Watch:
+//
+//   Watchpoints watch;
+//   watch.Break(0x0612);
+//   watch.WatchWrites(0x0200, 0x02FF);
+//   memory.Watch(&watch);
+//   cpu.Execute(Cycles, memory); // StopReason::Breakpoint on a hit, see Last
+//
+// Execute stops before running an instruction at a breakpoint. Calling it
+// again straight after, with PC still there, continues past the breakpoint
+// (Last says it was hit); a breakpoint on the first instruction of any other
+// call stops it at once, so slicing a run into several calls misses none.
+// It stops after an instruction (or interrupt) that stored into a watched
+// range, with the store done.
+//
+// Neither costs anything while no Watchpoints are armed: Execute checks for
+// them once per call. Armed, breakpoints are looked for once per basic
+// block, and only stores to pages holding a watched range leave Mem's fast
+// path, through the page's trap byte. BlockCache runs watched memory
+// through Execute; CycleExact doesn't check them.
+struct Watchpoints
+{
+  enum class Kind
+  {
+    None,
+    Break, // Address is the breakpoint
+    Write, // Address is the first watched byte stored to
+  };
+
+  // What stopped the last Execute run with these armed, cleared as each one
+  // starts. PC is the instruction that hit, or the first of an interrupt
+  // handler whose pushes did. Execute only resumes past a breakpoint that
+  // this records, so clear it after running unarmed if PC may since have
+  // come back to it.
+  struct Hit
+  {
+    Kind What = Kind::None;
+    Word Address = 0;
+    Word PC = 0;
+  };
+
+  Hit Last;
+
+  // After arming, changes only take effect once Mem::Watch is called again.
+  void Break(Word Address)
+  {
+    u64 &Bits = Breaks[Address >> 6];
+    u64 Bit = (u64)1 << (Address & 63);
+    if (!(Bits & Bit)) {
+      Bits |= Bit;
+      BreakPages[Address >> 8]++;
+      BreakCount++;
+    }
+  }
+
+  void Unbreak(Word Address)
+  {
+    u64 &Bits = Breaks[Address >> 6];
+    u64 Bit = (u64)1 << (Address & 63);
+    if (Bits & Bit) {
+      Bits &= ~Bit;
+      BreakPages[Address >> 8]--;
+      BreakCount--;
+    }
+  }
+
+  // Watches First to Last inclusive.
+  void WatchWrites(Word First, Word Last) { Writes.push_back(Range{First, Last}); }
+
+  // Drops a range added with the same bounds; false if there is none.
+  bool UnwatchWrites(Word First, Word Last)
+  {
+    for (size_t I = 0; I < Writes.size(); I++)
+    {
+      if (Writes[I].First == First && Writes[I].Last == Last) {
+        Writes.erase(Writes.begin() + (std::ptrdiff_t)I);
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void Clear()
+  {
+    std::memset(Breaks, 0, sizeof Breaks);
+    std::memset(BreakPages, 0, sizeof BreakPages);
+    BreakCount = 0;
+    Writes.clear();
+  }
+
+  bool HasBreaks() const { return BreakCount != 0; }
+  bool Empty() const { return BreakCount == 0 && Writes.empty(); }
+
+  bool IsBreak(Word Address) const
+  {
+    return BreakPages[Address >> 8] != 0 && (Breaks[Address >> 6] >> (Address & 63) & 1);
+  }
 
+  bool WatchesPage(Byte Page) const
+  {
+    for (const Range &R : Writes)
+    {
+      if (Page >= R.First >> 8 && Page <= R.Last >> 8) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Called by Mem for stores to watched pages; keeps the first hit.
+  void Stored(Word Address)
+  {
+    if (Last.What != Kind::None) {
+      return;
+    }
+    for (const Range &R : Writes)
+    {
+      if (Address >= R.First && Address <= R.Last) {
+        Last.What = Kind::Write;
+        Last.Address = Address;
+        return;
+      }
+    }
+  }
+
+private:
+  struct Range
+  {
+    Word First, Last;
+  };
+
+  u64 Breaks[1024] = {};    // one bit per address
+  Word BreakPages[256] = {}; // breakpoints on each page
+  u32 BreakCount = 0;
+  std::vector<Range> Writes;
+};
+
+// The CPU's view of the address space: 256 pages of 256 bytes, each either
+// RAM or mapped to a Device.
+//
+// RAM pages are reference counted and shared copy-on-write: copying a Mem,
+// to snapshot a machine or to fork many from one loaded image, copies the
+// page table and not the bytes, and a page is only duplicated when one of
+// the copies first writes to it. Fresh memory borrows a single static zero
+// page, so creating or clearing it writes only the page table.
+//
+// Reads index the page table, whose entry for a device page is null, so RAM
+// costs one test on top of the load. Writes check a trap byte per page,
+// which is nonzero only for shared pages, device pages, pages that cached
+// code came from and watched pages. Devices are not copied with the Mem: a
+// copy maps the same ones.
+//
+// Pages can also be borrowed from storage Mem doesn't own, such as a mapped
+// save-state or ROM file (see save_state.hpp and rom_loader.hpp). Only their
+// bytes are ever read: TRAP_BORROWED keeps them from being counted or freed,
+// and they are always copied before being written.
+//
+// Watchpoints armed with Watch set TRAP_WATCH on the pages they cover. They
+// are not copied with the Mem either: a copy starts unwatched.
 struct Mem 
 {
   static constexpr u32 MAX_MEM = 1024 * 64;
-  Byte Data[MAX_MEM];
+  static constexpr u32 PAGE_SIZE = 256;
+  static constexpr u32 PAGES = MAX_MEM / PAGE_SIZE;
+
+  struct Page
+  {
+    Byte Data[PAGE_SIZE] = {};
+    std::atomic<u32> Refs{1};
+  };
+
+  static constexpr Byte TRAP_CODE = 0x01;   // decoded code was taken from the page; see BlockCache
+  static constexpr Byte TRAP_SHARED = 0x02; // other Mems may hold the page too
+  static constexpr Byte TRAP_DEVICE = 0x04; // the page belongs to Devices[Page]
+  static constexpr Byte TRAP_BORROWED = 0x08; // Pages[Page] points at bytes Mem doesn't own
+  static constexpr Byte TRAP_WATCH = 0x10;    // stores are checked against Watches
+
+  Page *Pages[PAGES];
+  // Copying a Mem marks the source's pages shared as well, hence mutable.
+  mutable Byte Trap[PAGES];
+  // Bumped whenever a code page is written; see BlockCache.
+  u32 PageVersion[PAGES] = {};
+  Device *Devices[PAGES] = {};
+  // Counts reads that went to a device, so Execute can tell a loop that
+  // polls one from a loop that only reads RAM.
+  mutable u32 DeviceReads = 0;
+  // Armed breakpoints and watchpoints, or null; see Watch.
+  Watchpoints *Watches = nullptr;
+  // Unique to this Mem, and renewed when it is assigned to, so a BlockCache
+  // can tell it from an earlier Mem that had the same address.
+  u64 Id = NextId();
+
+  Mem()
+  {
+    for (u32 Page = 0; Page < PAGES; Page++)
+    {
+      Pages[Page] = ZeroPage();
+      Trap[Page] = TRAP_SHARED | TRAP_BORROWED;
+    }
+  }
+
+  Mem(const Mem &Other) { CopyFrom(Other); }
+
+  Mem &operator=(const Mem &Other)
+  {
+    if (this != &Other) {
+      ReleaseAll();
+      CopyFrom(Other);
+      Id = NextId();
+    }
+    return *this;
+  }
+
+  ~Mem() { ReleaseAll(); }
 
-  void Initialize() 
+  // Clears RAM. Devices stay mapped.
+  void Initialize() { BorrowAll(ZeroPage()); }
+
+  // Sets every RAM page to the PAGE_SIZE bytes at Pattern. The pages all
+  // share one copy until they are written, so this costs a single page
+  // however much RAM there is. Devices stay mapped.
+  void Fill(const Byte *Pattern)
+  {
+    Page *P = new Page;
+    std::memcpy(P->Data, Pattern, PAGE_SIZE);
+    u32 Count = 0;
+    for (u32 Page = 0; Page < PAGES; Page++)
+    {
+      if (!Devices[Page]) {
+        Replace((Byte)Page, P);
+        Trap[Page] = (Byte)(TRAP_SHARED | (Trap[Page] & TRAP_WATCH));
+        Count++;
+      }
+      InvalidatePage((Byte)Page);
+    }
+    // Counted once rather than page by page; nothing else can see P yet.
+    if (Count) {
+      P->Refs.store(Count, std::memory_order_relaxed);
+    } else {
+      delete P;
+    }
+  }
+
+  // What RAM holds after CPU::PowerOn.
+  enum class RamInit
+  {
+    Zero,      // cleared, as Initialize does
+    Pattern,   // POWER_ON_PATTERN on every page, as Fill does
+    Untouched, // left as it is, such as a loaded image
+  };
+
+  // Stripes of $00 and $FF, 64 bytes each, such as DRAM often wakes up
+  // holding. Programs that forget to initialize memory tend to break on
+  // this sooner than on zeros.
+  static const Byte *PowerOnPattern() { return PatternPage()->Data; }
+
+  void Initialize(RamInit Ram)
+  {
+    if (Ram == RamInit::Zero) {
+      BorrowAll(ZeroPage());
+    } else if (Ram == RamInit::Pattern) {
+      BorrowAll(PatternPage());
+    }
+  }
+
+  // Maps Count pages from FirstPage to D, replacing the RAM there. The zero
+  // page and the stack page stay RAM, so the CPU can skip the device check
+  // for them; pages below FIRST_DEVICE_PAGE are left alone.
+  static constexpr Byte FIRST_DEVICE_PAGE = 2;
+
+  void Map(Byte FirstPage, u32 Count, Device &D)
+  {
+    for (u32 Page = std::max<u32>(FirstPage, FIRST_DEVICE_PAGE); Page < FirstPage + Count && Page < PAGES; Page++)
+    {
+      Drop((Byte)Page);
+      Pages[Page] = nullptr;
+      Devices[Page] = &D;
+      Trap[Page] = (Byte)(TRAP_DEVICE | (Trap[Page] & TRAP_WATCH));
+      PageVersion[Page]++;
+    }
+  }
+
+  // Turns Count pages from FirstPage back into (zeroed) RAM.
+  void Unmap(Byte FirstPage, u32 Count)
+  {
+    for (u32 Page = FirstPage; Page < FirstPage + Count && Page < PAGES; Page++)
+    {
+      if (Devices[Page]) {
+        Devices[Page] = nullptr;
+        Pages[Page] = ZeroPage();
+        Trap[Page] = (Byte)(TRAP_SHARED | TRAP_BORROWED | (Trap[Page] & TRAP_WATCH));
+        PageVersion[Page]++;
+      }
+    }
+  }
+
+  // Arms W, or disarms with null. Call it again after changing W's write
+  // ranges. W must outlive the arming; Execute records hits in it.
+  void Watch(Watchpoints *W)
+  {
+    Watches = W;
+    for (u32 Page = 0; Page < PAGES; Page++)
+    {
+      if (W && W->WatchesPage((Byte)Page)) {
+        Trap[Page] |= TRAP_WATCH;
+      } else {
+        Trap[Page] &= (Byte)~TRAP_WATCH;
+      }
+    }
+  }
+
+  void InvalidatePage(Byte Page)
+  {
+    Trap[Page] &= (Byte)~TRAP_CODE;
+    PageVersion[Page]++;
+  }
+
+  // Whole-page replacement, for restoring and loading images. Each leaves
+  // device pages alone and invalidates any code cached from the page.
+
+  // Copies PAGE_SIZE bytes from Data into the page.
+  void LoadPage(Byte Index, const Byte *Data)
+  {
+    if (Devices[Index]) {
+      return;
+    }
+    if (Trap[Index] & TRAP_SHARED) {
+      Replace(Index, new Page);
+    }
+    std::memcpy(Pages[Index]->Data, Data, PAGE_SIZE);
+    InvalidatePage(Index);
+  }
+
+  // Copies Size bytes from Data to Address on, page by page. Device pages
+  // in the range are skipped.
+  void Load(Word Address, const Byte *Data, u32 Size)
   {
-    for (u32 i = 0; i < MAX_MEM; i++) 
+    u32 At = Address;
+    u32 End = std::min<u32>(At + Size, MAX_MEM);
+    while (At < End)
     {
-      Data[i] = 0;
+      Byte Index = (Byte)(At >> 8);
+      u32 Offset = At & 0xFF;
+      u32 Count = std::min(PAGE_SIZE - Offset, End - At);
+      if (Count == PAGE_SIZE) {
+        LoadPage(Index, Data);
+      } else if (!Devices[Index]) {
+        if (Trap[Index] & TRAP_SHARED) {
+          Unshare(Index);
+        }
+        std::memcpy(Pages[Index]->Data + Offset, Data, Count);
+        InvalidatePage(Index);
+      }
+      Data += Count;
+      At += Count;
+    }
+  }
+
+  // Shares Other's page, or the zero page when Other is null. A page Other
+  // borrowed is borrowed here too.
+  void SharePage(Byte Index, const Mem *Other)
+  {
+    if (Devices[Index]) {
+      return;
+    }
+    Page *P = Other ? Other->Pages[Index] : nullptr;
+    if (!P || (Other->Trap[Index] & TRAP_BORROWED)) {
+      BorrowPage(Index, (P ? P : ZeroPage())->Data);
+      return;
+    }
+    Other->Trap[Index] |= TRAP_SHARED;
+    if (Pages[Index] == P) {
+      return;
+    }
+    Replace(Index, Share(P));
+    Trap[Index] |= TRAP_SHARED;
+    InvalidatePage(Index);
+  }
+
+  // Points the page at PAGE_SIZE bytes at Data, aligned like a Page, without
+  // copying them. The caller keeps them alive and unchanged for as long as
+  // this Mem, or any copy of it, may still read them.
+  void BorrowPage(Byte Index, const Byte *Data)
+  {
+    Page *P = (Page *)Data;
+    if (Devices[Index] || Pages[Index] == P) {
+      return;
+    }
+    Replace(Index, P);
+    Trap[Index] |= TRAP_SHARED | TRAP_BORROWED;
+    InvalidatePage(Index);
+  }
+
+  static bool CanBorrow(const Byte *Data) { return (uintptr_t)Data % alignof(Page) == 0; }
+
+  bool IsZeroPage(Byte Index) const
+  {
+    const Page *P = Pages[Index];
+    if (P == ZeroPage()) {
+      return true;
+    }
+    if (!P) {
+      return false;
+    }
+    for (Byte Value : P->Data) {
+      if (Value) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  // Stores made by the CPU go through here so cached code stays coherent.
+  EMU6502_ALWAYS_INLINE void Write(Word Address, Byte Value)
+  {
+    Byte Page = (Byte)(Address >> 8);
+    if (EMU6502_UNLIKELY(Trap[Page] != 0)) {
+      WriteTrapped(Address, Value);
+      return;
+    }
+    Pages[Page]->Data[Address & 0xFF] = Value;
+  }
+
+  EMU6502_ALWAYS_INLINE Byte Read(Word Address) const
+  {
+    const Page *P = Pages[Address >> 8];
+    if (EMU6502_LIKELY(P != nullptr)) {
+      return P->Data[Address & 0xFF];
     }
+    return ReadDevice(Address);
   }
 
+  // Read for the zero page and the stack, which are always RAM.
+  EMU6502_ALWAYS_INLINE Byte ReadRam(Word Address) const { return Pages[Address >> 8]->Data[Address & 0xFF]; }
+
   // read 1 byte
-  Byte operator[](u32 Address) const { return Data[Address]; }
+  Byte operator[](u32 Address) const { return Read((Word)Address); }
+
+  // write 1 byte. Host code writing this way bypasses the code page check,
+  // like poking memory behind the CPU's back; see BlockCache. Only RAM can
+  // be reached like this: device pages give a scratch byte that nothing
+  // reads, as if nothing answered on the bus.
+  Byte &operator[](u32 Address)
+  {
+    Byte Page = (Byte)(Address >> 8);
+    if (Trap[Page] & TRAP_DEVICE) {
+      OpenBus = 0;
+      return OpenBus;
+    }
+    if (Trap[Page] & TRAP_SHARED) {
+      Unshare(Page);
+    }
+    return Pages[Page]->Data[Address & 0xFF];
+  }
+
+private:
+  Byte OpenBus = 0;
+
+  static u64 NextId()
+  {
+    static std::atomic<u64> Count{0};
+    return ++Count;
+  }
+
+  static Page *ZeroPage()
+  {
+    // Every Mem borrows it, so it is never counted.
+    static Page Zero;
+    return &Zero;
+  }
+
+  static Page *PatternPage()
+  {
+    static Page Pattern;
+    static const bool Striped = [] {
+      for (u32 I = 0; I < PAGE_SIZE; I++) {
+        Pattern.Data[I] = (I & 0x40) ? 0xFF : 0x00;
+      }
+      return true;
+    }();
+    (void)Striped;
+    return &Pattern;
+  }
+
+  // Points every RAM page at the static page P. Pages already there keep
+  // any code cached from them, since their bytes don't change.
+  void BorrowAll(Page *P)
+  {
+    for (u32 Page = 0; Page < PAGES; Page++)
+    {
+      if (!Devices[Page] && Pages[Page] != P) {
+        Replace((Byte)Page, P);
+        Trap[Page] |= TRAP_SHARED | TRAP_BORROWED;
+        InvalidatePage((Byte)Page);
+      }
+    }
+  }
+
+  static Page *Share(Page *P)
+  {
+    P->Refs.fetch_add(1, std::memory_order_relaxed);
+    return P;
+  }
+
+  static void Release(Page *P)
+  {
+    if (P->Refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      delete P;
+    }
+  }
+
+  // Lets go of the page at Index, unless it is borrowed or a device's.
+  void Drop(Byte Index)
+  {
+    if (Pages[Index] && !(Trap[Index] & TRAP_BORROWED)) {
+      Release(Pages[Index]);
+    }
+  }
+
+  // Installs a RAM page of Mem's own, dropping the one it replaces.
+  void Replace(Byte Index, Page *P)
+  {
+    Page *Old = Pages[Index];
+    bool Borrowed = Trap[Index] & TRAP_BORROWED;
+    Pages[Index] = P;
+    Trap[Index] &= (Byte)~(TRAP_SHARED | TRAP_BORROWED);
+    if (Old && !Borrowed) {
+      Release(Old);
+    }
+  }
+
+  // Versions only move forward, past both this Mem's and Other's, so code
+  // cached from what this Mem held before an assignment is never current.
+  void CopyFrom(const Mem &Other)
+  {
+    Watches = nullptr;
+    for (u32 Page = 0; Page < PAGES; Page++)
+    {
+      Devices[Page] = Other.Devices[Page];
+      PageVersion[Page] = std::max(PageVersion[Page], Other.PageVersion[Page]) + 1;
+      if (Devices[Page]) {
+        Pages[Page] = nullptr;
+        Trap[Page] = TRAP_DEVICE;
+        continue;
+      }
+      if (Other.Trap[Page] & TRAP_BORROWED) {
+        Pages[Page] = Other.Pages[Page];
+        Trap[Page] = TRAP_SHARED | TRAP_BORROWED;
+        continue;
+      }
+      Pages[Page] = Share(Other.Pages[Page]);
+      Other.Trap[Page] |= TRAP_SHARED;
+      Trap[Page] = TRAP_SHARED;
+    }
+  }
+
+  void ReleaseAll()
+  {
+    for (u32 Page = 0; Page < PAGES; Page++)
+    {
+      Drop((Byte)Page);
+    }
+  }
+
+  // Gives this Mem a page of its own to write to, copying it if it is
+  // borrowed or anyone else still holds it.
+  EMU6502_COLD void Unshare(Byte Page)
+  {
+    Mem::Page *Old = Pages[Page];
+    if ((Trap[Page] & TRAP_BORROWED) || Old->Refs.load(std::memory_order_acquire) != 1) {
+      Mem::Page *Copy = new Mem::Page;
+      std::memcpy(Copy->Data, Old->Data, PAGE_SIZE);
+      Replace(Page, Copy);
+    }
+    Trap[Page] &= (Byte)~TRAP_SHARED;
+  }
+
+  EMU6502_COLD Byte ReadDevice(Word Address) const
+  {
+    DeviceReads++;
+    return Devices[Address >> 8]->Read(Address);
+  }
 
-  // write 1 byte
-  Byte &operator[](u32 Address) { return Data[Address]; }
+  EMU6502_COLD void WriteTrapped(Word Address, Byte Value)
+  {
+    Byte Page = (Byte)(Address >> 8);
+    if (Trap[Page] & TRAP_WATCH) {
+      Watches->Stored(Address);
+    }
+    if (Trap[Page] & TRAP_DEVICE) {
+      Devices[Page]->Write(Address, Value);
+      return;
+    }
+    if (Trap[Page] & TRAP_SHARED) {
+      Unshare(Page);
+    }
+    if (Trap[Page] & TRAP_CODE) {
+      InvalidatePage(Page);
+    }
+    Pages[Page]->Data[Address & 0xFF] = Value;
+  }
 };
 
 struct CPU 
@@ -37,35 +654,101 @@ struct CPU
 
   Byte A, X, Y;
 
-  Byte C : 1; // Status Flag
-  Byte Z : 1; // Status Flag
-  Byte I : 1; // Status Flag
-  Byte D : 1; // Status Flag
-  Byte B : 1; // Status Flag
-  Byte V : 1; // Status Flag
-  Byte N : 1; // Status Flag
+  // Processor status. I and D sit in P at their 6502 bit positions. N, Z, C
+  // and V are evaluated lazily: instructions only store the value each flag
+  // derives from, and the flag itself is worked out when a branch, PHP or
+  // BRK reads it. Most results are overwritten before anything looks at them.
+  // B is not kept anywhere: it only exists in the status PHP and BRK push.
+  Byte P;       // I, D and bit 5, which always reads 1
+  Byte NResult; // N is bit 7
+  Byte ZResult; // Z is set when this is 0
+  Word CResult; // C is bit 8
+  Byte VResult; // V is bit 7
+
+  static constexpr Byte FLAG_C = 0x01;
+  static constexpr Byte FLAG_Z = 0x02;
+  static constexpr Byte FLAG_I = 0x04;
+  static constexpr Byte FLAG_D = 0x08;
+  static constexpr Byte FLAG_B = 0x10;
+  static constexpr Byte FLAG_U = 0x20;
+  static constexpr Byte FLAG_V = 0x40;
+  static constexpr Byte FLAG_N = 0x80;
+
+  bool GetC() const { return (CResult & 0x100) != 0; }
+  bool GetZ() const { return ZResult == 0; }
+  bool GetI() const { return (P & FLAG_I) != 0; }
+  bool GetD() const { return (P & FLAG_D) != 0; }
+  bool GetV() const { return (VResult & 0x80) != 0; }
+  bool GetN() const { return (NResult & 0x80) != 0; }
+
+  void SetC(bool Value) { CResult = Value ? 0x100 : 0; }
+  void SetZ(bool Value) { ZResult = Value ? 0 : 1; }
+  void SetV(bool Value) { VResult = Value ? 0x80 : 0; }
+  void SetN(bool Value) { NResult = Value ? 0x80 : 0; }
+  void SetFlag(Byte Flag, bool Value) { P = Value ? (Byte)(P | Flag) : (Byte)(P & ~Flag); }
+
+  static constexpr Word NMI_VECTOR = 0xFFFA;
+  static constexpr Word RESET_VECTOR = 0xFFFC;
+  static constexpr Word IRQ_VECTOR = 0xFFFE; // shared with BRK
+  static constexpr s32 INTERRUPT_CYCLES = 7;
+
+  // Interrupt lines. Each IRQ source holds its own bit of IrqLines while it
+  // wants service, and the IRQ is taken whenever any bit is set and I is
+  // clear; an NMI is taken once per Nmi() call. Execute works on a copy of
+  // the CPU, so the lines can only change between Execute calls, which is
+  // where a Scheduler runs device events: Execute looks at them when it
+  // starts and after an instruction that clears I, never per instruction.
+  Byte IrqLines = 0;
+  bool NmiPending = false;
+
+  // BRK stops Execute by default, which is how programs here end. Clear
+  // this to have it run as the 6502's software interrupt through $FFFE.
+  bool BrkHalts = true;
+
+  void SetIrq(Byte Line, bool Asserted)
+  {
+    IrqLines = Asserted ? (Byte)(IrqLines | Line) : (Byte)(IrqLines & ~Line);
+  }
+
+  void Nmi() { NmiPending = true; }
+
+  bool InterruptPending() const { return NmiPending || (IrqLines != 0 && !GetI()); }
+
+  // Reads the little-endian address stored at Vector.
+  static Word ReadVector(const Mem &memory, Word Vector)
+  {
+    return (Word)(memory.Read(Vector) | (memory.Read((Word)(Vector + 1)) << 8));
+  }
 
-  void Reset(Mem &memory) 
+  // Brings up a machine from power-on: clears the registers, initializes
+  // RAM as Ram says, then resets. Use it once on a new CPU, before which its
+  // registers are undefined.
+  void PowerOn(Mem &memory, Mem::RamInit Ram = Mem::RamInit::Zero)
   {
-    PC = 0xFFFC;
-    SP = 0x01FF; // 6502 stack at 0x0100-0x01FF, start at top
-    C = Z = I = D = B = V = N = 0;
+    memory.Initialize(Ram);
     A = X = Y = 0;
-    memory.Initialize();
+    IrqLines = 0;
+    NmiPending = false;
+    SP = 0x0100;
+    SetStatus(0);
+    Reset(memory);
   }
 
-  Byte FetchByte(u32 &Cycles, Mem &memory) 
+  // Warm reset, as pulling the RESET line does: the 6502 runs an interrupt
+  // sequence with its stack writes suppressed, so SP drops by three, I is
+  // set and PC is loaded from the RESET vector. Nothing else changes, RAM
+  // included.
+  void Reset(const Mem &memory) 
   {
-    Byte Data = memory[PC];
-    PC++;
-    Cycles--;
-    return Data;
+    SP = (Word)(0x0100 | (Byte)(SP - 3)); // 6502 stack at 0x0100-0x01FF
+    SetFlag(FLAG_I, true);
+    PC = ReadVector(memory, RESET_VECTOR);
   }
 
-  Byte ReadByte(u32 &Cycles, Word Address, Mem &memory) 
+  EMU6502_ALWAYS_INLINE Byte FetchByte(Mem &memory)
   {
-    Byte Data = memory[Address];
-    Cycles--;
+    Byte Data = memory.Read(PC);
+    PC++;
     return Data;
   }
 
@@ -98,6 +781,7 @@ struct CPU
 
     // BIT
     BIT_ZP = 0x24,
+    BIT_ABS = 0x2C,
  
      // ASL
     ASL_A = 0x0A,
@@ -137,6 +821,20 @@ struct CPU
     LSR_ABS = 0x4E,
     LSR_ABSX = 0x5E,
 
+    // ROL
+    ROL_A = 0x2A,
+    ROL_ZP = 0x26,
+    ROL_ZPX = 0x36,
+    ROL_ABS = 0x2E,
+    ROL_ABSX = 0x3E,
+
+    // ROR
+    ROR_A = 0x6A,
+    ROR_ZP = 0x66,
+    ROR_ZPX = 0x76,
+    ROR_ABS = 0x6E,
+    ROR_ABSX = 0x7E,
+
     // ORA
     ORA_IM = 0x09,
     ORA_ZP = 0x05,
@@ -217,7 +915,7 @@ struct CPU
     STX_ABS = 0x8E,
 
     STY_ZP = 0x84,
-    STY_ZPY = 0x94,
+    STY_ZPX = 0x94,
     STY_ABS = 0x8C,
 
     // Branches
@@ -252,1259 +950,1198 @@ struct CPU
     TXA = 0x8A,
     TXS = 0x9A,
     TYA = 0x98,
+    NOP = 0xEA,
   };
 
-  void LDASetStatus() 
+  void LDASetStatus() { SetZN(A); }
+  void LDXSetStatus() { SetZN(X); }
+  void LDYSetStatus() { SetZN(Y); }
+
+  void SetZN(Byte Value)
   {
-    Z = (A == 0);
-    N = (A & 0b10000000) > 0;
+    ZResult = Value;
+    NResult = Value;
   }
 
-  void LDXSetStatus() 
+  void PushByte(Byte Value, Mem &memory)
   {
-    Z = (X == 0);
-    N = (X & 0b10000000) > 0;
+    Word Address = (Word)(0x0100 | (SP & 0x00FF));
+    memory.Write(Address, Value);
+    SP = (Word)((SP & 0xFF00) | ((SP - 1) & 0x00FF));
   }
 
-  void LDYSetStatus() 
+  Byte PopByte(Mem &memory)
   {
-    Z = (Y == 0);
-    N = (Y & 0b10000000) > 0;
+    SP = (Word)((SP & 0xFF00) | ((SP + 1) & 0x00FF));
+    Word Address = (Word)(0x0100 | (SP & 0x00FF));
+    return memory.ReadRam(Address);
   }
 
-  void Execute(u32 Cycles, Mem &memory) 
+  Byte GetStatus() const
   {
-    auto setZN = [&](Byte value) {
-      Z = (value == 0);
-      N = (value & 0x80) != 0;
-    };
+    Byte Status = P;
+    Status |= NResult & FLAG_N;
+    Status |= (VResult >> 1) & FLAG_V;
+    Status |= GetZ() ? FLAG_Z : 0;
+    Status |= (Byte)(CResult >> 8) & FLAG_C;
+    return Status;
+  }
 
-    auto pushByte = [&](Byte v) {
-      Word addr = (Word)(0x0100 | (SP & 0x00FF));
-      memory[addr] = v;
-      SP = (Word)((SP & 0xFF00) | ((SP - 1) & 0x00FF));
-      Cycles--;
-    };
+  void SetStatus(Byte Status)
+  {
+    P = (Byte)((Status & (FLAG_I | FLAG_D)) | FLAG_U);
+    NResult = Status;
+    VResult = (Byte)(Status << 1);
+    ZResult = (Byte)(~Status & FLAG_Z);
+    CResult = (Word)(Status << 8);
+  }
+
+  // How an instruction uses its operand. Indexed reads pay an extra cycle
+  // only when indexing crosses a page; stores and read-modify-write always
+  // spend it, whether or not the high byte needed fixing up.
+  enum class Access { Read, Write, Modify };
+
+  // Cycle accounting. Every instruction is charged a fixed Cost, the cycles
+  // it always takes, from DispatchTable when it is dispatched; handlers only
+  // charge the penalties that depend on the data, a page crossed by indexing
+  // or a branch taken. Costs are worked out at compile time from each
+  // handler's shape: one cycle per instruction byte fetched, the addressing
+  // mode's AddressCycles, and the cycles of the operation itself.
+  // opcode_info.hpp checks the result against the datasheet timings, and
+  // cycle_exact.hpp runs the same instructions bus cycle by bus cycle.
+
+  // Addressing mode of an opcode, for tools that report on or disassemble
+  // code; the interpreter itself only uses the policy types below.
+  enum class AddressMode : Byte
+  {
+    Implied,
+    Accumulator,
+    Immediate,
+    ZeroPage,
+    ZeroPageX,
+    ZeroPageY,
+    Absolute,
+    AbsoluteX,
+    AbsoluteY,
+    Indirect,
+    IndexedIndirect,
+    IndirectIndexed,
+    Relative,
+  };
+
+  // Addressing modes as compile-time policies. Bytes is the operand length
+  // and Address<Kind>() turns the operand into the effective address for
+  // that kind of access, charging the page-crossing penalty where there is
+  // one. AddressCycles(Kind) is what the mode always costs on top of
+  // fetching the instruction and accessing the operand. Operations are
+  // instantiated over these, so every opcode of a mode shares the same
+  // address calculation and timing.
+  struct Immediate
+  {
+    static constexpr Byte Bytes = 1;
+    static constexpr AddressMode Kind = AddressMode::Immediate;
+    static constexpr Byte AddressCycles(Access) { return 0; }
+  };
+
+  struct ZeroPage
+  {
+    static constexpr Byte Bytes = 1;
+    static constexpr AddressMode Kind = AddressMode::ZeroPage;
+    static constexpr Byte AddressCycles(Access) { return 0; }
+
+    template <Access>
+    static Word Address(CPU &, s32 &, Mem &, Word Operand) { return Operand; }
+  };
+
+  // zp,X and zp,Y: the sum wraps within the zero page.
+  template <Byte CPU::*Index>
+  struct ZeroPageIndexed
+  {
+    static constexpr Byte Bytes = 1;
+    static constexpr AddressMode Kind = Index == &CPU::X ? AddressMode::ZeroPageX : AddressMode::ZeroPageY;
+    static constexpr Byte AddressCycles(Access) { return 1; } // index add
+
+    template <Access>
+    static Word Address(CPU &cpu, s32 &, Mem &, Word Operand) { return (Byte)(Operand + cpu.*Index); }
+  };
+
+  struct Absolute
+  {
+    static constexpr Byte Bytes = 2;
+    static constexpr AddressMode Kind = AddressMode::Absolute;
+    static constexpr Byte AddressCycles(Access) { return 0; }
+
+    template <Access>
+    static Word Address(CPU &, s32 &, Mem &, Word Operand) { return Operand; }
+  };
+
+  // The high byte fix-up: only reads that cross a page pay for it, as a
+  // penalty; stores and read-modify-write always spend the cycle.
+  static constexpr Byte FixUpCycles(Access Kind) { return Kind == Access::Read ? 0 : 1; }
 
-    auto popByte = [&]() -> Byte {
-      SP = (Word)((SP & 0xFF00) | ((SP + 1) & 0x00FF));
-      Word addr = (Word)(0x0100 | (SP & 0x00FF));
-      Byte v = memory[addr];
+  template <Access Kind>
+  static Word AddIndex(s32 &Cycles, Word BaseAddr, Byte Index)
+  {
+    Word EffectiveAddr = (Word)(BaseAddr + Index);
+    if (Kind == Access::Read && (EffectiveAddr & 0xFF00) != (BaseAddr & 0xFF00)) {
       Cycles--;
-      return v;
-    };
+    }
+    return EffectiveAddr;
+  }
 
-    auto getStatus = [&]() -> Byte {
-      Byte p = 0;
-      p |= (N ? 1 : 0) << 7;
-      p |= (V ? 1 : 0) << 6;
-      p |= 1 << 5;        // unused bit set
-      p |= (B ? 1 : 0) << 4;
-      p |= (D ? 1 : 0) << 3;
-      p |= (I ? 1 : 0) << 2;
-      p |= (Z ? 1 : 0) << 1;
-      p |= (C ? 1 : 0) << 0;
-      return p;
-    };
+  // abs,X and abs,Y
+  template <Byte CPU::*Index>
+  struct AbsoluteIndexed
+  {
+    static constexpr Byte Bytes = 2;
+    static constexpr AddressMode Kind = Index == &CPU::X ? AddressMode::AbsoluteX : AddressMode::AbsoluteY;
+    static constexpr Byte AddressCycles(Access K) { return FixUpCycles(K); }
 
-    auto setStatus = [&](Byte p) {
-      C = (p & 0x01) != 0;
-      Z = (p & 0x02) != 0;
-      I = (p & 0x04) != 0;
-      D = (p & 0x08) != 0;
-      B = (p & 0x10) != 0;
-      V = (p & 0x40) != 0;
-      N = (p & 0x80) != 0;
-    };
+    template <Access Kind>
+    static Word Address(CPU &cpu, s32 &Cycles, Mem &, Word Operand)
+    {
+      return AddIndex<Kind>(Cycles, Operand, cpu.*Index);
+    }
+  };
 
-    while (Cycles > 0)
+  // Reads a little-endian pointer from the zero page; the high byte comes
+  // from (ZeroPageAddr + 1) & $FF, never from page one.
+  static Word ReadZeroPagePointer(Byte ZeroPageAddr, Mem &memory)
+  {
+    Byte LowByte = memory.ReadRam(ZeroPageAddr);
+    Byte HighByte = memory.ReadRam((Byte)(ZeroPageAddr + 1));
+    return (Word)LowByte | ((Word)HighByte << 8);
+  }
+
+  // (zp,X)
+  struct IndexedIndirect
+  {
+    static constexpr Byte Bytes = 1;
+    static constexpr AddressMode Kind = AddressMode::IndexedIndirect;
+    static constexpr Byte AddressCycles(Access) { return 3; } // index add, pointer
+
+    template <Access>
+    static Word Address(CPU &cpu, s32 &, Mem &memory, Word Operand)
     {
-      Byte Ins = FetchByte(Cycles, memory);
-      Opcode Op = static_cast<Opcode>(Ins);
-      switch (Op)
-      {
-      case Opcode::JSR_ABS: 
-      {
-        Byte LowByte = FetchByte(Cycles, memory);
-        Byte HighByte = FetchByte(Cycles, memory);
-        Word AbsoluteAddr = (Word)LowByte | ((Word)HighByte << 8);
-
-        Word ret = (Word)(PC - 1); // push return-1 high then low on 6502
-        pushByte((Byte)((ret >> 8) & 0xFF));
-        pushByte((Byte)(ret & 0xFF));
-        PC = AbsoluteAddr;
-      } break;
-      case Opcode::LDA_IM: 
-      {
-        Byte Value = FetchByte(Cycles, memory);
-        A = Value;
-        LDASetStatus();
-      } break;
-      case Opcode::LDA_ZP: 
-      {
-        Byte ZeroPageAddr = FetchByte(Cycles, memory);
-        A = ReadByte(Cycles, ZeroPageAddr, memory);
-        LDASetStatus();
-      } break;
-      case Opcode::LDA_ZPX: 
-      {
-        Byte ZeroPageAddr = FetchByte(Cycles, memory);
-        Word EffectiveAddr = (ZeroPageAddr + X) & 0xFF;
-        Cycles--;
-        A = ReadByte(Cycles, EffectiveAddr, memory);
-        LDASetStatus();
-      } break;
-      case Opcode::LDA_ABS: 
-      {
-        Byte LowByte = FetchByte(Cycles, memory);
-        Byte HighByte = FetchByte(Cycles, memory);
-        Word AbsoluteAddr = (Word)LowByte | ((Word)HighByte << 8);
-        A = (SByte)ReadByte(Cycles, AbsoluteAddr, memory);
-        LDASetStatus();
-      } break;
-      case Opcode::LDA_ABS_X:
-      {
-        Byte LowByte = FetchByte(Cycles, memory);
-        Byte HighByte = FetchByte(Cycles, memory);
-        Word AbsoluteAddr = ((Word)HighByte << 8) | (Word)LowByte;
-        Word EffectiveAddr = AbsoluteAddr + X;
-        if ((EffectiveAddr & 0xFF00) != (AbsoluteAddr & 0xFF00)) {
-          Cycles--;
-        }
-        A = ReadByte(Cycles, EffectiveAddr, memory);
-        LDASetStatus();
-      } break;
-      case Opcode::LDA_ABS_Y: 
-      {
-        Byte LowByte = FetchByte(Cycles, memory);
-        Byte HighByte = FetchByte(Cycles, memory);
-        Word AbsoluteAddr = ((Word)HighByte << 8) | (Word)LowByte;
-        Word EffectiveAddr = AbsoluteAddr + Y;
-        if ((EffectiveAddr & 0xFF00) != (AbsoluteAddr & 0xFF00)) {
-          Cycles--;
-        }
-        A = ReadByte(Cycles, EffectiveAddr, memory);
-        LDASetStatus();
-      } break;
-      case Opcode::LDA_IND_X:   
-      {
-        Byte ZeroPageAddr = FetchByte(Cycles, memory);
-        Word EffectiveAddr = ZeroPageAddr + X;
-        Word HighByte = ReadByte(Cycles, EffectiveAddr + 1, memory);
-        Word LowByte = ReadByte(Cycles, EffectiveAddr, memory);
-        Word AbsoluteAddr = LowByte | (HighByte << 8);
-        A = ReadByte(Cycles, AbsoluteAddr, memory);
-        LDASetStatus();
-      } break;
-      case Opcode::LDA_IND_Y: 
-      {
-        Byte ZeroPageAddr = FetchByte(Cycles, memory);
-        Word LowByte = ReadByte(Cycles, ZeroPageAddr, memory);
-        Word HighByte = ReadByte(Cycles, (ZeroPageAddr + 1) & 0xFF, memory);
-        Word AbsoluteAddr = LowByte | (HighByte << 8);
-        Word EffectiveAddr = AbsoluteAddr + Y;
-        if ((EffectiveAddr & 0xFF00) != (AbsoluteAddr & 0xFF00)) {
+      return ReadZeroPagePointer((Byte)(Operand + cpu.X), memory);
+    }
+  };
+
+  // (zp),Y
+  struct IndirectIndexed
+  {
+    static constexpr Byte Bytes = 1;
+    static constexpr AddressMode Kind = AddressMode::IndirectIndexed;
+    static constexpr Byte AddressCycles(Access K) { return (Byte)(2 + FixUpCycles(K)); } // pointer, fix-up
+
+    template <Access Kind>
+    static Word Address(CPU &cpu, s32 &Cycles, Mem &memory, Word Operand)
+    {
+      Word BaseAddr = ReadZeroPagePointer((Byte)Operand, memory);
+      return AddIndex<Kind>(Cycles, BaseAddr, cpu.Y);
+    }
+  };
+
+  using ZeroPageX = ZeroPageIndexed<&CPU::X>;
+  using ZeroPageY = ZeroPageIndexed<&CPU::Y>;
+  using AbsoluteX = AbsoluteIndexed<&CPU::X>;
+  using AbsoluteY = AbsoluteIndexed<&CPU::Y>;
+
+  // Reads the operand of an instruction in addressing mode Mode. Zero page
+  // operands can't reach a device (see Mem::FIRST_DEVICE_PAGE), so they skip
+  // the check.
+  template <typename Mode>
+  Byte ReadOperand(Word Address, Mem &memory)
+  {
+    if constexpr (std::is_same<Mode, ZeroPage>::value || std::is_same<Mode, ZeroPageX>::value ||
+                  std::is_same<Mode, ZeroPageY>::value) {
+      return memory.ReadRam(Address);
+    } else {
+      return memory.Read(Address);
+    }
+  }
+
+  // Operations, independent of where their operand comes from.
+  void OpLDA(Byte Value) { A = Value; LDASetStatus(); }
+  void OpLDX(Byte Value) { X = Value; LDXSetStatus(); }
+  void OpLDY(Byte Value) { Y = Value; LDYSetStatus(); }
+  void OpAND(Byte Value) { A &= Value; SetZN(A); }
+  void OpORA(Byte Value) { A |= Value; SetZN(A); }
+  void OpEOR(Byte Value) { A ^= Value; SetZN(A); }
+
+  void OpADC(Byte Value)
+  {
+    if (EMU6502_UNLIKELY(P & FLAG_D)) {
+      AddDecimal(Value);
+      return;
+    }
+    AddBinary(Value);
+  }
+
+  // A - M - !C is A + ~M + C, flags included.
+  void OpSBC(Byte Value)
+  {
+    if (EMU6502_UNLIKELY(P & FLAG_D)) {
+      SubtractDecimal(Value);
+      return;
+    }
+    AddBinary((Byte)~Value);
+  }
+
+  void AddBinary(Byte Value)
+  {
+    Word Result = (Word)(A + Value + (GetC() ? 1 : 0));
+    VResult = (Byte)(~(A ^ Value) & (A ^ Result));
+    CResult = Result;
+    A = (Byte)Result;
+    SetZN(A);
+  }
+
+  // Decimal mode as the NMOS 6502 does it, for any operands, BCD or not. Z
+  // comes from the binary sum; N and V from the sum with only the low digit
+  // adjusted; C from the fully adjusted sum.
+  EMU6502_COLD void AddDecimal(Byte Value)
+  {
+    const Byte Carry = GetC() ? 1 : 0;
+    ZResult = (Byte)(A + Value + Carry);
+    s32 Low = (A & 0x0F) + (Value & 0x0F) + Carry;
+    if (Low >= 0x0A) {
+      Low = ((Low + 0x06) & 0x0F) + 0x10;
+    }
+    s32 Result = (A & 0xF0) + (Value & 0xF0) + Low;
+    NResult = (Byte)Result;
+    VResult = (Byte)(~(A ^ Value) & (A ^ Result));
+    if (Result >= 0xA0) {
+      Result += 0x60;
+    }
+    CResult = (Word)(Result >= 0x100 ? 0x100 : 0);
+    A = (Byte)Result;
+  }
+
+  // In decimal mode the NMOS 6502 sets every flag as in binary; only A is
+  // adjusted.
+  EMU6502_COLD void SubtractDecimal(Byte Value)
+  {
+    const s32 Borrow = GetC() ? 0 : 1;
+    s32 Low = (A & 0x0F) - (Value & 0x0F) - Borrow;
+    if (Low < 0) {
+      Low = ((Low - 0x06) & 0x0F) - 0x10;
+    }
+    s32 Result = (A & 0xF0) - (Value & 0xF0) + Low;
+    if (Result < 0) {
+      Result -= 0x60;
+    }
+    AddBinary((Byte)~Value);
+    A = (Byte)Result;
+  }
+
+  void Compare(Byte Register, Byte Value)
+  {
+    // Register + ~Value + 1 carries out of bit 7 exactly when Register >= Value.
+    CResult = (Word)(Register + (Byte)~Value + 1);
+    SetZN((Byte)CResult);
+  }
+
+  void OpCMP(Byte Value) { Compare(A, Value); }
+  void OpCPX(Byte Value) { Compare(X, Value); }
+  void OpCPY(Byte Value) { Compare(Y, Value); }
+
+  void OpBIT(Byte Value)
+  {
+    ZResult = A & Value;
+    VResult = (Byte)(Value << 1);
+    NResult = Value;
+  }
+
+  Byte OpASL(Byte Value)
+  {
+    CResult = (Word)(Value << 1);
+    Value = (Byte)CResult;
+    SetZN(Value);
+    return Value;
+  }
+
+  Byte OpLSR(Byte Value)
+  {
+    CResult = (Word)(Value << 8);
+    Value = (Byte)(Value >> 1);
+    SetZN(Value);
+    return Value;
+  }
+
+  Byte OpROL(Byte Value)
+  {
+    CResult = (Word)((Value << 1) | (GetC() ? 0x01 : 0x00));
+    Value = (Byte)CResult;
+    SetZN(Value);
+    return Value;
+  }
+
+  Byte OpROR(Byte Value)
+  {
+    Byte CarryIn = GetC() ? 0x80 : 0x00;
+    CResult = (Word)(Value << 8);
+    Value = (Byte)((Value >> 1) | CarryIn);
+    SetZN(Value);
+    return Value;
+  }
+
+  Byte OpINC(Byte Value) { Value = (Byte)(Value + 1); SetZN(Value); return Value; }
+  Byte OpDEC(Byte Value) { Value = (Byte)(Value - 1); SetZN(Value); return Value; }
+
+  void OpCLC() { SetC(false); }
+  void OpCLD() { SetFlag(FLAG_D, false); }
+  void OpCLI() { SetFlag(FLAG_I, false); }
+  void OpCLV() { SetV(false); }
+  void OpSEC() { SetC(true); }
+  void OpSED() { SetFlag(FLAG_D, true); }
+  void OpSEI() { SetFlag(FLAG_I, true); }
+  void OpINX() { X = (Byte)(X + 1); SetZN(X); }
+  void OpINY() { Y = (Byte)(Y + 1); SetZN(Y); }
+  void OpDEX() { X = (Byte)(X - 1); SetZN(X); }
+  void OpDEY() { Y = (Byte)(Y - 1); SetZN(Y); }
+  void OpTAX() { X = A; SetZN(X); }
+  void OpTAY() { Y = A; SetZN(Y); }
+  void OpTXA() { A = X; SetZN(A); }
+  void OpTYA() { A = Y; SetZN(A); }
+  void OpTSX() { X = (Byte)(SP & 0xFF); SetZN(X); }
+  void OpTXS() { SP = (Word)(0x0100 | X); }
+  void OpNOP() {}
+
+  // Instruction handlers. Every opcode maps to one of these, either an
+  // addressing mode x operation instantiation or a dedicated one. The
+  // dispatcher fetches the opcode and operand bytes, leaves PC past the
+  // instruction and charges Cost; Run() does the rest. EndsBlock marks
+  // instructions that can change the flow of control, Writes those that
+  // store to memory, Unmasks those that can clear I.
+  using Handler = void (*)(CPU &, s32 &, Mem &, Word);
+
+  template <Byte OperandBytes, Byte Cycles, bool Flow = false, bool Store = false,
+            AddressMode Mode = AddressMode::Implied>
+  struct Instruction
+  {
+    static constexpr Byte Bytes = OperandBytes;
+    static constexpr Byte Cost = Cycles;
+    static constexpr bool EndsBlock = Flow;
+    static constexpr bool Writes = Store;
+    static constexpr bool Halts = false;
+    static constexpr bool Unmasks = false;
+    static constexpr AddressMode Addressing = Mode;
+  };
+
+  // Fetching the opcode and operand bytes, then the address calculation and
+  // the given number of data cycles.
+  template <typename Mode, Access Kind, Byte DataCycles>
+  static constexpr Byte ModeCost = (Byte)(1 + Mode::Bytes + Mode::AddressCycles(Kind) + DataCycles);
+
+  // An immediate operand is the data, so reading it costs nothing more.
+  template <typename Mode>
+  static constexpr Byte ReadCost =
+      std::is_same<Mode, Immediate>::value ? (Byte)(1 + Mode::Bytes) : ModeCost<Mode, Access::Read, 1>;
+
+  template <void (CPU::*Op)(Byte), typename Mode>
+  struct Read : Instruction<Mode::Bytes, ReadCost<Mode>, false, false, Mode::Kind>
+  {
+    static void Run(CPU &cpu, s32 &Cycles, Mem &memory, Word Operand)
+    {
+      if constexpr (std::is_same<Mode, Immediate>::value) {
+        (cpu.*Op)((Byte)Operand);
+      } else {
+        Word Address = Mode::template Address<Access::Read>(cpu, Cycles, memory, Operand);
+        (cpu.*Op)(cpu.template ReadOperand<Mode>(Address, memory));
+      }
+    }
+  };
+
+  template <Byte CPU::*Register, typename Mode>
+  struct Store : Instruction<Mode::Bytes, ModeCost<Mode, Access::Write, 1>, false, true, Mode::Kind>
+  {
+    static void Run(CPU &cpu, s32 &Cycles, Mem &memory, Word Operand)
+    {
+      Word Address = Mode::template Address<Access::Write>(cpu, Cycles, memory, Operand);
+      memory.Write(Address, cpu.*Register);
+    }
+  };
+
+  // Read, write back the unmodified value, then write the result.
+  template <Byte (CPU::*Op)(Byte), typename Mode>
+  struct Modify : Instruction<Mode::Bytes, ModeCost<Mode, Access::Modify, 3>, false, true, Mode::Kind>
+  {
+    static void Run(CPU &cpu, s32 &Cycles, Mem &memory, Word Operand)
+    {
+      Word Address = Mode::template Address<Access::Modify>(cpu, Cycles, memory, Operand);
+      Byte Value = cpu.template ReadOperand<Mode>(Address, memory);
+      memory.Write(Address, (cpu.*Op)(Value));
+    }
+  };
+
+  template <Byte (CPU::*Op)(Byte)>
+  struct ModifyA : Instruction<0, 2, false, false, AddressMode::Accumulator>
+  {
+    static void Run(CPU &cpu, s32 &, Mem &, Word) { cpu.A = (cpu.*Op)(cpu.A); }
+  };
+
+  template <void (CPU::*Op)()>
+  struct Implied : Instruction<0, 2>
+  {
+    static constexpr bool Unmasks = Op == &CPU::OpCLI;
+    static void Run(CPU &cpu, s32 &, Mem &, Word) { (cpu.*Op)(); }
+  };
+
+  // Branch opcodes are xxy10000: xx picks N, V, C or Z and y is the value
+  // that flag must have for the branch to be taken.
+  template <Byte Ins>
+  struct Branch : Instruction<1, 2, true, false, AddressMode::Relative>
+  {
+    static bool Taken(const CPU &cpu)
+    {
+      bool Flag;
+      if constexpr ((Ins >> 6) == 0) {
+        Flag = cpu.GetN();
+      } else if constexpr ((Ins >> 6) == 1) {
+        Flag = cpu.GetV();
+      } else if constexpr ((Ins >> 6) == 2) {
+        Flag = cpu.GetC();
+      } else {
+        Flag = cpu.GetZ();
+      }
+      return Flag == (((Ins >> 5) & 1) != 0);
+    }
+
+    static void Run(CPU &cpu, s32 &Cycles, Mem &, Word Operand)
+    {
+      if (Taken(cpu)) {
+        Word OldPC = cpu.PC;
+        cpu.PC = (Word)(cpu.PC + (SByte)Operand);
+        Cycles--; // branch taken cost
+        if ((OldPC & 0xFF00) != (cpu.PC & 0xFF00)) {
           Cycles--;
         }
-        A = ReadByte(Cycles, EffectiveAddr, memory);
-        LDASetStatus();
-      } break;
-      case Opcode::AND_IM: 
-      {
-          Byte Value = FetchByte(Cycles, memory);
-          A &= Value;
-          Z = (A == 0);
-          N = (A & 0b10000000) > 0;
-      } break;
-      case Opcode::AND_ZP: 
-      {
-          Byte Addr = FetchByte(Cycles, memory);
-          Byte Value = ReadByte(Cycles, Addr, memory);
-          A &= Value;
-          Z = (A == 0);
-          N = (A & 0b10000000) > 0;
-      } break;
-      case Opcode::AND_ZPX: 
-      {
-          Byte Addr = FetchByte(Cycles, memory);
-          Byte EffectiveAddr = (Addr + X) & 0xFF;
-          Byte Value = ReadByte(Cycles, EffectiveAddr, memory);
-          A &= Value;
-          Z = (A == 0);
-          N = (A & 0b10000000) > 0;
-      } break;
-      case Opcode::AND_ABS: 
-      {
-          Byte LowByte = FetchByte(Cycles, memory);
-          Byte HighByte = FetchByte(Cycles, memory);
-          Word AbsoluteAddr = (Word)LowByte | ((Word)HighByte << 8);
-          Byte Value = ReadByte(Cycles, AbsoluteAddr, memory);
-          A &= Value;
-          Z = (A == 0);
-          N = (A & 0b10000000) > 0;
-      } break;
-      case Opcode::AND_ABSX: 
-      {
-          Byte LowByte = FetchByte(Cycles, memory);
-          Byte HighByte = FetchByte(Cycles, memory);
-          Word AbsoluteAddr = (Word)LowByte | ((Word)HighByte << 8);
-          Word EffectiveAddr = AbsoluteAddr + X;
-          if ((EffectiveAddr & 0xFF00) != (AbsoluteAddr & 0xFF00))  {
-            Cycles--;
-          }
-          Byte Value = ReadByte(Cycles, EffectiveAddr, memory);
-          A &= Value;
-          Z = (A == 0);
-          N = (A & 0b10000000) > 0;
-      } break;
-      case Opcode::AND_ABSY: 
-      {
-          Byte LowByte = FetchByte(Cycles, memory);
-          Byte HighByte = FetchByte(Cycles, memory);
-          Word AbsoluteAddr = (Word)LowByte | ((Word)HighByte << 8);
-          Word EffectiveAddr = AbsoluteAddr + Y;
-          if ((EffectiveAddr & 0xFF00) != (AbsoluteAddr & 0xFF00)) {
-            Cycles--;
-          }
-          Byte Value = ReadByte(Cycles, EffectiveAddr, memory);
-          A &= Value;
-          Z = (A == 0);
-          N = (A & 0b10000000) > 0;
-      } break;
-      case Opcode::AND_INDX: 
-      {
-          Byte ZeroPageAddr = FetchByte(Cycles, memory);
-          Word EffectiveAddr = (ZeroPageAddr + X) & 0xFF;
-          Byte LowByte = ReadByte(Cycles, EffectiveAddr, memory);
-          Byte HighByte = ReadByte(Cycles, (EffectiveAddr + 1) & 0xFF, memory);
-          Word AbsoluteAddr = (Word)LowByte | ((Word)HighByte << 8);
-          Byte Value = ReadByte(Cycles, AbsoluteAddr, memory);
-          A &= Value;
-          Z = (A == 0);
-          N = (A & 0b10000000) > 0;
-      } break;
-      case Opcode::AND_INDY: 
-      {
-          Byte ZeroPageAddr = FetchByte(Cycles, memory);
-          Byte LowByte = ReadByte(Cycles, ZeroPageAddr, memory);
-          Byte HighByte = ReadByte(Cycles, (ZeroPageAddr + 1) & 0xFF, memory);
-          Word AbsoluteAddr = (Word)LowByte | ((Word)HighByte << 8);
-          Word EffectiveAddr = AbsoluteAddr + Y;
-          if ((EffectiveAddr & 0xFF00) != (AbsoluteAddr & 0xFF00)) {
-            Cycles--;
-          }
-          Byte Value = ReadByte(Cycles, EffectiveAddr, memory);
-          A &= Value;
-          Z = (A == 0);
-          N = (A & 0b10000000) > 0;
-      } break;
-      // ORA
-      case Opcode::ORA_IM:
-      {
-          Byte Value = FetchByte(Cycles, memory);
-          A |= Value;
-          setZN(A);
-      } break;
-      case Opcode::ORA_ZP:
-      {
-          Byte Addr = FetchByte(Cycles, memory);
-          Byte Value = ReadByte(Cycles, Addr, memory);
-          A |= Value;
-          setZN(A);
-      } break;
-      case Opcode::ORA_ZPX:
-      {
-          Byte Addr = FetchByte(Cycles, memory);
-          Byte EffectiveAddr = (Addr + X) & 0xFF;
-          Byte Value = ReadByte(Cycles, EffectiveAddr, memory);
-          A |= Value;
-          setZN(A);
-      } break;
-      case Opcode::ORA_ABS:
-      {
-          Byte LowByte = FetchByte(Cycles, memory);
-          Byte HighByte = FetchByte(Cycles, memory);
-          Word AbsoluteAddr = (Word)LowByte | ((Word)HighByte << 8);
-          Byte Value = ReadByte(Cycles, AbsoluteAddr, memory);
-          A |= Value;
-          setZN(A);
-      } break;
-      case Opcode::ORA_ABSX:
-      {
-          Byte LowByte = FetchByte(Cycles, memory);
-          Byte HighByte = FetchByte(Cycles, memory);
-          Word AbsoluteAddr = (Word)LowByte | ((Word)HighByte << 8);
-          Word EffectiveAddr = AbsoluteAddr + X;
-          if ((EffectiveAddr & 0xFF00) != (AbsoluteAddr & 0xFF00)) { Cycles--; }
-          Byte Value = ReadByte(Cycles, EffectiveAddr, memory);
-          A |= Value;
-          setZN(A);
-      } break;
-      case Opcode::ORA_ABSY:
-      {
-          Byte LowByte = FetchByte(Cycles, memory);
-          Byte HighByte = FetchByte(Cycles, memory);
-          Word AbsoluteAddr = (Word)LowByte | ((Word)HighByte << 8);
-          Word EffectiveAddr = AbsoluteAddr + Y;
-          if ((EffectiveAddr & 0xFF00) != (AbsoluteAddr & 0xFF00)) { Cycles--; }
-          Byte Value = ReadByte(Cycles, EffectiveAddr, memory);
-          A |= Value;
-          setZN(A);
-      } break;
-      case Opcode::ORA_IND_X:
-      {
-          Byte ZeroPageAddr = FetchByte(Cycles, memory);
-          Word EffectiveAddr = (ZeroPageAddr + X) & 0xFF;
-          Byte Low = ReadByte(Cycles, EffectiveAddr, memory);
-          Byte High = ReadByte(Cycles, (EffectiveAddr + 1) & 0xFF, memory);
-          Word AbsoluteAddr = (Word)Low | ((Word)High << 8);
-          Byte Value = ReadByte(Cycles, AbsoluteAddr, memory);
-          A |= Value;
-          setZN(A);
-      } break;
-      case Opcode::ORA_IND_Y:
-      {
-          Byte ZeroPageAddr = FetchByte(Cycles, memory);
-          Byte Low = ReadByte(Cycles, ZeroPageAddr, memory);
-          Byte High = ReadByte(Cycles, (ZeroPageAddr + 1) & 0xFF, memory);
-          Word AbsoluteAddr = (Word)Low | ((Word)High << 8);
-          Word EffectiveAddr = AbsoluteAddr + Y;
-          if ((EffectiveAddr & 0xFF00) != (AbsoluteAddr & 0xFF00)) { Cycles--; }
-          Byte Value = ReadByte(Cycles, EffectiveAddr, memory);
-          A |= Value;
-          setZN(A);
-      } break;
-
-      // EOR
-      case Opcode::EOR_IM:
-      {
-          Byte Value = FetchByte(Cycles, memory);
-          A ^= Value;
-          setZN(A);
-      } break;
-      case Opcode::EOR_ZP:
-      {
-          Byte Addr = FetchByte(Cycles, memory);
-          Byte Value = ReadByte(Cycles, Addr, memory);
-          A ^= Value;
-          setZN(A);
-      } break;
-      case Opcode::EOR_ZPX:
-      {
-          Byte Addr = FetchByte(Cycles, memory);
-          Byte EffectiveAddr = (Addr + X) & 0xFF;
-          Byte Value = ReadByte(Cycles, EffectiveAddr, memory);
-          A ^= Value;
-          setZN(A);
-      } break;
-      case Opcode::EOR_ABS:
-      {
-          Byte LowByte = FetchByte(Cycles, memory);
-          Byte HighByte = FetchByte(Cycles, memory);
-          Word AbsoluteAddr = (Word)LowByte | ((Word)HighByte << 8);
-          Byte Value = ReadByte(Cycles, AbsoluteAddr, memory);
-          A ^= Value;
-          setZN(A);
-      } break;
-      case Opcode::EOR_ABSX:
-      {
-          Byte LowByte = FetchByte(Cycles, memory);
-          Byte HighByte = FetchByte(Cycles, memory);
-          Word AbsoluteAddr = (Word)LowByte | ((Word)HighByte << 8);
-          Word EffectiveAddr = AbsoluteAddr + X;
-          if ((EffectiveAddr & 0xFF00) != (AbsoluteAddr & 0xFF00)) { Cycles--; }
-          Byte Value = ReadByte(Cycles, EffectiveAddr, memory);
-          A ^= Value;
-          setZN(A);
-      } break;
-      case Opcode::EOR_ABSY:
-      {
-          Byte LowByte = FetchByte(Cycles, memory);
-          Byte HighByte = FetchByte(Cycles, memory);
-          Word AbsoluteAddr = (Word)LowByte | ((Word)HighByte << 8);
-          Word EffectiveAddr = AbsoluteAddr + Y;
-          if ((EffectiveAddr & 0xFF00) != (AbsoluteAddr & 0xFF00)) { Cycles--; }
-          Byte Value = ReadByte(Cycles, EffectiveAddr, memory);
-          A ^= Value;
-          setZN(A);
-      } break;
-      case Opcode::EOR_IND_X:
-      {
-          Byte ZeroPageAddr = FetchByte(Cycles, memory);
-          Word EffectiveAddr = (ZeroPageAddr + X) & 0xFF;
-          Byte Low = ReadByte(Cycles, EffectiveAddr, memory);
-          Byte High = ReadByte(Cycles, (EffectiveAddr + 1) & 0xFF, memory);
-          Word AbsoluteAddr = (Word)Low | ((Word)High << 8);
-          Byte Value = ReadByte(Cycles, AbsoluteAddr, memory);
-          A ^= Value;
-          setZN(A);
-      } break;
-      case Opcode::EOR_IND_Y:
-      {
-          Byte ZeroPageAddr = FetchByte(Cycles, memory);
-          Byte Low = ReadByte(Cycles, ZeroPageAddr, memory);
-          Byte High = ReadByte(Cycles, (ZeroPageAddr + 1) & 0xFF, memory);
-          Word AbsoluteAddr = (Word)Low | ((Word)High << 8);
-          Word EffectiveAddr = AbsoluteAddr + Y;
-          if ((EffectiveAddr & 0xFF00) != (AbsoluteAddr & 0xFF00)) { Cycles--; }
-          Byte Value = ReadByte(Cycles, EffectiveAddr, memory);
-          A ^= Value;
-          setZN(A);
-      } break;
-
-      // STA variants
-      case Opcode::STA_ZP:
-      {
-          Byte Addr = FetchByte(Cycles, memory);
-          memory[Addr] = A;
-          Cycles--;
-      } break;
-      case Opcode::STA_ZPX:
-      {
-          Byte Addr = FetchByte(Cycles, memory);
-          Byte EffectiveAddr = (Addr + X) & 0xFF;
-          memory[EffectiveAddr] = A;
-          Cycles--;
-      } break;
-      case Opcode::STA_ABSX:
-      {
-          Byte LowByte = FetchByte(Cycles, memory);
-          Byte HighByte = FetchByte(Cycles, memory);
-          Word AbsoluteAddr = (Word)LowByte | ((Word)HighByte << 8);
-          Word EffectiveAddr = AbsoluteAddr + X;
-          memory[EffectiveAddr] = A;
-          Cycles--;
-      } break;
-      case Opcode::STA_ABSY:
-      {
-          Byte LowByte = FetchByte(Cycles, memory);
-          Byte HighByte = FetchByte(Cycles, memory);
-          Word AbsoluteAddr = (Word)LowByte | ((Word)HighByte << 8);
-          Word EffectiveAddr = AbsoluteAddr + Y;
-          memory[EffectiveAddr] = A;
-          Cycles--;
-      } break;
-      case Opcode::STA_IND_X:
-      {
-          Byte ZeroPageAddr = FetchByte(Cycles, memory);
-          Word EffectiveAddr = (ZeroPageAddr + X) & 0xFF;
-          Byte Low = ReadByte(Cycles, EffectiveAddr, memory);
-          Byte High = ReadByte(Cycles, (EffectiveAddr + 1) & 0xFF, memory);
-          Word AbsoluteAddr = (Word)Low | ((Word)High << 8);
-          memory[AbsoluteAddr] = A;
-          Cycles--;
-      } break;
-      case Opcode::STA_IND_Y:
-      {
-          Byte ZeroPageAddr = FetchByte(Cycles, memory);
-          Byte Low = ReadByte(Cycles, ZeroPageAddr, memory);
-          Byte High = ReadByte(Cycles, (ZeroPageAddr + 1) & 0xFF, memory);
-          Word AbsoluteAddr = (Word)Low | ((Word)High << 8);
-          Word EffectiveAddr = AbsoluteAddr + Y;
-          memory[EffectiveAddr] = A;
-          Cycles--;
-      } break;
+      }
+    }
+  };
 
-      // LDX
-      case Opcode::LDX_IM:
-      {
-          X = FetchByte(Cycles, memory);
-          LDXSetStatus();
-      } break;
-      case Opcode::LDX_ZP:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          X = ReadByte(Cycles, addr, memory);
-          LDXSetStatus();
-      } break;
-      case Opcode::LDX_ZPY:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          Byte eff = (addr + Y) & 0xFF;
-          Cycles--; // indexing cost
-          X = ReadByte(Cycles, eff, memory);
-          LDXSetStatus();
-      } break;
-      case Opcode::LDX_ABS:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          X = ReadByte(Cycles, abs, memory);
-          LDXSetStatus();
-      } break;
-      case Opcode::LDX_ABSY:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          Word eff = abs + Y;
-          if ((eff & 0xFF00) != (abs & 0xFF00)) { Cycles--; }
-          X = ReadByte(Cycles, eff, memory);
-          LDXSetStatus();
-      } break;
-
-      // LDY
-      case Opcode::LDY_IM:
-      {
-          Y = FetchByte(Cycles, memory);
-          LDYSetStatus();
-      } break;
-      case Opcode::LDY_ZP:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          Y = ReadByte(Cycles, addr, memory);
-          LDYSetStatus();
-      } break;
-      case Opcode::LDY_ZPX:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          Byte eff = (addr + X) & 0xFF;
-          Cycles--;
-          Y = ReadByte(Cycles, eff, memory);
-          LDYSetStatus();
-      } break;
-      case Opcode::LDY_ABS:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          Y = ReadByte(Cycles, abs, memory);
-          LDYSetStatus();
-      } break;
-      case Opcode::LDY_ABSX:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          Word eff = abs + X;
-          if ((eff & 0xFF00) != (abs & 0xFF00)) { Cycles--; }
-          Y = ReadByte(Cycles, eff, memory);
-          LDYSetStatus();
-      } break;
-
-      // INC
-      case Opcode::INC_ZP:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          Byte v = ReadByte(Cycles, addr, memory);
-          v = (Byte)(v + 1);
-          memory[addr] = v; Cycles--;
-          setZN(v);
-      } break;
-      case Opcode::INC_ZPX:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          Byte eff = (addr + X) & 0xFF;
-          Byte v = ReadByte(Cycles, eff, memory);
-          v = (Byte)(v + 1);
-          memory[eff] = v; Cycles--;
-          setZN(v);
-      } break;
-      case Opcode::INC_ABS:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          Byte v = ReadByte(Cycles, abs, memory);
-          v = (Byte)(v + 1);
-          memory[abs] = v; Cycles--;
-          setZN(v);
-      } break;
-      case Opcode::INC_ABSX:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          Word eff = abs + X;
-          Byte v = ReadByte(Cycles, eff, memory);
-          v = (Byte)(v + 1);
-          memory[eff] = v; Cycles--;
-          setZN(v);
-      } break;
-
-      // DEC
-      case Opcode::DEC_ZP:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          Byte v = ReadByte(Cycles, addr, memory);
-          v = (Byte)(v - 1);
-          memory[addr] = v; Cycles--;
-          setZN(v);
-      } break;
-      case Opcode::DEC_ZPX:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          Byte eff = (addr + X) & 0xFF;
-          Byte v = ReadByte(Cycles, eff, memory);
-          v = (Byte)(v - 1);
-          memory[eff] = v; Cycles--;
-          setZN(v);
-      } break;
-      case Opcode::DEC_ABS:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          Byte v = ReadByte(Cycles, abs, memory);
-          v = (Byte)(v - 1);
-          memory[abs] = v; Cycles--;
-          setZN(v);
-      } break;
-      case Opcode::DEC_ABSX:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          Word eff = abs + X;
-          Byte v = ReadByte(Cycles, eff, memory);
-          v = (Byte)(v - 1);
-          memory[eff] = v; Cycles--;
-          setZN(v);
-      } break;
-
-      // INX/INY
-      case Opcode::INX:
-      {
-          X = (Byte)(X + 1);
-          setZN(X);
-      } break;
-      case Opcode::INY:
-      {
-          Y = (Byte)(Y + 1);
-          setZN(Y);
-      } break;
+  // Internal stack pointer cycle, two pushes, high address byte.
+  struct JSR : Instruction<2, 6, true, true, AddressMode::Absolute>
+  {
+    static void Run(CPU &cpu, s32 &, Mem &memory, Word Operand)
+    {
+      Word Return = (Word)(cpu.PC - 1); // push return-1 high then low on 6502
+      cpu.PushByte((Byte)((Return >> 8) & 0xFF), memory);
+      cpu.PushByte((Byte)(Return & 0xFF), memory);
+      // The 6502 fetches the high address byte after the pushes, which only
+      // code in the stack page can tell, by overwriting it.
+      if (EMU6502_UNLIKELY((Return >> 8) == 0x01)) {
+        Operand = (Word)((Operand & 0x00FF) | (memory.ReadRam(Return) << 8));
+      }
+      cpu.PC = Operand;
+    }
+  };
 
-      // DEX/DEY
-      case Opcode::DEX:
-      {
-          X = (Byte)(X - 1);
-          setZN(X);
-      } break;
-      case Opcode::DEY:
-      {
-          Y = (Byte)(Y - 1);
-          setZN(Y);
-      } break;
+  // Dummy read, stack pointer increment, two pulls, PC increment.
+  struct RTS : Instruction<0, 6, true>
+  {
+    static void Run(CPU &cpu, s32 &, Mem &memory, Word)
+    {
+      Byte LowByte = cpu.PopByte(memory);
+      Byte HighByte = cpu.PopByte(memory);
+      cpu.PC = (Word)(((Word)LowByte | ((Word)HighByte << 8)) + 1);
+    }
+  };
 
-      // CMP family
-      case Opcode::CMP_IM:
-      {
-          Byte v = FetchByte(Cycles, memory);
-          Word r = (Word)A - (Word)v;
-          Z = ((Byte)r == 0);
-          C = A >= v;
-          N = ((Byte)r & 0x80) != 0;
-      } break;
-      case Opcode::CMP_ZP:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          Byte v = ReadByte(Cycles, addr, memory);
-          Word r = (Word)A - (Word)v;
-          Z = ((Byte)r == 0);
-          C = A >= v;
-          N = ((Byte)r & 0x80) != 0;
-      } break;
-      case Opcode::CMP_ZPX:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          Byte eff = (addr + X) & 0xFF;
-          Byte v = ReadByte(Cycles, eff, memory);
-          Word r = (Word)A - (Word)v;
-          Z = ((Byte)r == 0);
-          C = A >= v;
-          N = ((Byte)r & 0x80) != 0;
-      } break;
-      case Opcode::CMP_ABS:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          Byte v = ReadByte(Cycles, abs, memory);
-          Word r = (Word)A - (Word)v;
-          Z = ((Byte)r == 0);
-          C = A >= v;
-          N = ((Byte)r & 0x80) != 0;
-      } break;
-      case Opcode::CMP_ABSX:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          Word eff = abs + X;
-          Byte v = ReadByte(Cycles, eff, memory);
-          Word r = (Word)A - (Word)v;
-          Z = ((Byte)r == 0);
-          C = A >= v;
-          N = ((Byte)r & 0x80) != 0;
-      } break;
-      case Opcode::CMP_ABSY:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          Word eff = abs + Y;
-          Byte v = ReadByte(Cycles, eff, memory);
-          Word r = (Word)A - (Word)v;
-          Z = ((Byte)r == 0);
-          C = A >= v;
-          N = ((Byte)r & 0x80) != 0;
-      } break;
-      case Opcode::CMP_IND_X:
-      {
-          Byte zp = FetchByte(Cycles, memory);
-          Byte eff = (zp + X) & 0xFF;
-          Byte low = ReadByte(Cycles, eff, memory);
-          Byte high = ReadByte(Cycles, (eff + 1) & 0xFF, memory);
-          Word abs = (Word)low | ((Word)high << 8);
-          Byte v = ReadByte(Cycles, abs, memory);
-          Word r = (Word)A - (Word)v;
-          Z = ((Byte)r == 0);
-          C = A >= v;
-          N = ((Byte)r & 0x80) != 0;
-      } break;
-      case Opcode::CMP_IND_Y:
-      {
-          Byte zp = FetchByte(Cycles, memory);
-          Byte low = ReadByte(Cycles, zp, memory);
-          Byte high = ReadByte(Cycles, (zp + 1) & 0xFF, memory);
-          Word abs = (Word)low | ((Word)high << 8);
-          Word eff = abs + Y;
-          Byte v = ReadByte(Cycles, eff, memory);
-          Word r = (Word)A - (Word)v;
-          Z = ((Byte)r == 0);
-          C = A >= v;
-          N = ((Byte)r & 0x80) != 0;
-      } break;
-
-      // CPX
-      case Opcode::CPX_IM:
-      {
-          Byte v = FetchByte(Cycles, memory);
-          Word r = (Word)X - (Word)v;
-          Z = ((Byte)r == 0);
-          C = X >= v;
-          N = ((Byte)r & 0x80) != 0;
-      } break;
-      case Opcode::CPX_ZP:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          Byte v = ReadByte(Cycles, addr, memory);
-          Word r = (Word)X - (Word)v;
-          Z = ((Byte)r == 0);
-          C = X >= v;
-          N = ((Byte)r & 0x80) != 0;
-      } break;
-      case Opcode::CPX_ABS:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          Byte v = ReadByte(Cycles, abs, memory);
-          Word r = (Word)X - (Word)v;
-          Z = ((Byte)r == 0);
-          C = X >= v;
-          N = ((Byte)r & 0x80) != 0;
-      } break;
-
-      // CPY
-      case Opcode::CPY_IM:
-      {
-          Byte v = FetchByte(Cycles, memory);
-          Word r = (Word)Y - (Word)v;
-          Z = ((Byte)r == 0);
-          C = Y >= v;
-          N = ((Byte)r & 0x80) != 0;
-      } break;
-      case Opcode::CPY_ZP:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          Byte v = ReadByte(Cycles, addr, memory);
-          Word r = (Word)Y - (Word)v;
-          Z = ((Byte)r == 0);
-          C = Y >= v;
-          N = ((Byte)r & 0x80) != 0;
-      } break;
-      case Opcode::CPY_ABS:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          Byte v = ReadByte(Cycles, abs, memory);
-          Word r = (Word)Y - (Word)v;
-          Z = ((Byte)r == 0);
-          C = Y >= v;
-          N = ((Byte)r & 0x80) != 0;
-      } break;
-
-      // Flag instructions
-      case Opcode::CLC: { C = 0; } break;
-      case Opcode::CLD: { D = 0; } break;
-      case Opcode::CLI: { I = 0; } break;
-      case Opcode::CLV: { V = 0; } break;
-      case Opcode::SEC: { C = 1; } break;
-      case Opcode::SED: { D = 1; } break;
-      case Opcode::SEI: { I = 1; } break;
-
-      // Stack ops
-      case Opcode::PHA: { pushByte(A); } break;
-      case Opcode::PHP: { pushByte(getStatus()); } break;
-      case Opcode::PLA: { A = popByte(); } break;
-      case Opcode::PLP: { setStatus(popByte()); } break;
-
-      // Transfers
-      case Opcode::TAX: { X = A; setZN(X); } break;
-      case Opcode::TAY: { Y = A; setZN(Y); } break;
-      case Opcode::TXA: { A = X; setZN(A); } break;
-      case Opcode::TYA: { A = Y; setZN(A); } break;
-      case Opcode::TSX: { X = (Byte)(SP & 0xFF); setZN(X); } break;
-      case Opcode::TXS: { SP = (Word)(0x0100 | X); } break;
-
-      // Shifts (only LSR implemented here)
-      case Opcode::LSR_A:
-      {
-          C = (A & 0x01) != 0;
-          A = (Byte)(A >> 1);
-          setZN(A);
-      } break;
-      case Opcode::LSR_ZP:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          Byte v = ReadByte(Cycles, addr, memory);
-          C = (v & 0x01) != 0;
-          v = (Byte)(v >> 1);
-          memory[addr] = v; Cycles--;
-          setZN(v);
-      } break;
-      case Opcode::LSR_ZPX:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          Byte eff = (addr + X) & 0xFF;
-          Byte v = ReadByte(Cycles, eff, memory);
-          C = (v & 0x01) != 0;
-          v = (Byte)(v >> 1);
-          memory[eff] = v; Cycles--;
-          setZN(v);
-      } break;
-      case Opcode::LSR_ABS:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          Byte v = ReadByte(Cycles, abs, memory);
-          C = (v & 0x01) != 0;
-          v = (Byte)(v >> 1);
-          memory[abs] = v; Cycles--;
-          setZN(v);
-      } break;
-      case Opcode::LSR_ABSX:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          Word eff = abs + X;
-          Byte v = ReadByte(Cycles, eff, memory);
-          C = (v & 0x01) != 0;
-          v = (Byte)(v >> 1);
-          memory[eff] = v; Cycles--;
-          setZN(v);
-      } break;
-
-      // Branches (relative addressing)
-      case Opcode::BEQ:
-      case Opcode::BNE:
-      case Opcode::BCC:
-      case Opcode::BCS:
-      case Opcode::BPL:
-      case Opcode::BMI:
-      case Opcode::BVC:
-      case Opcode::BVS:
-      {
-          Byte offset = FetchByte(Cycles, memory);
-          bool cond = false;
-          switch (Op) {
-            case Opcode::BEQ: cond = Z; break;
-            case Opcode::BNE: cond = !Z; break;
-            case Opcode::BCC: cond = !C; break;
-            case Opcode::BCS: cond = C; break;
-            case Opcode::BPL: cond = !N; break;
-            case Opcode::BMI: cond = N; break;
-            case Opcode::BVC: cond = !V; break;
-            case Opcode::BVS: cond = V; break;
-            default: break;
-          }
-          if (cond) {
-            Word oldPC = PC;
-            PC = (Word)(PC + (std::int8_t)offset);
-            Cycles--; // branch taken cost
-            if ((oldPC & 0xFF00) != (PC & 0xFF00)) { Cycles--; }
-          }
-      } break;
+  // Dummy read, stack pointer increment, three pulls.
+  struct RTI : Instruction<0, 6, true>
+  {
+    static constexpr bool Unmasks = true;
+    static void Run(CPU &cpu, s32 &, Mem &memory, Word)
+    {
+      cpu.SetStatus(cpu.PopByte(memory));
+      Byte LowByte = cpu.PopByte(memory);
+      Byte HighByte = cpu.PopByte(memory);
+      cpu.PC = (Word)LowByte | ((Word)HighByte << 8);
+    }
+  };
 
-      // Return from subroutine/interrupt
-      case Opcode::RTS:
-      {
-          Byte low = popByte();
-          Byte high = popByte();
-          Word addr = (Word)low | ((Word)high << 8);
-          PC = (Word)(addr + 1);
-      } break;
-      case Opcode::RTI:
-      {
-          Byte p = popByte();
-          setStatus(p);
-          Byte low = popByte();
-          Byte high = popByte();
-          PC = (Word)low | ((Word)high << 8);
-      } break;
-      case Opcode::STA_ABS: 
-      {
-          Byte LowByte = FetchByte(Cycles, memory);
-          Byte HighByte = FetchByte(Cycles, memory);
-          Word AbsoluteAddr = (Word)LowByte | ((Word)HighByte << 8);
-          memory[AbsoluteAddr] = A;
-          Cycles--;
-      } break;
-      // STX
-      case Opcode::STX_ZP:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          memory[addr] = X; Cycles--;
-      } break;
-      case Opcode::STX_ZPY:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          Byte eff = (addr + Y) & 0xFF;
-          memory[eff] = X; Cycles--;
-      } break;
-      case Opcode::STX_ABS:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          memory[abs] = X; Cycles--;
-      } break;
-
-      // STY
-      case Opcode::STY_ZP:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          memory[addr] = Y; Cycles--;
-      } break;
-      case Opcode::STY_ZPY:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          Byte eff = (addr + X) & 0xFF;
-          memory[eff] = Y; Cycles--;
-      } break;
-      case Opcode::STY_ABS:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          memory[abs] = Y; Cycles--;
-      } break;
-      case Opcode::ADC_ABS: 
-      {
-          Byte LowByte = FetchByte(Cycles, memory);
-          Byte HighByte = FetchByte(Cycles, memory);
-          Word AbsoluteAddr = (Word)LowByte | ((Word)HighByte << 8);
-          Byte Value = ReadByte(Cycles, AbsoluteAddr, memory);
-
-          Word Result = (Word)A + (Word)Value + (C ? 1 : 0);
-          V = (~(A ^ Value) & (A ^ (Byte)Result) & 0x80) != 0;
-          A = (Byte)Result;
-          C = (Result > 0xFF);
-          setZN(A);
-      } break;
-      case Opcode::ADC_ZP:
-      {
-          Byte zp = FetchByte(Cycles, memory);
-          Byte Value = ReadByte(Cycles, zp, memory);
-          Word Result = (Word)A + (Word)Value + (C ? 1 : 0);
-          V = (~(A ^ Value) & (A ^ (Byte)Result) & 0x80) != 0;
-          A = (Byte)Result;
-          C = (Result > 0xFF);
-          setZN(A);
-      } break;
-      case Opcode::ADC_IM:
-      {
-          Byte Value = FetchByte(Cycles, memory);
-          Word Result = (Word)A + (Word)Value + (C ? 1 : 0);
-          V = (~(A ^ Value) & (A ^ (Byte)Result) & 0x80) != 0;
-          A = (Byte)Result;
-          C = (Result > 0xFF);
-          setZN(A);
-      } break;
-      case Opcode::ADC_ZPX:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          Byte eff = (addr + X) & 0xFF;
-          Byte Value = ReadByte(Cycles, eff, memory);
-          Word Result = (Word)A + (Word)Value + (C ? 1 : 0);
-          V = (~(A ^ Value) & (A ^ (Byte)Result) & 0x80) != 0;
-          A = (Byte)Result;
-          C = (Result > 0xFF);
-          setZN(A);
-      } break;
-      case Opcode::ADC_ABSX:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          Word eff = abs + X;
-          if ((eff & 0xFF00) != (abs & 0xFF00)) { Cycles--; }
-          Byte Value = ReadByte(Cycles, eff, memory);
-          Word Result = (Word)A + (Word)Value + (C ? 1 : 0);
-          V = (~(A ^ Value) & (A ^ (Byte)Result) & 0x80) != 0;
-          A = (Byte)Result;
-          C = (Result > 0xFF);
-          setZN(A);
-      } break;
-      case Opcode::ADC_ABSY:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          Word eff = abs + Y;
-          if ((eff & 0xFF00) != (abs & 0xFF00)) { Cycles--; }
-          Byte Value = ReadByte(Cycles, eff, memory);
-          Word Result = (Word)A + (Word)Value + (C ? 1 : 0);
-          V = (~(A ^ Value) & (A ^ (Byte)Result) & 0x80) != 0;
-          A = (Byte)Result;
-          C = (Result > 0xFF);
-          setZN(A);
-      } break;
-      case Opcode::ADC_INDX:
-      {
-          Byte zp = FetchByte(Cycles, memory);
-          Word eff = (zp + X) & 0xFF;
-          Byte low = ReadByte(Cycles, eff, memory);
-          Byte high = ReadByte(Cycles, (eff + 1) & 0xFF, memory);
-          Word abs = (Word)low | ((Word)high << 8);
-          Byte Value = ReadByte(Cycles, abs, memory);
-          Word Result = (Word)A + (Word)Value + (C ? 1 : 0);
-          V = (~(A ^ Value) & (A ^ (Byte)Result) & 0x80) != 0;
-          A = (Byte)Result;
-          C = (Result > 0xFF);
-          setZN(A);
-      } break;
-      case Opcode::ADC_INDY:
-      {
-          Byte zp = FetchByte(Cycles, memory);
-          Byte low = ReadByte(Cycles, zp, memory);
-          Byte high = ReadByte(Cycles, (zp + 1) & 0xFF, memory);
-          Word abs = (Word)low | ((Word)high << 8);
-          Word eff = abs + Y;
-          if ((eff & 0xFF00) != (abs & 0xFF00)) { Cycles--; }
-          Byte Value = ReadByte(Cycles, eff, memory);
-          Word Result = (Word)A + (Word)Value + (C ? 1 : 0);
-          V = (~(A ^ Value) & (A ^ (Byte)Result) & 0x80) != 0;
-          A = (Byte)Result;
-          C = (Result > 0xFF);
-          setZN(A);
-      } break;
-      case Opcode::SBC_ABS: 
-      {
-          Byte LowByte = FetchByte(Cycles, memory);
-          Byte HighByte = FetchByte(Cycles, memory);
-          Word AbsoluteAddr = (Word)LowByte | ((Word) HighByte << 8);
-          SByte Value = ReadByte(Cycles, AbsoluteAddr, memory);
-
-          SByte A_s = (SByte)A;
-          SByte Value_s = (SByte)Value;
-          Word Result = (Word)A_s - (Word)Value_s - (C ? 0 : 1);
-          A = (Byte)Result;
-          C = (Result & 0x8000) == 0;
-          V = (((A_s ^ Value_s) & (A_s ^ (SByte)Result)) & 0x80) != 0;
-          setZN(A);
-      } break;
-      case Opcode::SBC_IM:
-      {
-          SByte A_s = (SByte)A;
-          Byte Value = FetchByte(Cycles, memory);
-          SByte Value_s = (SByte)Value;
-          Word Result = (Word)A_s - (Word)Value_s - (C ? 0 : 1);
-          A = (Byte)Result;
-          C = (Result & 0x8000) == 0;
-          V = (((A_s ^ Value_s) & (A_s ^ (SByte)Result)) & 0x80) != 0;
-          setZN(A);
-      } break;
-      case Opcode::SBC_ZP:
-      {
-          SByte A_s = (SByte)A;
-          Byte addr = FetchByte(Cycles, memory);
-          Byte Value = ReadByte(Cycles, addr, memory);
-          SByte Value_s = (SByte)Value;
-          Word Result = (Word)A_s - (Word)Value_s - (C ? 0 : 1);
-          A = (Byte)Result;
-          C = (Result & 0x8000) == 0;
-          V = (((A_s ^ Value_s) & (A_s ^ (SByte)Result)) & 0x80) != 0;
-          setZN(A);
-      } break;
-      case Opcode::SBC_ZPX:
-      {
-          SByte A_s = (SByte)A;
-          Byte addr = FetchByte(Cycles, memory);
-          Byte eff = (addr + X) & 0xFF;
-          Byte Value = ReadByte(Cycles, eff, memory);
-          SByte Value_s = (SByte)Value;
-          Word Result = (Word)A_s - (Word)Value_s - (C ? 0 : 1);
-          A = (Byte)Result;
-          C = (Result & 0x8000) == 0;
-          V = (((A_s ^ Value_s) & (A_s ^ (SByte)Result)) & 0x80) != 0;
-          setZN(A);
-      } break;
-      case Opcode::SBC_ABSX:
-      {
-          SByte A_s = (SByte)A;
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          Word eff = abs + X;
-          if ((eff & 0xFF00) != (abs & 0xFF00)) { Cycles--; }
-          Byte Value = ReadByte(Cycles, eff, memory);
-          SByte Value_s = (SByte)Value;
-          Word Result = (Word)A_s - (Word)Value_s - (C ? 0 : 1);
-          A = (Byte)Result;
-          C = (Result & 0x8000) == 0;
-          V = (((A_s ^ Value_s) & (A_s ^ (SByte)Result)) & 0x80) != 0;
-          setZN(A);
-      } break;
-      case Opcode::SBC_ABSY:
-      {
-          SByte A_s = (SByte)A;
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          Word eff = abs + Y;
-          if ((eff & 0xFF00) != (abs & 0xFF00)) { Cycles--; }
-          Byte Value = ReadByte(Cycles, eff, memory);
-          SByte Value_s = (SByte)Value;
-          Word Result = (Word)A_s - (Word)Value_s - (C ? 0 : 1);
-          A = (Byte)Result;
-          C = (Result & 0x8000) == 0;
-          V = (((A_s ^ Value_s) & (A_s ^ (SByte)Result)) & 0x80) != 0;
-          setZN(A);
-      } break;
-      case Opcode::SBC_IND_X:
-      {
-          SByte A_s = (SByte)A;
-          Byte zp = FetchByte(Cycles, memory);
-          Word eff = (zp + X) & 0xFF;
-          Byte low = ReadByte(Cycles, eff, memory);
-          Byte high = ReadByte(Cycles, (eff + 1) & 0xFF, memory);
-          Word abs = (Word)low | ((Word)high << 8);
-          Byte Value = ReadByte(Cycles, abs, memory);
-          SByte Value_s = (SByte)Value;
-          Word Result = (Word)A_s - (Word)Value_s - (C ? 0 : 1);
-          A = (Byte)Result;
-          C = (Result & 0x8000) == 0;
-          V = (((A_s ^ Value_s) & (A_s ^ (SByte)Result)) & 0x80) != 0;
-          setZN(A);
-      } break;
-      case Opcode::SBC_IND_Y:
-      {
-          SByte A_s = (SByte)A;
-          Byte zp = FetchByte(Cycles, memory);
-          Byte low = ReadByte(Cycles, zp, memory);
-          Byte high = ReadByte(Cycles, (zp + 1) & 0xFF, memory);
-          Word abs = (Word)low | ((Word)high << 8);
-          Word eff = abs + Y;
-          if ((eff & 0xFF00) != (abs & 0xFF00)) { Cycles--; }
-          Byte Value = ReadByte(Cycles, eff, memory);
-          SByte Value_s = (SByte)Value;
-          Word Result = (Word)A_s - (Word)Value_s - (C ? 0 : 1);
-          A = (Byte)Result;
-          C = (Result & 0x8000) == 0;
-          V = (((A_s ^ Value_s) & (A_s ^ (SByte)Result)) & 0x80) != 0;
-          setZN(A);
-      } break;
-      case Opcode::BRK: 
-      {
-          return;    
+  struct JMP_ABS : Instruction<2, 3, true, false, AddressMode::Absolute>
+  {
+    static void Run(CPU &cpu, s32 &, Mem &, Word Operand) { cpu.PC = Operand; }
+  };
+
+  // Two pointer reads.
+  struct JMP_IND : Instruction<2, 5, true, false, AddressMode::Indirect>
+  {
+    static void Run(CPU &cpu, s32 &, Mem &memory, Word Operand)
+    {
+      // 6502 page boundary wrap bug
+      Byte LowByte = memory.Read(Operand);
+      Byte HighByte = memory.Read((Word)((Operand & 0xFF00) | ((Operand + 1) & 0x00FF)));
+      cpu.PC = (Word)LowByte | ((Word)HighByte << 8);
+    }
+  };
+
+  // Pushes spend a dummy read before the write; pulls spend a dummy read
+  // and a stack pointer increment before the read.
+  struct PHA : Instruction<0, 3, false, true>
+  {
+    static void Run(CPU &cpu, s32 &, Mem &memory, Word) { cpu.PushByte(cpu.A, memory); }
+  };
+
+  struct PHP : Instruction<0, 3, false, true>
+  {
+    static void Run(CPU &cpu, s32 &, Mem &memory, Word) { cpu.PushByte((Byte)(cpu.GetStatus() | FLAG_B), memory); }
+  };
+
+  struct PLA : Instruction<0, 4>
+  {
+    static void Run(CPU &cpu, s32 &, Mem &memory, Word)
+    {
+      cpu.A = cpu.PopByte(memory);
+      cpu.SetZN(cpu.A);
+    }
+  };
+
+  struct PLP : Instruction<0, 4>
+  {
+    static constexpr bool Unmasks = true;
+    static void Run(CPU &cpu, s32 &, Mem &memory, Word) { cpu.SetStatus(cpu.PopByte(memory)); }
+  };
+
+  // BRK and unimplemented opcodes stop Execute instead of being dispatched
+  // (see Halt); their entries only mark them as halting. All they cost is
+  // the opcode fetch.
+  struct BRK : Instruction<0, 1, true>
+  {
+    static constexpr bool Halts = true;
+    static void Run(CPU &, s32 &, Mem &, Word) {}
+  };
+
+  struct Illegal : Instruction<0, 1, true>
+  {
+    static constexpr bool Halts = true;
+    static void Run(CPU &, s32 &, Mem &, Word) {}
+  };
+
+  // Length counts the opcode byte; Cost is what the instruction always
+  // takes, in cycles.
+  struct OpcodeEntry
+  {
+    Handler Fn;
+    Byte Length;
+    Byte Cost;
+    bool EndsBlock;
+    bool Writes;
+    bool Halts;
+    bool Unmasks;
+    AddressMode Addressing;
+  };
+
+  enum class StopReason { Budget, Brk, Illegal, Breakpoint };
+
+  // What an Execute call did. The instruction that exhausts the budget always
+  // completes, so CyclesConsumed can exceed the budget by Overrun cycles.
+  struct ExecResult
+  {
+    s32 CyclesConsumed = 0;
+    s32 Overrun = 0;
+    u64 InstructionsRetired = 0;
+    StopReason Reason = StopReason::Budget;
+  };
+
+  // Called with a halting opcode just fetched, charged and already counted
+  // as retired. Returns true, with Reason set, if execution stops. BRK stays
+  // retired and leaves PC past it, or with BrkHalts false runs as a software
+  // interrupt and doesn't stop; an illegal opcode is not executed, so PC,
+  // Cycles and Retired are rolled back to point at it.
+  bool Halt(Byte Ins, s32 &Cycles, u64 &Retired, Mem &memory, StopReason &Reason)
+  {
+    if (Ins == static_cast<Byte>(Opcode::BRK)) {
+      if (BrkHalts) {
+        Reason = StopReason::Brk;
+        return true;
       }
-      case Opcode::JMP_ABS:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word addr = (Word)lo | ((Word)hi << 8);
-          PC = addr;
-      } break;
-      case Opcode::JMP_IND:
-      {
-          Byte ptrLo = FetchByte(Cycles, memory);
-          Byte ptrHi = FetchByte(Cycles, memory);
-          Word ptr = (Word)ptrLo | ((Word)ptrHi << 8);
-          // 6502 page boundary wrap bug
-          Byte lo = memory[ptr];
-          Byte hi = memory[(Word)((ptr & 0xFF00) | ((ptr + 1) & 0x00FF))];
-          PC = (Word)lo | ((Word)hi << 8);
-      } break;
-      // ASL
-      case Opcode::ASL_A:
-      {
-          C = (A & 0x80) != 0;
-          A = (Byte)(A << 1);
-          setZN(A);
-      } break;
-      case Opcode::ASL_ZP:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          Byte v = ReadByte(Cycles, addr, memory);
-          C = (v & 0x80) != 0;
-          v = (Byte)(v << 1);
-          memory[addr] = v; Cycles--;
-          setZN(v);
-      } break;
-      case Opcode::ASL_ZPX:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          Byte eff = (addr + X) & 0xFF;
-          Byte v = ReadByte(Cycles, eff, memory);
-          C = (v & 0x80) != 0;
-          v = (Byte)(v << 1);
-          memory[eff] = v; Cycles--;
-          setZN(v);
-      } break;
-      case Opcode::ASL_ABS:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          Byte v = ReadByte(Cycles, abs, memory);
-          C = (v & 0x80) != 0;
-          v = (Byte)(v << 1);
-          memory[abs] = v; Cycles--;
-          setZN(v);
-      } break;
-      case Opcode::ASL_ABSX:
-      {
-          Byte lo = FetchByte(Cycles, memory);
-          Byte hi = FetchByte(Cycles, memory);
-          Word abs = (Word)lo | ((Word)hi << 8);
-          Word eff = abs + X;
-          Byte v = ReadByte(Cycles, eff, memory);
-          C = (v & 0x80) != 0;
-          v = (Byte)(v << 1);
-          memory[eff] = v; Cycles--;
-          setZN(v);
-      } break;
-      // BIT
-      case Opcode::BIT_ZP:
-      {
-          Byte addr = FetchByte(Cycles, memory);
-          Byte value = ReadByte(Cycles, addr, memory);
-          Z = (A & value) == 0;
-          V = (value & 0x40) != 0;
-          N = (value & 0x80) != 0;
-      } break;
-      default:
-      {
-        printf("Instruction not handled %d\n", Ins);
+      PC++; // BRK skips the byte after it
+      Enter(IRQ_VECTOR, (Byte)(GetStatus() | FLAG_B), memory);
+      Cycles -= INTERRUPT_CYCLES - 1;
+      return false;
+    }
+    PC--;
+    Cycles++;
+    Retired--;
+    Reason = StopReason::Illegal;
+    return true;
+  }
+
+  // Takes the pending interrupt, NMI first: pushes PC and the status with B
+  // clear, sets I and jumps through the vector.
+  void Interrupt(s32 &Cycles, Mem &memory)
+  {
+    Word Vector = IRQ_VECTOR;
+    if (NmiPending) {
+      NmiPending = false;
+      Vector = NMI_VECTOR;
+    }
+    Enter(Vector, GetStatus(), memory);
+    Cycles -= INTERRUPT_CYCLES;
+  }
+
+  void Enter(Word Vector, Byte Status, Mem &memory)
+  {
+    PushByte((Byte)(PC >> 8), memory);
+    PushByte((Byte)PC, memory);
+    PushByte((Byte)(Status | FLAG_U), memory);
+    SetFlag(FLAG_I, true);
+    PC = ReadVector(memory, Vector);
+  }
+
+  // After an instruction that can clear I: if that let a held IRQ through,
+  // parks the rest of the budget so the Execute loop ends and takes it.
+  EMU6502_ALWAYS_INLINE void CheckUnmasked(s32 &Cycles, s32 &Parked) const
+  {
+    if (EMU6502_UNLIKELY(IrqLines != 0 && !GetI() && Cycles > 0)) {
+      Parked = Cycles;
+      Cycles = 0;
+    }
+  }
+
+  // Execute loops count in locals, which the compiler can keep in registers,
+  // and only fill in the result on the way out.
+  static ExecResult Finish(StopReason Reason, s32 Budget, s32 Cycles, u64 Retired)
+  {
+    ExecResult Result;
+    Result.CyclesConsumed = Budget - Cycles;
+    Result.Overrun = Cycles < 0 ? -Cycles : 0;
+    Result.InstructionsRetired = Retired;
+    Result.Reason = Reason;
+    return Result;
+  }
+
+  static constexpr std::array<OpcodeEntry, 256> MakeDispatchTable()
+  {
+    std::array<OpcodeEntry, 256> T{};
+    auto Entry = [](auto H) {
+      using Ins = decltype(H);
+      return OpcodeEntry{&Ins::Run,    (Byte)(Ins::Bytes + 1), Ins::Cost,    Ins::EndsBlock,
+                         Ins::Writes,  Ins::Halts,             Ins::Unmasks, Ins::Addressing};
+    };
+    for (OpcodeEntry &E : T) {
+      E = Entry(Illegal{});
+    }
+    ForEachInstruction([&T, &Entry](Opcode Op, auto H) { T[static_cast<Byte>(Op)] = Entry(H); });
+    return T;
+  }
+
+  // Calls Set(Opcode, Handler{}) for every implemented opcode. Other engines
+  // build their own tables from the same list by mapping the handler types.
+  template <typename F>
+  static constexpr void ForEachInstruction(F &&Set)
+  {
+    using O = Opcode;
+    using IM = Immediate;
+    using ZP = ZeroPage;
+    using ZPX = ZeroPageX;
+    using ZPY = ZeroPageY;
+    using ABS = Absolute;
+    using ABSX = AbsoluteX;
+    using ABSY = AbsoluteY;
+    using INDX = IndexedIndirect;
+    using INDY = IndirectIndexed;
+
+    Set(O::LDA_IM, Read<&CPU::OpLDA, IM>{});
+    Set(O::LDA_ZP, Read<&CPU::OpLDA, ZP>{});
+    Set(O::LDA_ZPX, Read<&CPU::OpLDA, ZPX>{});
+    Set(O::LDA_ABS, Read<&CPU::OpLDA, ABS>{});
+    Set(O::LDA_ABS_X, Read<&CPU::OpLDA, ABSX>{});
+    Set(O::LDA_ABS_Y, Read<&CPU::OpLDA, ABSY>{});
+    Set(O::LDA_IND_X, Read<&CPU::OpLDA, INDX>{});
+    Set(O::LDA_IND_Y, Read<&CPU::OpLDA, INDY>{});
+
+    Set(O::LDX_IM, Read<&CPU::OpLDX, IM>{});
+    Set(O::LDX_ZP, Read<&CPU::OpLDX, ZP>{});
+    Set(O::LDX_ZPY, Read<&CPU::OpLDX, ZPY>{});
+    Set(O::LDX_ABS, Read<&CPU::OpLDX, ABS>{});
+    Set(O::LDX_ABSY, Read<&CPU::OpLDX, ABSY>{});
+
+    Set(O::LDY_IM, Read<&CPU::OpLDY, IM>{});
+    Set(O::LDY_ZP, Read<&CPU::OpLDY, ZP>{});
+    Set(O::LDY_ZPX, Read<&CPU::OpLDY, ZPX>{});
+    Set(O::LDY_ABS, Read<&CPU::OpLDY, ABS>{});
+    Set(O::LDY_ABSX, Read<&CPU::OpLDY, ABSX>{});
+
+    Set(O::AND_IM, Read<&CPU::OpAND, IM>{});
+    Set(O::AND_ZP, Read<&CPU::OpAND, ZP>{});
+    Set(O::AND_ZPX, Read<&CPU::OpAND, ZPX>{});
+    Set(O::AND_ABS, Read<&CPU::OpAND, ABS>{});
+    Set(O::AND_ABSX, Read<&CPU::OpAND, ABSX>{});
+    Set(O::AND_ABSY, Read<&CPU::OpAND, ABSY>{});
+    Set(O::AND_INDX, Read<&CPU::OpAND, INDX>{});
+    Set(O::AND_INDY, Read<&CPU::OpAND, INDY>{});
+
+    Set(O::ORA_IM, Read<&CPU::OpORA, IM>{});
+    Set(O::ORA_ZP, Read<&CPU::OpORA, ZP>{});
+    Set(O::ORA_ZPX, Read<&CPU::OpORA, ZPX>{});
+    Set(O::ORA_ABS, Read<&CPU::OpORA, ABS>{});
+    Set(O::ORA_ABSX, Read<&CPU::OpORA, ABSX>{});
+    Set(O::ORA_ABSY, Read<&CPU::OpORA, ABSY>{});
+    Set(O::ORA_IND_X, Read<&CPU::OpORA, INDX>{});
+    Set(O::ORA_IND_Y, Read<&CPU::OpORA, INDY>{});
+
+    Set(O::EOR_IM, Read<&CPU::OpEOR, IM>{});
+    Set(O::EOR_ZP, Read<&CPU::OpEOR, ZP>{});
+    Set(O::EOR_ZPX, Read<&CPU::OpEOR, ZPX>{});
+    Set(O::EOR_ABS, Read<&CPU::OpEOR, ABS>{});
+    Set(O::EOR_ABSX, Read<&CPU::OpEOR, ABSX>{});
+    Set(O::EOR_ABSY, Read<&CPU::OpEOR, ABSY>{});
+    Set(O::EOR_IND_X, Read<&CPU::OpEOR, INDX>{});
+    Set(O::EOR_IND_Y, Read<&CPU::OpEOR, INDY>{});
+
+    Set(O::ADC_IM, Read<&CPU::OpADC, IM>{});
+    Set(O::ADC_ZP, Read<&CPU::OpADC, ZP>{});
+    Set(O::ADC_ZPX, Read<&CPU::OpADC, ZPX>{});
+    Set(O::ADC_ABS, Read<&CPU::OpADC, ABS>{});
+    Set(O::ADC_ABSX, Read<&CPU::OpADC, ABSX>{});
+    Set(O::ADC_ABSY, Read<&CPU::OpADC, ABSY>{});
+    Set(O::ADC_INDX, Read<&CPU::OpADC, INDX>{});
+    Set(O::ADC_INDY, Read<&CPU::OpADC, INDY>{});
+
+    Set(O::SBC_IM, Read<&CPU::OpSBC, IM>{});
+    Set(O::SBC_ZP, Read<&CPU::OpSBC, ZP>{});
+    Set(O::SBC_ZPX, Read<&CPU::OpSBC, ZPX>{});
+    Set(O::SBC_ABS, Read<&CPU::OpSBC, ABS>{});
+    Set(O::SBC_ABSX, Read<&CPU::OpSBC, ABSX>{});
+    Set(O::SBC_ABSY, Read<&CPU::OpSBC, ABSY>{});
+    Set(O::SBC_IND_X, Read<&CPU::OpSBC, INDX>{});
+    Set(O::SBC_IND_Y, Read<&CPU::OpSBC, INDY>{});
+
+    Set(O::CMP_IM, Read<&CPU::OpCMP, IM>{});
+    Set(O::CMP_ZP, Read<&CPU::OpCMP, ZP>{});
+    Set(O::CMP_ZPX, Read<&CPU::OpCMP, ZPX>{});
+    Set(O::CMP_ABS, Read<&CPU::OpCMP, ABS>{});
+    Set(O::CMP_ABSX, Read<&CPU::OpCMP, ABSX>{});
+    Set(O::CMP_ABSY, Read<&CPU::OpCMP, ABSY>{});
+    Set(O::CMP_IND_X, Read<&CPU::OpCMP, INDX>{});
+    Set(O::CMP_IND_Y, Read<&CPU::OpCMP, INDY>{});
+
+    Set(O::CPX_IM, Read<&CPU::OpCPX, IM>{});
+    Set(O::CPX_ZP, Read<&CPU::OpCPX, ZP>{});
+    Set(O::CPX_ABS, Read<&CPU::OpCPX, ABS>{});
+
+    Set(O::CPY_IM, Read<&CPU::OpCPY, IM>{});
+    Set(O::CPY_ZP, Read<&CPU::OpCPY, ZP>{});
+    Set(O::CPY_ABS, Read<&CPU::OpCPY, ABS>{});
+
+    Set(O::BIT_ZP, Read<&CPU::OpBIT, ZP>{});
+    Set(O::BIT_ABS, Read<&CPU::OpBIT, ABS>{});
+
+    Set(O::STA_ZP, Store<&CPU::A, ZP>{});
+    Set(O::STA_ZPX, Store<&CPU::A, ZPX>{});
+    Set(O::STA_ABS, Store<&CPU::A, ABS>{});
+    Set(O::STA_ABSX, Store<&CPU::A, ABSX>{});
+    Set(O::STA_ABSY, Store<&CPU::A, ABSY>{});
+    Set(O::STA_IND_X, Store<&CPU::A, INDX>{});
+    Set(O::STA_IND_Y, Store<&CPU::A, INDY>{});
+
+    Set(O::STX_ZP, Store<&CPU::X, ZP>{});
+    Set(O::STX_ZPY, Store<&CPU::X, ZPY>{});
+    Set(O::STX_ABS, Store<&CPU::X, ABS>{});
+
+    Set(O::STY_ZP, Store<&CPU::Y, ZP>{});
+    Set(O::STY_ZPX, Store<&CPU::Y, ZPX>{});
+    Set(O::STY_ABS, Store<&CPU::Y, ABS>{});
+
+    Set(O::ASL_A, ModifyA<&CPU::OpASL>{});
+    Set(O::ASL_ZP, Modify<&CPU::OpASL, ZP>{});
+    Set(O::ASL_ZPX, Modify<&CPU::OpASL, ZPX>{});
+    Set(O::ASL_ABS, Modify<&CPU::OpASL, ABS>{});
+    Set(O::ASL_ABSX, Modify<&CPU::OpASL, ABSX>{});
+
+    Set(O::LSR_A, ModifyA<&CPU::OpLSR>{});
+    Set(O::LSR_ZP, Modify<&CPU::OpLSR, ZP>{});
+    Set(O::LSR_ZPX, Modify<&CPU::OpLSR, ZPX>{});
+    Set(O::LSR_ABS, Modify<&CPU::OpLSR, ABS>{});
+    Set(O::LSR_ABSX, Modify<&CPU::OpLSR, ABSX>{});
+
+    Set(O::ROL_A, ModifyA<&CPU::OpROL>{});
+    Set(O::ROL_ZP, Modify<&CPU::OpROL, ZP>{});
+    Set(O::ROL_ZPX, Modify<&CPU::OpROL, ZPX>{});
+    Set(O::ROL_ABS, Modify<&CPU::OpROL, ABS>{});
+    Set(O::ROL_ABSX, Modify<&CPU::OpROL, ABSX>{});
+
+    Set(O::ROR_A, ModifyA<&CPU::OpROR>{});
+    Set(O::ROR_ZP, Modify<&CPU::OpROR, ZP>{});
+    Set(O::ROR_ZPX, Modify<&CPU::OpROR, ZPX>{});
+    Set(O::ROR_ABS, Modify<&CPU::OpROR, ABS>{});
+    Set(O::ROR_ABSX, Modify<&CPU::OpROR, ABSX>{});
+
+    Set(O::INC_ZP, Modify<&CPU::OpINC, ZP>{});
+    Set(O::INC_ZPX, Modify<&CPU::OpINC, ZPX>{});
+    Set(O::INC_ABS, Modify<&CPU::OpINC, ABS>{});
+    Set(O::INC_ABSX, Modify<&CPU::OpINC, ABSX>{});
+
+    Set(O::DEC_ZP, Modify<&CPU::OpDEC, ZP>{});
+    Set(O::DEC_ZPX, Modify<&CPU::OpDEC, ZPX>{});
+    Set(O::DEC_ABS, Modify<&CPU::OpDEC, ABS>{});
+    Set(O::DEC_ABSX, Modify<&CPU::OpDEC, ABSX>{});
+
+    Set(O::BPL, Branch<static_cast<Byte>(O::BPL)>{});
+    Set(O::BMI, Branch<static_cast<Byte>(O::BMI)>{});
+    Set(O::BVC, Branch<static_cast<Byte>(O::BVC)>{});
+    Set(O::BVS, Branch<static_cast<Byte>(O::BVS)>{});
+    Set(O::BCC, Branch<static_cast<Byte>(O::BCC)>{});
+    Set(O::BCS, Branch<static_cast<Byte>(O::BCS)>{});
+    Set(O::BNE, Branch<static_cast<Byte>(O::BNE)>{});
+    Set(O::BEQ, Branch<static_cast<Byte>(O::BEQ)>{});
+
+    Set(O::CLC, Implied<&CPU::OpCLC>{});
+    Set(O::CLD, Implied<&CPU::OpCLD>{});
+    Set(O::CLI, Implied<&CPU::OpCLI>{});
+    Set(O::CLV, Implied<&CPU::OpCLV>{});
+    Set(O::SEC, Implied<&CPU::OpSEC>{});
+    Set(O::SED, Implied<&CPU::OpSED>{});
+    Set(O::SEI, Implied<&CPU::OpSEI>{});
+    Set(O::INX, Implied<&CPU::OpINX>{});
+    Set(O::INY, Implied<&CPU::OpINY>{});
+    Set(O::DEX, Implied<&CPU::OpDEX>{});
+    Set(O::DEY, Implied<&CPU::OpDEY>{});
+    Set(O::TAX, Implied<&CPU::OpTAX>{});
+    Set(O::TAY, Implied<&CPU::OpTAY>{});
+    Set(O::TXA, Implied<&CPU::OpTXA>{});
+    Set(O::TYA, Implied<&CPU::OpTYA>{});
+    Set(O::TSX, Implied<&CPU::OpTSX>{});
+    Set(O::TXS, Implied<&CPU::OpTXS>{});
+    Set(O::NOP, Implied<&CPU::OpNOP>{});
+
+    Set(O::PHA, PHA{});
+    Set(O::PHP, PHP{});
+    Set(O::PLA, PLA{});
+    Set(O::PLP, PLP{});
+    Set(O::JSR_ABS, JSR{});
+    Set(O::RTS, RTS{});
+    Set(O::RTI, RTI{});
+    Set(O::JMP_ABS, JMP_ABS{});
+    Set(O::JMP_IND, JMP_IND{});
+    Set(O::BRK, BRK{});
+  }
+
+  template <Byte Length>
+  Word FetchOperand(Mem &memory);
+
+  // Instrumentation hook for Execute. A probe is told about every retired
+  // instruction once it has run: the CPU state it left, its opcode, the PC it
+  // started at, its operand and the cycles it took. A probe whose Enabled is
+  // false compiles out entirely, so plain Execute calls pay nothing for the
+  // hook. Such a probe is instead told through Idle about the idle loops
+  // Execute skips: the state at the loop's top, and how many iterations and
+  // cycles were skipped. Enabled probes see every instruction, so Execute
+  // skips nothing for them.
+  struct NoProbe
+  {
+    static constexpr bool Enabled = false;
+    void Retire(const CPU &, Byte, Word, Word, s32) {}
+    void Idle(const CPU &, u64, s32) {}
+  };
+
+  // Idle loops. A wait loop such as LDA flag / BEQ loop, whose body stores
+  // nothing and reads no device, can only be left by an interrupt or a
+  // device event, and neither can arrive before Execute returns. Every
+  // IDLE_CHECK_INTERVAL short backward branches or JMPs, Execute notes the
+  // state one lands in and compares it with where the next one lands. The
+  // same registers and flags at the same place, after a body that runs
+  // straight through, mean the loop repeats exactly; Execute then drops the
+  // whole iterations left in the budget at once, ending in exactly the
+  // state, with the cycle and instruction counts, that running them would
+  // give. Under a Scheduler the budget ends at the next event, so waiting
+  // for it costs next to nothing.
+  static constexpr Word IDLE_LOOP_BYTES = 32;
+  static constexpr u32 IDLE_CHECK_INTERVAL = 64;
+
+  // Taken at one short backward jump, to compare at the next.
+  struct LoopMark
+  {
+    bool Armed = false;
+    u64 State = 0;
+    s32 Cycles = 0;
+    u64 Retired = 0;
+    u32 DeviceReads = 0;
+  };
+
+  // What WatchIdle skipped, and the short backward jumps until the next look.
+  struct IdleSkip
+  {
+    s32 Cycles;
+    u64 Retired;
+    u32 Countdown;
+  };
+
+  // Everything the next instruction depends on besides memory, exactly.
+  u64 LoopState() const
+  {
+    return (u64)PC | (u64)A << 16 | (u64)X << 24 | (u64)Y << 32 | (u64)(SP & 0xFF) << 40 | (u64)GetStatus() << 48;
+  }
+
+  // Called after a short backward jump from At to Cpu.PC. Everything comes
+  // in by value, so Execute's copy of the CPU and its counters never have
+  // their addresses taken and stay in host registers.
+  template <typename Probe>
+  EMU6502_COLD static IdleSkip WatchIdle(CPU Cpu, LoopMark &Mark, Word At, s32 Cycles, u64 Retired,
+                                         const Mem &memory, Probe &probe);
+
+  static bool IsIdleBody(Word From, Word To, const Mem &memory);
+
+  // Armed breakpoints are looked for where each basic block starts: the
+  // block is scanned, only if it has breakpoints at all, for the first one
+  // in it, and Execute compares PC with that until the block ends. Longer
+  // runs are scanned BREAK_SCAN_LENGTH instructions at a time. Code running
+  // from device pages can't be scanned ahead, and is only checked where its
+  // blocks start.
+  static constexpr u32 BREAK_SCAN_LENGTH = 64;
+
+  // The next place in the block running from PC, past PC itself, to look for
+  // a breakpoint at: the first breakpoint, or where the scan stopped short
+  // of the end of the block. -1 if there is nothing to look for.
+  static s32 NextBreak(Word PC, const Mem &memory);
+
+  // Runs until at least Cycles cycles have been spent or execution halts.
+  ExecResult Execute(s32 Cycles, Mem &memory);
+
+  template <typename Probe>
+  ExecResult Execute(s32 Cycles, Mem &memory, Probe &probe);
+
+  // Execute's loop; the Watching one also stops at memory.Watches' hits.
+  template <bool Watching, typename Probe>
+  ExecResult ExecuteLoop(s32 Cycles, Mem &memory, Probe &probe);
+};
+
+// Opcode -> handler, built at compile time.
+inline constexpr std::array<CPU::OpcodeEntry, 256> DispatchTable = CPU::MakeDispatchTable();
+
+// Programs linking the emu6502 library (src/emu6502.cpp) call its compiled
+// copy of the plain Execute instead of each compiling their own.
+#if defined(EMU6502_LIBRARY)
+extern template CPU::ExecResult CPU::Execute(s32 Cycles, Mem &memory, CPU::NoProbe &probe);
+#endif
+
+template <Byte Length>
+EMU6502_ALWAYS_INLINE Word CPU::FetchOperand(Mem &memory)
+{
+  if constexpr (Length == 1) {
+    return 0;
+  } else if constexpr (Length == 2) {
+    return FetchByte(memory);
+  } else {
+    Byte LowByte = FetchByte(memory);
+    Byte HighByte = FetchByte(memory);
+    return (Word)LowByte | ((Word)HighByte << 8);
+  }
+}
+
+// Expands X(N) for every opcode N. Execute loops use it to turn the table
+// into a dense switch: the compiler builds its own jump table from it, and
+// since DispatchTable is constexpr every handler call is direct and inlined.
+#define EMU6502_OPCODE_ROW(H, X)                                             \
+  X(H##0) X(H##1) X(H##2) X(H##3) X(H##4) X(H##5) X(H##6) X(H##7) X(H##8) \
+  X(H##9) X(H##A) X(H##B) X(H##C) X(H##D) X(H##E) X(H##F)
+#define EMU6502_FOR_EACH_OPCODE(X)                                                       \
+  EMU6502_OPCODE_ROW(0x0, X) EMU6502_OPCODE_ROW(0x1, X) EMU6502_OPCODE_ROW(0x2, X)       \
+  EMU6502_OPCODE_ROW(0x3, X) EMU6502_OPCODE_ROW(0x4, X) EMU6502_OPCODE_ROW(0x5, X)       \
+  EMU6502_OPCODE_ROW(0x6, X) EMU6502_OPCODE_ROW(0x7, X) EMU6502_OPCODE_ROW(0x8, X)       \
+  EMU6502_OPCODE_ROW(0x9, X) EMU6502_OPCODE_ROW(0xA, X) EMU6502_OPCODE_ROW(0xB, X)       \
+  EMU6502_OPCODE_ROW(0xC, X) EMU6502_OPCODE_ROW(0xD, X) EMU6502_OPCODE_ROW(0xE, X)       \
+  EMU6502_OPCODE_ROW(0xF, X)
+
+inline CPU::ExecResult CPU::Execute(s32 Cycles, Mem &memory)
+{
+  NoProbe None;
+  return Execute(Cycles, memory, None);
+}
+
+template <typename Probe>
+CPU::ExecResult CPU::Execute(s32 Cycles, Mem &memory, Probe &probe)
+{
+  if (EMU6502_UNLIKELY(memory.Watches != nullptr)) {
+    return ExecuteLoop<true>(Cycles, memory, probe);
+  }
+  return ExecuteLoop<false>(Cycles, memory, probe);
+}
+
+template <bool Watching, typename Probe>
+CPU::ExecResult CPU::ExecuteLoop(s32 Cycles, Mem &memory, Probe &probe)
+{
+#define EMU6502_CASE(N)                                                                         \
+  case N:                                                                                       \
+    Cycles -= DispatchTable[N].Cost;                                                            \
+    if constexpr (Watching && DispatchTable[N].EndsBlock) {                                     \
+      BlockStart = true;                                                                        \
+    }                                                                                           \
+    if constexpr (DispatchTable[N].Halts) {                                                     \
+      Halted = true;                                                                            \
+    } else {                                                                                    \
+      Operand = Local.FetchOperand<DispatchTable[N].Length>(memory);                            \
+      DispatchTable[N].Fn(Local, Cycles, memory, Operand);                                      \
+      if constexpr (DispatchTable[N].Unmasks) {                                                 \
+        Local.CheckUnmasked(Cycles, Parked);                                                    \
+      }                                                                                         \
+      if constexpr (!Probe::Enabled && (DispatchTable[N].Addressing == AddressMode::Relative || \
+                                        N == (Byte)Opcode::JMP_ABS)) {                          \
+        if ((Word)(StartPC - Local.PC) <= IDLE_LOOP_BYTES && --IdleCountdown == 0) {            \
+          IdleSkip Skip = WatchIdle(Local, Mark, StartPC, Cycles, Retired, memory, probe);      \
+          Cycles -= Skip.Cycles;                                                                \
+          Retired += Skip.Retired;                                                              \
+          IdleCountdown = Skip.Countdown;                                                       \
+        }                                                                                       \
+      }                                                                                         \
+    }                                                                                           \
+    break;
+
+  const s32 Budget = Cycles;
+  StopReason Reason = StopReason::Budget;
+  u64 Retired = 0;
+
+  // Run on a local copy: nothing a handler writes can alias it, so the
+  // compiler keeps the registers in host registers instead of reloading them
+  // after every store to guest memory.
+  CPU Local = *this;
+  s32 Parked = 0; // budget set aside to take an interrupt, see CheckUnmasked
+  [[maybe_unused]] LoopMark Mark;
+  [[maybe_unused]] u32 IdleCountdown = 1;
+  // Watching: a new block starts at PC, and where to look for a breakpoint
+  // in the current one (see NextBreak).
+  [[maybe_unused]] bool BlockStart = true;
+  [[maybe_unused]] bool Resuming = false; // continuing from the breakpoint the last call stopped at
+  [[maybe_unused]] s32 BreakAt = -1;
+  if constexpr (Watching) {
+    const Watchpoints::Hit &Last = memory.Watches->Last;
+    Resuming = Last.What == Watchpoints::Kind::Break && Last.PC == Local.PC;
+    memory.Watches->Last = Watchpoints::Hit{};
+  }
+  do
+  {
+    Cycles += Parked;
+    Parked = 0;
+    if (EMU6502_UNLIKELY(Local.InterruptPending()) && Cycles > 0) {
+      Local.Interrupt(Cycles, memory);
+      if constexpr (Watching) {
+        BlockStart = true;
+        Resuming = false;
+        if (EMU6502_UNLIKELY(memory.Watches->Last.What != Watchpoints::Kind::None)) {
+          memory.Watches->Last.PC = Local.PC;
+          Reason = StopReason::Breakpoint;
+          break;
+        }
+      }
+    }
+    while (Cycles > 0)
+    {
+      if constexpr (Watching) {
+        if (EMU6502_UNLIKELY(BlockStart || (s32)Local.PC == BreakAt)) {
+          if (!Resuming && memory.Watches->IsBreak(Local.PC)) {
+            memory.Watches->Last = Watchpoints::Hit{Watchpoints::Kind::Break, Local.PC, Local.PC};
+            Reason = StopReason::Breakpoint;
+            break;
+          }
+          BlockStart = false;
+          Resuming = false;
+          BreakAt = memory.Watches->HasBreaks() ? NextBreak(Local.PC, memory) : -1;
+        }
+      }
+      [[maybe_unused]] const Word StartPC = Local.PC;
+      [[maybe_unused]] const s32 StartCycles = Cycles;
+      Byte Ins = Local.FetchByte(memory);
+      Retired++; // counting here rather than after the switch is measurably faster
+      bool Halted = false;
+      Word Operand = 0;
+      switch (Ins)
+      {
+        EMU6502_FOR_EACH_OPCODE(EMU6502_CASE)
+      }
+      if (Halted && Local.Halt(Ins, Cycles, Retired, memory, Reason)) {
+        if constexpr (Probe::Enabled) {
+          if (Reason == StopReason::Brk) {
+            probe.Retire(Local, Ins, StartPC, Operand, StartCycles - Cycles);
+          }
+        }
         break;
       }
+      if constexpr (Probe::Enabled) {
+        probe.Retire(Local, Ins, StartPC, Operand, StartCycles - Cycles);
+      }
+      if constexpr (Watching) {
+        if (EMU6502_UNLIKELY(memory.Watches->Last.What != Watchpoints::Kind::None)) {
+          memory.Watches->Last.PC = StartPC;
+          Reason = StopReason::Breakpoint;
+          break;
+        }
       }
     }
+  } while (Parked != 0);
+  *this = Local;
+  return Finish(Reason, Budget, Cycles, Retired);
+
+#undef EMU6502_CASE
+}
+
+// Landing in the state marked at the last jump, after a body that runs
+// straight through without storing and read no device that time, the loop
+// repeats every Mark.Cycles - Cycles cycles until Execute returns. Whole
+// iterations are skipped only while the budget outlasts them, so the last,
+// partial one still runs and stops where it would have.
+template <typename Probe>
+CPU::IdleSkip CPU::WatchIdle(CPU Cpu, LoopMark &Mark, Word At, s32 Cycles, u64 Retired, const Mem &memory,
+                             Probe &probe)
+{
+  u64 State = Cpu.LoopState();
+  if (!Mark.Armed) {
+    Mark = LoopMark{true, State, Cycles, Retired, memory.DeviceReads};
+    return IdleSkip{0, 0, 1};
   }
-};
+  Mark.Armed = false;
+  IdleSkip Skip{0, 0, IDLE_CHECK_INTERVAL};
+  if (State != Mark.State || memory.DeviceReads != Mark.DeviceReads || !IsIdleBody(Cpu.PC, At, memory)) {
+    return Skip;
+  }
+  const s32 Period = Mark.Cycles - Cycles;
+  const s32 Iterations = (Cycles - 1) / Period;
+  if (Iterations > 0) {
+    Skip.Cycles = Iterations * Period;
+    Skip.Retired = (u64)Iterations * (Retired - Mark.Retired);
+    probe.Idle(Cpu, (u64)Iterations, Skip.Cycles);
+  }
+  return Skip;
+}
+
+inline s32 CPU::NextBreak(Word PC, const Mem &memory)
+{
+  Word At = PC;
+  for (u32 Scanned = 0; Scanned < BREAK_SCAN_LENGTH; Scanned++)
+  {
+    if (!memory.Pages[At >> 8]) {
+      return At == PC ? -1 : At;
+    }
+    const OpcodeEntry &Entry = DispatchTable[memory.ReadRam(At)];
+    if (Entry.EndsBlock) {
+      return -1;
+    }
+    At = (Word)(At + Entry.Length);
+    if (memory.Watches->IsBreak(At)) {
+      return At;
+    }
+  }
+  return At;
+}
+
+// True if the code from From up to the jump at To runs straight into it
+// without storing, jumping, halting or letting an interrupt in.
+inline bool CPU::IsIdleBody(Word From, Word To, const Mem &memory)
+{
+  while (From != To)
+  {
+    if ((Word)(To - From) > IDLE_LOOP_BYTES || !memory.Pages[From >> 8]) {
+      return false;
+    }
+    const OpcodeEntry &Entry = DispatchTable[memory.ReadRam(From)];
+    if (Entry.EndsBlock || Entry.Writes || Entry.Halts || Entry.Unmasks) {
+      return false;
+    }
+    From = (Word)(From + Entry.Length);
+  }
+  return true;
+}
@@ -0,0 +1,162 @@
+#pragma once
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "6502_emulator.hpp"
+
+// Runs many independent machines across cores. Each instance owns its CPU and
+// Mem, so workers share nothing mutable but the work queues.
+//
+// Instances are dealt out to workers as contiguous index ranges. A worker takes
+// Grain instances at a time from the front of its own range; once that is
+// empty it steals the back half of the largest range left, so uneven
+// workloads still balance out.
+struct BatchRunner
+{
+  struct Instance
+  {
+    CPU Cpu;
+    Mem Memory;
+    CPU::ExecResult Result;
+  };
+
+  static constexpr size_t Grain = 4;
+
+  // Heap-allocated one by one, so references returned by Add stay valid.
+  std::vector<std::unique_ptr<Instance>> Instances;
+
+  // Adds a machine that has been powered on; the caller loads it and sets PC.
+  Instance &Add()
+  {
+    Instances.push_back(std::make_unique<Instance>());
+    Instance &I = *Instances.back();
+    I.Cpu.PowerOn(I.Memory);
+    return I;
+  }
+
+  // Adds a machine that starts as a copy of cpu and Image. The copy shares
+  // Image's memory pages until either side writes to them, so forking many
+  // machines from one loaded image is cheap.
+  Instance &Add(const CPU &cpu, const Mem &Image)
+  {
+    Instances.push_back(std::make_unique<Instance>());
+    Instance &I = *Instances.back();
+    I.Cpu = cpu;
+    I.Memory = Image;
+    return I;
+  }
+
+  size_t Size() const { return Instances.size(); }
+  Instance &operator[](size_t Index) { return *Instances[Index]; }
+
+  // Runs every instance until it halts or has spent Budget cycles, and
+  // stores what happened in its Result. Workers defaults to the number of
+  // hardware threads.
+  void Run(s32 Budget, unsigned Workers = 0)
+  {
+    ForEach([this, Budget](size_t Index) {
+      Instance &I = *Instances[Index];
+      I.Result = I.Cpu.Execute(Budget, I.Memory);
+    }, Workers);
+  }
+
+  // Calls Job(Index) once for every instance, spread over workers as Run
+  // does, for work Run doesn't cover, such as budgets that differ from one
+  // instance to the next.
+  template <typename F>
+  void ForEach(F &&Job, unsigned Workers = 0)
+  {
+    if (Workers == 0) {
+      Workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    Workers = (unsigned)std::min<size_t>(Workers, std::max<size_t>(1, Size()));
+
+    std::vector<Range> Ranges(Workers);
+    for (unsigned W = 0; W < Workers; W++) {
+      Ranges[W].Begin = Size() * W / Workers;
+      Ranges[W].End = Size() * (W + 1) / Workers;
+    }
+
+    auto Work = [&Job, &Ranges](unsigned Self) {
+      size_t Begin, End;
+      while (Take(Ranges, Self, Begin, End)) {
+        for (size_t Index = Begin; Index < End; Index++) {
+          Job(Index);
+        }
+      }
+    };
+
+    std::vector<std::thread> Threads;
+    for (unsigned W = 1; W < Workers; W++) {
+      Threads.emplace_back(Work, W);
+    }
+    Work(0);
+    for (std::thread &T : Threads) {
+      T.join();
+    }
+  }
+
+private:
+  struct Range
+  {
+    std::mutex Lock;
+    size_t Begin = 0, End = 0;
+  };
+
+  // Hands worker Self its next chunk of instances, stealing if its own range
+  // has run dry. Returns false once there is nothing left anywhere.
+  static bool Take(std::vector<Range> &Ranges, unsigned Self, size_t &Begin, size_t &End)
+  {
+    Range &Own = Ranges[Self];
+    {
+      std::lock_guard<std::mutex> Guard(Own.Lock);
+      if (Own.Begin < Own.End) {
+        Begin = Own.Begin;
+        End = std::min(Own.End, Own.Begin + Grain);
+        Own.Begin = End;
+        return true;
+      }
+    }
+    for (;;)
+    {
+      // Pick the victim with the most work left. Sizes can change as soon as
+      // each lock is dropped, so recheck under the victim's lock.
+      Range *Victim = nullptr;
+      size_t Most = 0;
+      for (Range &R : Ranges) {
+        std::lock_guard<std::mutex> Guard(R.Lock);
+        if (R.End - R.Begin > Most) {
+          Most = R.End - R.Begin;
+          Victim = &R;
+        }
+      }
+      if (!Victim) {
+        return false;
+      }
+      {
+        // Take the back half; the victim keeps working from the front.
+        std::lock_guard<std::mutex> Guard(Victim->Lock);
+        if (Victim->Begin == Victim->End) {
+          continue;
+        }
+        size_t Mid = Victim->Begin + (Victim->End - Victim->Begin) / 2;
+        Begin = Mid;
+        End = Victim->End;
+        Victim->End = Mid;
+      }
+      if (End - Begin > Grain) {
+        // Keep what doesn't fit in this chunk as our own range. Only one
+        // lock is ever held at a time, so workers can't deadlock.
+        std::lock_guard<std::mutex> Guard(Own.Lock);
+        Own.Begin = Begin + Grain;
+        Own.End = End;
+        End = Begin + Grain;
+      }
+      return true;
+    }
+  }
+};
@@ -0,0 +1,298 @@
+#pragma once
+
+#include <unordered_map>
+#include <vector>
+
+#include "6502_emulator.hpp"
+
+// Translation cache for CPU::Execute. Straight-line code is decoded once into
+// basic blocks of pre-resolved ops (opcode, operand, next PC), keyed by start
+// PC, and replayed without re-fetching or re-decoding: each op goes straight
+// to its inlined handler with the operand already assembled. A block ends at
+// the first instruction that can change the flow of control, or when the next
+// instruction would start on another page.
+//
+// Only hot code is decoded. A block runs through the interpreter until it
+// has been entered HotThreshold times, and code that keeps being rewritten
+// goes back to the interpreter for good after MaxDecodes decodes, so neither
+// run-once nor self-modifying code pays for decoding it.
+//
+// Blocks remember the version of the pages they were decoded from. Stores
+// through Mem::Write bump the version of a code page, so self-modifying code
+// is re-decoded the next time it runs. Host code that pokes memory through
+// Mem::operator[] after blocks were cached must call Mem::InvalidatePage
+// itself. A cache holds blocks for one Mem at a time, told apart by Mem::Id
+// rather than by address; running it on another Mem flushes it.
+//
+// While a Mem has Watchpoints armed, Execute hands it to CPU::Execute.
+//
+// There is no native code generator behind the decoded tier. Replaying
+// decoded ops runs at about the interpreter's speed, so fetching and
+// decoding are not where the time goes; the handlers' paged memory
+// accesses, trap checks and cycle accounting are, and translated code
+// would have to keep all three to stay exact. It would also tie the
+// library to x86-64 and to hosts that allow executable mappings.
+struct BlockCache
+{
+  struct Op
+  {
+    Byte Opcode;
+    Word Operand;
+    Word NextPC;
+    bool Writes; // may store into the pages the block came from
+  };
+
+  struct Block
+  {
+    Word StartPC = 0;
+    Byte FirstPage = 0, LastPage = 0;
+    u32 FirstVersion = 0, LastVersion = 0;
+    u32 Runs = 0;    // entries while still cold
+    u32 Decodes = 0; // 0 until the block is first decoded
+    bool EndsAtHalt = false; // the instruction after the last op halts
+    std::vector<Op> Ops;
+    // The last two successors, tried before the map lookup: a block ending
+    // in a conditional branch usually alternates between two.
+    Block *Next[2] = {};
+  };
+
+  static constexpr u32 HotThreshold = 16;
+  static constexpr u32 MaxDecodes = 4;
+
+  std::unordered_map<Word, Block> Blocks;
+  u64 MemoryId = 0; // Mem::Id of the Mem the blocks came from; 0 for none
+
+  void Flush()
+  {
+    Blocks.clear();
+    MemoryId = 0;
+  }
+
+  static bool IsCurrent(const Block &B, const Mem &memory)
+  {
+    return memory.PageVersion[B.FirstPage] == B.FirstVersion &&
+           memory.PageVersion[B.LastPage] == B.LastVersion;
+  }
+
+  void Decode(Block &B, Word PC, Mem &memory)
+  {
+    B.FirstPage = B.LastPage = (Byte)(PC >> 8);
+    B.EndsAtHalt = false;
+    B.Decodes++;
+    B.Ops.clear();
+    while ((Byte)(PC >> 8) == B.FirstPage)
+    {
+      Byte Ins = memory.Read(PC);
+      const CPU::OpcodeEntry &E = DispatchTable[Ins];
+      if (E.Halts) {
+        B.EndsAtHalt = true;
+        break;
+      }
+      Word Operand = 0;
+      if (E.Length > 1) {
+        Operand = memory.Read((Word)(PC + 1));
+      }
+      if (E.Length > 2) {
+        Operand |= (Word)(memory.Read((Word)(PC + 2)) << 8);
+      }
+      B.LastPage = (Byte)((Word)(PC + E.Length - 1) >> 8);
+      PC = (Word)(PC + E.Length);
+      B.Ops.push_back(Op{Ins, Operand, PC, E.Writes});
+      if (E.EndsBlock) {
+        break;
+      }
+    }
+    for (Op &O : B.Ops)
+    {
+      O.Writes = O.Writes && MayStoreTo(B, O);
+    }
+    memory.Trap[B.FirstPage] |= Mem::TRAP_CODE;
+    memory.Trap[B.LastPage] |= Mem::TRAP_CODE;
+    B.FirstVersion = memory.PageVersion[B.FirstPage];
+    B.LastVersion = memory.PageVersion[B.LastPage];
+  }
+
+  // Whether a store by O can land on either of B's pages. Zero-page modes
+  // only reach page 0 and pushes only page 1, so most stores are known to
+  // leave the block alone when it is decoded.
+  static bool MayStoreTo(const Block &B, const Op &O)
+  {
+    auto Hits = [&B](Byte Page) { return Page == B.FirstPage || Page == B.LastPage; };
+    if (O.Opcode == (Byte)CPU::Opcode::JSR_ABS) {
+      return Hits(0x01); // the operand is where it jumps, not where it stores
+    }
+    const Word Operand = O.Operand;
+    switch (DispatchTable[O.Opcode].Addressing)
+    {
+    case CPU::AddressMode::ZeroPage:
+    case CPU::AddressMode::ZeroPageX:
+    case CPU::AddressMode::ZeroPageY:
+      return Hits(0x00);
+    case CPU::AddressMode::Implied:
+      return Hits(0x01);
+    case CPU::AddressMode::Absolute:
+      return Hits((Byte)(Operand >> 8));
+    case CPU::AddressMode::AbsoluteX:
+    case CPU::AddressMode::AbsoluteY:
+      return Hits((Byte)(Operand >> 8)) || Hits((Byte)((Operand >> 8) + 1));
+    default:
+      return true;
+    }
+  }
+
+  Block &Lookup(Word PC)
+  {
+    auto [It, Inserted] = Blocks.try_emplace(PC);
+    if (Inserted) {
+      It->second.StartPC = PC;
+    }
+    return It->second;
+  }
+
+  // True when the block should run from decoded ops, decoding it first if it
+  // has just become hot or went stale.
+  bool Prepare(Block &B, Mem &memory)
+  {
+    // Mapping a device bumps the page's version, so a current block cannot
+    // have come from one.
+    if (B.Decodes != 0 && IsCurrent(B, memory)) {
+      return true;
+    }
+    // Code running from device pages, or with operands reaching into one,
+    // is interpreted: decoding would read device registers ahead of time.
+    Byte Page = (Byte)(B.StartPC >> 8);
+    if (memory.Devices[Page] || memory.Devices[(Byte)(Page + 1)]) {
+      return false;
+    }
+    if (B.Decodes >= MaxDecodes || ++B.Runs < HotThreshold) {
+      return false;
+    }
+    Decode(B, B.StartPC, memory);
+    return true;
+  }
+
+  // Runs instructions straight from memory, up to and including the next one
+  // that ends a block. Returns true if execution halted, with Reason set.
+  static bool Interpret(CPU &Local, s32 &Cycles, s32 &Parked, Mem &memory, u64 &Retired, CPU::StopReason &Reason)
+  {
+#define EMU6502_CASE(N)                                                                 \
+  case N:                                                                               \
+    Cycles -= DispatchTable[N].Cost;                                                    \
+    if constexpr (DispatchTable[N].Halts) {                                             \
+      if (Local.Halt(N, Cycles, Retired, memory, Reason)) {                             \
+        return true;                                                                    \
+      }                                                                                 \
+    } else {                                                                            \
+      DispatchTable[N].Fn(Local, Cycles, memory,                                        \
+                          Local.FetchOperand<DispatchTable[N].Length>(memory));         \
+      if constexpr (DispatchTable[N].Unmasks) {                                         \
+        Local.CheckUnmasked(Cycles, Parked);                                            \
+      }                                                                                 \
+    }                                                                                   \
+    break;
+
+    while (Cycles > 0)
+    {
+      Byte Ins = Local.FetchByte(memory);
+      Retired++;
+      switch (Ins)
+      {
+        EMU6502_FOR_EACH_OPCODE(EMU6502_CASE)
+      }
+      if (DispatchTable[Ins].EndsBlock) {
+        break;
+      }
+    }
+    return false;
+
+#undef EMU6502_CASE
+  }
+
+  // Same contract as CPU::Execute, but runs from cached blocks.
+  CPU::ExecResult Execute(CPU &cpu, s32 Cycles, Mem &memory)
+  {
+    // Armed watchpoints are checked by the interpreter; see Watchpoints.
+    if (EMU6502_UNLIKELY(memory.Watches != nullptr)) {
+      return cpu.Execute(Cycles, memory);
+    }
+    if (MemoryId != memory.Id) {
+      Flush();
+      MemoryId = memory.Id;
+    }
+
+#define EMU6502_CASE(N)                                     \
+  case N:                                                   \
+    Cycles -= DispatchTable[N].Cost;                        \
+    DispatchTable[N].Fn(Local, Cycles, memory, O.Operand);  \
+    if constexpr (DispatchTable[N].Unmasks) {               \
+      Local.CheckUnmasked(Cycles, Parked);                  \
+    }                                                       \
+    break;
+
+    const s32 Budget = Cycles;
+    CPU::StopReason Reason = CPU::StopReason::Budget;
+    u64 Retired = 0;
+
+    // See CPU::Execute for why this works on a copy.
+    CPU Local = cpu;
+    Block *Previous = nullptr;
+    s32 Parked = 0;
+    bool Halted = false;
+    do
+    {
+      Cycles += Parked;
+      Parked = 0;
+      if (EMU6502_UNLIKELY(Local.InterruptPending()) && Cycles > 0) {
+        Local.Interrupt(Cycles, memory);
+      }
+      while (Cycles > 0)
+      {
+        Block *B = Previous ? Previous->Next[0] : nullptr;
+        if (!B || B->StartPC != Local.PC) {
+          B = Previous ? Previous->Next[1] : nullptr;
+          if (!B || B->StartPC != Local.PC) {
+            B = &Lookup(Local.PC);
+          }
+          if (Previous) {
+            Previous->Next[1] = Previous->Next[0];
+            Previous->Next[0] = B;
+          }
+        }
+        if (!Prepare(*B, memory)) {
+          if ((Halted = Interpret(Local, Cycles, Parked, memory, Retired, Reason))) {
+            break;
+          }
+          Previous = B;
+          continue;
+        }
+        for (const Op &O : B->Ops)
+        {
+          Local.PC = O.NextPC;
+          Retired++;
+          switch (O.Opcode)
+          {
+            EMU6502_FOR_EACH_OPCODE(EMU6502_CASE)
+          }
+          if (Cycles <= 0) {
+            break;
+          }
+          if (O.Writes && !IsCurrent(*B, memory)) {
+            // A store rewrote this block; carry on from a fresh decode.
+            B = nullptr;
+            break;
+          }
+        }
+        // Halting opcodes are never decoded; let the interpreter run them.
+        if (B && B->EndsAtHalt && Cycles > 0 &&
+            (Halted = Interpret(Local, Cycles, Parked, memory, Retired, Reason))) {
+          break;
+        }
+        Previous = B;
+      }
+    } while (Parked != 0 && !Halted);
+    cpu = Local;
+    return CPU::Finish(Reason, Budget, Cycles, Retired);
+
+#undef EMU6502_CASE
+  }
+};
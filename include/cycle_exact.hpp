@@ -0,0 +1,515 @@
+#pragma once
+
+#include <array>
+#include <type_traits>
+
+#include "6502_emulator.hpp"
+
+// Cycle-exact execution: the same instructions as CPU::Execute, run one bus
+// cycle at a time the way an NMOS 6502 drives its bus, dummy reads and
+// writes included, with a hook called on every cycle:
+//
+//   struct TimerClock
+//   {
+//     static constexpr bool Enabled = true;
+//     Timer &T;
+//     void Cycle(Word, Byte, BusOp) { T.Tick(1); }
+//   };
+//
+//   TimerClock Clock{timer};
+//   CycleExact::Execute(cpu, Cycles, memory, Clock);
+//
+// The hook sees each access as it happens, so devices attached to it can
+// count cycles, or watch the bus, with no slicing error. Registers, memory
+// and cycle counts come out exactly as from CPU::Execute, which charges the
+// same timings as whole-instruction costs from DispatchTable and stays the
+// fast path. Dummy accesses really reach memory, so a device with read side
+// effects sees them here and not there.
+//
+// Stopping and interrupts follow CPU::Execute: it stops at the end of the
+// instruction that exhausts the budget, or at BRK (after its opcode fetch,
+// unless BrkHalts is clear) or an illegal opcode (before any cycle of it),
+// and takes a pending interrupt between instructions.
+
+// What a bus cycle is for. Dummy accesses are the ones the 6502 makes while
+// it is busy internally; their results are thrown away.
+enum class BusOp : Byte
+{
+  Fetch, // opcode and operand bytes
+  Read,
+  Write,
+  DummyRead,
+  DummyWrite,
+};
+
+struct NoBusHook
+{
+  static constexpr bool Enabled = false;
+  void Cycle(Word, Byte, BusOp) {}
+};
+
+// Every memory access an instruction makes goes through a Bus, which does
+// the access, charges its cycle and tells the hook.
+template <typename Hook>
+struct Bus
+{
+  CPU &Cpu;
+  Mem &Memory;
+  Hook &Hooks;
+  s32 &Cycles;
+
+  EMU6502_ALWAYS_INLINE void Tick(Word Address, Byte Data, BusOp Op)
+  {
+    Cycles--;
+    if constexpr (Hook::Enabled) {
+      Hooks.Cycle(Address, Data, Op);
+    }
+  }
+
+  Byte Fetch()
+  {
+    Word Address = Cpu.PC++;
+    Byte Data = Memory.Read(Address);
+    Tick(Address, Data, BusOp::Fetch);
+    return Data;
+  }
+
+  Word FetchWord()
+  {
+    Byte LowByte = Fetch();
+    Byte HighByte = Fetch();
+    return (Word)LowByte | ((Word)HighByte << 8);
+  }
+
+  Byte Read(Word Address, BusOp Op = BusOp::Read)
+  {
+    Byte Data = Memory.Read(Address);
+    Tick(Address, Data, Op);
+    return Data;
+  }
+
+  void DummyRead(Word Address) { Read(Address, BusOp::DummyRead); }
+
+  void Write(Word Address, Byte Data, BusOp Op = BusOp::Write)
+  {
+    Memory.Write(Address, Data);
+    Tick(Address, Data, Op);
+  }
+
+  Word StackAddress() const { return (Word)(0x0100 | (Cpu.SP & 0x00FF)); }
+
+  void Push(Byte Data)
+  {
+    Write(StackAddress(), Data);
+    Cpu.SP = (Word)((Cpu.SP & 0xFF00) | ((Cpu.SP - 1) & 0x00FF));
+  }
+
+  Byte Pull()
+  {
+    Cpu.SP = (Word)((Cpu.SP & 0xFF00) | ((Cpu.SP + 1) & 0x00FF));
+    return Read(StackAddress());
+  }
+
+  // Adds Index to Base. While the 6502 fixes up the high byte it reads the
+  // unfixed address; reads skip that cycle when no fix-up is needed.
+  template <CPU::Access Kind>
+  Word AddIndex(Word Base, Byte Index)
+  {
+    Word Address = (Word)(Base + Index);
+    if (Kind != CPU::Access::Read || (Address & 0xFF00) != (Base & 0xFF00)) {
+      DummyRead((Word)((Base & 0xFF00) | (Address & 0x00FF)));
+    }
+    return Address;
+  }
+
+  Word ReadZeroPagePointer(Byte ZeroPageAddr)
+  {
+    Byte LowByte = Read(ZeroPageAddr);
+    Byte HighByte = Read((Byte)(ZeroPageAddr + 1));
+    return (Word)LowByte | ((Word)HighByte << 8);
+  }
+
+  // The last five cycles of BRK, IRQ and NMI, as CPU::Enter.
+  void Enter(Word Vector, Byte Status)
+  {
+    Push((Byte)(Cpu.PC >> 8));
+    Push((Byte)Cpu.PC);
+    Push((Byte)(Status | CPU::FLAG_U));
+    Cpu.SetFlag(CPU::FLAG_I, true);
+    Byte LowByte = Read(Vector);
+    Byte HighByte = Read((Word)(Vector + 1));
+    Cpu.PC = (Word)LowByte | ((Word)HighByte << 8);
+  }
+
+  // An interrupt spends two cycles reading the opcode it preempts, without
+  // fetching it, before the common sequence; as CPU::Interrupt.
+  void Interrupt()
+  {
+    Word Vector = CPU::IRQ_VECTOR;
+    if (Cpu.NmiPending) {
+      Cpu.NmiPending = false;
+      Vector = CPU::NMI_VECTOR;
+    }
+    DummyRead(Cpu.PC);
+    DummyRead(Cpu.PC);
+    Enter(Vector, Cpu.GetStatus());
+  }
+};
+
+// Bus cycle counterparts of the CPU addressing modes: Address fetches the
+// operand and works out the effective address for that kind of access.
+template <typename Mode>
+struct BusMode;
+
+template <>
+struct BusMode<CPU::ZeroPage>
+{
+  template <CPU::Access, typename B>
+  static Word Address(B &bus) { return bus.Fetch(); }
+};
+
+template <Byte CPU::*Index>
+struct BusMode<CPU::ZeroPageIndexed<Index>>
+{
+  template <CPU::Access, typename B>
+  static Word Address(B &bus)
+  {
+    Byte Base = bus.Fetch();
+    bus.DummyRead(Base); // index add
+    return (Byte)(Base + bus.Cpu.*Index);
+  }
+};
+
+template <>
+struct BusMode<CPU::Absolute>
+{
+  template <CPU::Access, typename B>
+  static Word Address(B &bus) { return bus.FetchWord(); }
+};
+
+template <Byte CPU::*Index>
+struct BusMode<CPU::AbsoluteIndexed<Index>>
+{
+  template <CPU::Access Kind, typename B>
+  static Word Address(B &bus)
+  {
+    Word Base = bus.FetchWord();
+    return bus.template AddIndex<Kind>(Base, bus.Cpu.*Index);
+  }
+};
+
+template <>
+struct BusMode<CPU::IndexedIndirect>
+{
+  template <CPU::Access, typename B>
+  static Word Address(B &bus)
+  {
+    Byte Pointer = bus.Fetch();
+    bus.DummyRead(Pointer); // index add
+    return bus.ReadZeroPagePointer((Byte)(Pointer + bus.Cpu.X));
+  }
+};
+
+template <>
+struct BusMode<CPU::IndirectIndexed>
+{
+  template <CPU::Access Kind, typename B>
+  static Word Address(B &bus)
+  {
+    Word Base = bus.ReadZeroPagePointer(bus.Fetch());
+    return bus.template AddIndex<Kind>(Base, bus.Cpu.Y);
+  }
+};
+
+// Bus cycle counterparts of the CPU handlers. Run executes the instruction
+// after its opcode fetch, operand fetch included. Each one mirrors the CPU
+// handler of the same name.
+template <typename H>
+struct BusHandler;
+
+template <void (CPU::*Op)(Byte), typename Mode>
+struct BusHandler<CPU::Read<Op, Mode>>
+{
+  template <typename B>
+  static void Run(B &bus)
+  {
+    if constexpr (std::is_same<Mode, CPU::Immediate>::value) {
+      (bus.Cpu.*Op)(bus.Fetch());
+    } else {
+      Word Address = BusMode<Mode>::template Address<CPU::Access::Read>(bus);
+      (bus.Cpu.*Op)(bus.Read(Address));
+    }
+  }
+};
+
+template <Byte CPU::*Register, typename Mode>
+struct BusHandler<CPU::Store<Register, Mode>>
+{
+  template <typename B>
+  static void Run(B &bus)
+  {
+    Word Address = BusMode<Mode>::template Address<CPU::Access::Write>(bus);
+    bus.Write(Address, bus.Cpu.*Register);
+  }
+};
+
+template <Byte (CPU::*Op)(Byte), typename Mode>
+struct BusHandler<CPU::Modify<Op, Mode>>
+{
+  template <typename B>
+  static void Run(B &bus)
+  {
+    Word Address = BusMode<Mode>::template Address<CPU::Access::Modify>(bus);
+    Byte Value = bus.Read(Address);
+    bus.Write(Address, Value, BusOp::DummyWrite);
+    bus.Write(Address, (bus.Cpu.*Op)(Value));
+  }
+};
+
+template <Byte (CPU::*Op)(Byte)>
+struct BusHandler<CPU::ModifyA<Op>>
+{
+  template <typename B>
+  static void Run(B &bus)
+  {
+    bus.DummyRead(bus.Cpu.PC);
+    bus.Cpu.A = (bus.Cpu.*Op)(bus.Cpu.A);
+  }
+};
+
+template <void (CPU::*Op)()>
+struct BusHandler<CPU::Implied<Op>>
+{
+  template <typename B>
+  static void Run(B &bus)
+  {
+    bus.DummyRead(bus.Cpu.PC);
+    (bus.Cpu.*Op)();
+  }
+};
+
+// A taken branch reads the opcode after it while adding the offset, and if
+// that crosses a page, reads the target in the old page while fixing it up.
+template <Byte Ins>
+struct BusHandler<CPU::Branch<Ins>>
+{
+  template <typename B>
+  static void Run(B &bus)
+  {
+    SByte Offset = (SByte)bus.Fetch();
+    if (CPU::Branch<Ins>::Taken(bus.Cpu)) {
+      Word OldPC = bus.Cpu.PC;
+      Word NewPC = (Word)(OldPC + Offset);
+      bus.DummyRead(OldPC);
+      if ((OldPC & 0xFF00) != (NewPC & 0xFF00)) {
+        bus.DummyRead((Word)((OldPC & 0xFF00) | (NewPC & 0x00FF)));
+      }
+      bus.Cpu.PC = NewPC;
+    }
+  }
+};
+
+// The high address byte is fetched last, after the pushes, so the return
+// address pushed is that of the high byte.
+template <>
+struct BusHandler<CPU::JSR>
+{
+  template <typename B>
+  static void Run(B &bus)
+  {
+    Byte LowByte = bus.Fetch();
+    bus.DummyRead(bus.StackAddress());
+    bus.Push((Byte)(bus.Cpu.PC >> 8));
+    bus.Push((Byte)bus.Cpu.PC);
+    Byte HighByte = bus.Fetch();
+    bus.Cpu.PC = (Word)LowByte | ((Word)HighByte << 8);
+  }
+};
+
+template <>
+struct BusHandler<CPU::RTS>
+{
+  template <typename B>
+  static void Run(B &bus)
+  {
+    bus.DummyRead(bus.Cpu.PC);
+    bus.DummyRead(bus.StackAddress());
+    Byte LowByte = bus.Pull();
+    Byte HighByte = bus.Pull();
+    bus.Cpu.PC = (Word)LowByte | ((Word)HighByte << 8);
+    bus.DummyRead(bus.Cpu.PC);
+    bus.Cpu.PC++;
+  }
+};
+
+template <>
+struct BusHandler<CPU::RTI>
+{
+  template <typename B>
+  static void Run(B &bus)
+  {
+    bus.DummyRead(bus.Cpu.PC);
+    bus.DummyRead(bus.StackAddress());
+    bus.Cpu.SetStatus(bus.Pull());
+    Byte LowByte = bus.Pull();
+    Byte HighByte = bus.Pull();
+    bus.Cpu.PC = (Word)LowByte | ((Word)HighByte << 8);
+  }
+};
+
+template <>
+struct BusHandler<CPU::JMP_ABS>
+{
+  template <typename B>
+  static void Run(B &bus) { bus.Cpu.PC = bus.FetchWord(); }
+};
+
+template <>
+struct BusHandler<CPU::JMP_IND>
+{
+  template <typename B>
+  static void Run(B &bus)
+  {
+    Word Pointer = bus.FetchWord();
+    // 6502 page boundary wrap bug
+    Byte LowByte = bus.Read(Pointer);
+    Byte HighByte = bus.Read((Word)((Pointer & 0xFF00) | ((Pointer + 1) & 0x00FF)));
+    bus.Cpu.PC = (Word)LowByte | ((Word)HighByte << 8);
+  }
+};
+
+template <>
+struct BusHandler<CPU::PHA>
+{
+  template <typename B>
+  static void Run(B &bus)
+  {
+    bus.DummyRead(bus.Cpu.PC);
+    bus.Push(bus.Cpu.A);
+  }
+};
+
+template <>
+struct BusHandler<CPU::PHP>
+{
+  template <typename B>
+  static void Run(B &bus)
+  {
+    bus.DummyRead(bus.Cpu.PC);
+    bus.Push((Byte)(bus.Cpu.GetStatus() | CPU::FLAG_B));
+  }
+};
+
+template <>
+struct BusHandler<CPU::PLA>
+{
+  template <typename B>
+  static void Run(B &bus)
+  {
+    bus.DummyRead(bus.Cpu.PC);
+    bus.DummyRead(bus.StackAddress());
+    bus.Cpu.A = bus.Pull();
+    bus.Cpu.SetZN(bus.Cpu.A);
+  }
+};
+
+template <>
+struct BusHandler<CPU::PLP>
+{
+  template <typename B>
+  static void Run(B &bus)
+  {
+    bus.DummyRead(bus.Cpu.PC);
+    bus.DummyRead(bus.StackAddress());
+    bus.Cpu.SetStatus(bus.Pull());
+  }
+};
+
+// Halting opcodes are handled by Execute before dispatch.
+template <>
+struct BusHandler<CPU::BRK>
+{
+  template <typename B>
+  static void Run(B &) {}
+};
+
+template <>
+struct BusHandler<CPU::Illegal>
+{
+  template <typename B>
+  static void Run(B &) {}
+};
+
+struct CycleExact
+{
+  template <typename Hook>
+  using BusFn = void (*)(Bus<Hook> &);
+
+  template <typename Hook>
+  static constexpr std::array<BusFn<Hook>, 256> MakeTable()
+  {
+    std::array<BusFn<Hook>, 256> T{};
+    for (BusFn<Hook> &Fn : T) {
+      Fn = &BusHandler<CPU::Illegal>::template Run<Bus<Hook>>;
+    }
+    CPU::ForEachInstruction([&T](CPU::Opcode Op, auto H) {
+      T[static_cast<Byte>(Op)] = &BusHandler<decltype(H)>::template Run<Bus<Hook>>;
+    });
+    return T;
+  }
+
+  template <typename Hook>
+  static constexpr std::array<BusFn<Hook>, 256> Table = MakeTable<Hook>();
+
+  // Runs cpu until at least Cycles cycles have been spent or execution
+  // halts, calling hook.Cycle on every bus cycle.
+  template <typename Hook>
+  static CPU::ExecResult Execute(CPU &cpu, s32 Cycles, Mem &memory, Hook &hook)
+  {
+    const s32 Budget = Cycles;
+    CPU::StopReason Reason = CPU::StopReason::Budget;
+    u64 Retired = 0;
+
+    CPU Local = cpu;
+    Bus<Hook> bus{Local, memory, hook, Cycles};
+    while (Cycles > 0)
+    {
+      // Interrupt lines can't change during the call, so looking at them
+      // before every instruction takes interrupts where CPU::Execute does.
+      if (Local.InterruptPending()) {
+        bus.Interrupt();
+        continue;
+      }
+      // The opcode is looked at before its fetch cycle is charged, so an
+      // illegal one can stop the CPU without spending anything.
+      const Word At = Local.PC;
+      const Byte Ins = memory.Read(At);
+      const bool Brk = Ins == static_cast<Byte>(CPU::Opcode::BRK);
+      if (DispatchTable[Ins].Halts && !Brk) {
+        Reason = CPU::StopReason::Illegal;
+        break;
+      }
+      Local.PC++;
+      bus.Tick(At, Ins, BusOp::Fetch);
+      Retired++;
+      if (Brk) {
+        if (Local.BrkHalts) {
+          Reason = CPU::StopReason::Brk;
+          break;
+        }
+        bus.Fetch(); // the byte after BRK, skipped
+        bus.Enter(CPU::IRQ_VECTOR, (Byte)(Local.GetStatus() | CPU::FLAG_B));
+        continue;
+      }
+      Table<Hook>[Ins](bus);
+    }
+    cpu = Local;
+    return CPU::Finish(Reason, Budget, Cycles, Retired);
+  }
+
+  static CPU::ExecResult Execute(CPU &cpu, s32 Cycles, Mem &memory)
+  {
+    NoBusHook None;
+    return Execute(cpu, Cycles, memory, None);
+  }
+};
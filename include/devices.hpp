@@ -0,0 +1,157 @@
+#pragma once
+
+#include <deque>
+#include <ostream>
+#include <string>
+
+#include "6502_emulator.hpp"
+
+// Stand-in peripherals to map into a Mem with Mem::Map. Each decodes only
+// the low bits of the address, so its registers repeat across the pages it
+// is mapped at.
+
+// Character output: every byte written is printed to Out. Reads give 0.
+struct Console : Device
+{
+  std::ostream &Out;
+
+  explicit Console(std::ostream &out) : Out(out) {}
+
+  Byte Read(Word) override { return 0; }
+  void Write(Word, Byte Value) override { Out.put((char)Value); }
+};
+
+// A serial port laid out like a 6551 ACIA, with host-side queues in place of
+// the line:
+//   +0 data     read: next received byte; write: transmit
+//   +1 status   bit 3: a received byte is waiting; bit 4: ready to transmit
+//   +2 command  stored as written
+//   +3 control  stored as written
+struct Uart : Device
+{
+  static constexpr Byte STATUS_RX_FULL = 0x08;
+  static constexpr Byte STATUS_TX_EMPTY = 0x10;
+
+  std::deque<Byte> Received; // host -> guest
+  std::string Transmitted;   // guest -> host
+  Byte Command = 0, Control = 0;
+
+  Byte Read(Word Address) override
+  {
+    switch (Address & 0x03)
+    {
+    case 0: {
+      if (Received.empty()) {
+        return 0;
+      }
+      Byte Value = Received.front();
+      Received.pop_front();
+      return Value;
+    }
+    case 1:
+      return (Byte)(STATUS_TX_EMPTY | (Received.empty() ? 0 : STATUS_RX_FULL));
+    case 2:
+      return Command;
+    default:
+      return Control;
+    }
+  }
+
+  void Write(Word Address, Byte Value) override
+  {
+    switch (Address & 0x03)
+    {
+    case 0:
+      Transmitted.push_back((char)Value);
+      break;
+    case 1:
+      // programmed reset
+      Command = 0;
+      break;
+    case 2:
+      Command = Value;
+      break;
+    default:
+      Control = Value;
+      break;
+    }
+  }
+};
+
+// A 16-bit interval timer counting down once per CPU cycle. Devices don't
+// see the CPU's clock, so the host calls Tick with the cycles each Execute
+// slice consumed, or every cycle from a CycleExact bus hook.
+//   +0 counter low     read: counter; write: latch
+//   +1 counter high    read: counter; write: latch, then reload and start
+//   +2 control         bit 0: running; bit 1: reload from the latch on expiry
+//   +3 status          bit 7: expired since last read; reading clears it
+struct Timer : Device
+{
+  static constexpr Byte CONTROL_RUN = 0x01;
+  static constexpr Byte CONTROL_REPEAT = 0x02;
+  static constexpr Byte STATUS_EXPIRED = 0x80;
+
+  Word Latch = 0xFFFF;
+  Word Counter = 0xFFFF;
+  Byte Control = 0, Status = 0;
+
+  void Tick(s32 Cycles)
+  {
+    if (!(Control & CONTROL_RUN) || Cycles <= 0) {
+      return;
+    }
+    u32 Elapsed = (u32)Cycles;
+    if (Elapsed <= Counter) {
+      Counter = (Word)(Counter - Elapsed);
+      return;
+    }
+    // Expires one cycle after reaching 0.
+    Status |= STATUS_EXPIRED;
+    Elapsed -= (u32)Counter + 1;
+    if (Control & CONTROL_REPEAT) {
+      u32 Period = (u32)Latch + 1;
+      Counter = (Word)(Latch - Elapsed % Period);
+    } else {
+      Counter = 0;
+      Control &= (Byte)~CONTROL_RUN;
+    }
+  }
+
+  Byte Read(Word Address) override
+  {
+    switch (Address & 0x03)
+    {
+    case 0:
+      return (Byte)(Counter & 0xFF);
+    case 1:
+      return (Byte)(Counter >> 8);
+    case 2:
+      return Control;
+    default: {
+      Byte Value = Status;
+      Status = 0;
+      return Value;
+    }
+    }
+  }
+
+  void Write(Word Address, Byte Value) override
+  {
+    switch (Address & 0x03)
+    {
+    case 0:
+      Latch = (Word)((Latch & 0xFF00) | Value);
+      break;
+    case 1:
+      Latch = (Word)((Latch & 0x00FF) | (Value << 8));
+      Counter = Latch;
+      Control |= CONTROL_RUN;
+      break;
+    case 2:
+      Control = Value;
+      break;
+    default:
+      break;
+    }
+  }
+};
@@ -0,0 +1,172 @@
+#ifndef EMU6502_H
+#define EMU6502_H
+
+/* A C interface to the emulator, for embedding it from C or from other
+ * languages through their FFI. Link against the emu6502 library:
+ *
+ *   emu6502_machine *m = emu6502_create();
+ *   emu6502_load_file(m, "monitor.rom", EMU6502_FORMAT_DETECT, EMU6502_ADDRESS_TOP);
+ *   emu6502_reset(m);
+ *   emu6502_result r;
+ *   emu6502_run(m, 1000000, &r);
+ *   emu6502_destroy(m);
+ *
+ * A machine is a CPU and its 64 KiB of memory. Calls on one machine must not
+ * overlap; separate machines can be run from separate threads. Functions that
+ * can fail return 1 on success and 0 on failure. The layout of the structs
+ * and the meaning of the constants below only change with
+ * EMU6502_ABI_VERSION. */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(_WIN32) && defined(EMU6502_SHARED)
+#if defined(EMU6502_BUILD)
+#define EMU6502_API __declspec(dllexport)
+#else
+#define EMU6502_API __declspec(dllimport)
+#endif
+#elif defined(__GNUC__)
+#define EMU6502_API __attribute__((visibility("default")))
+#else
+#define EMU6502_API
+#endif
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EMU6502_ABI_VERSION 1
+
+typedef struct emu6502_machine emu6502_machine;
+
+/* Why emu6502_run stopped, as CPU::StopReason. */
+enum
+{
+  EMU6502_STOP_BUDGET = 0,     /* the cycles were spent */
+  EMU6502_STOP_BRK = 1,        /* BRK, while BRK halts */
+  EMU6502_STOP_ILLEGAL = 2,    /* an undocumented opcode, left unexecuted */
+  EMU6502_STOP_BREAKPOINT = 3
+};
+
+/* File formats for emu6502_load_file, as RomImage::Format. */
+enum
+{
+  EMU6502_FORMAT_DETECT = 0,
+  EMU6502_FORMAT_RAW = 1,
+  EMU6502_FORMAT_INTEL_HEX = 2,
+  EMU6502_FORMAT_PRG = 3
+};
+
+/* RAM contents for emu6502_power_on, as Mem::RamInit. */
+enum
+{
+  EMU6502_RAM_ZERO = 0,
+  EMU6502_RAM_PATTERN = 1,
+  EMU6502_RAM_UNTOUCHED = 2
+};
+
+/* What emu6502_last_hit reports, as Watchpoints::Kind. */
+enum
+{
+  EMU6502_HIT_NONE = 0,
+  EMU6502_HIT_BREAK = 1,
+  EMU6502_HIT_WRITE = 2
+};
+
+/* Raw images end at $FFFF unless given an address. */
+#define EMU6502_ADDRESS_TOP (-1)
+
+typedef struct emu6502_registers
+{
+  uint16_t pc;
+  uint8_t sp; /* in page 1 */
+  uint8_t a, x, y;
+  uint8_t p; /* the status as PHP pushes it, less B */
+} emu6502_registers;
+
+typedef struct emu6502_result
+{
+  int32_t cycles;  /* spent, which can pass the budget by the overrun */
+  int32_t overrun;
+  uint64_t instructions;
+  int32_t reason; /* EMU6502_STOP_* */
+} emu6502_result;
+
+EMU6502_API uint32_t emu6502_abi_version(void);
+
+/* A new machine, powered on with zeroed RAM and BRK halting, or NULL if out
+ * of memory. */
+EMU6502_API emu6502_machine *emu6502_create(void);
+EMU6502_API void emu6502_destroy(emu6502_machine *machine);
+
+/* Clears the registers, initializes RAM as ram (EMU6502_RAM_*) says and
+ * resets. */
+EMU6502_API void emu6502_power_on(emu6502_machine *machine, int ram);
+
+/* Warm reset: SP drops by three, I is set and PC comes from $FFFC. */
+EMU6502_API void emu6502_reset(emu6502_machine *machine);
+
+/* Places the image in the file at path in memory, leaving the registers
+ * alone; reset to start it at its RESET vector. address only applies to raw
+ * images. Pages are mapped from the file rather than copied, so the file
+ * stays open while any of them is still in memory. It is closed at the next
+ * load, power-on or restore that finds none left, so loading another image
+ * over the same range replaces it. */
+EMU6502_API int emu6502_load_file(emu6502_machine *machine, const char *path, int format, int32_t address);
+
+/* Runs for at least cycles cycles, or until execution stops. Returns the
+ * reason it stopped; fills in result if it isn't NULL. */
+EMU6502_API int emu6502_run(emu6502_machine *machine, int32_t cycles, emu6502_result *result);
+
+EMU6502_API void emu6502_get_registers(const emu6502_machine *machine, emu6502_registers *registers);
+EMU6502_API void emu6502_set_registers(emu6502_machine *machine, const emu6502_registers *registers);
+
+/* Nonzero to stop at BRK (the default), zero to run it as an interrupt. */
+EMU6502_API void emu6502_set_brk_halts(emu6502_machine *machine, int halts);
+
+/* Holds or releases IRQ line(s) in the mask lines, one bit per source. */
+EMU6502_API void emu6502_set_irq(emu6502_machine *machine, uint8_t lines, int asserted);
+EMU6502_API void emu6502_nmi(emu6502_machine *machine);
+
+/* Breakpoints stop emu6502_run with EMU6502_STOP_BREAKPOINT before the
+ * instruction at address runs. Running again with PC still there continues
+ * past the breakpoint; any other run stops at one on its first instruction.
+ * Nonzero enabled sets one, zero clears it. */
+EMU6502_API void emu6502_set_breakpoint(emu6502_machine *machine, uint16_t address, int enabled);
+
+/* Write watchpoints stop it after an instruction that stores to first..last
+ * inclusive. Zero enabled removes a range set with the same bounds, and
+ * returns 0 if there was none. Runs cost nothing extra while no breakpoints
+ * or watchpoints are set. */
+EMU6502_API int emu6502_watch_writes(emu6502_machine *machine, uint16_t first, uint16_t last, int enabled);
+
+/* Why the last run stopped at EMU6502_STOP_BREAKPOINT, as EMU6502_HIT_*. Fills
+ * in the breakpoint or the address stored to, and the PC of the instruction
+ * that hit, for each pointer that isn't NULL. */
+EMU6502_API int emu6502_last_hit(const emu6502_machine *machine, uint16_t *address, uint16_t *pc);
+
+/* Reads and writes memory as the host rather than over the bus: device
+ * pages read as 0 and ignore writes, and watchpoints do not fire. */
+EMU6502_API uint8_t emu6502_read(const emu6502_machine *machine, uint16_t address);
+EMU6502_API void emu6502_write(emu6502_machine *machine, uint16_t address, uint8_t value);
+
+/* Copies size bytes between memory at address and data. Blocks must not run
+ * past $FFFF; 0 if they would. */
+EMU6502_API int emu6502_read_block(const emu6502_machine *machine, uint16_t address, uint8_t *data, size_t size);
+EMU6502_API int emu6502_write_block(emu6502_machine *machine, uint16_t address, const uint8_t *data, size_t size);
+
+/* Saves the machine as a save state (see save_state.hpp) into buffer if it
+ * holds capacity bytes or more. Returns the size of the state either way, so
+ * a call with a NULL buffer asks how much room to make. */
+EMU6502_API size_t emu6502_save_state(const emu6502_machine *machine, uint8_t *buffer, size_t capacity);
+
+/* Restores a state saved by emu6502_save_state. 0, changing nothing, if it
+ * is malformed. */
+EMU6502_API int emu6502_restore_state(emu6502_machine *machine, const uint8_t *state, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,737 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#if !defined(_WIN32)
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
+#include "6502_emulator.hpp"
+
+// A GDB remote serial protocol server, for debugging guest code in the
+// running emulator:
+//
+//   GdbStub gdb;
+//   gdb.Listen("1234");                 // or "unix:/tmp/emu6502.sock"
+//   for (;;) {
+//     gdb.Run(cpu, Cycles, memory);     // as cpu.Execute, serving gdb
+//   }
+//
+// Until a debugger connects, Run only looks for a pending connection and
+// calls Execute, so the program runs at full speed; there is no separate
+// debug build. A debugger that connects finds the machine stopped, and can
+// read and write the registers (a, x, y, sp, pc and p, described to it by a
+// target description) and memory, single-step, continue, interrupt with
+// Ctrl-C, and set breakpoints (Z0, Z1) and write watchpoints (Z2) kept in
+// the stub's Watchpoints. Run blocks while the machine is stopped in the
+// debugger, and otherwise returns as Execute would, so it also drops into
+// a Scheduler: events.Run(cpu, Cycles, [&](s32 Slice) { return gdb.Run(cpu,
+// Slice, memory); }).
+//
+// Breakpoints and watchpoints are reported to the debugger and never end
+// Run; BRK and illegal opcodes are reported and then end it as they end
+// Execute. Memory's own watchpoints are set aside while a debugger is
+// attached. Detaching, or killing, which can't end the host process, lets
+// the program run on at full speed until the next debugger connects.
+// Device pages read as zeros to the debugger, which is refused writes to
+// them (and past $FFFF), so it doesn't disturb the devices; its writes to
+// RAM don't trip watchpoints. TCP connections are only accepted from the
+// local host. Not available on Windows, where Listen fails.
+struct GdbStub
+{
+  // While the debugger waits on a continue, Run checks for a Ctrl-C from it
+  // every POLL_SLICE cycles.
+  static constexpr s32 POLL_SLICE = 1 << 16;
+
+  // Bytes of memory one m packet may ask for.
+  static constexpr u32 MAX_READ = 4096;
+
+  GdbStub() = default;
+  GdbStub(const GdbStub &) = delete;
+  GdbStub &operator=(const GdbStub &) = delete;
+  ~GdbStub() { Close(); }
+
+  // Listens on Where: "unix:PATH" for a Unix socket, else "[localhost:]PORT"
+  // for TCP on the loopback interface. False if the socket can't be set up.
+  bool Listen(const char *Where)
+  {
+    Close();
+#if !defined(_WIN32)
+    std::string Address = Where;
+    if (Address.rfind("unix:", 0) == 0) {
+      Path = Address.substr(5);
+      sockaddr_un Un = {};
+      if (Path.empty() || Path.size() >= sizeof Un.sun_path) {
+        return false;
+      }
+      Un.sun_family = AF_UNIX;
+      std::memcpy(Un.sun_path, Path.c_str(), Path.size());
+      ::unlink(Path.c_str());
+      Listener = ::socket(AF_UNIX, SOCK_STREAM, 0);
+      if (Listener < 0 || ::bind(Listener, (sockaddr *)&Un, sizeof Un) != 0) {
+        Close();
+        return false;
+      }
+    } else {
+      size_t Colon = Address.rfind(':');
+      if (Colon != std::string::npos) {
+        std::string Host = Address.substr(0, Colon);
+        if (Host != "localhost" && Host != "127.0.0.1" && !Host.empty()) {
+          return false;
+        }
+        Address = Address.substr(Colon + 1);
+      }
+      char *End = nullptr;
+      unsigned long Port = std::strtoul(Address.c_str(), &End, 10);
+      if (Address.empty() || *End != '\0' || Port == 0 || Port > 0xFFFF) {
+        return false;
+      }
+      sockaddr_in In = {};
+      In.sin_family = AF_INET;
+      In.sin_port = htons((uint16_t)Port);
+      In.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+      Listener = ::socket(AF_INET, SOCK_STREAM, 0);
+      int On = 1;
+      if (Listener < 0 || ::setsockopt(Listener, SOL_SOCKET, SO_REUSEADDR, &On, sizeof On) != 0 ||
+          ::bind(Listener, (sockaddr *)&In, sizeof In) != 0) {
+        Close();
+        return false;
+      }
+    }
+    if (::listen(Listener, 1) != 0) {
+      Close();
+      return false;
+    }
+    return true;
+#else
+    (void)Where;
+    return false;
+#endif
+  }
+
+  // Drops any debugger and stops listening.
+  void Close()
+  {
+    Detach();
+#if !defined(_WIN32)
+    if (Listener >= 0) {
+      ::close(Listener);
+      Listener = -1;
+      if (!Path.empty()) {
+        ::unlink(Path.c_str());
+      }
+    }
+#endif
+    Path.clear();
+  }
+
+  bool Attached() const { return Client >= 0; }
+
+  // Takes a debugger waiting to connect, or with Wait, waits for one. True
+  // once one is attached.
+  bool Accept(bool Wait = false)
+  {
+#if !defined(_WIN32)
+    if (Client >= 0) {
+      return true;
+    }
+    if (Listener < 0) {
+      return false;
+    }
+    pollfd Poll = {Listener, POLLIN, 0};
+    if (::poll(&Poll, 1, Wait ? -1 : 0) <= 0) {
+      return false;
+    }
+    return Attach(::accept(Listener, nullptr, nullptr));
+#else
+    (void)Wait;
+    return false;
+#endif
+  }
+
+  // Serves a debugger already connected on the socket Fd, such as one end
+  // of a socketpair, as if Accept had taken it. The stub closes Fd when the
+  // debugger detaches. False if Fd is negative or one is already attached.
+  bool Attach(int Fd)
+  {
+#if !defined(_WIN32)
+    if (Fd < 0 || Client >= 0) {
+      return false;
+    }
+    Client = Fd;
+    int On = 1;
+    ::setsockopt(Client, IPPROTO_TCP, TCP_NODELAY, &On, sizeof On); // fails harmlessly on Unix sockets
+#if defined(SO_NOSIGPIPE)
+    ::setsockopt(Client, SOL_SOCKET, SO_NOSIGPIPE, &On, sizeof On);
+#endif
+    Fresh = true;
+    Stopped = true;
+    Stepping = false;
+    NoAck = false;
+    Input.clear();
+    Debug.Clear();
+    return true;
+#else
+    (void)Fd;
+    return false;
+#endif
+  }
+
+  // Drops the debugger, if any, and gives the Mem it was debugging back the
+  // watchpoints it had before.
+  void Detach()
+  {
+#if !defined(_WIN32)
+    if (Client >= 0) {
+      // Closing with input still unread would reset the connection rather
+      // than end it, so finish sending and discard the rest first.
+      ::shutdown(Client, SHUT_WR);
+      char Buffer[256];
+      while (::recv(Client, Buffer, sizeof Buffer, MSG_DONTWAIT) > 0) {
+      }
+      ::close(Client);
+      Client = -1;
+    }
+#endif
+    if (Memory) {
+      Memory->Watch(Previous);
+      Memory = nullptr;
+    }
+    Fresh = false;
+    Stopped = false;
+    Stepping = false;
+    Debug.Clear();
+  }
+
+  // As cpu.Execute(Cycles, memory), serving the debugger along the way.
+  CPU::ExecResult Run(CPU &cpu, s32 Cycles, Mem &memory)
+  {
+    CPU::NoProbe None;
+    return Run(cpu, Cycles, memory, None);
+  }
+
+  // The same with an Execute probe.
+  template <typename Probe>
+  CPU::ExecResult Run(CPU &cpu, s32 Cycles, Mem &memory, Probe &probe)
+  {
+    if (Client < 0 && !Accept()) {
+      return cpu.Execute(Cycles, memory, probe);
+    }
+    if (Fresh) {
+      Fresh = false;
+      Memory = &memory;
+      Previous = memory.Watches;
+      memory.Watch(nullptr);
+    }
+    const s32 Budget = Cycles;
+    CPU::StopReason Reason = CPU::StopReason::Budget;
+    u64 Retired = 0;
+    while (Cycles > 0)
+    {
+      if (Stopped) {
+        Serve(cpu, memory);
+      }
+      if (Client < 0) {
+        break;
+      }
+      if (memory.Watches != &Debug) {
+        Debug.Last = Watchpoints::Hit{}; // PC may come back to a breakpoint hit before
+      }
+      CPU::ExecResult Result = cpu.Execute(Stepping ? 1 : std::min(Cycles, POLL_SLICE), memory, probe);
+      Cycles -= Result.CyclesConsumed;
+      Retired += Result.InstructionsRetired;
+      if (Result.Reason == CPU::StopReason::Breakpoint) {
+        StopAt(Debug.Last.What == Watchpoints::Kind::Write ? Debug.Last.Address : -1, SIGNAL_TRAP);
+      } else if (Result.Reason != CPU::StopReason::Budget) {
+        StopAt(-1, Result.Reason == CPU::StopReason::Illegal ? SIGNAL_ILLEGAL : SIGNAL_TRAP);
+        Reason = Result.Reason;
+        break;
+      } else if (Stepping) {
+        StopAt(-1, SIGNAL_TRAP);
+      } else if (Interrupted()) {
+        StopAt(-1, SIGNAL_INTERRUPT);
+      }
+    }
+    if (Client < 0 && Cycles > 0 && Reason == CPU::StopReason::Budget) {
+      CPU::ExecResult Result = cpu.Execute(Cycles, memory, probe);
+      Cycles -= Result.CyclesConsumed;
+      Retired += Result.InstructionsRetired;
+      Reason = Result.Reason;
+    }
+    return CPU::Finish(Reason, Budget, Cycles, Retired);
+  }
+
+private:
+  static constexpr int SIGNAL_INTERRUPT = 2;
+  static constexpr int SIGNAL_ILLEGAL = 4;
+  static constexpr int SIGNAL_TRAP = 5;
+
+  // Register numbers, in the order g packets send them.
+  enum Register { REG_A, REG_X, REG_Y, REG_SP, REG_PC, REG_P, REGISTERS };
+
+  int Listener = -1;
+  int Client = -1;
+  std::string Path;           // of a Unix socket, removed on Close
+  std::string Input;          // received and not yet parsed
+  bool Fresh = false;         // attached, and Run hasn't set memory's watchpoints aside yet
+  bool Stopped = false;       // the debugger has the machine stopped
+  bool Stepping = false;
+  bool NoAck = false;
+  Watchpoints Debug;          // the debugger's, armed only while it has some
+  Mem *Memory = nullptr;      // being debugged
+  Watchpoints *Previous = nullptr; // its own, set aside meanwhile
+
+  // Answers packets until the debugger resumes the machine or goes away.
+  void Serve(CPU &cpu, Mem &memory)
+  {
+    std::string Packet;
+    while (Stopped && Client >= 0)
+    {
+      if (!Receive(Packet)) {
+        Detach();
+        return;
+      }
+      Handle(Packet, cpu, memory);
+    }
+  }
+
+  void Handle(const std::string &Packet, CPU &cpu, Mem &memory)
+  {
+    const char *Args = Packet.c_str() + 1;
+    switch (Packet[0])
+    {
+    case '?':
+      Send("S05");
+      return;
+    case 'g': {
+      Word Values[REGISTERS];
+      Registers(cpu, Values);
+      std::string Reply;
+      for (int R = 0; R < REGISTERS; R++) {
+        Reply += Hex(Values[R], R == REG_PC ? 2 : 1);
+      }
+      Send(Reply);
+      return;
+    }
+    case 'G': {
+      Word Values[REGISTERS];
+      const char *At = Args;
+      for (int R = 0; R < REGISTERS; R++) {
+        u32 Value = 0;
+        if (!ParseHexBytes(At, R == REG_PC ? 2 : 1, Value)) {
+          Send("E01");
+          return;
+        }
+        Values[R] = (Word)Value;
+      }
+      SetRegisters(cpu, Values);
+      Send("OK");
+      return;
+    }
+    case 'p': {
+      u32 Number = (u32)std::strtoul(Args, nullptr, 16);
+      if (Number >= REGISTERS) {
+        Send("E01");
+        return;
+      }
+      Word Values[REGISTERS];
+      Registers(cpu, Values);
+      Send(Hex(Values[Number], Number == REG_PC ? 2 : 1));
+      return;
+    }
+    case 'P': {
+      char *End = nullptr;
+      u32 Number = (u32)std::strtoul(Args, &End, 16);
+      u32 Value = 0;
+      const char *At = End + 1;
+      if (*End != '=' || Number >= REGISTERS || !ParseHexBytes(At, Number == REG_PC ? 2 : 1, Value)) {
+        Send("E01");
+        return;
+      }
+      Word Values[REGISTERS];
+      Registers(cpu, Values);
+      Values[Number] = (Word)Value;
+      SetRegisters(cpu, Values);
+      Send("OK");
+      return;
+    }
+    case 'm': {
+      u32 Address = 0, Length = 0;
+      if (!ParseRange(Args, ',', Address, Length) || Length > MAX_READ) {
+        Send("E01");
+        return;
+      }
+      std::string Reply;
+      for (u32 I = 0; I < Length && Address + I < Mem::MAX_MEM; I++) {
+        Word At = (Word)(Address + I);
+        Reply += Hex(memory.Devices[At >> 8] ? 0 : memory.Read(At), 1);
+      }
+      Send(Reply);
+      return;
+    }
+    case 'M': {
+      u32 Address = 0, Length = 0;
+      const char *Data = std::strchr(Args, ':');
+      if (!Data || !ParseRange(Args, ',', Address, Length) || std::strlen(Data + 1) != Length * 2 ||
+          Address > Mem::MAX_MEM || Length > Mem::MAX_MEM - Address) {
+        Send("E01");
+        return;
+      }
+      // Every byte is checked before any is written, so a packet that can't
+      // be written whole, with a bad digit or reaching a device page,
+      // changes nothing.
+      const char *At = Data + 1;
+      for (u32 I = 0; I < Length; I++) {
+        u32 Value = 0;
+        if (!ParseHexBytes(At, 1, Value) || memory.Devices[(Address + I) >> 8]) {
+          Send("E01");
+          return;
+        }
+      }
+      At = Data + 1;
+      for (u32 I = 0; I < Length; I++) {
+        u32 Value = 0;
+        ParseHexBytes(At, 1, Value);
+        // A host poke rather than a bus write: no watchpoint fires, and
+        // code cached from the page is dropped.
+        memory[(Word)(Address + I)] = (Byte)Value;
+        memory.InvalidatePage((Byte)((Address + I) >> 8));
+      }
+      Send("OK");
+      return;
+    }
+    case 'c':
+    case 's':
+      if (*Args) {
+        cpu.PC = (Word)std::strtoul(Args, nullptr, 16);
+      }
+      Stepping = Packet[0] == 's';
+      Stopped = false;
+      return;
+    case 'Z':
+    case 'z':
+      Send(SetWatch(Packet[0] == 'Z', Args, memory) ? "OK" : "");
+      return;
+    case 'D':
+      Send("OK");
+      Detach();
+      return;
+    case 'k':
+      // gdb doesn't wait for a reply to k, only for the connection to
+      // close, which Detach does the orderly way.
+      Detach();
+      return;
+    case 'H':
+    case 'T':
+      Send("OK");
+      return;
+    case 'q':
+    case 'Q':
+      Query(Packet);
+      return;
+    default:
+      Send(""); // unsupported
+      return;
+    }
+  }
+
+  void Query(const std::string &Packet)
+  {
+    if (Packet.rfind("qSupported", 0) == 0) {
+      Send("PacketSize=4000;qXfer:features:read+;QStartNoAckMode+");
+    } else if (Packet == "QStartNoAckMode") {
+      Send("OK");
+      NoAck = true;
+    } else if (Packet == "qAttached") {
+      Send("1");
+    } else if (Packet == "qC") {
+      Send("QC1");
+    } else if (Packet == "qfThreadInfo") {
+      Send("m1");
+    } else if (Packet == "qsThreadInfo") {
+      Send("l");
+    } else if (Packet.rfind("qXfer:features:read:target.xml:", 0) == 0) {
+      u32 Offset = 0, Length = 0;
+      const char *Args = Packet.c_str() + std::strlen("qXfer:features:read:target.xml:");
+      if (!ParseRange(Args, ',', Offset, Length)) {
+        Send("E01");
+        return;
+      }
+      static const std::string Xml =
+          "<?xml version=\"1.0\"?><!DOCTYPE target SYSTEM \"gdb-target.dtd\">"
+          "<target version=\"1.0\"><feature name=\"org.emu6502.cpu\">"
+          "<reg name=\"a\" bitsize=\"8\" type=\"uint8\" regnum=\"0\"/>"
+          "<reg name=\"x\" bitsize=\"8\" type=\"uint8\"/>"
+          "<reg name=\"y\" bitsize=\"8\" type=\"uint8\"/>"
+          "<reg name=\"sp\" bitsize=\"8\" type=\"uint8\"/>"
+          "<reg name=\"pc\" bitsize=\"16\" type=\"code_ptr\"/>"
+          "<reg name=\"p\" bitsize=\"8\" type=\"uint8\"/>"
+          "</feature></target>";
+      if (Offset >= Xml.size()) {
+        Send("l");
+        return;
+      }
+      std::string Chunk = Xml.substr(Offset, Length);
+      Send((Offset + Chunk.size() < Xml.size() ? "m" : "l") + Chunk);
+    } else {
+      Send("");
+    }
+  }
+
+  // Z/z TYPE,ADDR,KIND. Breakpoints (types 0 and 1) and write watchpoints
+  // (type 2) are supported; false for the rest.
+  bool SetWatch(bool Insert, const char *Args, Mem &memory)
+  {
+    char *End = nullptr;
+    unsigned long Type = std::strtoul(Args, &End, 16);
+    u32 Address = 0, Length = 0;
+    if (*End != ',' || !ParseRange(End + 1, ',', Address, Length) || Address >= Mem::MAX_MEM) {
+      return false;
+    }
+    if (Type == 0 || Type == 1) {
+      if (Insert) {
+        Debug.Break((Word)Address);
+      } else {
+        Debug.Unbreak((Word)Address);
+      }
+    } else if (Type == 2) {
+      Word Last = (Word)std::min<u32>(Address + std::max<u32>(Length, 1) - 1, 0xFFFF);
+      if (Insert) {
+        Debug.WatchWrites((Word)Address, Last);
+      } else if (!Debug.UnwatchWrites((Word)Address, Last)) {
+        return false;
+      }
+    } else {
+      return false;
+    }
+    memory.Watch(Debug.Empty() ? nullptr : &Debug);
+    return true;
+  }
+
+  // Tells the debugger the machine stopped, with the watched address stored
+  // to if Watched isn't -1.
+  void StopAt(s32 Watched, int Signal)
+  {
+    char Reply[32];
+    if (Watched >= 0) {
+      std::snprintf(Reply, sizeof Reply, "T%02xwatch:%04x;", Signal, (unsigned)Watched);
+    } else {
+      std::snprintf(Reply, sizeof Reply, "S%02x", Signal);
+    }
+    Send(Reply);
+    Stopped = true;
+    Stepping = false;
+  }
+
+  static void Registers(const CPU &cpu, Word *Values)
+  {
+    Values[REG_A] = cpu.A;
+    Values[REG_X] = cpu.X;
+    Values[REG_Y] = cpu.Y;
+    Values[REG_SP] = (Word)(cpu.SP & 0xFF);
+    Values[REG_PC] = cpu.PC;
+    Values[REG_P] = cpu.GetStatus();
+  }
+
+  static void SetRegisters(CPU &cpu, const Word *Values)
+  {
+    cpu.A = (Byte)Values[REG_A];
+    cpu.X = (Byte)Values[REG_X];
+    cpu.Y = (Byte)Values[REG_Y];
+    cpu.SP = (Word)(0x0100 | (Values[REG_SP] & 0xFF));
+    cpu.PC = Values[REG_PC];
+    cpu.SetStatus((Byte)Values[REG_P]);
+  }
+
+  // Value as Bytes little-endian bytes in hex, as registers travel.
+  static std::string Hex(u32 Value, int Bytes)
+  {
+    std::string Text;
+    char Pair[3];
+    for (int I = 0; I < Bytes; I++) {
+      std::snprintf(Pair, sizeof Pair, "%02x", (Value >> (8 * I)) & 0xFF);
+      Text += Pair;
+    }
+    return Text;
+  }
+
+  static int HexDigit(char C)
+  {
+    if (C >= '0' && C <= '9') {
+      return C - '0';
+    }
+    if (C >= 'a' && C <= 'f') {
+      return C - 'a' + 10;
+    }
+    if (C >= 'A' && C <= 'F') {
+      return C - 'A' + 10;
+    }
+    return -1;
+  }
+
+  // Reads Bytes little-endian bytes in hex from At on, advancing it.
+  static bool ParseHexBytes(const char *&At, int Bytes, u32 &Value)
+  {
+    Value = 0;
+    for (int I = 0; I < Bytes; I++) {
+      int High = HexDigit(At[0]);
+      int Low = High < 0 ? -1 : HexDigit(At[1]);
+      if (Low < 0) {
+        return false;
+      }
+      Value |= (u32)(High << 4 | Low) << (8 * I);
+      At += 2;
+    }
+    return true;
+  }
+
+  // "FIRST<Separator>SECOND" in hex, as addresses and lengths travel.
+  static bool ParseRange(const char *Args, char Separator, u32 &First, u32 &Second)
+  {
+    char *End = nullptr;
+    First = (u32)std::strtoul(Args, &End, 16);
+    if (End == Args || *End != Separator) {
+      return false;
+    }
+    const char *Next = End + 1;
+    Second = (u32)std::strtoul(Next, &End, 16);
+    return End != Next;
+  }
+
+  // Waits for the next packet, acknowledging it unless in no-ack mode.
+  // False once the debugger is gone.
+  bool Receive(std::string &Packet)
+  {
+    for (;;)
+    {
+      size_t Start = Input.find('$');
+      size_t Hash = Start == std::string::npos ? Start : Input.find('#', Start);
+      if (Hash != std::string::npos && Hash + 2 < Input.size()) {
+        Packet = Input.substr(Start + 1, Hash - Start - 1);
+        unsigned Sum = (unsigned)(HexDigit(Input[Hash + 1]) << 4 | HexDigit(Input[Hash + 2]));
+        Input.erase(0, Hash + 3);
+        bool Intact = Sum == Checksum(Packet);
+        if (!NoAck) {
+          Write(Intact ? "+" : "-");
+        }
+        if (Intact && !Packet.empty()) {
+          return true;
+        }
+        continue;
+      }
+      if (Start == std::string::npos) {
+        Input.clear(); // acks and stray Ctrl-Cs
+      }
+      if (!Fill(true)) {
+        return false;
+      }
+    }
+  }
+
+  // Sends a packet, and unless in no-ack mode waits for the debugger to
+  // acknowledge it, resending it when asked to.
+  void Send(const std::string &Data)
+  {
+    char Tail[4];
+    std::snprintf(Tail, sizeof Tail, "#%02x", Checksum(Data));
+    std::string Packet = "$" + Data + Tail;
+    for (int Tries = 0; Tries < 8 && Client >= 0; Tries++)
+    {
+      Write(Packet);
+      if (NoAck) {
+        return;
+      }
+      for (;;)
+      {
+        size_t Ack = Input.find_first_of("+-");
+        size_t Start = Input.find('$');
+        if (Ack != std::string::npos && Ack < Start) {
+          bool Resend = Input[Ack] == '-';
+          Input.erase(0, Ack + 1);
+          if (!Resend) {
+            return;
+          }
+          break;
+        }
+        if (Start != std::string::npos || !Fill(true)) {
+          return; // a new packet implies the reply got through
+        }
+      }
+    }
+  }
+
+  static unsigned Checksum(const std::string &Data)
+  {
+    unsigned Sum = 0;
+    for (char C : Data) {
+      Sum += (unsigned char)C;
+    }
+    return Sum & 0xFF;
+  }
+
+  // True if the debugger sent Ctrl-C while the machine ran. Notices it going
+  // away too.
+  bool Interrupted()
+  {
+    if (!Fill(false)) {
+      Detach();
+      return false;
+    }
+    size_t Break = Input.find('\x03');
+    if (Break == std::string::npos) {
+      return false;
+    }
+    Input.erase(0, Break + 1);
+    return true;
+  }
+
+  // Appends whatever the debugger sent to Input, waiting for something if
+  // Wait. False if the connection is closed.
+  bool Fill(bool Wait)
+  {
+#if !defined(_WIN32)
+    char Buffer[4096];
+    ssize_t Count = ::recv(Client, Buffer, sizeof Buffer, Wait ? 0 : MSG_DONTWAIT);
+    if (Count > 0) {
+      Input.append(Buffer, (size_t)Count);
+      return true;
+    }
+    return Count < 0 && (errno == EINTR || (!Wait && (errno == EAGAIN || errno == EWOULDBLOCK)));
+#else
+    (void)Wait;
+    return false;
+#endif
+  }
+
+  void Write(const std::string &Data)
+  {
+#if !defined(_WIN32)
+#if defined(MSG_NOSIGNAL)
+    const int Flags = MSG_NOSIGNAL;
+#else
+    const int Flags = 0;
+#endif
+    size_t Sent = 0;
+    while (Client >= 0 && Sent < Data.size())
+    {
+      ssize_t Count = ::send(Client, Data.data() + Sent, Data.size() - Sent, Flags);
+      if (Count <= 0) {
+        return; // the next receive notices the debugger has gone
+      }
+      Sent += (size_t)Count;
+    }
+#else
+    (void)Data;
+#endif
+  }
+};
@@ -0,0 +1,985 @@
+#pragma once
+
+#include <array>
+#include <cstring>
+#include <type_traits>
+
+#include "6502_emulator.hpp"
+
+// Marks a branch-free loop over the lanes. GCC unrolls loops this short
+// completely before its vectoriser runs, which leaves 8 and 16 lanes with
+// scalar code; kept rolled, they vectorise at any lane count.
+#if defined(__GNUC__) && !defined(__clang__)
+#define EMU6502_LANE_LOOP _Pragma("GCC unroll 1")
+#else
+#define EMU6502_LANE_LOOP
+#endif
+
+// Runs the same program on many machines at once, one machine per lane.
+// Registers are kept as structure-of-arrays and every step executes one
+// instruction for all lanes that are at the same PC with the same opcode,
+// so fetch, decode and dispatch are paid once per step instead of once per
+// lane, and the per-lane work is plain loops over the register arrays that
+// the compiler can vectorise.
+//
+// Lanes that diverge on a branch are masked off; each step picks the lowest
+// PC among running lanes, so lanes that took different paths join up again
+// once they reach common code. Semantics, including cycle counts and stop
+// reasons, are those of CPU::Execute: the per-lane operations are the CPU
+// ones, applied to each lane and blended back where the lane is active.
+// Lanes only have RAM, though, with no devices or interrupt lines, and BRK
+// always stops them; LoadLane refuses machines that need more.
+//
+// Lane memories are interleaved by address, Data[Address][Lane], so lanes
+// touching the same address read one contiguous row. That makes a Lockstep
+// 64 KiB x Lanes large: allocate it on the heap.
+template <int Lanes>
+struct Lockstep
+{
+  static_assert(Lanes >= 1 && Lanes <= 32, "Lockstep supports 1 to 32 lanes");
+  static constexpr int LaneCount = Lanes;
+
+  alignas(64) Word PC[Lanes];
+  alignas(64) Word SP[Lanes];
+  alignas(64) Byte A[Lanes];
+  alignas(64) Byte X[Lanes];
+  alignas(64) Byte Y[Lanes];
+  alignas(64) Byte P[Lanes];
+  alignas(64) Byte NResult[Lanes];
+  alignas(64) Byte ZResult[Lanes];
+  alignas(64) Word CResult[Lanes];
+  alignas(64) Byte VResult[Lanes];
+
+  alignas(64) s32 Cycles[Lanes];
+  alignas(64) Byte Running[Lanes]; // nonzero until the lane stops
+  alignas(64) u32 Retired[Lanes]; // fits: every instruction costs at least a cycle
+  CPU::StopReason Reason[Lanes];
+  s32 Budget = 0;
+  bool Uniform = false; // every lane in the current step has the same operand
+
+  // The current step: which lanes take part, and each lane's operand.
+  alignas(64) Byte Active[Lanes];
+  alignas(64) Word Operand[Lanes];
+
+  alignas(64) Byte Data[Mem::MAX_MEM][Lanes];
+
+  // Copies a scalar machine into a lane. False, leaving the lane as it was,
+  // if the lane couldn't run it as CPU::Execute would: the Mem has device
+  // pages mapped, the CPU runs BRK as an interrupt (BrkHalts false), or it
+  // has an IRQ line held or an NMI pending.
+  bool LoadLane(int Lane, const CPU &cpu, const Mem &memory)
+  {
+    if (!cpu.BrkHalts || cpu.IrqLines != 0 || cpu.NmiPending) {
+      return false;
+    }
+    for (u32 Page = 0; Page < Mem::PAGES; Page++) {
+      if (memory.Devices[Page]) {
+        return false;
+      }
+    }
+    Put(Lane, cpu, true);
+    for (u32 Page = 0; Page < Mem::PAGES; Page++) {
+      const Mem::Page *P = memory.Pages[Page];
+      for (u32 Offset = 0; Offset < Mem::PAGE_SIZE; Offset++) {
+        Data[Page << 8 | Offset][Lane] = P->Data[Offset];
+      }
+    }
+    return true;
+  }
+
+  // Copies a lane back out to a scalar machine. Memory goes back a page at
+  // a time through Mem::LoadPage, and only pages whose bytes differ are
+  // written, so the rest stay shared with the Mem they were copied from.
+  // Like any host load this is not a CPU store: watchpoints do not fire.
+  // Device pages of memory are left alone.
+  void SaveLane(int Lane, CPU &cpu, Mem &memory) const
+  {
+    CPU Regs = Get(Lane);
+    cpu.PC = Regs.PC;
+    cpu.SP = Regs.SP;
+    cpu.A = Regs.A;
+    cpu.X = Regs.X;
+    cpu.Y = Regs.Y;
+    cpu.SetStatus(Regs.GetStatus());
+    Byte Bytes[Mem::PAGE_SIZE];
+    for (u32 Page = 0; Page < Mem::PAGES; Page++) {
+      if (memory.Devices[Page]) {
+        continue;
+      }
+      for (u32 Offset = 0; Offset < Mem::PAGE_SIZE; Offset++) {
+        Bytes[Offset] = Data[Page << 8 | Offset][Lane];
+      }
+      if (std::memcmp(memory.Pages[Page]->Data, Bytes, Mem::PAGE_SIZE) != 0) {
+        memory.LoadPage((Byte)Page, Bytes);
+      }
+    }
+  }
+
+  // What the last Execute did on a lane, as CPU::Execute would report it.
+  CPU::ExecResult Result(int Lane) const
+  {
+    return CPU::Finish(Reason[Lane], Budget, Cycles[Lane], Retired[Lane]);
+  }
+
+  // Runs every lane until it halts or has spent at least Cycles cycles.
+  void Execute(s32 Cycles);
+
+  // Registers of one lane as a CPU, so the CPU operations can run on them.
+  CPU Get(int L) const
+  {
+    CPU R;
+    R.PC = PC[L];
+    R.SP = SP[L];
+    R.A = A[L];
+    R.X = X[L];
+    R.Y = Y[L];
+    R.P = P[L];
+    R.NResult = NResult[L];
+    R.ZResult = ZResult[L];
+    R.CResult = CResult[L];
+    R.VResult = VResult[L];
+    return R;
+  }
+
+  // Writes R back to lane L where On is set. Written as selects rather than
+  // a branch so loops over lanes stay vectorisable.
+  void Put(int L, const CPU &R, bool On)
+  {
+    PC[L] = On ? R.PC : PC[L];
+    SP[L] = On ? R.SP : SP[L];
+    A[L] = On ? R.A : A[L];
+    X[L] = On ? R.X : X[L];
+    Y[L] = On ? R.Y : Y[L];
+    P[L] = On ? R.P : P[L];
+    NResult[L] = On ? R.NResult : NResult[L];
+    ZResult[L] = On ? R.ZResult : ZResult[L];
+    CResult[L] = On ? R.CResult : CResult[L];
+    VResult[L] = On ? R.VResult : VResult[L];
+  }
+
+  // Put, plus the C cycles the instruction spent.
+  void Commit(int L, const CPU &R, s32 C, bool On)
+  {
+    Put(L, R, On);
+    Cycles[L] += On ? C : 0;
+  }
+
+  // Lane versions of the CPU memory helpers. Reads may happen for inactive
+  // lanes too, which is harmless; writes only happen where On is set.
+  Byte ReadByte(s32 &C, Word Address, int L) const
+  {
+    C--;
+    return Data[Address][L];
+  }
+
+  void WriteByte(s32 &C, Word Address, Byte Value, int L, bool On)
+  {
+    C--;
+    if (On) {
+      Data[Address][L] = Value;
+    }
+  }
+
+  void PushByte(CPU &R, s32 &C, Byte Value, int L, bool On)
+  {
+    WriteByte(C, (Word)(0x0100 | (R.SP & 0x00FF)), Value, L, On);
+    R.SP = (Word)((R.SP & 0xFF00) | ((R.SP - 1) & 0x00FF));
+  }
+
+  Byte PopByte(CPU &R, s32 &C, int L) const
+  {
+    R.SP = (Word)((R.SP & 0xFF00) | ((R.SP + 1) & 0x00FF));
+    return ReadByte(C, (Word)(0x0100 | (R.SP & 0x00FF)), L);
+  }
+
+  Word ReadZeroPagePointer(s32 &C, Byte ZeroPageAddr, int L) const
+  {
+    Byte LowByte = ReadByte(C, ZeroPageAddr, L);
+    Byte HighByte = ReadByte(C, (Byte)(ZeroPageAddr + 1), L);
+    return (Word)LowByte | ((Word)HighByte << 8);
+  }
+
+  using LaneFn = void (*)(Lockstep &);
+
+  static constexpr std::array<LaneFn, 256> MakeTable();
+};
+
+// Lane counterparts of the CPU addressing modes, same timing. They compute
+// the effective address for one lane; R holds that lane's registers and C
+// collects its cycles.
+template <typename Mode>
+struct LaneMode
+{
+  template <CPU::Access, typename M>
+  static Word Address(const M &, const CPU &, s32 &, int, Word Operand) { return Operand; }
+};
+
+template <Byte CPU::*Index>
+struct LaneMode<CPU::ZeroPageIndexed<Index>>
+{
+  template <CPU::Access, typename M>
+  static Word Address(const M &, const CPU &R, s32 &C, int, Word Operand)
+  {
+    C--; // index add
+    return (Byte)(Operand + R.*Index);
+  }
+};
+
+template <Byte CPU::*Index>
+struct LaneMode<CPU::AbsoluteIndexed<Index>>
+{
+  template <CPU::Access Kind, typename M>
+  static Word Address(const M &, const CPU &R, s32 &C, int, Word Operand)
+  {
+    C -= CPU::FixUpCycles(Kind); // charged by the CPU as part of Cost
+    return CPU::AddIndex<Kind>(C, Operand, R.*Index);
+  }
+};
+
+template <>
+struct LaneMode<CPU::IndexedIndirect>
+{
+  template <CPU::Access, typename M>
+  static Word Address(const M &Machine, const CPU &R, s32 &C, int L, Word Operand)
+  {
+    C--; // index add
+    return Machine.ReadZeroPagePointer(C, (Byte)(Operand + R.X), L);
+  }
+};
+
+template <>
+struct LaneMode<CPU::IndirectIndexed>
+{
+  template <CPU::Access Kind, typename M>
+  static Word Address(const M &Machine, const CPU &R, s32 &C, int L, Word Operand)
+  {
+    Word BaseAddr = Machine.ReadZeroPagePointer(C, (Byte)Operand, L);
+    C -= CPU::FixUpCycles(Kind);
+    return CPU::AddIndex<Kind>(C, BaseAddr, R.Y);
+  }
+};
+
+// Array-wise versions of the hottest CPU operations. Handlers use one where
+// it exists instead of running the CPU operation lane by lane, since these
+// compile to vector code; each must match its CPU counterpart exactly. The
+// operand comes from Value(L), so the same loop serves immediate, row and
+// gathered operands.
+template <auto Op>
+struct VectorOp
+{
+  static constexpr bool Exists = false;
+};
+
+template <typename T>
+inline void Select(T &Dst, T Value, bool On)
+{
+  Dst = On ? Value : Dst;
+}
+
+// The lane array behind a CPU register. Indexed as a member, not through a
+// pointer, so the compiler can tell it apart from the other arrays.
+template <Byte CPU::*Register, typename M>
+inline auto &LaneRegister(M &Machine)
+{
+  if constexpr (Register == &CPU::A) {
+    return Machine.A;
+  } else if constexpr (Register == &CPU::X) {
+    return Machine.X;
+  } else {
+    return Machine.Y;
+  }
+}
+
+// Loads and logic: the register gets the new value, which is also the N/Z
+// result.
+template <Byte CPU::*Register, typename F>
+struct VectorResult
+{
+  static constexpr bool Exists = true;
+
+  template <typename M, typename V>
+  static void Apply(M &Machine, V Value)
+  {
+    auto &R = LaneRegister<Register>(Machine);
+    EMU6502_LANE_LOOP
+    for (int L = 0; L < M::LaneCount; L++) {
+      Byte Result = F{}(R[L], Value(L));
+      Select(R[L], Result, Machine.Active[L]);
+      Select(Machine.NResult[L], Result, Machine.Active[L]);
+      Select(Machine.ZResult[L], Result, Machine.Active[L]);
+    }
+  }
+
+  template <typename M>
+  static void Apply(M &Machine)
+  {
+    Apply(Machine, [](int) { return (Byte)0; });
+  }
+};
+
+struct Take { Byte operator()(Byte, Byte V) const { return V; } };
+struct And { Byte operator()(Byte R, Byte V) const { return R & V; } };
+struct Or { Byte operator()(Byte R, Byte V) const { return R | V; } };
+struct Xor { Byte operator()(Byte R, Byte V) const { return R ^ V; } };
+struct Inc { Byte operator()(Byte R, Byte) const { return (Byte)(R + 1); } };
+struct Dec { Byte operator()(Byte R, Byte) const { return (Byte)(R - 1); } };
+
+template <> struct VectorOp<&CPU::OpLDA> : VectorResult<&CPU::A, Take> {};
+template <> struct VectorOp<&CPU::OpLDX> : VectorResult<&CPU::X, Take> {};
+template <> struct VectorOp<&CPU::OpLDY> : VectorResult<&CPU::Y, Take> {};
+template <> struct VectorOp<&CPU::OpAND> : VectorResult<&CPU::A, And> {};
+template <> struct VectorOp<&CPU::OpORA> : VectorResult<&CPU::A, Or> {};
+template <> struct VectorOp<&CPU::OpEOR> : VectorResult<&CPU::A, Xor> {};
+template <> struct VectorOp<&CPU::OpINX> : VectorResult<&CPU::X, Inc> {};
+template <> struct VectorOp<&CPU::OpINY> : VectorResult<&CPU::Y, Inc> {};
+template <> struct VectorOp<&CPU::OpDEX> : VectorResult<&CPU::X, Dec> {};
+template <> struct VectorOp<&CPU::OpDEY> : VectorResult<&CPU::Y, Dec> {};
+
+// Transfers read one register and write another, so they take the source
+// as the operand.
+template <Byte CPU::*From, Byte CPU::*To>
+struct VectorTransfer : VectorResult<To, Take>
+{
+  template <typename M>
+  static void Apply(M &Machine)
+  {
+    const auto &Source = LaneRegister<From>(Machine);
+    VectorResult<To, Take>::Apply(Machine, [&Source](int L) { return Source[L]; });
+  }
+};
+
+template <> struct VectorOp<&CPU::OpTAX> : VectorTransfer<&CPU::A, &CPU::X> {};
+template <> struct VectorOp<&CPU::OpTAY> : VectorTransfer<&CPU::A, &CPU::Y> {};
+template <> struct VectorOp<&CPU::OpTXA> : VectorTransfer<&CPU::X, &CPU::A> {};
+template <> struct VectorOp<&CPU::OpTYA> : VectorTransfer<&CPU::Y, &CPU::A> {};
+
+// ADC, and SBC as ADC of the inverted operand.
+template <void (CPU::*Op)(Byte), Byte Invert>
+struct VectorAdd
+{
+  static constexpr bool Exists = true;
+
+  // Lanes in decimal mode are left to the CPU operation.
+  template <typename M, typename V>
+  static void Apply(M &Machine, V Value)
+  {
+    Byte Decimal = 0;
+    EMU6502_LANE_LOOP
+    for (int L = 0; L < M::LaneCount; L++) {
+      Byte A = Machine.A[L];
+      Byte B = Value(L) ^ Invert;
+      Word Result = (Word)(A + B + ((Machine.CResult[L] >> 8) & 1));
+      Byte InDecimal = (Machine.P[L] & CPU::FLAG_D) != 0;
+      bool On = Machine.Active[L] & !InDecimal;
+      Decimal |= Machine.Active[L] & InDecimal;
+      Select(Machine.VResult[L], (Byte)(~(A ^ B) & (A ^ Result)), On);
+      Select(Machine.CResult[L], Result, On);
+      Select(Machine.A[L], (Byte)Result, On);
+      Select(Machine.NResult[L], (Byte)Result, On);
+      Select(Machine.ZResult[L], (Byte)Result, On);
+    }
+    if (EMU6502_UNLIKELY(Decimal)) {
+      for (int L = 0; L < M::LaneCount; L++) {
+        if (Machine.Active[L] && (Machine.P[L] & CPU::FLAG_D)) {
+          CPU R = Machine.Get(L);
+          (R.*Op)(Value(L));
+          Machine.Put(L, R, true);
+        }
+      }
+    }
+  }
+};
+
+template <> struct VectorOp<&CPU::OpADC> : VectorAdd<&CPU::OpADC, 0x00> {};
+template <> struct VectorOp<&CPU::OpSBC> : VectorAdd<&CPU::OpSBC, 0xFF> {};
+
+template <>
+struct VectorOp<&CPU::OpBIT>
+{
+  static constexpr bool Exists = true;
+
+  template <typename M, typename V>
+  static void Apply(M &Machine, V Value)
+  {
+    EMU6502_LANE_LOOP
+    for (int L = 0; L < M::LaneCount; L++) {
+      Byte B = Value(L);
+      Select(Machine.ZResult[L], (Byte)(Machine.A[L] & B), Machine.Active[L]);
+      Select(Machine.VResult[L], (Byte)(B << 1), Machine.Active[L]);
+      Select(Machine.NResult[L], B, Machine.Active[L]);
+    }
+  }
+};
+
+template <Byte CPU::*Register>
+struct VectorCompare
+{
+  static constexpr bool Exists = true;
+
+  template <typename M, typename V>
+  static void Apply(M &Machine, V Value)
+  {
+    const auto &R = LaneRegister<Register>(Machine);
+    EMU6502_LANE_LOOP
+    for (int L = 0; L < M::LaneCount; L++) {
+      Word Result = (Word)(R[L] + (Byte)~Value(L) + 1);
+      Select(Machine.CResult[L], Result, Machine.Active[L]);
+      Select(Machine.NResult[L], (Byte)Result, Machine.Active[L]);
+      Select(Machine.ZResult[L], (Byte)Result, Machine.Active[L]);
+    }
+  }
+};
+
+template <> struct VectorOp<&CPU::OpCMP> : VectorCompare<&CPU::A> {};
+template <> struct VectorOp<&CPU::OpCPX> : VectorCompare<&CPU::X> {};
+template <> struct VectorOp<&CPU::OpCPY> : VectorCompare<&CPU::Y> {};
+
+template <Word Carry>
+struct VectorSetCarry
+{
+  static constexpr bool Exists = true;
+
+  template <typename M>
+  static void Apply(M &Machine)
+  {
+    EMU6502_LANE_LOOP
+    for (int L = 0; L < M::LaneCount; L++) {
+      Select(Machine.CResult[L], Carry, Machine.Active[L]);
+    }
+  }
+};
+
+template <> struct VectorOp<&CPU::OpCLC> : VectorSetCarry<0> {};
+template <> struct VectorOp<&CPU::OpSEC> : VectorSetCarry<0x100> {};
+
+// Array-wise read-modify-write operations, for the accumulator and for a
+// row of memory. F gives the new value and the new carry word from the old
+// value and carry word.
+template <auto Op>
+struct VectorModify
+{
+  static constexpr bool Exists = false;
+};
+
+template <typename F>
+struct VectorShift
+{
+  static constexpr bool Exists = true;
+
+  template <typename M, typename T>
+  static void Apply(M &Machine, T &Values)
+  {
+    EMU6502_LANE_LOOP
+    for (int L = 0; L < M::LaneCount; L++) {
+      Byte Old = Values[L];
+      Word Carry = Machine.CResult[L];
+      Byte New = F::Value(Old, Carry);
+      Select(Values[L], New, Machine.Active[L]);
+      Select(Machine.CResult[L], F::Carry(Old, Carry), Machine.Active[L]);
+      Select(Machine.NResult[L], New, Machine.Active[L]);
+      Select(Machine.ZResult[L], New, Machine.Active[L]);
+    }
+  }
+};
+
+struct ShiftLeft
+{
+  static Byte Value(Byte V, Word) { return (Byte)(V << 1); }
+  static Word Carry(Byte V, Word) { return (Word)(V << 1); }
+};
+
+struct ShiftRight
+{
+  static Byte Value(Byte V, Word) { return (Byte)(V >> 1); }
+  static Word Carry(Byte V, Word) { return (Word)(V << 8); }
+};
+
+struct RotateLeft
+{
+  static Byte Value(Byte V, Word C) { return (Byte)((V << 1) | ((C >> 8) & 1)); }
+  static Word Carry(Byte V, Word C) { return (Word)((V << 1) | ((C >> 8) & 1)); }
+};
+
+struct RotateRight
+{
+  static Byte Value(Byte V, Word C) { return (Byte)((V >> 1) | ((C >> 1) & 0x80)); }
+  static Word Carry(Byte V, Word) { return (Word)(V << 8); }
+};
+
+struct Increment
+{
+  static Byte Value(Byte V, Word) { return (Byte)(V + 1); }
+  static Word Carry(Byte, Word C) { return C; }
+};
+
+struct Decrement
+{
+  static Byte Value(Byte V, Word) { return (Byte)(V - 1); }
+  static Word Carry(Byte, Word C) { return C; }
+};
+
+template <> struct VectorModify<&CPU::OpASL> : VectorShift<ShiftLeft> {};
+template <> struct VectorModify<&CPU::OpLSR> : VectorShift<ShiftRight> {};
+template <> struct VectorModify<&CPU::OpROL> : VectorShift<RotateLeft> {};
+template <> struct VectorModify<&CPU::OpROR> : VectorShift<RotateRight> {};
+template <> struct VectorModify<&CPU::OpINC> : VectorShift<Increment> {};
+template <> struct VectorModify<&CPU::OpDEC> : VectorShift<Decrement> {};
+
+// Lane counterparts of the CPU handlers. Run executes the instruction for the
+// lanes in Active; PC and the fetch cycles are already accounted for. Each
+// one mirrors the CPU handler of the same name.
+template <typename H>
+struct LaneHandler;
+
+// True for modes whose effective address is just the operand.
+template <typename Mode>
+constexpr bool DirectMode = std::is_same<Mode, CPU::ZeroPage>::value || std::is_same<Mode, CPU::Absolute>::value;
+
+template <void (CPU::*Op)(Byte), typename Mode>
+struct LaneHandler<CPU::Read<Op, Mode>>
+{
+  template <typename M>
+  static void Run(M &Machine)
+  {
+    if constexpr (VectorOp<Op>::Exists && (std::is_same<Mode, CPU::Immediate>::value || DirectMode<Mode>)) {
+      if constexpr (std::is_same<Mode, CPU::Immediate>::value) {
+        VectorOp<Op>::Apply(Machine, [&Machine](int L) { return (Byte)Machine.Operand[L]; });
+        return;
+      }
+      if (Machine.Uniform) {
+        const Byte *Row = Machine.Data[Machine.Operand[0]];
+        VectorOp<Op>::Apply(Machine, [Row](int L) { return Row[L]; });
+      } else {
+        VectorOp<Op>::Apply(Machine, [&Machine](int L) { return Machine.Data[Machine.Operand[L]][L]; });
+      }
+      EMU6502_LANE_LOOP
+      for (int L = 0; L < M::LaneCount; L++) {
+        Machine.Cycles[L] -= Machine.Active[L];
+      }
+      return;
+    }
+    for (int L = 0; L < M::LaneCount; L++) {
+      CPU R = Machine.Get(L);
+      s32 C = 0;
+      if constexpr (std::is_same<Mode, CPU::Immediate>::value) {
+        (R.*Op)((Byte)Machine.Operand[L]);
+      } else {
+        Word Address = LaneMode<Mode>::template Address<CPU::Access::Read>(Machine, R, C, L, Machine.Operand[L]);
+        (R.*Op)(Machine.ReadByte(C, Address, L));
+      }
+      Machine.Commit(L, R, C, Machine.Active[L]);
+    }
+  }
+};
+
+template <Byte CPU::*Register, typename Mode>
+struct LaneHandler<CPU::Store<Register, Mode>>
+{
+  template <typename M>
+  static void Run(M &Machine)
+  {
+    if constexpr (DirectMode<Mode>) {
+      if (Machine.Uniform) {
+        auto &Row = Machine.Data[Machine.Operand[0]];
+        const auto &R = LaneRegister<Register>(Machine);
+        EMU6502_LANE_LOOP
+        for (int L = 0; L < M::LaneCount; L++) {
+          Select(Row[L], R[L], Machine.Active[L]);
+          Machine.Cycles[L] -= Machine.Active[L];
+        }
+        return;
+      }
+    }
+    for (int L = 0; L < M::LaneCount; L++) {
+      CPU R = Machine.Get(L);
+      s32 C = 0;
+      Word Address = LaneMode<Mode>::template Address<CPU::Access::Write>(Machine, R, C, L, Machine.Operand[L]);
+      Machine.WriteByte(C, Address, R.*Register, L, Machine.Active[L]);
+      Machine.Commit(L, R, C, Machine.Active[L]);
+    }
+  }
+};
+
+template <Byte (CPU::*Op)(Byte), typename Mode>
+struct LaneHandler<CPU::Modify<Op, Mode>>
+{
+  template <typename M>
+  static void Run(M &Machine)
+  {
+    if constexpr (VectorModify<Op>::Exists && DirectMode<Mode>) {
+      if (Machine.Uniform) {
+        VectorModify<Op>::Apply(Machine, Machine.Data[Machine.Operand[0]]);
+        EMU6502_LANE_LOOP
+        for (int L = 0; L < M::LaneCount; L++) {
+          Machine.Cycles[L] -= Machine.Active[L] * 3; // read, modify, write
+        }
+        return;
+      }
+    }
+    for (int L = 0; L < M::LaneCount; L++) {
+      CPU R = Machine.Get(L);
+      s32 C = 0;
+      Word Address = LaneMode<Mode>::template Address<CPU::Access::Modify>(Machine, R, C, L, Machine.Operand[L]);
+      Byte Value = Machine.ReadByte(C, Address, L);
+      C--;
+      Machine.WriteByte(C, Address, (R.*Op)(Value), L, Machine.Active[L]);
+      Machine.Commit(L, R, C, Machine.Active[L]);
+    }
+  }
+};
+
+template <Byte (CPU::*Op)(Byte)>
+struct LaneHandler<CPU::ModifyA<Op>>
+{
+  template <typename M>
+  static void Run(M &Machine)
+  {
+    if constexpr (VectorModify<Op>::Exists) {
+      VectorModify<Op>::Apply(Machine, Machine.A);
+      EMU6502_LANE_LOOP
+      for (int L = 0; L < M::LaneCount; L++) {
+        Machine.Cycles[L] -= Machine.Active[L];
+      }
+      return;
+    }
+    for (int L = 0; L < M::LaneCount; L++) {
+      CPU R = Machine.Get(L);
+      R.A = (R.*Op)(R.A);
+      Machine.Commit(L, R, -1, Machine.Active[L]);
+    }
+  }
+};
+
+template <void (CPU::*Op)()>
+struct LaneHandler<CPU::Implied<Op>>
+{
+  template <typename M>
+  static void Run(M &Machine)
+  {
+    if constexpr (VectorOp<Op>::Exists) {
+      VectorOp<Op>::Apply(Machine);
+      EMU6502_LANE_LOOP
+      for (int L = 0; L < M::LaneCount; L++) {
+        Machine.Cycles[L] -= Machine.Active[L];
+      }
+      return;
+    }
+    for (int L = 0; L < M::LaneCount; L++) {
+      CPU R = Machine.Get(L);
+      (R.*Op)();
+      Machine.Commit(L, R, -1, Machine.Active[L]);
+    }
+  }
+};
+
+template <Byte Ins>
+struct LaneHandler<CPU::Branch<Ins>>
+{
+  template <typename M>
+  static void Run(M &Machine)
+  {
+    EMU6502_LANE_LOOP
+    for (int L = 0; L < M::LaneCount; L++) {
+      bool Flag;
+      if constexpr ((Ins >> 6) == 0) {
+        Flag = (Machine.NResult[L] & 0x80) != 0;
+      } else if constexpr ((Ins >> 6) == 1) {
+        Flag = (Machine.VResult[L] & 0x80) != 0;
+      } else if constexpr ((Ins >> 6) == 2) {
+        Flag = (Machine.CResult[L] & 0x100) != 0;
+      } else {
+        Flag = Machine.ZResult[L] == 0;
+      }
+      // Same as CPU::Branch: one cycle if taken, another if that crosses a page.
+      bool Taken = Machine.Active[L] & (Flag == (((Ins >> 5) & 1) != 0));
+      Word OldPC = Machine.PC[L];
+      Word NewPC = (Word)(OldPC + (SByte)Machine.Operand[L]);
+      Select(Machine.PC[L], NewPC, Taken);
+      Machine.Cycles[L] -= Taken ? 1 + ((OldPC ^ NewPC) > 0xFF) : 0;
+    }
+  }
+};
+
+template <>
+struct LaneHandler<CPU::JSR>
+{
+  template <typename M>
+  static void Run(M &Machine)
+  {
+    for (int L = 0; L < M::LaneCount; L++) {
+      CPU R = Machine.Get(L);
+      s32 C = -1; // internal stack pointer cycle
+      Word Return = (Word)(R.PC - 1);
+      Machine.PushByte(R, C, (Byte)((Return >> 8) & 0xFF), L, Machine.Active[L]);
+      Machine.PushByte(R, C, (Byte)(Return & 0xFF), L, Machine.Active[L]);
+      // As CPU::JSR, the high byte is fetched after the pushes.
+      Word Target = Machine.Operand[L];
+      if ((Return >> 8) == 0x01) {
+        Target = (Word)((Target & 0x00FF) | (Machine.Data[Return][L] << 8));
+      }
+      R.PC = Target;
+      Machine.Commit(L, R, C, Machine.Active[L]);
+    }
+  }
+};
+
+template <>
+struct LaneHandler<CPU::RTS>
+{
+  template <typename M>
+  static void Run(M &Machine)
+  {
+    for (int L = 0; L < M::LaneCount; L++) {
+      CPU R = Machine.Get(L);
+      s32 C = -2; // dummy read and stack pointer increment
+      Byte LowByte = Machine.PopByte(R, C, L);
+      Byte HighByte = Machine.PopByte(R, C, L);
+      R.PC = (Word)(((Word)LowByte | ((Word)HighByte << 8)) + 1);
+      C--; // PC increment
+      Machine.Commit(L, R, C, Machine.Active[L]);
+    }
+  }
+};
+
+template <>
+struct LaneHandler<CPU::RTI>
+{
+  template <typename M>
+  static void Run(M &Machine)
+  {
+    for (int L = 0; L < M::LaneCount; L++) {
+      CPU R = Machine.Get(L);
+      s32 C = -2; // dummy read and stack pointer increment
+      R.SetStatus(Machine.PopByte(R, C, L));
+      Byte LowByte = Machine.PopByte(R, C, L);
+      Byte HighByte = Machine.PopByte(R, C, L);
+      R.PC = (Word)LowByte | ((Word)HighByte << 8);
+      Machine.Commit(L, R, C, Machine.Active[L]);
+    }
+  }
+};
+
+template <>
+struct LaneHandler<CPU::JMP_ABS>
+{
+  template <typename M>
+  static void Run(M &Machine)
+  {
+    EMU6502_LANE_LOOP
+    for (int L = 0; L < M::LaneCount; L++) {
+      Machine.PC[L] = Machine.Active[L] ? Machine.Operand[L] : Machine.PC[L];
+    }
+  }
+};
+
+template <>
+struct LaneHandler<CPU::JMP_IND>
+{
+  template <typename M>
+  static void Run(M &Machine)
+  {
+    for (int L = 0; L < M::LaneCount; L++) {
+      CPU R = Machine.Get(L);
+      s32 C = 0;
+      // 6502 page boundary wrap bug
+      Word Pointer = Machine.Operand[L];
+      Byte LowByte = Machine.ReadByte(C, Pointer, L);
+      Byte HighByte = Machine.ReadByte(C, (Word)((Pointer & 0xFF00) | ((Pointer + 1) & 0x00FF)), L);
+      R.PC = (Word)LowByte | ((Word)HighByte << 8);
+      Machine.Commit(L, R, C, Machine.Active[L]);
+    }
+  }
+};
+
+template <>
+struct LaneHandler<CPU::PHA>
+{
+  template <typename M>
+  static void Run(M &Machine)
+  {
+    // Works on the lane arrays directly: only SP and A are involved.
+    EMU6502_LANE_LOOP
+    for (int L = 0; L < M::LaneCount; L++) {
+      bool On = Machine.Active[L];
+      Word SP = Machine.SP[L];
+      Byte &Top = Machine.Data[0x0100 | (SP & 0x00FF)][L];
+      Select(Top, Machine.A[L], On);
+      Select(Machine.SP[L], (Word)((SP & 0xFF00) | ((SP - 1) & 0x00FF)), On);
+      Machine.Cycles[L] -= On ? 2 : 0;
+    }
+  }
+};
+
+template <>
+struct LaneHandler<CPU::PHP>
+{
+  template <typename M>
+  static void Run(M &Machine)
+  {
+    for (int L = 0; L < M::LaneCount; L++) {
+      CPU R = Machine.Get(L);
+      s32 C = -1;
+      Machine.PushByte(R, C, (Byte)(R.GetStatus() | CPU::FLAG_B), L, Machine.Active[L]);
+      Machine.Commit(L, R, C, Machine.Active[L]);
+    }
+  }
+};
+
+template <>
+struct LaneHandler<CPU::PLA>
+{
+  template <typename M>
+  static void Run(M &Machine)
+  {
+    EMU6502_LANE_LOOP
+    for (int L = 0; L < M::LaneCount; L++) {
+      bool On = Machine.Active[L];
+      Word SP = (Word)((Machine.SP[L] & 0xFF00) | ((Machine.SP[L] + 1) & 0x00FF));
+      Byte Value = Machine.Data[0x0100 | (SP & 0x00FF)][L];
+      Select(Machine.SP[L], SP, On);
+      Select(Machine.A[L], Value, On);
+      Select(Machine.NResult[L], Value, On);
+      Select(Machine.ZResult[L], Value, On);
+      Machine.Cycles[L] -= On ? 3 : 0;
+    }
+  }
+};
+
+template <>
+struct LaneHandler<CPU::PLP>
+{
+  template <typename M>
+  static void Run(M &Machine)
+  {
+    for (int L = 0; L < M::LaneCount; L++) {
+      CPU R = Machine.Get(L);
+      s32 C = -2;
+      R.SetStatus(Machine.PopByte(R, C, L));
+      Machine.Commit(L, R, C, Machine.Active[L]);
+    }
+  }
+};
+
+// Halting opcodes are handled by Execute before dispatch.
+template <>
+struct LaneHandler<CPU::BRK>
+{
+  template <typename M>
+  static void Run(M &) {}
+};
+
+template <>
+struct LaneHandler<CPU::Illegal>
+{
+  template <typename M>
+  static void Run(M &) {}
+};
+
+template <int Lanes>
+constexpr std::array<typename Lockstep<Lanes>::LaneFn, 256> Lockstep<Lanes>::MakeTable()
+{
+  std::array<LaneFn, 256> T{};
+  for (LaneFn &Fn : T) {
+    Fn = &LaneHandler<CPU::Illegal>::template Run<Lockstep>;
+  }
+  CPU::ForEachInstruction([&T](CPU::Opcode Op, auto H) {
+    T[static_cast<Byte>(Op)] = &LaneHandler<decltype(H)>::template Run<Lockstep>;
+  });
+  return T;
+}
+
+template <int Lanes>
+inline constexpr std::array<typename Lockstep<Lanes>::LaneFn, 256> LockstepTable = Lockstep<Lanes>::MakeTable();
+
+template <int Lanes>
+inline void Lockstep<Lanes>::Execute(s32 CycleBudget)
+{
+  // Each step runs the lanes at the lowest PC among running lanes; halted
+  // lanes sort last.
+  Budget = CycleBudget;
+  u32 Lowest = 0x10000;
+  EMU6502_LANE_LOOP
+  for (int L = 0; L < Lanes; L++) {
+    Cycles[L] = Budget;
+    Retired[L] = 0;
+    Reason[L] = CPU::StopReason::Budget;
+    Running[L] = Budget > 0;
+    u32 Key = PC[L] | ((u32)(Running[L] == 0) << 16);
+    Lowest = Key < Lowest ? Key : Lowest;
+  }
+
+#define EMU6502_CASE(N)                                  \
+  case N:                                                \
+    LockstepTable<Lanes>[N](*this);                     \
+    break;
+
+  while (Lowest != 0x10000)
+  {
+    const Word At = (Word)Lowest;
+
+    // Lanes at the same PC can still hold different code; step the ones
+    // that agree with the first of them and leave the rest for later.
+    int First = 0;
+    while (!(Running[First] && PC[First] == At)) {
+      First++;
+    }
+    const Byte Ins = Data[At][First];
+    const CPU::OpcodeEntry &E = DispatchTable[Ins];
+
+    const Word At1 = (Word)(At + 1);
+    const Word At2 = (Word)(At + 2);
+    const Word LowMask = E.Length > 1 ? 0x00FF : 0;
+    const Word HighMask = E.Length > 2 ? 0xFF00 : 0;
+    // Handlers read a row of memory at once when every lane uses the same
+    // address, taken from lane 0; lanes that are off only need a harmless
+    // address to read, so they get the first active lane's operand.
+    const Word Lead = (Word)((Data[At1][First] & LowMask) | ((Data[At2][First] << 8) & HighMask));
+    Byte Differs = 0;
+    // Bitwise rather than logical ands throughout: branch-free loops are the
+    // ones the compiler vectorises.
+    EMU6502_LANE_LOOP
+    for (int L = 0; L < Lanes; L++) {
+      Byte On = (Byte)((Running[L] != 0) & (PC[L] == At) & (Data[At][L] == Ins));
+      Word Own = (Word)((Data[At1][L] & LowMask) | ((Data[At2][L] << 8) & HighMask));
+      Active[L] = On;
+      Differs |= On & (Own != Lead);
+      Operand[L] = On ? Own : Lead;
+      PC[L] = On ? (Word)(At + E.Length) : PC[L];
+      Cycles[L] -= On ? E.Length : 0;
+      Retired[L] += On;
+    }
+    Uniform = !Differs;
+
+    if (EMU6502_UNLIKELY(E.Halts)) {
+      // Same as CPU::Halt: BRK is retired with PC past it, an illegal
+      // opcode is rolled back.
+      const bool Brk = Ins == static_cast<Byte>(CPU::Opcode::BRK);
+      for (int L = 0; L < Lanes; L++) {
+        if (Active[L]) {
+          Running[L] = 0;
+          Reason[L] = Brk ? CPU::StopReason::Brk : CPU::StopReason::Illegal;
+          if (!Brk) {
+            PC[L] = At;
+            Cycles[L] += E.Length;
+            Retired[L]--;
+          }
+        }
+      }
+    } else {
+      switch (Ins)
+      {
+        EMU6502_FOR_EACH_OPCODE(EMU6502_CASE)
+      }
+    }
+
+    Lowest = 0x10000;
+    EMU6502_LANE_LOOP
+    for (int L = 0; L < Lanes; L++) {
+      Running[L] &= (Byte)!(Active[L] & (Cycles[L] <= 0));
+      u32 Key = PC[L] | ((u32)(Running[L] == 0) << 16);
+      Lowest = Key < Lowest ? Key : Lowest;
+    }
+  }
+
+#undef EMU6502_CASE
+}
@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdio>
+#include <memory>
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "6502_emulator.hpp"
+
+// A whole file mapped read-only into memory, so images can be used, and Mem
+// pages borrowed from them, without copying. The data starts suitably
+// aligned for Mem::BorrowPage. Where mmap isn't available the file is read
+// into a buffer instead.
+struct MappedFile
+{
+  MappedFile() = default;
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  ~MappedFile() { Close(); }
+
+  // Maps the file at Path, replacing any open one. False if it can't be
+  // read or is empty.
+  bool Open(const char *Path)
+  {
+    Close();
+#if !defined(_WIN32)
+    int Fd = ::open(Path, O_RDONLY);
+    if (Fd < 0) {
+      return false;
+    }
+    struct stat Info;
+    if (::fstat(Fd, &Info) != 0 || Info.st_size <= 0) {
+      ::close(Fd);
+      return false;
+    }
+    void *Address = ::mmap(nullptr, (size_t)Info.st_size, PROT_READ, MAP_PRIVATE, Fd, 0);
+    ::close(Fd);
+    if (Address == MAP_FAILED) {
+      return false;
+    }
+    Bytes = (const Byte *)Address;
+    Length = (size_t)Info.st_size;
+    Mapped = true;
+#else
+    std::FILE *File = std::fopen(Path, "rb");
+    if (!File) {
+      return false;
+    }
+    std::fseek(File, 0, SEEK_END);
+    long End = std::ftell(File);
+    std::fseek(File, 0, SEEK_SET);
+    if (End <= 0) {
+      std::fclose(File);
+      return false;
+    }
+    Buffer.reset(new u64[((size_t)End + sizeof(u64) - 1) / sizeof(u64)]);
+    Bytes = (const Byte *)Buffer.get();
+    Length = (size_t)End;
+    bool Read = std::fread(Buffer.get(), 1, Length, File) == Length;
+    std::fclose(File);
+    if (!Read) {
+      Close();
+      return false;
+    }
+#endif
+    return true;
+  }
+
+  void Close()
+  {
+#if !defined(_WIN32)
+    if (Mapped) {
+      ::munmap((void *)Bytes, Length);
+    }
+#endif
+    Buffer.reset();
+    Bytes = nullptr;
+    Length = 0;
+    Mapped = false;
+  }
+
+  bool IsOpen() const { return Bytes != nullptr; }
+  const Byte *Data() const { return Bytes; }
+  size_t Size() const { return Length; }
+
+private:
+  const Byte *Bytes = nullptr;
+  size_t Length = 0;
+  bool Mapped = false;
+  std::unique_ptr<u64[]> Buffer; // without mmap
+};
@@ -0,0 +1,156 @@
+#pragma once
+
+#include <array>
+#include <cstdio>
+#include <string>
+
+#include "6502_emulator.hpp"
+
+// Static facts about opcodes that the interpreter doesn't need but tools
+// reporting on guest code do. Length and addressing mode live in
+// DispatchTable; this adds names and documented timings.
+
+// Mnemonic of each opcode, "???" where none is defined.
+inline constexpr std::array<const char *, 256> Mnemonics = {
+    "BRK", "ORA", "???", "???", "???", "ORA", "ASL", "???", "PHP", "ORA", "ASL", "???", "???", "ORA", "ASL", "???", // 0_
+    "BPL", "ORA", "???", "???", "???", "ORA", "ASL", "???", "CLC", "ORA", "???", "???", "???", "ORA", "ASL", "???", // 1_
+    "JSR", "AND", "???", "???", "BIT", "AND", "ROL", "???", "PLP", "AND", "ROL", "???", "BIT", "AND", "ROL", "???", // 2_
+    "BMI", "AND", "???", "???", "???", "AND", "ROL", "???", "SEC", "AND", "???", "???", "???", "AND", "ROL", "???", // 3_
+    "RTI", "EOR", "???", "???", "???", "EOR", "LSR", "???", "PHA", "EOR", "LSR", "???", "JMP", "EOR", "LSR", "???", // 4_
+    "BVC", "EOR", "???", "???", "???", "EOR", "LSR", "???", "CLI", "EOR", "???", "???", "???", "EOR", "LSR", "???", // 5_
+    "RTS", "ADC", "???", "???", "???", "ADC", "ROR", "???", "PLA", "ADC", "ROR", "???", "JMP", "ADC", "ROR", "???", // 6_
+    "BVS", "ADC", "???", "???", "???", "ADC", "ROR", "???", "SEI", "ADC", "???", "???", "???", "ADC", "ROR", "???", // 7_
+    "???", "STA", "???", "???", "STY", "STA", "STX", "???", "DEY", "???", "TXA", "???", "STY", "STA", "STX", "???", // 8_
+    "BCC", "STA", "???", "???", "STY", "STA", "STX", "???", "TYA", "STA", "TXS", "???", "???", "STA", "???", "???", // 9_
+    "LDY", "LDA", "LDX", "???", "LDY", "LDA", "LDX", "???", "TAY", "LDA", "TAX", "???", "LDY", "LDA", "LDX", "???", // A_
+    "BCS", "LDA", "???", "???", "LDY", "LDA", "LDX", "???", "CLV", "LDA", "TSX", "???", "LDY", "LDA", "LDX", "???", // B_
+    "CPY", "CMP", "???", "???", "CPY", "CMP", "DEC", "???", "INY", "CMP", "DEX", "???", "CPY", "CMP", "DEC", "???", // C_
+    "BNE", "CMP", "???", "???", "???", "CMP", "DEC", "???", "CLD", "CMP", "???", "???", "???", "CMP", "DEC", "???", // D_
+    "CPX", "SBC", "???", "???", "CPX", "SBC", "INC", "???", "INX", "SBC", "NOP", "???", "CPX", "SBC", "INC", "???", // E_
+    "BEQ", "SBC", "???", "???", "???", "SBC", "INC", "???", "SED", "SBC", "???", "???", "???", "SBC", "INC", "???", // F_
+};
+
+// Cycles each opcode takes on a 6502 before penalties: an indexed read whose
+// address crosses a page pays one more cycle, and a taken branch one more,
+// or two if it lands on another page. 0 where no opcode is defined.
+inline constexpr std::array<Byte, 256> BaseCycles = {
+    7, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 0, 4, 6, 0, // 0_
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0, // 1_
+    6, 6, 0, 0, 3, 3, 5, 0, 4, 2, 2, 0, 4, 4, 6, 0, // 2_
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0, // 3_
+    6, 6, 0, 0, 0, 3, 5, 0, 3, 2, 2, 0, 3, 4, 6, 0, // 4_
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0, // 5_
+    6, 6, 0, 0, 0, 3, 5, 0, 4, 2, 2, 0, 5, 4, 6, 0, // 6_
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0, // 7_
+    0, 6, 0, 0, 3, 3, 3, 0, 2, 0, 2, 0, 4, 4, 4, 0, // 8_
+    2, 6, 0, 0, 4, 4, 4, 0, 2, 5, 2, 0, 0, 5, 0, 0, // 9_
+    2, 6, 2, 0, 3, 3, 3, 0, 2, 2, 2, 0, 4, 4, 4, 0, // A_
+    2, 5, 0, 0, 4, 4, 4, 0, 2, 4, 2, 0, 4, 4, 4, 0, // B_
+    2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0, // C_
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0, // D_
+    2, 6, 0, 0, 3, 3, 5, 0, 2, 2, 2, 0, 4, 4, 6, 0, // E_
+    2, 5, 0, 0, 0, 4, 6, 0, 2, 4, 0, 0, 0, 4, 7, 0, // F_
+};
+
+// The interpreter charges DispatchTable's Costs, worked out from each
+// handler's shape; they must be the documented timings. Halting opcodes
+// stop before running and are charged only their opcode fetch.
+constexpr bool CostsMatchBaseCycles()
+{
+  for (int Op = 0; Op < 256; Op++)
+  {
+    if (!DispatchTable[Op].Halts && DispatchTable[Op].Cost != BaseCycles[Op]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static_assert(CostsMatchBaseCycles(), "DispatchTable costs disagree with BaseCycles");
+
+inline const char *AddressModeName(CPU::AddressMode Mode)
+{
+  using M = CPU::AddressMode;
+  switch (Mode)
+  {
+  case M::Implied:
+    return "implied";
+  case M::Accumulator:
+    return "accumulator";
+  case M::Immediate:
+    return "#imm";
+  case M::ZeroPage:
+    return "zp";
+  case M::ZeroPageX:
+    return "zp,X";
+  case M::ZeroPageY:
+    return "zp,Y";
+  case M::Absolute:
+    return "abs";
+  case M::AbsoluteX:
+    return "abs,X";
+  case M::AbsoluteY:
+    return "abs,Y";
+  case M::Indirect:
+    return "(abs)";
+  case M::IndexedIndirect:
+    return "(zp,X)";
+  case M::IndirectIndexed:
+    return "(zp),Y";
+  case M::Relative:
+    return "rel";
+  }
+  return "?";
+}
+
+// Formats an instruction as assembly, e.g. "LDA ($10),Y". PC is where the
+// instruction starts; branches show their target rather than the offset.
+inline std::string Disassemble(Byte Opcode, Word Operand, Word PC)
+{
+  using M = CPU::AddressMode;
+  char Text[32];
+  const char *Name = Mnemonics[Opcode];
+  switch (DispatchTable[Opcode].Addressing)
+  {
+  case M::Implied:
+    std::snprintf(Text, sizeof Text, "%s", Name);
+    break;
+  case M::Accumulator:
+    std::snprintf(Text, sizeof Text, "%s A", Name);
+    break;
+  case M::Immediate:
+    std::snprintf(Text, sizeof Text, "%s #$%02X", Name, Operand & 0xFF);
+    break;
+  case M::ZeroPage:
+    std::snprintf(Text, sizeof Text, "%s $%02X", Name, Operand & 0xFF);
+    break;
+  case M::ZeroPageX:
+    std::snprintf(Text, sizeof Text, "%s $%02X,X", Name, Operand & 0xFF);
+    break;
+  case M::ZeroPageY:
+    std::snprintf(Text, sizeof Text, "%s $%02X,Y", Name, Operand & 0xFF);
+    break;
+  case M::Absolute:
+    std::snprintf(Text, sizeof Text, "%s $%04X", Name, Operand);
+    break;
+  case M::AbsoluteX:
+    std::snprintf(Text, sizeof Text, "%s $%04X,X", Name, Operand);
+    break;
+  case M::AbsoluteY:
+    std::snprintf(Text, sizeof Text, "%s $%04X,Y", Name, Operand);
+    break;
+  case M::Indirect:
+    std::snprintf(Text, sizeof Text, "%s ($%04X)", Name, Operand);
+    break;
+  case M::IndexedIndirect:
+    std::snprintf(Text, sizeof Text, "%s ($%02X,X)", Name, Operand & 0xFF);
+    break;
+  case M::IndirectIndexed:
+    std::snprintf(Text, sizeof Text, "%s ($%02X),Y", Name, Operand & 0xFF);
+    break;
+  case M::Relative:
+    std::snprintf(Text, sizeof Text, "%s $%04X", Name, (Word)(PC + 2 + (SByte)Operand));
+    break;
+  }
+  return Text;
+}
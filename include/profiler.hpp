@@ -0,0 +1,261 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <map>
+#include <ostream>
+#include <vector>
+
+#include "opcode_info.hpp"
+
+// Execution profile gathered through CPU::Execute's probe hook:
+//
+//   Profiler profile;
+//   cpu.Execute(Cycles, memory, profile);
+//   profile.Report(std::cout);
+//
+// It counts executions and cycles per opcode and per PC. Cycles beyond an
+// opcode's BaseCycles are penalties: for a branch, one means it was taken
+// and two that it was taken onto another page; for anything else, one means
+// indexing crossed a page. Addressing mode totals are summed from the opcode
+// counts when reporting. Since it sees every instruction, Execute skips no
+// idle loops under it; an IdleLog records those instead.
+struct Profiler
+{
+  static constexpr bool Enabled = true;
+
+  struct OpcodeStats
+  {
+    u64 Count = 0;
+    u64 Cycles = 0;
+    u64 Taken = 0;       // branches only
+    u64 PageCrosses = 0; // each cost one cycle
+  };
+
+  std::array<OpcodeStats, 256> Opcodes{};
+  std::vector<u64> PCCount, PCCycles; // indexed by the PC an instruction started at
+  std::vector<Byte> PCOpcode;         // last opcode seen there
+
+  Profiler() : PCCount(0x10000), PCCycles(0x10000), PCOpcode(0x10000) {}
+
+  void Retire(const CPU &, Byte Opcode, Word PC, Word, s32 Cycles)
+  {
+    OpcodeStats &S = Opcodes[Opcode];
+    S.Count++;
+    S.Cycles += (u64)Cycles;
+    PCCount[PC]++;
+    PCCycles[PC] += (u64)Cycles;
+    PCOpcode[PC] = Opcode;
+
+    s32 Penalty = Cycles - BaseCycles[Opcode];
+    if (Penalty <= 0) {
+      return;
+    }
+    if (DispatchTable[Opcode].Addressing == CPU::AddressMode::Relative) {
+      S.Taken++;
+      if (Penalty > 1) {
+        S.PageCrosses++;
+      }
+    } else {
+      S.PageCrosses++;
+    }
+  }
+
+  // Forgets everything recorded, as if freshly constructed.
+  void Clear()
+  {
+    Opcodes = {};
+    std::fill(PCCount.begin(), PCCount.end(), 0);
+    std::fill(PCCycles.begin(), PCCycles.end(), 0);
+    std::fill(PCOpcode.begin(), PCOpcode.end(), 0);
+  }
+
+  u64 TotalInstructions() const
+  {
+    u64 Total = 0;
+    for (const OpcodeStats &S : Opcodes) {
+      Total += S.Count;
+    }
+    return Total;
+  }
+
+  u64 TotalCycles() const
+  {
+    u64 Total = 0;
+    for (const OpcodeStats &S : Opcodes) {
+      Total += S.Cycles;
+    }
+    return Total;
+  }
+
+  // Writes the profile with every table sorted by cycles spent, hottest
+  // first. The hot PC table is cut off after Top entries.
+  void Report(std::ostream &Out, size_t Top = 20) const
+  {
+    char Line[160];
+    auto Print = [&Out, &Line](auto... Args) {
+      std::snprintf(Line, sizeof Line, Args...);
+      Out << Line;
+    };
+    const u64 Instructions = TotalInstructions();
+    const u64 Cycles = TotalCycles();
+    auto Share = [Cycles](u64 Part) { return Cycles ? 100.0 * (double)Part / (double)Cycles : 0.0; };
+    auto Ratio = [](u64 Part, u64 Whole) { return Whole ? 100.0 * (double)Part / (double)Whole : 0.0; };
+
+    Print("%llu instructions, %llu cycles, %.2f cycles/instruction\n", (unsigned long long)Instructions,
+          (unsigned long long)Cycles, Instructions ? (double)Cycles / (double)Instructions : 0.0);
+
+    std::vector<Byte> ByCycles;
+    for (u32 Op = 0; Op < 256; ++Op) {
+      if (Opcodes[Op].Count) {
+        ByCycles.push_back((Byte)Op);
+      }
+    }
+    std::sort(ByCycles.begin(), ByCycles.end(),
+              [this](Byte L, Byte R) { return Opcodes[L].Cycles > Opcodes[R].Cycles; });
+
+    Print("\n%-19s %12s %13s %8s %5s\n", "Opcode", "Count", "Cycles", "Cycles%", "Avg");
+    for (Byte Op : ByCycles) {
+      const OpcodeStats &S = Opcodes[Op];
+      Print("$%02X %-3s %-11s %12llu %13llu %7.2f%% %5.2f\n", Op, Mnemonics[Op],
+            AddressModeName(DispatchTable[Op].Addressing), (unsigned long long)S.Count,
+            (unsigned long long)S.Cycles, Share(S.Cycles), (double)S.Cycles / (double)S.Count);
+    }
+
+    std::array<OpcodeStats, (size_t)CPU::AddressMode::Relative + 1> Modes{};
+    for (Byte Op : ByCycles) {
+      OpcodeStats &M = Modes[(size_t)DispatchTable[Op].Addressing];
+      M.Count += Opcodes[Op].Count;
+      M.Cycles += Opcodes[Op].Cycles;
+    }
+    std::vector<size_t> ModeOrder;
+    for (size_t M = 0; M < Modes.size(); ++M) {
+      if (Modes[M].Count) {
+        ModeOrder.push_back(M);
+      }
+    }
+    std::sort(ModeOrder.begin(), ModeOrder.end(),
+              [&Modes](size_t L, size_t R) { return Modes[L].Cycles > Modes[R].Cycles; });
+
+    Print("\n%-19s %12s %13s %8s\n", "Addressing mode", "Count", "Cycles", "Cycles%");
+    for (size_t M : ModeOrder) {
+      Print("%-19s %12llu %13llu %7.2f%%\n", AddressModeName((CPU::AddressMode)M),
+            (unsigned long long)Modes[M].Count, (unsigned long long)Modes[M].Cycles, Share(Modes[M].Cycles));
+    }
+
+    bool Heading = false;
+    for (Byte Op : ByCycles) {
+      const OpcodeStats &S = Opcodes[Op];
+      if (DispatchTable[Op].Addressing != CPU::AddressMode::Relative) {
+        continue;
+      }
+      if (!Heading) {
+        Print("\n%-19s %12s %12s %7s %13s\n", "Branch", "Count", "Taken", "Taken%", "Page crosses");
+        Heading = true;
+      }
+      Print("$%02X %-15s %12llu %12llu %6.1f%% %13llu\n", Op, Mnemonics[Op], (unsigned long long)S.Count,
+            (unsigned long long)S.Taken, Ratio(S.Taken, S.Count), (unsigned long long)S.PageCrosses);
+    }
+
+    Heading = false;
+    for (Byte Op : ByCycles) {
+      const OpcodeStats &S = Opcodes[Op];
+      if (DispatchTable[Op].Addressing == CPU::AddressMode::Relative || S.PageCrosses == 0) {
+        continue;
+      }
+      if (!Heading) {
+        Print("\n%-19s %12s %12s %9s\n", "Page cross", "Count", "Crosses", "Crosses%");
+        Heading = true;
+      }
+      Print("$%02X %-3s %-11s %12llu %12llu %8.1f%%\n", Op, Mnemonics[Op],
+            AddressModeName(DispatchTable[Op].Addressing), (unsigned long long)S.Count,
+            (unsigned long long)S.PageCrosses, Ratio(S.PageCrosses, S.Count));
+    }
+
+    std::vector<Word> HotPCs;
+    for (u32 PC = 0; PC < 0x10000; ++PC) {
+      if (PCCount[PC]) {
+        HotPCs.push_back((Word)PC);
+      }
+    }
+    size_t Shown = std::min(Top, HotPCs.size());
+    std::partial_sort(HotPCs.begin(), HotPCs.begin() + (std::ptrdiff_t)Shown, HotPCs.end(),
+                      [this](Word L, Word R) { return PCCycles[L] > PCCycles[R]; });
+
+    Print("\n%-19s %12s %13s %8s\n", "PC", "Count", "Cycles", "Cycles%");
+    for (size_t I = 0; I < Shown; ++I) {
+      Word PC = HotPCs[I];
+      Print("$%04X %-3s %-9s %12llu %13llu %7.2f%%\n", PC, Mnemonics[PCOpcode[PC]],
+            AddressModeName(DispatchTable[PCOpcode[PC]].Addressing), (unsigned long long)PCCount[PC],
+            (unsigned long long)PCCycles[PC], Share(PCCycles[PC]));
+    }
+  }
+};
+
+// The idle loops CPU::Execute skipped, gathered through its Idle hook:
+//
+//   IdleLog idle;
+//   cpu.Execute(Cycles, memory, idle);
+//   idle.Report(std::cout);
+//
+// Unlike the Profiler it isn't Enabled, so it doesn't stop Execute skipping
+// the loops it records. Each loop is kept under the PC of its top, with how
+// often it was skipped and the iterations and cycles that were.
+struct IdleLog
+{
+  static constexpr bool Enabled = false;
+
+  struct LoopStats
+  {
+    u64 Skips = 0;
+    u64 Iterations = 0;
+    u64 Cycles = 0;
+  };
+
+  std::map<Word, LoopStats> Loops;
+
+  void Retire(const CPU &, Byte, Word, Word, s32) {}
+
+  void Idle(const CPU &Cpu, u64 Iterations, s32 Cycles)
+  {
+    LoopStats &S = Loops[Cpu.PC];
+    S.Skips++;
+    S.Iterations += Iterations;
+    S.Cycles += (u64)Cycles;
+  }
+
+  void Clear() { Loops.clear(); }
+
+  u64 TotalCycles() const
+  {
+    u64 Total = 0;
+    for (const auto &Loop : Loops) {
+      Total += Loop.second.Cycles;
+    }
+    return Total;
+  }
+
+  // Writes the loops, most cycles skipped first.
+  void Report(std::ostream &Out) const
+  {
+    char Line[160];
+    auto Print = [&Out, &Line](auto... Args) {
+      std::snprintf(Line, sizeof Line, Args...);
+      Out << Line;
+    };
+    std::vector<std::pair<Word, LoopStats>> ByCycles(Loops.begin(), Loops.end());
+    std::sort(ByCycles.begin(), ByCycles.end(),
+              [](const auto &L, const auto &R) { return L.second.Cycles > R.second.Cycles; });
+
+    Print("%zu idle loops, %llu cycles skipped\n", ByCycles.size(), (unsigned long long)TotalCycles());
+    if (ByCycles.empty()) {
+      return;
+    }
+    Print("\n%-5s %12s %12s %13s\n", "Loop", "Skips", "Iterations", "Cycles");
+    for (const auto &Loop : ByCycles) {
+      Print("$%04X %12llu %12llu %13llu\n", Loop.first, (unsigned long long)Loop.second.Skips,
+            (unsigned long long)Loop.second.Iterations, (unsigned long long)Loop.second.Cycles);
+    }
+  }
+};
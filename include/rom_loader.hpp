@@ -0,0 +1,299 @@
+#pragma once
+
+#include <algorithm>
+#include <cctype>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "6502_emulator.hpp"
+#include "mapped_file.hpp"
+
+// Program and ROM images loaded from files:
+//
+//   RomImage rom;
+//   rom.Open("monitor.rom");
+//   rom.Boot(cpu, memory); // loads it and starts at the RESET vector
+//
+// Three formats are understood:
+//   raw        the bytes as they sit in memory, loaded at a given address or
+//              by default so that they end at $FFFF, vectors included
+//   Intel HEX  text records; data, end-of-file and extended address records
+//              are honoured, start address records are ignored
+//   .prg       a little-endian load address followed by the bytes
+//
+// Raw and .prg files are mmapped and used in place. Loading points whole
+// pages of the image straight at the file and copies only the partial pages
+// at its ends, so booting a ROM takes microseconds whatever its size; a page
+// is copied when the guest first writes to it. A .prg's bytes sit two past
+// the file's start, off the alignment a page needs, so they are copied
+// whole. Intel HEX is decoded into a buffer once at Open, which Load then
+// uses the same way.
+//
+// Loaded Mems, and copies of them, keep reading the image, so the RomImage
+// must outlive all of them (or load with Borrow false).
+struct RomImage
+{
+  enum class Format
+  {
+    Detect, // by extension, else Intel HEX if the file starts with ':', else raw
+    Raw,
+    IntelHex,
+    Prg,
+  };
+
+  static constexpr s32 TOP = -1; // raw images end at $FFFF
+
+  // A run of bytes to place at Address.
+  struct Segment
+  {
+    Word Address;
+    const Byte *Data;
+    u32 Size;
+  };
+
+  std::vector<Segment> Segments;
+
+  RomImage() = default;
+  RomImage(const RomImage &) = delete;
+  RomImage &operator=(const RomImage &) = delete;
+
+  // Reads the image at Path, replacing any open one. Address only applies
+  // to raw images. False if the file can't be read, is malformed or doesn't
+  // fit in 64 KiB.
+  bool Open(const char *Path, Format Kind = Format::Detect, s32 Address = TOP)
+  {
+    Close();
+    if (!File.Open(Path)) {
+      return false;
+    }
+    if (Kind == Format::Detect) {
+      Kind = DetectFormat(Path);
+    }
+    bool Ok = false;
+    switch (Kind)
+    {
+    case Format::IntelHex:
+      Ok = ParseIntelHex();
+      break;
+    case Format::Prg:
+      Ok = ParsePrg();
+      break;
+    default:
+      Ok = ParseRaw(Address);
+      break;
+    }
+    if (!Ok) {
+      Close();
+    }
+    return Ok;
+  }
+
+  void Close()
+  {
+    Segments.clear();
+    Decoded.clear();
+    File.Close();
+  }
+
+  bool IsOpen() const { return File.IsOpen(); }
+
+  // Places the image in memory, borrowing its whole pages unless Borrow is
+  // false, in which case everything is copied. Device pages are skipped.
+  void Load(Mem &memory, bool Borrow = true) const
+  {
+    for (const Segment &S : Segments)
+    {
+      u32 At = S.Address;
+      const Byte *Data = S.Data;
+      u32 Left = S.Size;
+      while (Left > 0)
+      {
+        u32 Count = std::min(Mem::PAGE_SIZE - (At & 0xFF), Left);
+        if (Borrow && Count == Mem::PAGE_SIZE && Mem::CanBorrow(Data)) {
+          memory.BorrowPage((Byte)(At >> 8), Data);
+        } else {
+          memory.Load((Word)At, Data, Count);
+        }
+        At += Count;
+        Data += Count;
+        Left -= Count;
+      }
+    }
+  }
+
+  // True while memory still borrows a page of the image, so the image has
+  // to stay open. Pages stop being borrowed once they are written, loaded
+  // over or cleared.
+  bool Lends(const Mem &memory) const
+  {
+    for (u32 Page = 0; Page < Mem::PAGES; Page++)
+    {
+      if (!(memory.Trap[Page] & Mem::TRAP_BORROWED) || !memory.Pages[Page]) {
+        continue;
+      }
+      const Byte *Data = memory.Pages[Page]->Data;
+      for (const Segment &S : Segments) {
+        if (Data >= S.Data && Data < S.Data + S.Size) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  // Loads the image and powers cpu on with memory left as loaded, so it
+  // starts at the RESET vector.
+  void Boot(CPU &cpu, Mem &memory, bool Borrow = true) const
+  {
+    Load(memory, Borrow);
+    cpu.PowerOn(memory, Mem::RamInit::Untouched);
+  }
+
+private:
+  MappedFile File;
+  std::vector<Byte> Decoded; // Intel HEX data, which Segments point into
+
+  Format DetectFormat(const char *Path) const
+  {
+    std::string Name = Path;
+    size_t Dot = Name.rfind('.');
+    std::string Extension = Dot == std::string::npos ? "" : Name.substr(Dot + 1);
+    for (char &C : Extension) {
+      C = (char)std::tolower((unsigned char)C);
+    }
+    if (Extension == "hex" || Extension == "ihx" || Extension == "ihex") {
+      return Format::IntelHex;
+    }
+    if (Extension == "prg") {
+      return Format::Prg;
+    }
+    if (Extension == "bin" || Extension == "rom") {
+      return Format::Raw;
+    }
+    return File.Data()[0] == ':' ? Format::IntelHex : Format::Raw;
+  }
+
+  bool ParseRaw(s32 Address)
+  {
+    size_t Size = File.Size();
+    if (Size > Mem::MAX_MEM || Address < TOP) {
+      return false;
+    }
+    u32 Start = Address == TOP ? (u32)(Mem::MAX_MEM - Size) : (u32)Address;
+    if (Start + Size > Mem::MAX_MEM) {
+      return false;
+    }
+    Segments.push_back({(Word)Start, File.Data(), (u32)Size});
+    return true;
+  }
+
+  bool ParsePrg()
+  {
+    size_t Size = File.Size();
+    const Byte *Data = File.Data();
+    if (Size < 3) {
+      return false;
+    }
+    u32 Start = (u32)(Data[0] | (Data[1] << 8));
+    if (Start + (Size - 2) > Mem::MAX_MEM) {
+      return false;
+    }
+    Segments.push_back({(Word)Start, Data + 2, (u32)(Size - 2)});
+    return true;
+  }
+
+  static int HexDigit(Byte C)
+  {
+    if (C >= '0' && C <= '9') {
+      return C - '0';
+    }
+    C = (Byte)(C | 0x20);
+    return C >= 'a' && C <= 'f' ? C - 'a' + 10 : -1;
+  }
+
+  // Decodes every record into Decoded, merging records that continue one
+  // another into a single segment.
+  bool ParseIntelHex()
+  {
+    const Byte *Text = File.Data();
+    const size_t Size = File.Size();
+    struct Run
+    {
+      u32 Address, Offset, Size;
+    };
+    std::vector<Run> Runs;
+    std::vector<Byte> Record;
+    u32 Base = 0;
+    size_t At = 0;
+    bool Ended = false;
+    while (!Ended)
+    {
+      while (At < Size && std::isspace(Text[At])) {
+        At++;
+      }
+      if (At == Size) {
+        break;
+      }
+      if (Text[At++] != ':') {
+        return false;
+      }
+
+      // Count, address, type, data and checksum as bytes.
+      Record.clear();
+      Byte Sum = 0;
+      while (At + 1 < Size && HexDigit(Text[At]) >= 0 && HexDigit(Text[At + 1]) >= 0)
+      {
+        Byte Value = (Byte)(HexDigit(Text[At]) << 4 | HexDigit(Text[At + 1]));
+        Record.push_back(Value);
+        Sum = (Byte)(Sum + Value);
+        At += 2;
+      }
+      if (Record.size() < 5 || Record.size() != 5u + Record[0] || Sum != 0) {
+        return false;
+      }
+
+      const Byte Count = Record[0];
+      const u32 Offset = (u32)(Record[1] << 8 | Record[2]);
+      const Byte *Data = &Record[4];
+      switch (Record[3])
+      {
+      case 0x00: {
+        u32 Address = Base + Offset;
+        if (Address + Count > Mem::MAX_MEM) {
+          return false;
+        }
+        if (!Runs.empty() && Runs.back().Address + Runs.back().Size == Address) {
+          Runs.back().Size += Count;
+        } else {
+          // Lines the run up with the buffer so its whole pages can be borrowed.
+          Decoded.resize(Decoded.size() + ((Address - Decoded.size()) & 0xFF));
+          Runs.push_back({Address, (u32)Decoded.size(), Count});
+        }
+        Decoded.insert(Decoded.end(), Data, Data + Count);
+        break;
+      }
+      case 0x01:
+        Ended = true;
+        break;
+      case 0x02: // extended segment address
+      case 0x04: // extended linear address
+        if (Count != 2) {
+          return false;
+        }
+        Base = (u32)(Data[0] << 8 | Data[1]) << (Record[3] == 0x02 ? 4 : 16);
+        break;
+      case 0x03: // start segment address
+      case 0x05: // start linear address
+        break;
+      default:
+        return false;
+      }
+    }
+
+    for (const Run &R : Runs) {
+      Segments.push_back({(Word)R.Address, Decoded.data() + R.Offset, R.Size});
+    }
+    return true;
+  }
+};
@@ -0,0 +1,279 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include "6502_emulator.hpp"
+#include "mapped_file.hpp"
+
+// Save states: a CPU, with its interrupt lines, and its memory as a compact,
+// versioned byte image.
+// Saving the same machine always gives the same bytes.
+//
+// Memory is stored page by page, and only pages that hold something are
+// stored at all: zero pages are omitted, and a delta save against a base
+// image (the loaded program, say) also omits every page still equal to the
+// base. Under copy-on-write most such pages are still shared with the base,
+// which makes finding them nearly free. Device pages are not saved; devices
+// keep their own state.
+//
+// Stored pages are plain, aligned page images, so a MappedSaveState can mmap
+// the file and point a Mem's pages straight at it: restoring copies nothing,
+// and a page is only copied when the guest first writes to it.
+//
+// Layout, little-endian:
+//   0    "6502SAVE"
+//   8    u16 version, u16 flags (FLAG_DELTA)
+//   12   u32 number of stored pages
+//   16   u64 Hash() of the base image, 0 unless FLAG_DELTA
+//   24   PC u16, SP u16, A, X, Y, P (as GetStatus() returns it)
+//   32   IrqLines, interrupt flags (INT_*), 6 bytes of zeros
+//   40   one PageKind per page
+//   296  the stored pages in address order, Mem::PAGE_SIZE bytes each
+struct SaveState
+{
+  static constexpr char MAGIC[8] = {'6', '5', '0', '2', 'S', 'A', 'V', 'E'};
+  static constexpr Word VERSION = 3;
+  static constexpr Word FLAG_DELTA = 0x0001;
+
+  static constexpr Byte INT_NMI_PENDING = 0x01;
+  static constexpr Byte INT_BRK_HALTS = 0x02;
+
+  enum PageKind : Byte
+  {
+    PAGE_ZERO = 0,   // all zeros
+    PAGE_BASE = 1,   // same as the base image
+    PAGE_STORED = 2, // the next stored page
+    PAGE_DEVICE = 3, // mapped to a device when saved; left alone on restore
+  };
+
+  static constexpr size_t KINDS_OFFSET = 40;
+  static constexpr size_t PAGES_OFFSET = KINDS_OFFSET + Mem::PAGES;
+  static constexpr size_t PAGE_RECORD = Mem::PAGE_SIZE;
+
+  static_assert(PAGES_OFFSET % alignof(Mem::Page) == 0, "stored pages must be aligned to be borrowed in place");
+
+  // FNV-1a over the RAM, reading device pages as zeros. Identifies the
+  // base a delta was saved against.
+  static u64 Hash(const Mem &memory)
+  {
+    u64 H = 0xcbf29ce484222325ull;
+    for (u32 Page = 0; Page < Mem::PAGES; Page++)
+    {
+      const Mem::Page *P = memory.Pages[Page];
+      for (u32 I = 0; I < Mem::PAGE_SIZE; I++) {
+        H = (H ^ (P ? P->Data[I] : 0)) * 0x100000001b3ull;
+      }
+    }
+    return H;
+  }
+
+  // An image that delta states are saved against and restored onto, such
+  // as the freshly loaded program. It is hashed once here, so Memory must
+  // not change while the BaseImage is in use.
+  struct BaseImage
+  {
+    const Mem &Memory;
+    u64 Hash;
+
+    explicit BaseImage(const Mem &memory) : Memory(memory), Hash(SaveState::Hash(memory)) {}
+  };
+
+  // Serializes cpu and memory, as a delta against Base if one is given.
+  static std::vector<Byte> Save(const CPU &cpu, const Mem &memory, const BaseImage *Base = nullptr)
+  {
+    Byte Kinds[Mem::PAGES];
+    u32 Stored = 0;
+    for (u32 Page = 0; Page < Mem::PAGES; Page++)
+    {
+      Kinds[Page] = Classify(memory, Base, (Byte)Page);
+      Stored += Kinds[Page] == PAGE_STORED;
+    }
+
+    std::vector<Byte> Out(PAGES_OFFSET + Stored * PAGE_RECORD, 0);
+    std::memcpy(&Out[0], MAGIC, sizeof MAGIC);
+    Put16(&Out[8], VERSION);
+    Put16(&Out[10], Base ? FLAG_DELTA : 0);
+    Put32(&Out[12], Stored);
+    u64 BaseHash = Base ? Base->Hash : 0;
+    Put32(&Out[16], (u32)BaseHash);
+    Put32(&Out[20], (u32)(BaseHash >> 32));
+    Put16(&Out[24], cpu.PC);
+    Put16(&Out[26], cpu.SP);
+    Out[28] = cpu.A;
+    Out[29] = cpu.X;
+    Out[30] = cpu.Y;
+    Out[31] = cpu.GetStatus();
+    Out[32] = cpu.IrqLines;
+    Out[33] = (Byte)((cpu.NmiPending ? INT_NMI_PENDING : 0) | (cpu.BrkHalts ? INT_BRK_HALTS : 0));
+    std::memcpy(&Out[KINDS_OFFSET], Kinds, Mem::PAGES);
+
+    Byte *Record = &Out[PAGES_OFFSET];
+    for (u32 Page = 0; Page < Mem::PAGES; Page++)
+    {
+      if (Kinds[Page] == PAGE_STORED) {
+        std::memcpy(Record, memory.Pages[Page]->Data, Mem::PAGE_SIZE);
+        Record += PAGE_RECORD;
+      }
+    }
+    return Out;
+  }
+
+  static bool Write(const char *Path, const CPU &cpu, const Mem &memory, const BaseImage *Base = nullptr)
+  {
+    std::vector<Byte> Bytes = Save(cpu, memory, Base);
+    std::FILE *File = std::fopen(Path, "wb");
+    if (!File) {
+      return false;
+    }
+    bool Ok = std::fwrite(Bytes.data(), 1, Bytes.size(), File) == Bytes.size();
+    return std::fclose(File) == 0 && Ok;
+  }
+
+  // Checks that Size bytes at Data hold a save state this version can
+  // restore, against Base if it is a delta.
+  static bool Valid(const Byte *Data, size_t Size, const BaseImage *Base)
+  {
+    if (Size < PAGES_OFFSET || std::memcmp(Data, MAGIC, sizeof MAGIC) != 0 || Get16(Data + 8) != VERSION) {
+      return false;
+    }
+    u32 Stored = Get32(Data + 12);
+    u32 Counted = 0;
+    for (u32 Page = 0; Page < Mem::PAGES; Page++)
+    {
+      Byte Kind = Data[KINDS_OFFSET + Page];
+      if (Kind > PAGE_DEVICE || (Kind == PAGE_BASE && !(Get16(Data + 10) & FLAG_DELTA))) {
+        return false;
+      }
+      Counted += Kind == PAGE_STORED;
+    }
+    if (Counted != Stored || Size != PAGES_OFFSET + (size_t)Stored * PAGE_RECORD) {
+      return false;
+    }
+    if (Get16(Data + 10) & FLAG_DELTA) {
+      u64 BaseHash = (u64)Get32(Data + 16) | ((u64)Get32(Data + 20) << 32);
+      return Base && Base->Hash == BaseHash;
+    }
+    return true;
+  }
+
+  // Restores a save state held in memory into cpu and memory, copying the
+  // stored pages. Base must be the image a delta was saved against. Returns
+  // false, changing nothing, if the state is malformed or Base doesn't
+  // match.
+  static bool Restore(const Byte *Data, size_t Size, CPU &cpu, Mem &memory, const BaseImage *Base = nullptr)
+  {
+    if (!Valid(Data, Size, Base)) {
+      return false;
+    }
+    Apply(Data, cpu, memory, Base, [&memory](Byte Page, const Byte *Record) { memory.LoadPage(Page, Record); });
+    return true;
+  }
+
+  static bool Restore(const std::vector<Byte> &State, CPU &cpu, Mem &memory, const BaseImage *Base = nullptr)
+  {
+    return Restore(State.data(), State.size(), cpu, memory, Base);
+  }
+
+  // Restores the registers and every non-stored page, and hands each stored
+  // page to Store(Page, Record). Data must be Valid.
+  template <typename F>
+  static void Apply(const Byte *Data, CPU &cpu, Mem &memory, const BaseImage *Base, F &&Store)
+  {
+    cpu.PC = Get16(Data + 24);
+    cpu.SP = Get16(Data + 26);
+    cpu.A = Data[28];
+    cpu.X = Data[29];
+    cpu.Y = Data[30];
+    cpu.SetStatus(Data[31]);
+    cpu.IrqLines = Data[32];
+    cpu.NmiPending = (Data[33] & INT_NMI_PENDING) != 0;
+    cpu.BrkHalts = (Data[33] & INT_BRK_HALTS) != 0;
+
+    const Byte *Record = Data + PAGES_OFFSET;
+    for (u32 Page = 0; Page < Mem::PAGES; Page++)
+    {
+      switch (Data[KINDS_OFFSET + Page])
+      {
+      case PAGE_ZERO:
+        memory.SharePage((Byte)Page, nullptr);
+        break;
+      case PAGE_BASE:
+        memory.SharePage((Byte)Page, &Base->Memory);
+        break;
+      case PAGE_STORED:
+        Store((Byte)Page, Record);
+        Record += PAGE_RECORD;
+        break;
+      default:
+        break;
+      }
+    }
+  }
+
+private:
+  static Byte Classify(const Mem &memory, const BaseImage *Base, Byte Page)
+  {
+    const Mem::Page *P = memory.Pages[Page];
+    if (!P) {
+      return PAGE_DEVICE;
+    }
+    if (Base) {
+      const Mem::Page *B = Base->Memory.Pages[Page];
+      if (P == B || (B && std::memcmp(P->Data, B->Data, Mem::PAGE_SIZE) == 0)) {
+        return PAGE_BASE;
+      }
+    }
+    return memory.IsZeroPage(Page) ? PAGE_ZERO : PAGE_STORED;
+  }
+
+  static void Put16(Byte *Out, Word Value)
+  {
+    Out[0] = (Byte)Value;
+    Out[1] = (Byte)(Value >> 8);
+  }
+
+  static void Put32(Byte *Out, u32 Value)
+  {
+    for (int I = 0; I < 4; I++) {
+      Out[I] = (Byte)(Value >> (8 * I));
+    }
+  }
+
+  static Word Get16(const Byte *In) { return (Word)(In[0] | (In[1] << 8)); }
+
+  static u32 Get32(const Byte *In)
+  {
+    return (u32)In[0] | ((u32)In[1] << 8) | ((u32)In[2] << 16) | ((u32)In[3] << 24);
+  }
+};
+
+// A save-state file mapped into memory, for restoring many machines from
+// checkpoints cheaply. Restore points the machine's RAM pages straight at
+// the pages stored in the file instead of copying them; a page is copied
+// only when the guest first writes to it.
+//
+// Restored Mems, and copies of them, keep reading the file's pages, so the
+// MappedSaveState must outlive all of them.
+struct MappedSaveState
+{
+  bool Open(const char *Path) { return File.Open(Path); }
+  void Close() { File.Close(); }
+  bool IsOpen() const { return File.IsOpen(); }
+
+  // As SaveState::Restore, but borrowing the stored pages from the file.
+  bool Restore(CPU &cpu, Mem &memory, const SaveState::BaseImage *Base = nullptr) const
+  {
+    if (!File.IsOpen() || !SaveState::Valid(File.Data(), File.Size(), Base)) {
+      return false;
+    }
+    SaveState::Apply(File.Data(), cpu, memory, Base,
+                     [&memory](Byte Page, const Byte *Record) { memory.BorrowPage(Page, Record); });
+    return true;
+  }
+
+private:
+  MappedFile File;
+};
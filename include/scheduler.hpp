@@ -0,0 +1,118 @@
+#pragma once
+
+#include <algorithm>
+#include <functional>
+#include <vector>
+
+#include "6502_emulator.hpp"
+
+// Events at given CPU cycles, for devices that must act at exact times
+// (raise an interrupt, say) without being polled every instruction:
+//
+//   Scheduler events;
+//   events.After(1000, [](CPU &cpu, u64) { cpu.SetIrq(TIMER_IRQ, true); });
+//   events.Run(cpu, Cycles, memory);
+//
+// Run splits the budget into Execute slices that end at the next event, so
+// the hot loop never checks for devices; events then fire between
+// instructions, at most one instruction late. A guest idling until then in
+// a wait loop is fast-forwarded by Execute (see CPU::IDLE_CHECK_INTERVAL).
+// Now counts every cycle run through the Scheduler. Events are kept in a
+// min-heap on (cycle, order of scheduling), so events due together fire in
+// the order they were added.
+struct Scheduler
+{
+  // Called with the CPU and the cycle the event was due at, which Now may
+  // have passed by part of an instruction. Repeating events reschedule
+  // themselves from that cycle to stay on time.
+  using Callback = std::function<void(CPU &cpu, u64 Due)>;
+
+  u64 Now = 0;
+
+  // Schedules Fn for cycle Due and returns an id to cancel it by.
+  u64 At(u64 Due, Callback Fn)
+  {
+    u64 Id = ++LastId;
+    Events.push_back(Event{Due, Id, std::move(Fn)});
+    std::push_heap(Events.begin(), Events.end(), Later);
+    return Id;
+  }
+
+  u64 After(u64 Delay, Callback Fn) { return At(Now + Delay, std::move(Fn)); }
+
+  // False if the event has already fired or was cancelled.
+  bool Cancel(u64 Id)
+  {
+    auto It = std::find_if(Events.begin(), Events.end(), [Id](const Event &E) { return E.Id == Id; });
+    if (It == Events.end()) {
+      return false;
+    }
+    Events.erase(It);
+    std::make_heap(Events.begin(), Events.end(), Later);
+    return true;
+  }
+
+  bool Empty() const { return Events.empty(); }
+
+  // Cycle of the earliest event; only meaningful when not Empty.
+  u64 Next() const { return Events.front().Due; }
+
+  // Fires every event due by Now, including ones they schedule for Now.
+  void Fire(CPU &cpu)
+  {
+    while (!Events.empty() && Events.front().Due <= Now)
+    {
+      std::pop_heap(Events.begin(), Events.end(), Later);
+      Event E = std::move(Events.back());
+      Events.pop_back();
+      E.Fn(cpu, E.Due);
+    }
+  }
+
+  // As CPU::Execute, firing events on time along the way.
+  CPU::ExecResult Run(CPU &cpu, s32 Cycles, Mem &memory)
+  {
+    return Run(cpu, Cycles, [&cpu, &memory](s32 Slice) { return cpu.Execute(Slice, memory); });
+  }
+
+  // The same with another engine: Execute(Slice) runs cpu for Slice cycles
+  // the way CPU::Execute does, as BlockCache and CycleExact do.
+  template <typename F>
+  CPU::ExecResult Run(CPU &cpu, s32 Cycles, F &&Execute)
+  {
+    const s32 Budget = Cycles;
+    CPU::StopReason Reason = CPU::StopReason::Budget;
+    u64 Retired = 0;
+    Fire(cpu);
+    while (Cycles > 0)
+    {
+      s32 Slice = Cycles;
+      if (!Events.empty() && Next() - Now < (u64)Slice) {
+        Slice = (s32)(Next() - Now);
+      }
+      CPU::ExecResult Result = Execute(Slice);
+      Now += (u64)Result.CyclesConsumed;
+      Cycles -= Result.CyclesConsumed;
+      Retired += Result.InstructionsRetired;
+      Fire(cpu);
+      if (Result.Reason != CPU::StopReason::Budget) {
+        Reason = Result.Reason;
+        break;
+      }
+    }
+    return CPU::Finish(Reason, Budget, Cycles, Retired);
+  }
+
+private:
+  struct Event
+  {
+    u64 Due;
+    u64 Id; // also the order events were scheduled in
+    Callback Fn;
+  };
+
+  static bool Later(const Event &L, const Event &R) { return L.Due != R.Due ? L.Due > R.Due : L.Id > R.Id; }
+
+  std::vector<Event> Events;
+  u64 LastId = 0;
+};
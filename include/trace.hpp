@@ -0,0 +1,280 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "6502_emulator.hpp"
+
+// Instruction tracing for CPU::Execute. A Tracer is an Execute probe that
+// packs every retired instruction into a fixed-size TraceRecord and pushes
+// it into a single-producer, single-consumer ring; a writer thread drains
+// the ring into a binary trace file. The emulating thread never formats text
+// or touches the file: tracing costs it one 16-byte store per instruction,
+// plus waiting whenever the writer falls a whole ring behind.
+//
+// Trace files are little-endian:
+//   header   "6502TRCE", u16 version, u16 record size, u32 reserved (0)
+//   records  one per retired instruction, laid out as by TraceRecord::Encode
+// tools/trace_decode.cpp prints them as text.
+
+// One retired instruction: the cycle it started on, where it was, what it
+// was and the registers it left behind.
+struct TraceRecord
+{
+  u32 CycleLow;
+  Word CycleHigh; // the cycle count is kept to 48 bits
+  Word PC;
+  Word Operand;
+  Byte Opcode;
+  Byte A, X, Y;
+  Byte P;  // as GetStatus() returns it
+  Byte SP; // low byte; the stack is always page one
+
+  static constexpr size_t SIZE = 16;
+
+  u64 Cycle() const { return (u64)CycleLow | ((u64)CycleHigh << 32); }
+
+  // Spelled out byte by byte so compilers can merge the stores into a copy
+  // on little-endian hosts.
+  void Encode(Byte *Out) const
+  {
+    Out[0] = (Byte)CycleLow;
+    Out[1] = (Byte)(CycleLow >> 8);
+    Out[2] = (Byte)(CycleLow >> 16);
+    Out[3] = (Byte)(CycleLow >> 24);
+    Out[4] = (Byte)CycleHigh;
+    Out[5] = (Byte)(CycleHigh >> 8);
+    Out[6] = (Byte)PC;
+    Out[7] = (Byte)(PC >> 8);
+    Out[8] = (Byte)Operand;
+    Out[9] = (Byte)(Operand >> 8);
+    Out[10] = Opcode;
+    Out[11] = A;
+    Out[12] = X;
+    Out[13] = Y;
+    Out[14] = P;
+    Out[15] = SP;
+  }
+
+  static TraceRecord Decode(const Byte *In)
+  {
+    TraceRecord R;
+    R.CycleLow = (u32)In[0] | ((u32)In[1] << 8) | ((u32)In[2] << 16) | ((u32)In[3] << 24);
+    R.CycleHigh = (Word)(In[4] | (In[5] << 8));
+    R.PC = (Word)(In[6] | (In[7] << 8));
+    R.Operand = (Word)(In[8] | (In[9] << 8));
+    R.Opcode = In[10];
+    R.A = In[11];
+    R.X = In[12];
+    R.Y = In[13];
+    R.P = In[14];
+    R.SP = In[15];
+    return R;
+  }
+};
+
+static_assert(sizeof(TraceRecord) == TraceRecord::SIZE, "trace records are meant to stay compact");
+
+struct TraceFile
+{
+  static constexpr char MAGIC[8] = {'6', '5', '0', '2', 'T', 'R', 'C', 'E'};
+  static constexpr Word VERSION = 1;
+  static constexpr size_t HEADER_SIZE = 16;
+
+  static void EncodeHeader(Byte *Out)
+  {
+    std::memset(Out, 0, HEADER_SIZE);
+    std::memcpy(Out, MAGIC, sizeof MAGIC);
+    Out[8] = (Byte)VERSION;
+    Out[9] = (Byte)(VERSION >> 8);
+    Out[10] = (Byte)TraceRecord::SIZE;
+    Out[11] = (Byte)(TraceRecord::SIZE >> 8);
+  }
+
+  // Reads and checks the header; false if File doesn't hold a trace this
+  // version can decode.
+  static bool ReadHeader(std::FILE *File)
+  {
+    Byte Header[HEADER_SIZE];
+    if (std::fread(Header, 1, HEADER_SIZE, File) != HEADER_SIZE) {
+      return false;
+    }
+    Word Version = (Word)(Header[8] | (Header[9] << 8));
+    Word RecordSize = (Word)(Header[10] | (Header[11] << 8));
+    return std::memcmp(Header, MAGIC, sizeof MAGIC) == 0 && Version == VERSION &&
+           RecordSize == TraceRecord::SIZE;
+  }
+};
+
+// Bounded lock-free queue between exactly one producer thread and one
+// consumer thread. Each side owns one index and only reads the other's, so
+// handing items over costs a copy and a release store. Each side also caches
+// the other's index and rereads it only when the ring looks full or empty,
+// and the two sides' data sit on separate cache lines.
+template <typename T, size_t Capacity>
+struct SpscRing
+{
+  static_assert((Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+  SpscRing() : Slots(new T[Capacity]) {}
+
+  // Producer side. False if the ring is full.
+  bool TryPush(const T &Item)
+  {
+    size_t H = Head.load(std::memory_order_relaxed);
+    if (H - TailCache == Capacity) {
+      TailCache = Tail.load(std::memory_order_acquire);
+      if (H - TailCache == Capacity) {
+        return false;
+      }
+    }
+    Slots[H & (Capacity - 1)] = Item;
+    Head.store(H + 1, std::memory_order_release);
+    return true;
+  }
+
+  // Consumer side. Calls Fn(Index, Item) on up to Max items in place, in
+  // order, then frees their slots. Returns how many it consumed.
+  template <typename F>
+  size_t Consume(size_t Max, F &&Fn)
+  {
+    size_t Tl = Tail.load(std::memory_order_relaxed);
+    if (HeadCache == Tl) {
+      HeadCache = Head.load(std::memory_order_acquire);
+    }
+    size_t Count = std::min(Max, HeadCache - Tl);
+    for (size_t I = 0; I < Count; I++) {
+      Fn(I, Slots[(Tl + I) & (Capacity - 1)]);
+    }
+    Tail.store(Tl + Count, std::memory_order_release);
+    return Count;
+  }
+
+private:
+  alignas(64) std::atomic<size_t> Head{0};
+  size_t TailCache = 0; // producer's view of Tail
+  alignas(64) std::atomic<size_t> Tail{0};
+  size_t HeadCache = 0; // consumer's view of Head
+  alignas(64) std::unique_ptr<T[]> Slots;
+};
+
+// Execute probe that records a trace:
+//
+//   Tracer trace;
+//   trace.Open("run.trace");
+//   cpu.Execute(Cycles, memory, trace);
+//   trace.Close();
+//
+// Only one thread may run Execute with a given Tracer at a time. Clock keeps
+// counting across Execute calls, so a trace spanning many calls lines up.
+struct Tracer
+{
+  static constexpr bool Enabled = true;
+  static constexpr size_t RING_RECORDS = 1 << 16;
+
+  u64 Clock = 0;   // cycles retired so far
+  u64 Records = 0; // records queued since Open
+
+  Tracer() = default;
+  Tracer(const Tracer &) = delete;
+  Tracer &operator=(const Tracer &) = delete;
+  ~Tracer() { Close(); }
+
+  // Starts a trace file at Path, replacing any open one. False if the file
+  // can't be created.
+  bool Open(const char *Path)
+  {
+    Close();
+    File = std::fopen(Path, "wb");
+    if (!File) {
+      return false;
+    }
+    Byte Header[TraceFile::HEADER_SIZE];
+    TraceFile::EncodeHeader(Header);
+    Failed = std::fwrite(Header, 1, sizeof Header, File) != sizeof Header;
+    Records = 0;
+    Stopping.store(false, std::memory_order_relaxed);
+    Writer = std::thread([this] { Drain(); });
+    return true;
+  }
+
+  // Writes out everything still queued and closes the file. False if any
+  // of the trace failed to be written.
+  bool Close()
+  {
+    if (!File) {
+      return true;
+    }
+    Stopping.store(true, std::memory_order_release);
+    Writer.join();
+    bool Ok = !Failed && std::fclose(File) == 0;
+    File = nullptr;
+    return Ok;
+  }
+
+  bool IsOpen() const { return File != nullptr; }
+
+  void Retire(const CPU &cpu, Byte Opcode, Word PC, Word Operand, s32 Cycles)
+  {
+    TraceRecord R;
+    R.CycleLow = (u32)Clock;
+    R.CycleHigh = (Word)(Clock >> 32);
+    R.PC = PC;
+    R.Operand = Operand;
+    R.Opcode = Opcode;
+    R.A = cpu.A;
+    R.X = cpu.X;
+    R.Y = cpu.Y;
+    R.P = cpu.GetStatus();
+    R.SP = (Byte)cpu.SP;
+    Clock += (u64)Cycles;
+    if (EMU6502_UNLIKELY(!File)) {
+      return;
+    }
+    while (EMU6502_UNLIKELY(!Ring.TryPush(R)))
+    {
+      std::this_thread::yield();
+    }
+    Records++;
+  }
+
+private:
+  SpscRing<TraceRecord, RING_RECORDS> Ring;
+  std::FILE *File = nullptr;
+  std::thread Writer;
+  std::atomic<bool> Stopping{false};
+  bool Failed = false; // written by the writer thread until it is joined
+
+  void Drain()
+  {
+    constexpr size_t BATCH = 4096;
+    std::vector<Byte> Bytes(BATCH * TraceRecord::SIZE);
+    Byte *Out = Bytes.data();
+    for (;;)
+    {
+      // Checked before consuming, so records pushed ahead of Close are never
+      // left behind.
+      bool Stop = Stopping.load(std::memory_order_acquire);
+      size_t Count = Ring.Consume(BATCH, [Out](size_t I, const TraceRecord &R) {
+        R.Encode(Out + I * TraceRecord::SIZE);
+      });
+      if (Count == 0) {
+        if (Stop) {
+          break;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+        continue;
+      }
+      size_t Size = Count * TraceRecord::SIZE;
+      if (std::fwrite(Bytes.data(), 1, Size, File) != Size) {
+        Failed = true;
+      }
+    }
+  }
+};
@@ -0,0 +1,258 @@
+// The emu6502 library: the C interface declared in include/emu6502.h, and
+// the one compiled copy of CPU::Execute that programs linking the library
+// share (see EMU6502_LIBRARY in 6502_emulator.hpp).
+
+#include "emu6502.h"
+
+#include <algorithm>
+#include <memory>
+#include <new>
+#include <vector>
+#include "6502_emulator.hpp"
+#include "rom_loader.hpp"
+#include "save_state.hpp"
+
+template CPU::ExecResult CPU::Execute(s32 Cycles, Mem &memory, CPU::NoProbe &probe);
+
+struct emu6502_machine {
+    CPU cpu;
+    Mem mem;
+    // Armed on mem only while it holds something, so plain runs pay nothing.
+    Watchpoints watches;
+    // Loaded images lend their pages to mem, so each lives until mem no
+    // longer borrows any of them; see ReleaseImages.
+    std::vector<std::unique_ptr<RomImage>> images;
+};
+
+namespace {
+
+static_assert(static_cast<int>(CPU::StopReason::Budget) == EMU6502_STOP_BUDGET &&
+                  static_cast<int>(CPU::StopReason::Brk) == EMU6502_STOP_BRK &&
+                  static_cast<int>(CPU::StopReason::Illegal) == EMU6502_STOP_ILLEGAL &&
+                  static_cast<int>(CPU::StopReason::Breakpoint) == EMU6502_STOP_BREAKPOINT,
+              "stop reasons are part of the C ABI");
+static_assert(static_cast<int>(Watchpoints::Kind::None) == EMU6502_HIT_NONE &&
+                  static_cast<int>(Watchpoints::Kind::Break) == EMU6502_HIT_BREAK &&
+                  static_cast<int>(Watchpoints::Kind::Write) == EMU6502_HIT_WRITE,
+              "hit kinds are part of the C ABI");
+
+Mem::RamInit RamInit(int ram) {
+    switch (ram) {
+    case EMU6502_RAM_PATTERN:
+        return Mem::RamInit::Pattern;
+    case EMU6502_RAM_UNTOUCHED:
+        return Mem::RamInit::Untouched;
+    default:
+        return Mem::RamInit::Zero;
+    }
+}
+
+RomImage::Format Format(int format) {
+    switch (format) {
+    case EMU6502_FORMAT_RAW:
+        return RomImage::Format::Raw;
+    case EMU6502_FORMAT_INTEL_HEX:
+        return RomImage::Format::IntelHex;
+    case EMU6502_FORMAT_PRG:
+        return RomImage::Format::Prg;
+    default:
+        return RomImage::Format::Detect;
+    }
+}
+
+bool FitsMemory(uint16_t address, size_t size) {
+    return size <= Mem::MAX_MEM - address;
+}
+
+void Rearm(emu6502_machine *machine) {
+    machine->mem.Watch(machine->watches.Empty() ? nullptr : &machine->watches);
+}
+
+// Closes the images mem no longer borrows pages from, such as one loaded
+// over by another image of the same range.
+void ReleaseImages(emu6502_machine *machine) {
+    std::vector<std::unique_ptr<RomImage>> &images = machine->images;
+    images.erase(std::remove_if(images.begin(), images.end(),
+                                [machine](const std::unique_ptr<RomImage> &image) {
+                                    return !image->Lends(machine->mem);
+                                }),
+                 images.end());
+}
+
+// Host access to memory, unlike the CPU's, has no side effects: device
+// pages are not reached, reading as 0 and dropping writes, and watchpoints
+// do not fire. Writes invalidate code cached from the page.
+Byte Peek(const Mem &mem, Word address) {
+    return mem.Devices[address >> 8] ? 0 : mem.Read(address);
+}
+
+void Poke(Mem &mem, Word address, Byte value) {
+    Byte page = static_cast<Byte>(address >> 8);
+    if (!mem.Devices[page]) {
+        mem[address] = value;
+        mem.InvalidatePage(page);
+    }
+}
+
+} // namespace
+
+extern "C" {
+
+uint32_t emu6502_abi_version(void) {
+    return EMU6502_ABI_VERSION;
+}
+
+emu6502_machine *emu6502_create(void) {
+    emu6502_machine *machine = new (std::nothrow) emu6502_machine;
+    if (machine) {
+        machine->cpu.PowerOn(machine->mem);
+    }
+    return machine;
+}
+
+void emu6502_destroy(emu6502_machine *machine) {
+    delete machine;
+}
+
+void emu6502_power_on(emu6502_machine *machine, int ram) {
+    machine->cpu.PowerOn(machine->mem, RamInit(ram));
+    ReleaseImages(machine);
+}
+
+void emu6502_reset(emu6502_machine *machine) {
+    machine->cpu.Reset(machine->mem);
+}
+
+int emu6502_load_file(emu6502_machine *machine, const char *path, int format, int32_t address) {
+    std::unique_ptr<RomImage> image(new (std::nothrow) RomImage);
+    if (!image || !image->Open(path, Format(format), address)) {
+        return 0;
+    }
+    image->Load(machine->mem);
+    machine->images.push_back(std::move(image));
+    ReleaseImages(machine);
+    return 1;
+}
+
+int emu6502_run(emu6502_machine *machine, int32_t cycles, emu6502_result *result) {
+    // Execute only records hits while watches are armed; it keeps the last
+    // one until then, to resume past a breakpoint it stopped at.
+    if (!machine->mem.Watches) {
+        machine->watches.Last = Watchpoints::Hit{};
+    }
+    CPU::ExecResult exec = machine->cpu.Execute(cycles, machine->mem);
+    if (result) {
+        result->cycles = exec.CyclesConsumed;
+        result->overrun = exec.Overrun;
+        result->instructions = exec.InstructionsRetired;
+        result->reason = static_cast<int32_t>(exec.Reason);
+    }
+    return static_cast<int>(exec.Reason);
+}
+
+void emu6502_get_registers(const emu6502_machine *machine, emu6502_registers *registers) {
+    const CPU &cpu = machine->cpu;
+    registers->pc = cpu.PC;
+    registers->sp = static_cast<uint8_t>(cpu.SP);
+    registers->a = cpu.A;
+    registers->x = cpu.X;
+    registers->y = cpu.Y;
+    registers->p = cpu.GetStatus();
+}
+
+void emu6502_set_registers(emu6502_machine *machine, const emu6502_registers *registers) {
+    CPU &cpu = machine->cpu;
+    cpu.PC = registers->pc;
+    cpu.SP = static_cast<Word>(0x0100 | registers->sp);
+    cpu.A = registers->a;
+    cpu.X = registers->x;
+    cpu.Y = registers->y;
+    cpu.SetStatus(registers->p);
+}
+
+void emu6502_set_brk_halts(emu6502_machine *machine, int halts) {
+    machine->cpu.BrkHalts = halts != 0;
+}
+
+void emu6502_set_irq(emu6502_machine *machine, uint8_t lines, int asserted) {
+    machine->cpu.SetIrq(lines, asserted != 0);
+}
+
+void emu6502_nmi(emu6502_machine *machine) {
+    machine->cpu.Nmi();
+}
+
+void emu6502_set_breakpoint(emu6502_machine *machine, uint16_t address, int enabled) {
+    if (enabled) {
+        machine->watches.Break(address);
+    } else {
+        machine->watches.Unbreak(address);
+    }
+    Rearm(machine);
+}
+
+int emu6502_watch_writes(emu6502_machine *machine, uint16_t first, uint16_t last, int enabled) {
+    bool ok = true;
+    if (enabled) {
+        machine->watches.WatchWrites(first, last);
+    } else {
+        ok = machine->watches.UnwatchWrites(first, last);
+    }
+    Rearm(machine);
+    return ok ? 1 : 0;
+}
+
+int emu6502_last_hit(const emu6502_machine *machine, uint16_t *address, uint16_t *pc) {
+    const Watchpoints::Hit &hit = machine->watches.Last;
+    if (address) {
+        *address = hit.Address;
+    }
+    if (pc) {
+        *pc = hit.PC;
+    }
+    return static_cast<int>(hit.What);
+}
+
+uint8_t emu6502_read(const emu6502_machine *machine, uint16_t address) {
+    return Peek(machine->mem, address);
+}
+
+void emu6502_write(emu6502_machine *machine, uint16_t address, uint8_t value) {
+    Poke(machine->mem, address, value);
+}
+
+int emu6502_read_block(const emu6502_machine *machine, uint16_t address, uint8_t *data, size_t size) {
+    if (!FitsMemory(address, size)) {
+        return 0;
+    }
+    for (size_t i = 0; i < size; ++i) {
+        data[i] = Peek(machine->mem, static_cast<Word>(address + i));
+    }
+    return 1;
+}
+
+int emu6502_write_block(emu6502_machine *machine, uint16_t address, const uint8_t *data, size_t size) {
+    if (!FitsMemory(address, size)) {
+        return 0;
+    }
+    machine->mem.Load(address, data, static_cast<u32>(size));
+    return 1;
+}
+
+size_t emu6502_save_state(const emu6502_machine *machine, uint8_t *buffer, size_t capacity) {
+    std::vector<Byte> state = SaveState::Save(machine->cpu, machine->mem);
+    if (buffer && capacity >= state.size()) {
+        std::memcpy(buffer, state.data(), state.size());
+    }
+    return state.size();
+}
+
+int emu6502_restore_state(emu6502_machine *machine, const uint8_t *state, size_t size) {
+    if (!SaveState::Restore(state, size, machine->cpu, machine->mem)) {
+        return 0;
+    }
+    ReleaseImages(machine);
+    return 1;
+}
+
+} // extern "C"
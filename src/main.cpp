@@ -1,16 +1,135 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <limits>
+#include <string>
 #include "6502_emulator.hpp"
+#include "batch_runner.hpp"
+#include "rom_loader.hpp"
+
+constexpr Word fib_n_loc = 0x0010;
+constexpr Word fib_result_loc = 0x0011;
+
+// Loads the Fibonacci demo for n and points the CPU at it.
+static void LoadFibonacci(CPU &cpu, Mem &mem, int n) {
+    mem[fib_n_loc] = static_cast<Byte>(n);
+
+    Byte program[] = {
+        0xA9, 0x00,           // LDA #$00
+        0x85, fib_result_loc, // STA result
+        0xA9, 0x01,           // LDA #$01
+        0x85, 0x12,           // STA $12 (prev)
+        0xA6, fib_n_loc,      // LDX n (ZP)
+        0xE0, 0x00,           // CPX #$00
+        0xF0, 0x17,           // BEQ end_zero (to BRK)
+        0xE0, 0x01,           // CPX #$01
+        0xF0, 0x14,           // BEQ end_one
+        0xCA,                 // DEX (X = n-1)
+        // loop:
+        0x18,                 // CLC
+        0xA5, fib_result_loc, // LDA result
+        0x65, 0x12,           // ADC $12 (prev)
+        0x85, 0x13,           // STA $13 (sum)
+        0xA5, fib_result_loc, // LDA result
+        0x85, 0x12,           // STA $12 (prev = old result)
+        0xA5, 0x13,           // LDA $13 (sum)
+        0x85, fib_result_loc, // STA result
+        0xCA,                 // DEX
+        0xD0, 0xEE,           // BNE loop (relative -18)
+        // end_zero:
+        0x00,                 // BRK
+        // end_one:
+        0xA9, 0x01,           // LDA #$01
+        0x85, fib_result_loc, // STA result
+        0x00                  // BRK
+    };
+
+    // Load above the zero page so the variables at $10-$13 don't overlap the code
+    constexpr Word program_loc = 0x0200;
+    mem.Load(program_loc, program, sizeof(program));
+
+    cpu.PC = program_loc;
+}
+
+// Boots a ROM or program file through its RESET vector and runs it until it
+// halts or spends the cycle budget:
+//
+//   ./bin/main FILE [--format=raw|hex|prg] [--address=HEX] [--cycles=N]
+static int RunRom(int argc, char **argv) {
+    std::string path;
+    RomImage::Format format = RomImage::Format::Detect;
+    s32 address = RomImage::TOP;
+    long long cycles = 100000000;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--format=raw") {
+            format = RomImage::Format::Raw;
+        } else if (arg == "--format=hex") {
+            format = RomImage::Format::IntelHex;
+        } else if (arg == "--format=prg") {
+            format = RomImage::Format::Prg;
+        } else if (arg.rfind("--address=", 0) == 0) {
+            address = static_cast<s32>(std::strtol(arg.c_str() + 10, nullptr, 16) & 0xFFFF);
+        } else if (arg.rfind("--cycles=", 0) == 0) {
+            cycles = std::strtoll(arg.c_str() + 9, nullptr, 10);
+        } else if (path.empty() && arg.rfind("--", 0) != 0) {
+            path = arg;
+        } else {
+            path.clear();
+            break;
+        }
+    }
+    if (path.empty() || cycles <= 0) {
+        std::cerr << "usage: " << argv[0] << " FILE [--format=raw|hex|prg] [--address=HEX] [--cycles=N]\n";
+        return 2;
+    }
+
+    RomImage rom;
+    if (!rom.Open(path.c_str(), format, address)) {
+        std::cerr << "cannot load " << path << "\n";
+        return 1;
+    }
+    Mem mem;
+    CPU cpu;
+    rom.Boot(cpu, mem);
+
+    CPU::ExecResult exec;
+    u64 instructions = 0;
+    long long spent = 0;
+    while (spent < cycles) {
+        s32 budget = static_cast<s32>(std::min<long long>(cycles - spent, 1 << 30));
+        exec = cpu.Execute(budget, mem);
+        instructions += exec.InstructionsRetired;
+        spent += exec.CyclesConsumed;
+        if (exec.Reason != CPU::StopReason::Budget) {
+            break;
+        }
+    }
+
+    const char *reason = exec.Reason == CPU::StopReason::Brk       ? "BRK"
+                          : exec.Reason == CPU::StopReason::Illegal ? "illegal opcode"
+                                                                    : "cycle budget spent";
+    std::printf("%s after %llu instructions, %lld cycles\n", reason, static_cast<unsigned long long>(instructions),
+                spent);
+    std::printf("PC=%04X A=%02X X=%02X Y=%02X SP=%02X P=%02X\n", cpu.PC, cpu.A, cpu.X, cpu.Y, cpu.SP & 0xFF,
+                cpu.GetStatus());
+    return exec.Reason == CPU::StopReason::Illegal ? 1 : 0;
+}
 
+int main(int argc, char **argv) {
+    if (argc > 1) {
+        return RunRom(argc, argv);
+    }
 
-int main() {
     Mem mem;
     CPU cpu;
-    cpu.Reset(mem);
+    cpu.PowerOn(mem);
 
     std::cout << "Select demo:\n";
     std::cout << "  1) Calculator (+/-)\n";
     std::cout << "  2) Fibonacci sequence generator\n";
+    std::cout << "  3) Fibonacci 0-20 as a batch, one machine each\n";
     std::cout << "> ";
     int choice = 0;
     if (!(std::cin >> choice)) {
@@ -44,13 +163,14 @@ int main() {
         constexpr Word operand2_loc = 0x0011;
         constexpr Word result_loc   = 0x0012;
 
-        mem.Data[operand1_loc] = static_cast<Byte>(operand1);
-        mem.Data[operand2_loc] = static_cast<Byte>(operand2);
+        mem[operand1_loc] = static_cast<Byte>(operand1);
+        mem[operand2_loc] = static_cast<Byte>(operand2);
 
-        Byte program[10];
+        Byte program[11];
         size_t program_size = 0;
 
         if (operation == '+') {
+            program[program_size++] = static_cast<Byte>(CPU::Opcode::CLC);
             program[program_size++] = static_cast<Byte>(CPU::Opcode::LDA_ABS);
             program[program_size++] = operand1_loc & 0xFF;
             program[program_size++] = (operand1_loc >> 8) & 0xFF;
@@ -61,6 +181,7 @@ int main() {
             program[program_size++] = result_loc & 0xFF;
             program[program_size++] = (result_loc >> 8) & 0xFF;
         } else if (operation == '-') {
+            program[program_size++] = static_cast<Byte>(CPU::Opcode::SEC);
             program[program_size++] = static_cast<Byte>(CPU::Opcode::LDA_ABS);
             program[program_size++] = operand1_loc & 0xFF;
             program[program_size++] = (operand1_loc >> 8) & 0xFF;
@@ -75,14 +196,12 @@ int main() {
             return 1;
         }
 
-        for (size_t i = 0; i < program_size; i++) {
-            mem.Data[0x0000 + i] = program[i];
-        }
+        mem.Load(0x0000, program, static_cast<u32>(program_size));
 
         cpu.PC = 0x0000;
-        cpu.Execute(10, mem);
+        cpu.Execute(14, mem);
 
-        std::cout << "Result: " << static_cast<int>(static_cast<SByte>(mem.Data[result_loc])) << "\n";
+        std::cout << "Result: " << static_cast<int>(static_cast<SByte>(mem.Read(result_loc))) << "\n";
         return 0;
     }
 
@@ -95,52 +214,33 @@ int main() {
            return 1;
        }
 
-       constexpr Word n_loc = 0x0010;
-       constexpr Word result_loc = 0x0011;
-
-       mem.Data[n_loc] = static_cast<Byte>(n);
-
-       Byte program[] = {
-           0xA9, 0x00,       // LDA #$00
-           0x85, result_loc, // STA result
-           0xA9, 0x01,       // LDA #$01
-           0x85, 0x12,       // STA $12 (prev)
-           0xA6, n_loc,      // LDX n (ZP)
-           0xE0, 0x00,       // CPX #$00
-           0xF0, 0x17,       // BEQ end_zero (to BRK)
-           0xE0, 0x01,       // CPX #$01
-           0xF0, 0x14,       // BEQ end_one
-           0xCA,             // DEX (X = n-1)
-           // loop:
-           0x18,             // CLC
-           0xA5, result_loc, // LDA result
-           0x65, 0x12,       // ADC $12 (prev)
-           0x85, 0x13,       // STA $13 (sum)
-           0xA5, result_loc, // LDA result
-           0x85, 0x12,       // STA $12 (prev = old result)
-           0xA5, 0x13,       // LDA $13 (sum)
-           0x85, result_loc, // STA result
-           0xCA,             // DEX
-           0xD0, 0xEE,       // BNE loop (relative -18)
-           // end_zero:
-           0x00,             // BRK
-           // end_one:
-           0xA9, 0x01,       // LDA #$01
-           0x85, result_loc, // STA result
-           0x00              // BRK
-       };
-
-       for (size_t i = 0; i < sizeof(program); ++i) {
-           mem.Data[0x0000 + i] = program[i];
-       }
-
-       cpu.PC = 0x0000;
+       LoadFibonacci(cpu, mem, n);
        cpu.Execute(10000, mem);
 
-       std::cout << "Fibonacci(" << n << ") = " << static_cast<int>(mem.Data[result_loc]) << "\n";
+       std::cout << "Fibonacci(" << n << ") = " << static_cast<int>(mem.Read(fib_result_loc)) << "\n";
        return 0;
    }
 
+    if (choice == 3) {
+        // Load the program once; every machine starts as a copy of that image
+        // and shares its pages until it writes to them.
+        Mem image;
+        CPU boot;
+        boot.PowerOn(image);
+        LoadFibonacci(boot, image, 0);
+
+        BatchRunner batch;
+        for (int n = 0; n <= 20; ++n) {
+            BatchRunner::Instance &instance = batch.Add(boot, image);
+            instance.Memory[fib_n_loc] = static_cast<Byte>(n);
+        }
+        batch.Run(10000);
+        for (size_t n = 0; n < batch.Size(); ++n) {
+            std::cout << "Fibonacci(" << n << ") = " << static_cast<int>(batch[n].Memory.Read(fib_result_loc)) << "\n";
+        }
+        return 0;
+    }
+
     std::cerr << "Unknown choice\n";
     return 1;
 }
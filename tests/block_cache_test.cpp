@@ -0,0 +1,216 @@
+// Differential tests of BlockCache against CPU::Execute: the same program
+// run by both, sliced the same way, must leave identical registers, memory
+// and results after every slice.
+
+#include <random>
+#include <vector>
+#include "block_cache.hpp"
+#include "check.hpp"
+#include "machine.hpp"
+
+namespace {
+
+// Runs both machines in slices of slice cycles until they stop or spend
+// budget, checking they agree after each slice.
+void run_both(Machine &interp, Machine &cached, s32 slice, BlockCache &cache, s32 budget = 200000) {
+    for (s32 spent = 0; spent < budget;) {
+        CPU::ExecResult want = interp.cpu.Execute(slice, interp.mem);
+        CPU::ExecResult got = cache.Execute(cached.cpu, slice, cached.mem);
+        CHECK(got.Reason == want.Reason);
+        CHECK(got.CyclesConsumed == want.CyclesConsumed);
+        CHECK(got.Overrun == want.Overrun);
+        CHECK(got.InstructionsRetired == want.InstructionsRetired);
+        CHECK(cached.cpu.LoopState() == interp.cpu.LoopState());
+        CHECK(same_memory(cached.mem, interp.mem));
+        if (check::failures() != 0 || want.Reason != CPU::StopReason::Budget) {
+            break;
+        }
+        spent += want.CyclesConsumed;
+    }
+}
+
+// As above for a program loaded at program_loc. Returns the interpreter's
+// final state.
+Machine run_both(const Byte *program, u32 size, s32 slice, BlockCache &cache, s32 budget = 200000) {
+    Machine interp = boot(program, size);
+    Machine cached = boot(program, size);
+    run_both(interp, cached, slice, cache, budget);
+    return interp;
+}
+
+// Rewrites the operand of the LDA after it on every pass, so the loop's
+// block goes stale halfway through each time it runs, and is given back to
+// the interpreter after BlockCache::MaxDecodes decodes.
+const Byte self_modifying[] = {
+    0xA2, 0x40,       // LDX #$40
+    0xEE, 0x06, 0x02, // loop: INC $0206 (the LDA operand)
+    0xA9, 0x00,       // LDA #$00
+    0xCA,             // DEX
+    0xD0, 0xF8,       // BNE loop
+    0x00,             // BRK
+};
+
+// A loop that never gets hot, then one that does, summing into $10.
+const Byte cold_then_hot[] = {
+    0xA2, 0x05,       // LDX #$05
+    0x18,             // cold: CLC
+    0xA5, 0x10,       // LDA $10
+    0x69, 0x03,       // ADC #$03
+    0x85, 0x10,       // STA $10
+    0xCA,             // DEX
+    0xD0, 0xF6,       // BNE cold
+    0xA0, 0x00,       // LDY #$00
+    0x98,             // hot: TYA
+    0x99, 0x00, 0x03, // STA $0300,Y
+    0xC8,             // INY
+    0xD0, 0xF9,       // BNE hot
+    0x00,             // BRK
+};
+
+void test_self_modifying_code() {
+    for (s32 slice : {1, 3, 7, 100000}) {
+        BlockCache cache;
+        Machine end = run_both(self_modifying, sizeof(self_modifying), slice, cache);
+        CHECK(end.cpu.A == 0x40);
+        CHECK(end.mem.Read(0x0206) == 0x40);
+        CHECK(cache.Blocks[0x0202].Decodes == BlockCache::MaxDecodes);
+    }
+}
+
+void test_cold_and_hot_code() {
+    for (s32 slice : {1, 2, 5, 11, 100000}) {
+        BlockCache cache;
+        Machine end = run_both(cold_then_hot, sizeof(cold_then_hot), slice, cache);
+        CHECK(end.mem.Read(0x0010) == 15);
+        CHECK(end.mem.Read(0x03FF) == 0xFF);
+        CHECK(cache.Blocks[0x0202].Decodes == 0);
+        CHECK(cache.Blocks[0x020E].Decodes == 1);
+    }
+}
+
+// Loops whose code sits on the zero page and on the stack page, where
+// zero-page stores and pushes land: each rewrites the operand of the LDA
+// after the store, and keeps what it loaded in $0300 on.
+void test_code_on_pages_stores_reach() {
+    const Byte zero_page[] = {
+        0xA2, 0x30,       // LDX #$30
+        0xE6, 0x85,       // loop: INC $85 (the LDA operand)
+        0xA9, 0x00,       // LDA #$00
+        0x9D, 0x00, 0x03, // STA $0300,X
+        0xCA,             // DEX
+        0xD0, 0xF6,       // BNE loop
+        0x00,             // BRK
+    };
+    const Byte stack_page[] = {
+        0xA2, 0x29,       // LDX #$29
+        0x9A,             // TXS: pushes land on $0129, the LDA operand
+        0xA0, 0x30,       // LDY #$30
+        0x98,             // loop: TYA
+        0x48,             // PHA
+        0x68,             // PLA
+        0xA9, 0x00,       // LDA #$00
+        0x99, 0x00, 0x03, // STA $0300,Y
+        0x88,             // DEY
+        0xD0, 0xF5,       // BNE loop
+        0x00,             // BRK
+    };
+    for (s32 slice : {1, 5, 100000}) {
+        BlockCache cache;
+        Machine interp = boot(zero_page, sizeof(zero_page), 0x0080);
+        Machine cached = boot(zero_page, sizeof(zero_page), 0x0080);
+        run_both(interp, cached, slice, cache);
+        CHECK(interp.cpu.A == 0x30);
+
+        BlockCache stack_cache;
+        Machine stack_interp = boot(stack_page, sizeof(stack_page), 0x0120);
+        Machine stack_cached = boot(stack_page, sizeof(stack_page), 0x0120);
+        run_both(stack_interp, stack_cached, slice, stack_cache);
+        CHECK(stack_interp.cpu.A == 0x01);
+    }
+}
+
+// Counts its reads, so reading it ahead of time would show.
+struct Counter : Device {
+    Byte count = 0;
+    Byte Read(Word) override { return count++; }
+    void Write(Word, Byte value) override { count = value; }
+};
+
+// A hot loop polling a device and copying what it reads into RAM.
+void test_device_reads() {
+    const Byte program[] = {
+        0xA0, 0x00,       // LDY #$00
+        0xAD, 0x00, 0xC0, // loop: LDA $C000
+        0x99, 0x00, 0x03, // STA $0300,Y
+        0xC8,             // INY
+        0xD0, 0xF7,       // BNE loop
+        0x00,             // BRK
+    };
+    for (s32 slice : {1, 7, 100000}) {
+        BlockCache cache;
+        Counter interp_device, cached_device;
+        Machine interp = boot(program, sizeof(program));
+        Machine cached = boot(program, sizeof(program));
+        interp.mem.Map(0xC0, 1, interp_device);
+        cached.mem.Map(0xC0, 1, cached_device);
+        run_both(interp, cached, slice, cache);
+        CHECK(interp.mem.Read(0x03FF) == 0xFF);
+        CHECK(cached_device.count == interp_device.count);
+    }
+}
+
+// Random loop bodies built from every opcode that neither halts nor changes
+// the flow of control, with operands aimed at the zero page, the stack, the
+// code itself and data, so some of them rewrite the loop as it runs.
+void test_random_loops() {
+    std::vector<Byte> straight;
+    for (u32 op = 0; op < 256; ++op) {
+        if (!DispatchTable[op].EndsBlock && !DispatchTable[op].Halts) {
+            straight.push_back(static_cast<Byte>(op));
+        }
+    }
+    const Byte high_bytes[] = {0x00, 0x01, 0x02, 0x03, 0x04};
+    std::mt19937 random(6502);
+    for (int round = 0; round < 300; ++round) {
+        std::vector<Byte> program = {0xA9, 0x28, 0x85, 0xF0}; // LDA #$28, STA $F0
+        Word loop = static_cast<Word>(program_loc + program.size());
+        int ops = 1 + static_cast<int>(random() % 24);
+        for (int i = 0; i < ops; ++i) {
+            Byte op = straight[random() % straight.size()];
+            program.push_back(op);
+            if (DispatchTable[op].Length > 1) {
+                // Keep clear of $F0, the loop counter, most of the time.
+                program.push_back(static_cast<Byte>(random() % 0xE0));
+            }
+            if (DispatchTable[op].Length > 2) {
+                program.push_back(high_bytes[random() % sizeof(high_bytes)]);
+            }
+        }
+        program.insert(program.end(), {0xC6, 0xF0}); // DEC $F0
+        s32 back = loop - static_cast<s32>(program_loc + program.size() + 2);
+        if (back < -128) {
+            continue;
+        }
+        program.insert(program.end(), {0xD0, static_cast<Byte>(back), 0x00}); // BNE loop, BRK
+
+        Machine interp = boot(program.data(), static_cast<u32>(program.size()));
+        Machine cached = boot(program.data(), static_cast<u32>(program.size()));
+        BlockCache cache;
+        run_both(interp, cached, 1 + static_cast<s32>(random() % 64), cache, 20000);
+        if (check::failures() != 0) {
+            std::fprintf(stderr, "random loop %d failed\n", round);
+            return;
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    test_self_modifying_code();
+    test_cold_and_hot_code();
+    test_code_on_pages_stores_reach();
+    test_device_reads();
+    test_random_loops();
+    return check::result();
+}
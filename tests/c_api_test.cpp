@@ -0,0 +1,79 @@
+// The C interface: host reads and writes stay off the bus, and images are
+// closed once memory no longer holds any of their pages.
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include "check.hpp"
+#include "emu6502.h"
+
+namespace {
+
+// Writing to a watched range from the host is not a store by the program.
+void test_host_writes_skip_watchpoints() {
+    emu6502_machine *m = emu6502_create();
+    CHECK(emu6502_watch_writes(m, 0x0300, 0x03FF, 1));
+    emu6502_write(m, 0x0310, 0x42);
+    CHECK(emu6502_read(m, 0x0310) == 0x42);
+    CHECK(emu6502_last_hit(m, nullptr, nullptr) == EMU6502_HIT_NONE);
+
+    // The program's own store still stops it.
+    const uint8_t program[] = {0x8D, 0x11, 0x03, 0x00}; // STA $0311, BRK
+    CHECK(emu6502_write_block(m, 0x0200, program, sizeof(program)));
+    emu6502_registers regs;
+    emu6502_get_registers(m, &regs);
+    regs.pc = 0x0200;
+    emu6502_set_registers(m, &regs);
+    CHECK(emu6502_run(m, 100, nullptr) == EMU6502_STOP_BREAKPOINT);
+    uint16_t address = 0;
+    CHECK(emu6502_last_hit(m, &address, nullptr) == EMU6502_HIT_WRITE);
+    CHECK(address == 0x0311);
+    emu6502_destroy(m);
+}
+
+// How many mappings of path the process holds, or -1 where that can't be
+// told.
+int mappings_of(const std::string &path) {
+    std::ifstream maps("/proc/self/maps");
+    if (!maps) {
+        return -1;
+    }
+    int count = 0;
+    for (std::string line; std::getline(maps, line);) {
+        count += line.find(path) != std::string::npos;
+    }
+    return count;
+}
+
+void test_images_released() {
+    const std::string path = "c_api_test.rom";
+    {
+        std::ofstream rom(path, std::ios::binary);
+        std::string page(256, '\xEA');
+        rom << page << page;
+    }
+    emu6502_machine *m = emu6502_create();
+    CHECK(emu6502_load_file(m, path.c_str(), EMU6502_FORMAT_RAW, 0x8000));
+    CHECK(emu6502_read(m, 0x81FF) == 0xEA);
+    int once = mappings_of(path);
+    if (once > 0) {
+        // Loading over the same range replaces the image.
+        CHECK(emu6502_load_file(m, path.c_str(), EMU6502_FORMAT_RAW, 0x8000));
+        CHECK(mappings_of(path) == once);
+        // Powering on clears memory, so nothing is borrowed any more.
+        emu6502_power_on(m, EMU6502_RAM_ZERO);
+        CHECK(mappings_of(path) == 0);
+        CHECK(emu6502_read(m, 0x8000) == 0x00);
+    }
+    emu6502_destroy(m);
+    std::remove(path.c_str());
+}
+
+} // namespace
+
+int main() {
+    test_host_writes_skip_watchpoints();
+    test_images_released();
+    return check::result();
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+// Just enough of a test framework for the programs in tests/: CHECK reports
+// a failed condition and carries on, and main returns check::result() so
+// CTest sees whether anything failed.
+
+#include <cstdio>
+
+namespace check {
+
+inline int &failures() {
+    static int count = 0;
+    return count;
+}
+
+inline void fail(const char *file, int line, const char *what) {
+    std::fprintf(stderr, "%s:%d: CHECK failed: %s\n", file, line, what);
+    ++failures();
+}
+
+inline int result() {
+    if (failures() != 0) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures());
+        return 1;
+    }
+    std::puts("ok");
+    return 0;
+}
+
+} // namespace check
+
+#define CHECK(cond)                                 \
+    do {                                            \
+        if (!(cond)) {                              \
+            check::fail(__FILE__, __LINE__, #cond); \
+        }                                           \
+    } while (0)
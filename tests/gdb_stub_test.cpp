@@ -0,0 +1,134 @@
+// The GDB stub's packet handling, driven over a socketpair: a script of
+// packets is queued on one end, the stub serves the other from Run, and
+// its replies are checked in order. Writes that can't land whole, with a
+// bad hex digit, on a device page or past $FFFF, are refused and change
+// nothing.
+
+#include <sys/socket.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include "check.hpp"
+#include "gdb_stub.hpp"
+
+namespace {
+
+constexpr Word program_loc = 0x0200;
+constexpr Byte device_page = 0xC0;
+
+std::string packet(const std::string &data) {
+    unsigned sum = 0;
+    for (char c : data) {
+        sum += static_cast<unsigned char>(c);
+    }
+    char tail[4];
+    std::snprintf(tail, sizeof tail, "#%02x", sum & 0xFF);
+    return "$" + data + tail;
+}
+
+// The payloads of the packets in stream, acks skipped.
+std::vector<std::string> packets(const std::string &stream) {
+    std::vector<std::string> found;
+    size_t start = stream.find('$');
+    while (start != std::string::npos) {
+        size_t hash = stream.find('#', start);
+        if (hash == std::string::npos) {
+            break;
+        }
+        found.push_back(stream.substr(start + 1, hash - start - 1));
+        start = stream.find('$', hash);
+    }
+    return found;
+}
+
+struct Counter : Device {
+    u32 reads = 0;
+    u32 writes = 0;
+    Byte Read(Word) override {
+        ++reads;
+        return 0x77;
+    }
+    void Write(Word, Byte) override { ++writes; }
+};
+
+void test_packets() {
+    const Byte program[] = {0xEA, 0xEA, 0xEA, 0x00}; // NOP, NOP, NOP, BRK
+    Mem mem;
+    mem.Load(program_loc, program, sizeof(program));
+    CPU cpu;
+    cpu.PowerOn(mem, Mem::RamInit::Untouched);
+    Counter device;
+    mem.Map(device_page, 1, device);
+
+    // Each packet with the reply it must get; c gets none until the
+    // breakpoint stops it.
+    const std::vector<std::pair<std::string, std::string>> script = {
+        {"QStartNoAckMode", "OK"},
+        {"?", "S05"},
+        {"P0=5a", "OK"},
+        {"p0", "5a"},
+        {"M300,3:0102ff", "OK"},
+        {"m300,3", "0102ff"},
+        {"M300,2:12zz", "E01"},       // bad digit: the first byte isn't written either
+        {"m300,2", "0102"},
+        {"M310,2:12", "E01"},         // shorter than its length
+        {"MBFFF,2:aabb", "E01"},      // runs onto the device page
+        {"mbfff,1", "00"},
+        {"mc000,1", "00"},            // the device isn't read
+        {"MFFFF,2:aabb", "E01"},      // runs past $FFFF
+        {"M10000,1:aa", "E01"},
+        {"MFFFF,1:cc", "OK"},
+        {"Z0,202,1", "OK"},
+        {"P4=0002", "OK"},            // PC, little-endian
+        {"c", "S05"},                 // stops at the breakpoint
+        {"p4", "0202"},
+        {"D", "OK"},
+    };
+    std::string input;
+    for (const auto &step : script) {
+        input += packet(step.first);
+        if (step.first == "QStartNoAckMode") {
+            input += "+"; // acknowledges the OK; nothing after it is
+        }
+    }
+
+    int ends[2];
+    CHECK(::socketpair(AF_UNIX, SOCK_STREAM, 0, ends) == 0);
+    CHECK(::write(ends[1], input.data(), input.size()) == static_cast<ssize_t>(input.size()));
+    GdbStub gdb;
+    CHECK(gdb.Attach(ends[0]));
+    gdb.Run(cpu, 1000, mem);
+    CHECK(!gdb.Attached());
+
+    std::string output;
+    char buffer[4096];
+    for (ssize_t count; (count = ::read(ends[1], buffer, sizeof buffer)) > 0;) {
+        output.append(buffer, static_cast<size_t>(count));
+    }
+    ::close(ends[1]);
+
+    std::vector<std::string> replies = packets(output);
+    CHECK(replies.size() == script.size());
+    for (size_t i = 0; i < replies.size() && i < script.size(); ++i) {
+        if (replies[i] != script[i].second) {
+            std::fprintf(stderr, "%s: got %s, want %s\n", script[i].first.c_str(), replies[i].c_str(),
+                         script[i].second.c_str());
+            CHECK(replies[i] == script[i].second);
+        }
+    }
+
+    CHECK(cpu.A == 0x5A);
+    CHECK(mem.Read(0x0300) == 0x01 && mem.Read(0x0301) == 0x02 && mem.Read(0x0302) == 0xFF);
+    CHECK(mem.Read(0x0310) == 0x00);
+    CHECK(mem.Read(0xBFFF) == 0x00);
+    CHECK(mem.Read(0xFFFF) == 0xCC);
+    CHECK(device.reads == 0);
+    CHECK(device.writes == 0);
+}
+
+} // namespace
+
+int main() {
+    test_packets();
+    return check::result();
+}
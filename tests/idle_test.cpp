@@ -0,0 +1,143 @@
+// Idle loop skipping: Execute fast-forwarding a wait loop must end every
+// call exactly where it does when it interprets each iteration under a probe
+// that sees every instruction, and an IdleLog must hear about what it
+// skipped. A loop polling a device is never skipped.
+
+#include "check.hpp"
+#include "machine.hpp"
+#include "profiler.hpp"
+#include "scheduler.hpp"
+
+namespace {
+
+constexpr Word flag = 0x0010;
+constexpr Byte device_page = 0xC0;
+
+// Sees every instruction, so Execute skips nothing under it.
+struct Stepper {
+    static constexpr bool Enabled = true;
+    void Retire(const CPU &, Byte, Word, Word, s32) {}
+};
+
+// Six cycles a time round until flag is set.
+const Byte wait_loop[] = {
+    0xA5, flag, // loop: LDA flag
+    0xF0, 0xFC, // BEQ loop
+    0x00,       // BRK
+};
+
+const Byte poll_loop[] = {
+    0xAD, 0x00, device_page, // loop: LDA $C000
+    0xF0, 0xFB,              // BEQ loop
+    0x00,                    // BRK
+};
+
+// Reads as zero until it has been read ready_after times.
+struct Ready : Device {
+    u32 reads = 0;
+    u32 ready_after = 0;
+    Byte Read(Word) override { return ++reads > ready_after ? 1 : 0; }
+    void Write(Word, Byte) override {}
+};
+
+bool same(const CPU::ExecResult &a, const CPU::ExecResult &b) {
+    return a.Reason == b.Reason && a.CyclesConsumed == b.CyclesConsumed && a.Overrun == b.Overrun &&
+           a.InstructionsRetired == b.InstructionsRetired;
+}
+
+// Runs the three machines for rounds calls of slice cycles each: plain
+// Execute, Execute with idle logging, and Execute stepping through every
+// instruction; each call must end the same way on all three.
+void compare(Machine &plain, Machine &logged, Machine &stepped, s32 slice, int rounds, IdleLog &idle) {
+    Stepper stepper;
+    for (int round = 0; round < rounds; ++round) {
+        CPU::ExecResult want = stepped.cpu.Execute(slice, stepped.mem, stepper);
+        CHECK(same(plain.cpu.Execute(slice, plain.mem), want));
+        CHECK(same(logged.cpu.Execute(slice, logged.mem, idle), want));
+        CHECK(plain.cpu.LoopState() == stepped.cpu.LoopState());
+        CHECK(logged.cpu.LoopState() == stepped.cpu.LoopState());
+        CHECK(same_memory(plain.mem, stepped.mem));
+        CHECK(same_memory(logged.mem, stepped.mem));
+        if (want.Reason != CPU::StopReason::Budget) {
+            return;
+        }
+    }
+}
+
+void test_wait_loop() {
+    for (s32 slice : {1, 2, 5, 6, 7, 12, 13, 100, 383, 384, 385, 4099, 100000, 1 << 24}) {
+        Machine plain = boot(wait_loop, sizeof(wait_loop));
+        Machine logged = plain, stepped = plain;
+        IdleLog idle;
+        compare(plain, logged, stepped, slice, 6, idle);
+        if (slice >= 100000) {
+            auto loop = idle.Loops.find(program_loc);
+            CHECK(idle.Loops.size() == 1 && loop != idle.Loops.end());
+            if (loop != idle.Loops.end()) {
+                CHECK(loop->second.Skips == 6);
+                CHECK(loop->second.Cycles == loop->second.Iterations * 6);
+                CHECK(loop->second.Cycles > 6 * static_cast<u64>(slice - 100));
+            }
+        }
+        if (check::failures() != 0) {
+            std::fprintf(stderr, "wait loop in slices of %d failed\n", slice);
+            return;
+        }
+    }
+}
+
+// Under a Scheduler, an event setting the flag ends the wait on time.
+void test_wait_loop_until_event() {
+    for (u64 due : {1ull, 10ull, 1000ull, 123457ull}) {
+        Machine skipping = boot(wait_loop, sizeof(wait_loop));
+        Machine stepped = skipping;
+        Scheduler skipping_events, stepped_events;
+        skipping_events.At(due, [&skipping](CPU &, u64) { skipping.mem[flag] = 1; });
+        stepped_events.At(due, [&stepped](CPU &, u64) { stepped.mem[flag] = 1; });
+        IdleLog idle;
+        Stepper stepper;
+        auto skip = [&skipping, &idle](s32 slice) { return skipping.cpu.Execute(slice, skipping.mem, idle); };
+        auto step = [&stepped, &stepper](s32 slice) { return stepped.cpu.Execute(slice, stepped.mem, stepper); };
+        CPU::ExecResult got = skipping_events.Run(skipping.cpu, 1 << 20, skip);
+        CPU::ExecResult want = stepped_events.Run(stepped.cpu, 1 << 20, step);
+        CHECK(want.Reason == CPU::StopReason::Brk);
+        CHECK(same(got, want));
+        CHECK(skipping.cpu.LoopState() == stepped.cpu.LoopState());
+        CHECK(skipping_events.Now == stepped_events.Now);
+        CHECK(skipping_events.Now >= due);
+        CHECK(due < 1000 || idle.TotalCycles() > due / 2);
+    }
+}
+
+// Every read may change what the device says, so polling it is never
+// skipped, and it sees the same reads either way.
+void test_device_poll() {
+    for (s32 slice : {1, 7, 100, 5000, 1 << 20}) {
+        Ready plain_device, logged_device, stepped_device;
+        plain_device.ready_after = logged_device.ready_after = stepped_device.ready_after = 3000;
+        Machine plain = boot(poll_loop, sizeof(poll_loop));
+        Machine logged = plain, stepped = plain;
+        plain.mem.Map(device_page, 1, plain_device);
+        logged.mem.Map(device_page, 1, logged_device);
+        stepped.mem.Map(device_page, 1, stepped_device);
+        IdleLog idle;
+        compare(plain, logged, stepped, slice, 100000, idle);
+        CHECK(stepped.cpu.A == 1);
+        CHECK(idle.Loops.empty());
+        CHECK(plain_device.reads == stepped_device.reads);
+        CHECK(logged_device.reads == stepped_device.reads);
+        if (check::failures() != 0) {
+            std::fprintf(stderr, "device poll in slices of %d failed\n", slice);
+            return;
+        }
+    }
+}
+
+} // namespace
+
+int main() {
+    test_wait_loop();
+    test_wait_loop_until_event();
+    test_device_poll();
+    return check::result();
+}
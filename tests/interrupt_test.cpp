@@ -0,0 +1,195 @@
+// Interrupts and the Scheduler: IRQs raised by events are taken at the
+// slice boundary the event ends, with the interrupted PC and status on the
+// stack; NMI goes before IRQ; a held IRQ gets in after CLI, PLP and RTI
+// unmask it; BRK can run as a software interrupt; and events fire in
+// (cycle, scheduling order) order unless cancelled.
+
+#include <vector>
+#include "check.hpp"
+#include "machine.hpp"
+#include "scheduler.hpp"
+
+namespace {
+
+constexpr Word irq_handler = 0x0400;
+constexpr Word nmi_handler = 0x0500;
+constexpr Byte line = 0x01;
+constexpr Byte illegal = 0x02; // stops Execute where it stands
+
+// CLI, then waits in JMP loop at program_loc + 1.
+const Byte waiting[] = {0x58, 0x4C, 0x01, 0x02};
+
+// Boots program with the IRQ and NMI vectors pointing at the handlers,
+// which stop Execute unless given code of their own.
+Machine boot_with_handlers(const Byte *program, u32 size) {
+    Machine m = boot(program, size);
+    const Byte vectors[] = {nmi_handler & 0xFF, nmi_handler >> 8, 0, 0, irq_handler & 0xFF, irq_handler >> 8};
+    m.mem.Load(CPU::NMI_VECTOR, vectors, sizeof(vectors));
+    m.mem.Load(irq_handler, &illegal, 1);
+    m.mem.Load(nmi_handler, &illegal, 1);
+    return m;
+}
+
+// What the last interrupt pushed, from the stack below sp.
+struct Pushed {
+    Word pc;
+    Byte status;
+};
+
+Pushed pushed(const Machine &m, Word sp) {
+    Word pc_high = static_cast<Word>(0x0100 | (sp & 0xFF));
+    Word pc_low = static_cast<Word>(0x0100 | ((sp - 1) & 0xFF));
+    Word status = static_cast<Word>(0x0100 | ((sp - 2) & 0xFF));
+    return {static_cast<Word>(m.mem.Read(pc_low) | m.mem.Read(pc_high) << 8), m.mem.Read(status)};
+}
+
+void test_scheduled_irq() {
+    for (u64 due : {5u, 100u, 1001u, 50000u}) {
+        Machine m = boot_with_handlers(waiting, sizeof(waiting));
+        const Word sp = m.cpu.SP;
+        Scheduler events;
+        u64 raised = 0;
+        events.At(due, [&events, &raised](CPU &cpu, u64) {
+            raised = events.Now;
+            cpu.SetIrq(line, true);
+        });
+        CPU::ExecResult exec = events.Run(m.cpu, 1 << 20, m.mem);
+        CHECK(exec.Reason == CPU::StopReason::Illegal);
+        CHECK(m.cpu.PC == irq_handler);
+        // At most one JMP late, and the vector entered straight away.
+        CHECK(raised >= due && raised < due + 3);
+        CHECK(events.Now == raised + CPU::INTERRUPT_CYCLES);
+        Pushed p = pushed(m, sp);
+        CHECK(p.pc == program_loc + 1);
+        CHECK((p.status & (CPU::FLAG_B | CPU::FLAG_U | CPU::FLAG_I)) == CPU::FLAG_U);
+        CHECK(m.cpu.GetI());
+        CHECK((m.cpu.SP & 0xFF) == ((sp - 3) & 0xFF));
+    }
+}
+
+// Due together, the IRQ scheduled first, the NMI is still taken first; its
+// handler returns into the IRQ, which is still held.
+void test_nmi_before_irq() {
+    Machine m = boot_with_handlers(waiting, sizeof(waiting));
+    const Byte nmi[] = {0xE6, 0x10, 0x40}; // INC $10, RTI
+    const Byte irq[] = {0xA5, 0x10, illegal}; // LDA $10
+    m.mem.Load(nmi_handler, nmi, sizeof(nmi));
+    m.mem.Load(irq_handler, irq, sizeof(irq));
+    Scheduler events;
+    events.At(300, [](CPU &cpu, u64) { cpu.SetIrq(line, true); });
+    events.At(300, [](CPU &cpu, u64) { cpu.Nmi(); });
+    CPU::ExecResult exec = events.Run(m.cpu, 1 << 20, m.mem);
+    CHECK(exec.Reason == CPU::StopReason::Illegal);
+    CHECK(m.cpu.PC == irq_handler + 2);
+    CHECK(m.cpu.A == 1);
+    CHECK(!m.cpu.NmiPending);
+    CHECK(m.cpu.IrqLines == line);
+}
+
+// With I set, a held IRQ waits; the instruction that clears I lets it in
+// straight after.
+void test_irq_held_until_unmasked() {
+    const Byte after_cli[] = {0xEA, 0x58, 0xEA, 0x00};             // NOP, CLI, NOP, BRK
+    const Byte after_plp[] = {0xA9, 0x00, 0x48, 0x28, 0xEA, 0x00}; // LDA #0, PHA, PLP, NOP, BRK
+    struct Case {
+        const Byte *program;
+        u32 size;
+        Word resume; // the PC pushed
+        u64 retired;
+    };
+    for (const Case &c : {Case{after_cli, sizeof(after_cli), program_loc + 2, 2},
+                          Case{after_plp, sizeof(after_plp), program_loc + 4, 3}}) {
+        Machine m = boot_with_handlers(c.program, c.size);
+        CHECK(m.cpu.GetI());
+        m.cpu.SetIrq(line, true);
+        const Word sp = m.cpu.SP;
+        CPU::ExecResult exec = m.cpu.Execute(1000, m.mem);
+        CHECK(exec.Reason == CPU::StopReason::Illegal);
+        CHECK(exec.InstructionsRetired == c.retired);
+        CHECK(m.cpu.PC == irq_handler);
+        CHECK(pushed(m, sp).pc == c.resume);
+    }
+
+    // RTI brings I back clear, so a line still held re-enters the handler
+    // until an event releases it.
+    const Byte polling[] = {0x58, 0xA5, 0x11, 0xF0, 0xFC, 0x00}; // CLI, loop: LDA $11, BEQ loop, BRK
+    const Byte handler[] = {0xE6, 0x10, 0x40};                   // INC $10, RTI
+    Machine m = boot_with_handlers(polling, sizeof(polling));
+    m.mem.Load(irq_handler, handler, sizeof(handler));
+    m.cpu.SetIrq(line, true);
+    Scheduler events;
+    events.At(200, [&m](CPU &cpu, u64) {
+        cpu.SetIrq(line, false);
+        m.mem[0x11] = 1;
+    });
+    CHECK(events.Run(m.cpu, 1 << 20, m.mem).Reason == CPU::StopReason::Brk);
+    // Each time round is INC, RTI and the entry: 18 cycles.
+    CHECK(m.mem.Read(0x10) >= 200 / 18 && m.mem.Read(0x10) <= 200 / 18 + 1);
+}
+
+// With BrkHalts clear, BRK goes through the IRQ vector with B set in the
+// pushed status and the byte after it skipped.
+void test_brk_interrupt() {
+    const Byte program[] = {0x00, 0xFF}; // BRK and its padding byte
+    Machine m = boot_with_handlers(program, sizeof(program));
+    m.cpu.BrkHalts = false;
+    const Word sp = m.cpu.SP;
+    CPU::ExecResult exec = m.cpu.Execute(1000, m.mem);
+    CHECK(exec.Reason == CPU::StopReason::Illegal);
+    CHECK(exec.CyclesConsumed == 7);
+    CHECK(exec.InstructionsRetired == 1);
+    CHECK(m.cpu.PC == irq_handler);
+    Pushed p = pushed(m, sp);
+    CHECK(p.pc == program_loc + 2);
+    CHECK((p.status & (CPU::FLAG_B | CPU::FLAG_U)) == (CPU::FLAG_B | CPU::FLAG_U));
+}
+
+void test_cancel() {
+    Machine m = boot_with_handlers(waiting, sizeof(waiting));
+    Scheduler events;
+    u64 id = events.At(100, [](CPU &cpu, u64) { cpu.SetIrq(line, true); });
+    bool fired = false;
+    u64 other = events.At(50, [&fired](CPU &, u64) { fired = true; });
+    CHECK(events.Cancel(id));
+    CHECK(!events.Cancel(id));
+    CPU::ExecResult exec = events.Run(m.cpu, 1000, m.mem);
+    CHECK(exec.Reason == CPU::StopReason::Budget);
+    CHECK(m.cpu.IrqLines == 0);
+    CHECK(m.cpu.PC == program_loc + 1);
+    CHECK(fired);
+    CHECK(!events.Cancel(other)); // already fired
+    CHECK(events.Empty());
+}
+
+// Events fire in order of due cycle, then of scheduling; one scheduled for
+// Now by another fires in the same pass.
+void test_event_order() {
+    Machine m = boot_with_handlers(waiting, sizeof(waiting));
+    Scheduler events;
+    std::vector<int> order;
+    events.At(30, [&order](CPU &, u64) { order.push_back(1); });
+    events.At(10, [&order](CPU &, u64) { order.push_back(2); });
+    events.At(30, [&events, &order](CPU &, u64 due) {
+        order.push_back(3);
+        events.At(due, [&order](CPU &, u64) { order.push_back(5); });
+    });
+    events.At(10, [&order](CPU &, u64) { order.push_back(4); });
+    events.At(20, [&order](CPU &, u64 due) { order.push_back(due == 20 ? 6 : -1); });
+    for (int i = 10; i < 20; ++i) {
+        events.At(40, [&order, i](CPU &, u64) { order.push_back(i); });
+    }
+    events.Run(m.cpu, 100, m.mem);
+    CHECK((order == std::vector<int>{2, 4, 6, 1, 3, 5, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19}));
+}
+
+} // namespace
+
+int main() {
+    test_scheduled_irq();
+    test_nmi_before_irq();
+    test_irq_held_until_unmasked();
+    test_brk_interrupt();
+    test_cancel();
+    test_event_order();
+    return check::result();
+}
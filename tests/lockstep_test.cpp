@@ -0,0 +1,181 @@
+// Differential tests of Lockstep against CPU::Execute: every lane of a
+// lockstep run must end up where the same machine run on its own does, with
+// the same results, registers and memory.
+
+#include <memory>
+#include <random>
+#include <vector>
+#include "check.hpp"
+#include "lockstep.hpp"
+#include "machine.hpp"
+
+namespace {
+
+constexpr Word subroutine_loc = 0x0300;
+constexpr Word data_loc = 0x8000; // left alone by the programs
+
+// A loop of random instructions run 40 times, with conditional branches
+// skipping a few bytes ahead, so lanes holding different data take
+// different paths and meet again, and the odd JSR to a subroutine. Stores
+// reach the zero page, the stack, the program and the subroutine.
+std::vector<Byte> random_program(std::mt19937 &random) {
+    static std::vector<Byte> straight;
+    if (straight.empty()) {
+        for (u32 op = 0; op < 256; ++op) {
+            if (!DispatchTable[op].EndsBlock && !DispatchTable[op].Halts) {
+                straight.push_back(static_cast<Byte>(op));
+            }
+        }
+    }
+    const Byte high_bytes[] = {0x00, 0x01, 0x02, 0x03};
+    std::vector<Byte> program = {0xA9, 0x28, 0x85, 0xF0}; // LDA #$28, STA $F0
+    Word loop = static_cast<Word>(program_loc + program.size());
+    int ops = 1 + static_cast<int>(random() % 24);
+    for (int i = 0; i < ops; ++i) {
+        u32 pick = random() % 16;
+        if (pick == 0) {
+            program.insert(program.end(), {0x20, subroutine_loc & 0xFF, subroutine_loc >> 8}); // JSR
+            continue;
+        }
+        if (pick < 4) {
+            Byte branch = static_cast<Byte>(0x10 | (random() % 8) << 5);
+            program.insert(program.end(), {branch, static_cast<Byte>(random() % 6)});
+            continue;
+        }
+        Byte op = straight[random() % straight.size()];
+        program.push_back(op);
+        if (DispatchTable[op].Length > 1) {
+            // Keep clear of $F0, the loop counter, most of the time.
+            program.push_back(static_cast<Byte>(random() % 0xE0));
+        }
+        if (DispatchTable[op].Length > 2) {
+            program.push_back(high_bytes[random() % sizeof(high_bytes)]);
+        }
+    }
+    program.insert(program.end(), {0xC6, 0xF0}); // DEC $F0
+    s32 back = loop - static_cast<s32>(program_loc + program.size() + 2);
+    if (back < -128) {
+        return {};
+    }
+    program.insert(program.end(), {0xD0, static_cast<Byte>(back), 0x00}); // BNE loop, BRK
+    return program;
+}
+
+// Runs program on Lanes lanes, each with its own registers and zero page,
+// in slices of slice cycles, against each lane's machine run on its own.
+template <int Lanes>
+void run_lanes(const std::vector<Byte> &program, s32 slice, std::mt19937 &random) {
+    Mem image;
+    const Byte subroutine[] = {0xE8, 0x48, 0x68, 0x60}; // INX, PHA, PLA, RTS
+    const Byte data[] = {0x65, 0x02};
+    image.Load(program_loc, program.data(), static_cast<u32>(program.size()));
+    image.Load(subroutine_loc, subroutine, sizeof(subroutine));
+    image.Load(data_loc, data, sizeof(data));
+
+    std::vector<Machine> start(Lanes), scalar(Lanes);
+    auto lockstep = std::make_unique<Lockstep<Lanes>>();
+    for (int lane = 0; lane < Lanes; ++lane) {
+        Machine &m = start[lane];
+        m.mem = image;
+        m.cpu.PowerOn(m.mem, Mem::RamInit::Untouched);
+        m.cpu.PC = program_loc;
+        m.cpu.A = static_cast<Byte>(random());
+        m.cpu.X = static_cast<Byte>(random());
+        m.cpu.Y = static_cast<Byte>(random());
+        m.cpu.SetStatus(static_cast<Byte>(random() & ~CPU::FLAG_I));
+        for (Word address = 0; address < 0x40; ++address) {
+            m.mem[address] = static_cast<Byte>(random());
+        }
+        scalar[lane] = m;
+        CHECK(lockstep->LoadLane(lane, m.cpu, m.mem));
+    }
+
+    for (int round = 0; round < 8; ++round) {
+        lockstep->Execute(slice);
+        for (int lane = 0; lane < Lanes; ++lane) {
+            CPU::ExecResult want = scalar[lane].cpu.Execute(slice, scalar[lane].mem);
+            CPU::ExecResult got = lockstep->Result(lane);
+            CHECK(got.Reason == want.Reason);
+            CHECK(got.CyclesConsumed == want.CyclesConsumed);
+            CHECK(got.Overrun == want.Overrun);
+            CHECK(got.InstructionsRetired == want.InstructionsRetired);
+        }
+    }
+
+    for (int lane = 0; lane < Lanes; ++lane) {
+        Machine saved = start[lane];
+        lockstep->SaveLane(lane, saved.cpu, saved.mem);
+        CHECK(saved.cpu.LoopState() == scalar[lane].cpu.LoopState());
+        CHECK(same_memory(saved.mem, scalar[lane].mem));
+        // Pages the lane left alone stay shared.
+        CHECK(saved.mem.Pages[data_loc >> 8] == start[lane].mem.Pages[data_loc >> 8]);
+    }
+}
+
+void test_random_programs() {
+    std::mt19937 random(6502);
+    for (int round = 0; round < 200; ++round) {
+        std::vector<Byte> program = random_program(random);
+        if (program.empty()) {
+            continue;
+        }
+        s32 slice = 1 + static_cast<s32>(random() % 2000);
+        if (round % 2) {
+            run_lanes<32>(program, slice, random);
+        } else {
+            run_lanes<5>(program, slice, random);
+        }
+        if (check::failures() != 0) {
+            std::fprintf(stderr, "random program %d failed\n", round);
+            return;
+        }
+    }
+}
+
+// Lanes have no devices or interrupt lines and always stop at BRK, so
+// machines that need any of those are refused, and the lane keeps the
+// machine it had.
+void test_refused_machines() {
+    struct Latch : Device {
+        Byte value = 0x5A;
+        Byte Read(Word) override { return value; }
+        void Write(Word, Byte v) override { value = v; }
+    };
+    const Byte program[] = {0xA9, 0x77, 0x00}; // LDA #$77, BRK
+    Machine m = boot(program, sizeof(program));
+    auto lockstep = std::make_unique<Lockstep<2>>();
+    CHECK(lockstep->LoadLane(0, m.cpu, m.mem));
+    CHECK(lockstep->LoadLane(1, m.cpu, m.mem));
+
+    Latch latch;
+    Machine mapped = m;
+    mapped.mem.Map(0xC0, 1, latch);
+    CHECK(!lockstep->LoadLane(1, mapped.cpu, mapped.mem));
+
+    Machine interrupting = m;
+    interrupting.cpu.BrkHalts = false;
+    CHECK(!lockstep->LoadLane(1, interrupting.cpu, interrupting.mem));
+
+    interrupting = m;
+    interrupting.cpu.SetIrq(1, true);
+    CHECK(!lockstep->LoadLane(1, interrupting.cpu, interrupting.mem));
+
+    interrupting = m;
+    interrupting.cpu.Nmi();
+    CHECK(!lockstep->LoadLane(1, interrupting.cpu, interrupting.mem));
+
+    lockstep->Execute(1000);
+    Machine saved = m;
+    lockstep->SaveLane(1, saved.cpu, saved.mem);
+    CHECK(lockstep->Result(1).Reason == CPU::StopReason::Brk);
+    CHECK(saved.cpu.A == 0x77);
+    CHECK(latch.value == 0x5A);
+}
+
+} // namespace
+
+int main() {
+    test_random_programs();
+    test_refused_machines();
+    return check::result();
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+// The machine the differential tests in tests/ run: a Mem and the CPU on
+// it, booted with a program, and a comparison of two machines' memories.
+
+#include <cstring>
+#include "6502_emulator.hpp"
+
+constexpr Word program_loc = 0x0200;
+
+struct Machine {
+    Mem mem;
+    CPU cpu;
+};
+
+// A powered-on machine with program loaded at at and PC on it.
+inline Machine boot(const Byte *program, u32 size, Word at = program_loc) {
+    Machine m;
+    m.mem.Load(at, program, size);
+    m.cpu.PowerOn(m.mem, Mem::RamInit::Untouched);
+    m.cpu.PC = at;
+    return m;
+}
+
+// True if both have the same RAM and devices on the same pages. What the
+// devices hold isn't compared, nor read: each machine has its own.
+inline bool same_memory(const Mem &a, const Mem &b) {
+    for (u32 page = 0; page < Mem::PAGES; ++page) {
+        if ((a.Devices[page] != nullptr) != (b.Devices[page] != nullptr)) {
+            return false;
+        }
+        if (!a.Devices[page] && std::memcmp(a.Pages[page]->Data, b.Pages[page]->Data, Mem::PAGE_SIZE) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
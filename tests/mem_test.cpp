@@ -0,0 +1,102 @@
+// Copy-on-write paging: copies share pages until written, and neither
+// assigning one Mem over another nor building a new Mem where an old one
+// was leaves code cached from the old contents current.
+
+#include <cstring>
+#include <new>
+#include "block_cache.hpp"
+#include "check.hpp"
+
+namespace {
+
+constexpr Word program_loc = 0x0200;
+
+// Spins X down from $20 loading Value into A each time round, so the loop's
+// block is entered often enough to be decoded, then BRKs.
+void load_loop(Mem &mem, Byte value) {
+    const Byte program[] = {
+        0xA2, 0x20,  // LDX #$20
+        0xA9, value, // loop: LDA #value
+        0xCA,        // DEX
+        0xD0, 0xFB,  // BNE loop
+        0x00,        // BRK
+    };
+    mem.Load(program_loc, program, sizeof(program));
+}
+
+CPU fresh_cpu(Mem &mem) {
+    CPU cpu;
+    cpu.PowerOn(mem, Mem::RamInit::Untouched);
+    cpu.PC = program_loc;
+    return cpu;
+}
+
+void test_copies_share_until_written() {
+    Mem a;
+    a[0x1234] = 0x55;
+    Mem b = a;
+    CHECK(b.Read(0x1234) == 0x55);
+    CHECK(b.Pages[0x12] == a.Pages[0x12]);
+
+    b.Write(0x1234, 0x66);
+    CHECK(b.Pages[0x12] != a.Pages[0x12]);
+    CHECK(a.Read(0x1234) == 0x55);
+    CHECK(b.Read(0x1234) == 0x66);
+}
+
+void test_assignment_invalidates_cached_code() {
+    Mem one, two;
+    load_loop(one, 0x01);
+    load_loop(two, 0x02);
+
+    Mem work = one;
+    BlockCache cache;
+    CPU cpu = fresh_cpu(work);
+    CHECK(cache.Execute(cpu, 10000, work).Reason == CPU::StopReason::Brk);
+    CHECK(cpu.A == 0x01);
+
+    // Same Mem object, different image: the loop cached from `one` is stale.
+    work = two;
+    cpu = fresh_cpu(work);
+    CHECK(cache.Execute(cpu, 10000, work).Reason == CPU::StopReason::Brk);
+    CPU interp = fresh_cpu(work);
+    CHECK(interp.Execute(10000, work).Reason == CPU::StopReason::Brk);
+    CHECK(interp.A == 0x02);
+    CHECK(cpu.A == interp.A);
+
+    // And back again, to an image the cache has seen before.
+    work = one;
+    cpu = fresh_cpu(work);
+    CHECK(cache.Execute(cpu, 10000, work).Reason == CPU::StopReason::Brk);
+    CHECK(cpu.A == 0x01);
+}
+
+// A new Mem at the address of a destroyed one starts its page versions
+// over, so the cache must not take it for the old one.
+void test_new_mem_at_same_address() {
+    alignas(Mem) unsigned char storage[sizeof(Mem)];
+    BlockCache cache;
+
+    Mem *mem = new (storage) Mem;
+    load_loop(*mem, 0x01);
+    CPU cpu = fresh_cpu(*mem);
+    CHECK(cache.Execute(cpu, 10000, *mem).Reason == CPU::StopReason::Brk);
+    CHECK(cpu.A == 0x01);
+    mem->~Mem();
+
+    mem = new (storage) Mem;
+    load_loop(*mem, 0x02);
+    cpu = fresh_cpu(*mem);
+    CHECK(cache.Execute(cpu, 10000, *mem).Reason == CPU::StopReason::Brk);
+    CHECK(cpu.A == 0x02);
+    mem->~Mem();
+}
+
+} // namespace
+
+int main() {
+    test_copies_share_until_written();
+    test_assignment_invalidates_cached_code();
+    test_new_mem_at_same_address();
+    return check::result();
+}
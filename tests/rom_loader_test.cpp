@@ -0,0 +1,187 @@
+// RomImage: Intel HEX, .prg and raw images open into the right segments,
+// load with their whole pages borrowed where the bytes allow it, and boot
+// at the RESET vector; malformed images are refused.
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+#include "check.hpp"
+#include "rom_loader.hpp"
+
+namespace {
+
+void write_file(const std::string &path, const std::string &contents) {
+    std::ofstream out(path, std::ios::binary);
+    out << contents;
+}
+
+// One Intel HEX record, checksum included.
+std::string record(Byte type, Word address, const std::vector<Byte> &data) {
+    std::vector<Byte> bytes = {static_cast<Byte>(data.size()), static_cast<Byte>(address >> 8),
+                               static_cast<Byte>(address), type};
+    bytes.insert(bytes.end(), data.begin(), data.end());
+    Byte sum = 0;
+    for (Byte b : bytes) {
+        sum = static_cast<Byte>(sum + b);
+    }
+    bytes.push_back(static_cast<Byte>(-sum));
+    std::string line = ":";
+    for (Byte b : bytes) {
+        char hex[3];
+        std::snprintf(hex, sizeof hex, "%02X", b);
+        line += hex;
+    }
+    return line + "\r\n";
+}
+
+Byte pattern(u32 i) {
+    return static_cast<Byte>(i * 7 + 3);
+}
+
+bool borrowed(const Mem &mem, Byte page, const Byte *from) {
+    return (mem.Trap[page] & Mem::TRAP_BORROWED) && mem.Pages[page]->Data == from;
+}
+
+// $0300-$0410 in 16-byte records, which run on into one segment, then three
+// bytes at $8000, behind an extended linear address and a start record.
+void test_intel_hex() {
+    const std::string path = "rom_loader_test.hex";
+    std::string text = record(0x04, 0, {0x00, 0x00});
+    for (u32 at = 0x0300; at < 0x0411; at += 16) {
+        std::vector<Byte> data;
+        for (u32 i = at; i < std::min<u32>(at + 16, 0x0411); ++i) {
+            data.push_back(pattern(i));
+        }
+        text += record(0x00, static_cast<Word>(at), data);
+    }
+    text += record(0x00, 0x8000, {0xA9, 0x01, 0x00});
+    text += record(0x05, 0, {0x00, 0x00, 0x80, 0x00});
+    text += record(0x01, 0, {});
+    write_file(path, text);
+
+    RomImage rom;
+    CHECK(rom.Open(path.c_str()));
+    CHECK(rom.Segments.size() == 2);
+    if (rom.Segments.size() == 2) {
+        CHECK(rom.Segments[0].Address == 0x0300 && rom.Segments[0].Size == 0x111);
+        CHECK(rom.Segments[1].Address == 0x8000 && rom.Segments[1].Size == 3);
+
+        Mem mem;
+        rom.Load(mem);
+        CHECK(borrowed(mem, 0x03, rom.Segments[0].Data));
+        CHECK(!(mem.Trap[0x04] & Mem::TRAP_BORROWED));
+        CHECK(!(mem.Trap[0x80] & Mem::TRAP_BORROWED));
+        CHECK(rom.Lends(mem));
+        bool same = true;
+        for (u32 i = 0x0300; i < 0x0411; ++i) {
+            same = same && mem.Read(static_cast<Word>(i)) == pattern(i);
+        }
+        CHECK(same);
+        CHECK(mem.Read(0x0411) == 0x00);
+        CHECK(mem.Read(0x8000) == 0xA9 && mem.Read(0x8002) == 0x00);
+
+        Mem copied;
+        rom.Load(copied, false);
+        CHECK(!rom.Lends(copied));
+        CHECK(copied.Read(0x0300) == pattern(0x0300));
+    }
+    std::remove(path.c_str());
+}
+
+void test_bad_intel_hex() {
+    const std::string path = "rom_loader_test.hex";
+    std::string good = record(0x00, 0x0200, {0xEA, 0xEA});
+    std::string bad_sum = good;
+    bad_sum[bad_sum.size() - 3] = bad_sum[bad_sum.size() - 3] == '0' ? '1' : '0';
+    const std::string images[] = {
+        bad_sum + record(0x01, 0, {}),
+        record(0x00, 0xFFF0, std::vector<Byte>(32, 0xEA)) + record(0x01, 0, {}), // past $FFFF
+        record(0x04, 0, {0x00, 0x01}) + good + record(0x01, 0, {}),             // at $10200
+        record(0x06, 0, {}) + record(0x01, 0, {}),                              // no such type
+        "EA" + good,                                                            // no colon
+        good.substr(0, good.size() - 4) + "\r\n",                               // cut short
+    };
+    for (const std::string &image : images) {
+        write_file(path, image);
+        RomImage rom;
+        CHECK(!rom.Open(path.c_str()));
+        CHECK(!rom.IsOpen() && rom.Segments.empty());
+    }
+    std::remove(path.c_str());
+}
+
+// A .prg's data sits two bytes into the file, off the alignment a page needs
+// to be borrowed, so it is copied.
+void test_prg() {
+    const std::string path = "rom_loader_test.prg";
+    std::string bytes = {'\x00', '\xC0'};
+    for (u32 i = 0; i < 300; ++i) {
+        bytes += static_cast<char>(pattern(i));
+    }
+    write_file(path, bytes);
+    RomImage rom;
+    CHECK(rom.Open(path.c_str()));
+    CHECK(rom.Segments.size() == 1);
+    if (rom.Segments.size() == 1) {
+        CHECK(rom.Segments[0].Address == 0xC000 && rom.Segments[0].Size == 300);
+        Mem mem;
+        rom.Load(mem);
+        CHECK(mem.Read(0xC000) == pattern(0) && mem.Read(0xC12B) == pattern(299));
+        CHECK(!rom.Lends(mem));
+    }
+
+    write_file(path, std::string("\xFF\xFF\xEA\xEA", 4)); // past $FFFF
+    CHECK(!rom.Open(path.c_str()));
+    std::remove(path.c_str());
+}
+
+// 528 bytes by default end at $FFFF, so they start at $FDF0 and fill $FE
+// and $FF, which are borrowed; the RESET vector in the last of them starts
+// the machine.
+void test_raw_at_top() {
+    const std::string path = "rom_loader_test.rom";
+    std::string bytes;
+    for (u32 i = 0; i < 528; ++i) {
+        bytes += static_cast<char>(pattern(i));
+    }
+    bytes[528 - 4] = '\x34'; // $FFFC
+    bytes[528 - 3] = '\x12';
+    write_file(path, bytes);
+
+    RomImage rom;
+    CHECK(rom.Open(path.c_str()));
+    CHECK(rom.Segments.size() == 1);
+    if (rom.Segments.size() == 1) {
+        const RomImage::Segment &segment = rom.Segments[0];
+        CHECK(segment.Address == 0xFDF0 && segment.Size == 528);
+        Mem mem;
+        CPU cpu;
+        rom.Boot(cpu, mem);
+        CHECK(cpu.PC == 0x1234);
+        CHECK(!(mem.Trap[0xFD] & Mem::TRAP_BORROWED));
+        CHECK(borrowed(mem, 0xFE, segment.Data + 0x10));
+        CHECK(borrowed(mem, 0xFF, segment.Data + 0x110));
+        CHECK(mem.Read(0xFDF0) == pattern(0) && mem.Read(0xFEFF) == pattern(0x10F));
+
+        // Written, a borrowed page becomes the Mem's own; the file is untouched.
+        mem.Write(0xFE00, 0x99);
+        CHECK(!(mem.Trap[0xFE] & Mem::TRAP_BORROWED));
+        CHECK(segment.Data[0x10] == pattern(0x10));
+    }
+
+    CHECK(rom.Open(path.c_str(), RomImage::Format::Raw, 0x0200));
+    CHECK(rom.Segments.size() == 1 && rom.Segments[0].Address == 0x0200);
+    CHECK(!rom.Open(path.c_str(), RomImage::Format::Raw, 0xFF00)); // past $FFFF
+    std::remove(path.c_str());
+}
+
+} // namespace
+
+int main() {
+    test_intel_hex();
+    test_bad_intel_hex();
+    test_prg();
+    test_raw_at_top();
+    return check::result();
+}
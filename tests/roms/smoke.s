@@ -0,0 +1,127 @@
+; A small conformance ROM for functional_test, in the style of Klaus
+; Dormann's functional test: every check that fails branches to itself, so
+; the runner reports the address of the failing check, and the end of the
+; test is a JMP to itself at the success address, $048B.
+;
+; smoke.hex is this source (in ca65 syntax) assembled, and is pinned by its
+; SHA-256 in CMakeLists.txt; update the hash when reassembling it.
+;
+;   ./bin/functional_test tests/roms/smoke.hex --success=048B
+
+        .org $0400
+start:
+        ; binary ADC: $50 + $50 = $A0, overflow, negative, no carry
+        cld
+        clc
+        lda #$50
+        adc #$50
+        bvc *
+        bcs *
+        bpl *
+        cmp #$A0
+        bne *
+
+        ; decimal ADC: 58 + 46 = 104
+        sed
+        clc
+        lda #$58
+        adc #$46
+        bcc *
+        cmp #$04
+        bne *
+
+        ; decimal SBC: 46 - 12 = 34, and 21 - 34 borrows to 87
+        sec
+        lda #$46
+        sbc #$12
+        bcc *
+        cmp #$34
+        bne *
+        sec
+        lda #$21
+        sbc #$34
+        bcs *
+        cmp #$87
+        bne *
+        cld
+
+        ; binary SBC borrows: 0 - 1 = $FF, carry clear
+        sec
+        lda #$00
+        sbc #$01
+        bcs *
+        cmp #$FF
+        bne *
+
+        ; PHP pushes B and bit 5 set whatever PLP pulled
+        lda #$FF
+        pha
+        plp
+        php
+        pla
+        cmp #$FF
+        bne *
+        cld
+        cli
+        lda #$00
+        pha
+        plp
+        php
+        pla
+        cmp #$30
+        bne *
+
+        ; JSR/RTS
+        ldx #$00
+        jsr sub
+        cpx #$5A
+        bne *
+
+        ; (zp),Y stores
+        lda #$00
+        sta $10
+        lda #$03
+        sta $11
+        ldy #$05
+        lda #$77
+        sta ($10),y
+        lda #$00
+        lda $0305
+        cmp #$77
+        bne *
+
+        ; ROR A rotates the carry in and bit 0 out
+        sec
+        lda #$81
+        ror a
+        bcc *
+        cmp #$C0
+        bne *
+
+        ; BRK runs the IRQ vector with B set in the pushed status and
+        ; returns past its padding byte
+        ldx #$00
+        brk
+        nop
+        cpx #$01
+        bne *
+        tya
+        and #$10
+        beq *
+
+success:
+        jmp success
+
+sub:
+        ldx #$5A
+        rts
+
+irq:
+        pla
+        pha
+        tay
+        ldx #$01
+        rti
+
+        .org $FFFE
+        .word irq
@@ -0,0 +1,14 @@
+# Runs functional_test on a conformance ROM after checking the ROM is the
+# one the test was written for:
+#
+#   cmake -DRUNNER=functional_test -DROM=FILE -DSHA256=HASH [-DARGS=a;b] -P run_rom.cmake
+
+file(SHA256 "${ROM}" actual)
+if (NOT actual STREQUAL SHA256)
+  message(FATAL_ERROR "${ROM} has SHA-256 ${actual}, expected ${SHA256}")
+endif()
+
+execute_process(COMMAND "${RUNNER}" "${ROM}" ${ARGS} RESULT_VARIABLE result)
+if (NOT result EQUAL 0)
+  message(FATAL_ERROR "${ROM} failed")
+endif()
@@ -0,0 +1,172 @@
+// Save states: what is saved comes back exactly, and states that can't be
+// restored change nothing.
+
+#include <cstdio>
+#include <vector>
+#include "check.hpp"
+#include "machine.hpp"
+#include "save_state.hpp"
+
+namespace {
+
+// Counts $10 up through $0300-$03FF, so running it changes a page the
+// loaded program didn't touch as well as the zero page.
+const Byte program[] = {
+    0xA2, 0x00,       // LDX #$00
+    0xE6, 0x10,       // loop: INC $10
+    0xA5, 0x10,       // LDA $10
+    0x9D, 0x00, 0x03, // STA $0300,X
+    0xE8,             // INX
+    0xD0, 0xF7,       // BNE loop
+    0x00,             // BRK
+};
+
+bool same_cpu(const CPU &a, const CPU &b) {
+    return a.LoopState() == b.LoopState() && a.IrqLines == b.IrqLines && a.NmiPending == b.NmiPending &&
+           a.BrkHalts == b.BrkHalts;
+}
+
+// Saves halfway through the program, runs on, restores and checks the
+// machine is back where it was saved, then that it finishes the same way.
+void test_round_trip() {
+    Machine m = boot(program, sizeof(program));
+    m.cpu.Execute(200, m.mem);
+    Machine saved = m;
+    std::vector<Byte> state = SaveState::Save(m.cpu, m.mem);
+    CHECK(SaveState::Save(m.cpu, m.mem) == state);
+
+    CHECK(m.cpu.Execute(100000, m.mem).Reason == CPU::StopReason::Brk);
+    Machine finished = m;
+    m.mem[0x8000] = 0x99; // a page the state has as zeros
+    CHECK(!same_memory(m.mem, saved.mem));
+
+    CHECK(SaveState::Restore(state, m.cpu, m.mem));
+    CHECK(same_cpu(m.cpu, saved.cpu));
+    CHECK(same_memory(m.mem, saved.mem));
+    CHECK(m.cpu.Execute(100000, m.mem).Reason == CPU::StopReason::Brk);
+    CHECK(same_cpu(m.cpu, finished.cpu));
+    CHECK(same_memory(m.mem, finished.mem));
+}
+
+// A delta against the loaded program stores only the pages that changed,
+// and restores onto that base and no other.
+void test_delta_against_base() {
+    Machine loaded = boot(program, sizeof(program));
+    SaveState::BaseImage base(loaded.mem);
+
+    Machine m = loaded;
+    m.cpu.Execute(300, m.mem);
+    std::vector<Byte> delta = SaveState::Save(m.cpu, m.mem, &base);
+    std::vector<Byte> full = SaveState::Save(m.cpu, m.mem);
+    // The zero page and $0300 changed; the program's page did not.
+    CHECK(delta.size() == SaveState::PAGES_OFFSET + 2 * SaveState::PAGE_RECORD);
+    CHECK(full.size() == SaveState::PAGES_OFFSET + 3 * SaveState::PAGE_RECORD);
+
+    Machine into = loaded;
+    into.mem[0x0200] = 0xEA; // differs from the base; the restore puts it back
+    CHECK(SaveState::Restore(delta, into.cpu, into.mem, &base));
+    CHECK(same_cpu(into.cpu, m.cpu));
+    CHECK(same_memory(into.mem, m.mem));
+    CHECK(into.mem.Pages[0x02] == loaded.mem.Pages[0x02]);
+
+    // Without the base, or against a different one, it is refused.
+    Machine other = loaded;
+    other.mem[0x4000] = 0x01;
+    SaveState::BaseImage wrong(other.mem);
+    Machine untouched = loaded;
+    CHECK(!SaveState::Restore(delta, untouched.cpu, untouched.mem));
+    CHECK(!SaveState::Restore(delta, untouched.cpu, untouched.mem, &wrong));
+    CHECK(same_memory(untouched.mem, loaded.mem));
+}
+
+// Truncated, padded or corrupted states are refused without touching the
+// machine.
+void test_malformed_states() {
+    Machine m = boot(program, sizeof(program));
+    m.cpu.Execute(200, m.mem);
+    std::vector<Byte> state = SaveState::Save(m.cpu, m.mem);
+
+    Machine target = boot(program, sizeof(program));
+    const Machine before = target;
+    auto refused = [&](const std::vector<Byte> &bad) {
+        bool ok = !SaveState::Restore(bad, target.cpu, target.mem);
+        return ok && same_cpu(target.cpu, before.cpu) && same_memory(target.mem, before.mem);
+    };
+
+    CHECK(refused({}));
+    CHECK(refused(std::vector<Byte>(state.begin(), state.begin() + 8)));
+    CHECK(refused(std::vector<Byte>(state.begin(), state.begin() + SaveState::PAGES_OFFSET)));
+    CHECK(refused(std::vector<Byte>(state.begin(), state.end() - 1)));
+    std::vector<Byte> padded = state;
+    padded.push_back(0);
+    CHECK(refused(padded));
+    std::vector<Byte> bad_magic = state;
+    bad_magic[0] = 'X';
+    CHECK(refused(bad_magic));
+    for (Byte version : {0, 2, 4}) {
+        std::vector<Byte> other_version = state;
+        other_version[8] = version;
+        CHECK(refused(other_version));
+    }
+    std::vector<Byte> bad_kind = state;
+    bad_kind[SaveState::KINDS_OFFSET + 0x40] = 7;
+    CHECK(refused(bad_kind));
+    std::vector<Byte> bad_count = state;
+    bad_count[12]++;
+    CHECK(refused(bad_count));
+    std::vector<Byte> base_without_delta = state;
+    base_without_delta[SaveState::KINDS_OFFSET + 0x40] = SaveState::PAGE_BASE;
+    CHECK(refused(base_without_delta));
+}
+
+// A mapped state restores the same machine, borrowing its pages until they
+// are written.
+void test_mapped_restore() {
+    Machine m = boot(program, sizeof(program));
+    m.cpu.Execute(200, m.mem);
+    const char *path = "save_state_test.6502save"; // in the build directory under CTest
+    CHECK(SaveState::Write(path, m.cpu, m.mem));
+
+    Machine into = boot(program, sizeof(program));
+    {
+        MappedSaveState mapped;
+        CHECK(mapped.Open(path));
+        CHECK(mapped.Restore(into.cpu, into.mem));
+        CHECK(same_cpu(into.cpu, m.cpu));
+        CHECK(same_memory(into.mem, m.mem));
+        CHECK(into.cpu.Execute(100000, into.mem).Reason == CPU::StopReason::Brk);
+        CHECK(m.cpu.Execute(100000, m.mem).Reason == CPU::StopReason::Brk);
+        CHECK(same_memory(into.mem, m.mem));
+        into.mem = Mem(); // drop the borrowed pages before the mapping goes
+    }
+    std::remove(path);
+}
+
+// The interrupt state survives a round trip.
+void test_interrupt_state() {
+    Mem mem;
+    CPU cpu;
+    cpu.PowerOn(mem);
+    cpu.SetIrq(0x05, true);
+    cpu.Nmi();
+    cpu.BrkHalts = false;
+    std::vector<Byte> state = SaveState::Save(cpu, mem);
+
+    CPU back;
+    back.PowerOn(mem);
+    CHECK(SaveState::Restore(state, back, mem));
+    CHECK(back.IrqLines == 0x05);
+    CHECK(back.NmiPending);
+    CHECK(!back.BrkHalts);
+}
+
+} // namespace
+
+int main() {
+    test_round_trip();
+    test_delta_against_base();
+    test_malformed_states();
+    test_mapped_restore();
+    test_interrupt_state();
+    return check::result();
+}
@@ -0,0 +1,119 @@
+// Breakpoints and write watchpoints: hits are reported wherever a run is
+// sliced, and running again resumes past the breakpoint just hit.
+
+#include "block_cache.hpp"
+#include "check.hpp"
+
+namespace {
+
+constexpr Word program_loc = 0x0200;
+
+// Four NOPs, a store to $0300 and a BRK.
+void load_program(Mem &mem) {
+    const Byte program[] = {
+        0xEA, 0xEA, 0xEA, 0xEA, // NOP x4
+        0x8D, 0x00, 0x03,       // STA $0300
+        0x00,                   // BRK
+    };
+    mem.Load(program_loc, program, sizeof(program));
+}
+
+CPU fresh_cpu(Mem &mem) {
+    CPU cpu;
+    cpu.PowerOn(mem, Mem::RamInit::Untouched);
+    cpu.PC = program_loc;
+    return cpu;
+}
+
+void test_resumes_past_the_breakpoint_hit() {
+    Mem mem;
+    load_program(mem);
+    Watchpoints watch;
+    watch.Break(0x0202);
+    mem.Watch(&watch);
+    CPU cpu = fresh_cpu(mem);
+
+    CHECK(cpu.Execute(100, mem).Reason == CPU::StopReason::Breakpoint);
+    CHECK(cpu.PC == 0x0202);
+    CHECK(watch.Last.What == Watchpoints::Kind::Break);
+    CHECK(watch.Last.Address == 0x0202);
+
+    CHECK(cpu.Execute(100, mem).Reason == CPU::StopReason::Brk);
+}
+
+void test_slice_starting_at_a_breakpoint_stops() {
+    Mem mem;
+    load_program(mem);
+    Watchpoints watch;
+    watch.Break(0x0204);
+    mem.Watch(&watch);
+    CPU cpu = fresh_cpu(mem);
+
+    // Two NOPs' worth of budget each: the second slice starts at $0204.
+    CHECK(cpu.Execute(4, mem).Reason == CPU::StopReason::Budget);
+    CHECK(cpu.Execute(4, mem).Reason == CPU::StopReason::Budget);
+    CHECK(cpu.PC == 0x0204);
+    CPU::ExecResult hit = cpu.Execute(100, mem);
+    CHECK(hit.Reason == CPU::StopReason::Breakpoint);
+    CHECK(hit.InstructionsRetired == 0);
+    CHECK(cpu.PC == 0x0204);
+
+    CHECK(cpu.Execute(100, mem).Reason == CPU::StopReason::Brk);
+}
+
+void test_moving_pc_back_to_a_breakpoint_stops() {
+    Mem mem;
+    load_program(mem);
+    Watchpoints watch;
+    watch.Break(0x0200);
+    mem.Watch(&watch);
+    CPU cpu = fresh_cpu(mem);
+
+    CHECK(cpu.Execute(100, mem).Reason == CPU::StopReason::Breakpoint);
+    CHECK(cpu.Execute(2, mem).Reason == CPU::StopReason::Budget);
+    cpu.PC = program_loc;
+    CHECK(cpu.Execute(100, mem).Reason == CPU::StopReason::Breakpoint);
+}
+
+void test_write_watch_stops_after_the_store() {
+    Mem mem;
+    load_program(mem);
+    Watchpoints watch;
+    watch.WatchWrites(0x0300, 0x0300);
+    mem.Watch(&watch);
+    CPU cpu = fresh_cpu(mem);
+    cpu.A = 0x42;
+
+    CHECK(cpu.Execute(100, mem).Reason == CPU::StopReason::Breakpoint);
+    CHECK(watch.Last.What == Watchpoints::Kind::Write);
+    CHECK(watch.Last.Address == 0x0300);
+    CHECK(watch.Last.PC == 0x0204);
+    CHECK(mem.Read(0x0300) == 0x42);
+    CHECK(cpu.Execute(100, mem).Reason == CPU::StopReason::Brk);
+}
+
+void test_block_cache_honours_breakpoints() {
+    Mem mem;
+    load_program(mem);
+    Watchpoints watch;
+    watch.Break(0x0204);
+    mem.Watch(&watch);
+    CPU cpu = fresh_cpu(mem);
+    BlockCache cache;
+
+    CHECK(cache.Execute(cpu, 4, mem).Reason == CPU::StopReason::Budget);
+    CHECK(cache.Execute(cpu, 4, mem).Reason == CPU::StopReason::Budget);
+    CHECK(cache.Execute(cpu, 100, mem).Reason == CPU::StopReason::Breakpoint);
+    CHECK(cache.Execute(cpu, 100, mem).Reason == CPU::StopReason::Brk);
+}
+
+} // namespace
+
+int main() {
+    test_resumes_past_the_breakpoint_hit();
+    test_slice_starting_at_a_breakpoint_stops();
+    test_moving_pc_back_to_a_breakpoint_stops();
+    test_write_watch_stops_after_the_store();
+    test_block_cache_honours_breakpoints();
+    return check::result();
+}
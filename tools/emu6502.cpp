@@ -0,0 +1,462 @@
+// Runs programs headless and reports how they ended as JSON, for scripts and
+// batch jobs:
+//
+//   ./bin/emu6502 run FILE [--format=raw|hex|prg] [--load=ADDR] [--pc=ADDR]
+//                     [--cycles=N] [--brk=halt|interrupt] [--dump-regs]
+//                     [--dump-mem=FROM:TO]... [--gdb=[localhost:]PORT|unix:PATH]
+//                     [--gdb-wait]
+//   ./bin/emu6502 batch MANIFEST [--jobs=N]
+//
+// run loads FILE as RomImage does (raw images at --load, else ending at
+// $FFFF), starts at --pc or the RESET vector, and runs until BRK, an illegal
+// opcode or --cycles cycles (default 1000000000). Options take their value
+// after '=' or as the next argument; addresses are hex, with or without 0x
+// or $. The JSON gives the stop reason, PC, cycles, instructions, time and
+// speed, and the idle loops Execute skipped (by the PC of each loop's top,
+// with the iterations and cycles skipped there), plus the registers with
+// --dump-regs and each inclusive range of memory asked for with --dump-mem,
+// as a hex string.
+//
+// --gdb serves the GDB remote protocol (see gdb_stub.hpp) on a local port or
+// Unix socket while the program runs, so a debugger can attach at any time;
+// --gdb-wait waits for it to attach before starting.
+//
+// batch runs one job per line of MANIFEST, each line holding the arguments
+// of run; blank lines and lines starting with '#' are skipped, and relative
+// paths are taken from the manifest's directory. Jobs run in parallel on
+// --jobs workers (default: every hardware thread) through BatchRunner, and
+// the JSON lists each job's result in manifest order, then the totals.
+//
+// Exits 0 if every job ran, 1 if one couldn't be loaded (or listen for gdb)
+// or hit an illegal opcode, and 2 on bad arguments.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#include "batch_runner.hpp"
+#include "gdb_stub.hpp"
+#include "profiler.hpp"
+#include "rom_loader.hpp"
+
+namespace {
+
+// Execute takes an s32 budget; longer runs go in slices of this many cycles.
+constexpr s32 SLICE = 1 << 30;
+// With --gdb, shorter ones, so a debugger connecting is noticed promptly.
+constexpr s32 GDB_SLICE = 1 << 20;
+
+const char USAGE[] = "usage: emu6502 run FILE [--format=raw|hex|prg] [--load=ADDR] [--pc=ADDR] [--cycles=N]\n"
+                     "                        [--brk=halt|interrupt] [--dump-regs] [--dump-mem=FROM:TO]...\n"
+                     "                        [--gdb=[localhost:]PORT|unix:PATH] [--gdb-wait]\n"
+                     "       emu6502 batch MANIFEST [--jobs=N]\n";
+
+struct Range {
+    Word from;
+    Word to;
+};
+
+struct Job {
+    std::string path;
+    RomImage::Format format = RomImage::Format::Detect;
+    s32 load = RomImage::TOP;
+    bool set_pc = false;
+    Word pc = 0;
+    unsigned long long cycles = 1000000000;
+    bool brk_halts = true;
+    bool dump_regs = false;
+    std::vector<Range> dumps;
+    std::string gdb;
+    bool gdb_wait = false;
+
+    // Filled in by Execute.
+    bool loaded = false;
+    std::string error; // why it didn't run
+    RomImage image; // lends its pages to the instance's memory
+    CPU::StopReason reason = CPU::StopReason::Budget;
+    unsigned long long spent = 0;
+    u64 instructions = 0;
+    double seconds = 0;
+    IdleLog idle;
+};
+
+bool ParseAddress(const std::string &text, Word &address) {
+    const char *digits = text.c_str();
+    if (*digits == '$') {
+        ++digits;
+    }
+    char *end = nullptr;
+    unsigned long value = std::strtoul(digits, &end, 16);
+    if (*digits == '\0' || *end != '\0' || value > 0xFFFF) {
+        return false;
+    }
+    address = static_cast<Word>(value);
+    return true;
+}
+
+// Parses the arguments of run into job; false, with a message on error, if
+// they aren't valid.
+bool ParseJob(const std::vector<std::string> &args, Job &job, std::string &error) {
+    for (size_t i = 0; i < args.size(); ++i) {
+        std::string arg = args[i];
+        if (arg.rfind("--", 0) != 0) {
+            if (!job.path.empty()) {
+                error = "more than one FILE: " + arg;
+                return false;
+            }
+            job.path = arg;
+            continue;
+        }
+        std::string name = arg;
+        std::string value;
+        bool has_value = false;
+        size_t equals = arg.find('=');
+        if (equals != std::string::npos) {
+            name = arg.substr(0, equals);
+            value = arg.substr(equals + 1);
+            has_value = true;
+        }
+        if (name == "--dump-regs" && !has_value) {
+            job.dump_regs = true;
+            continue;
+        }
+        if (name == "--gdb-wait" && !has_value) {
+            job.gdb_wait = true;
+            continue;
+        }
+        if (!has_value) {
+            if (i + 1 == args.size()) {
+                error = name + " needs a value";
+                return false;
+            }
+            value = args[++i];
+        }
+        Word address = 0;
+        bool ok = true;
+        if (name == "--format") {
+            if (value == "raw") {
+                job.format = RomImage::Format::Raw;
+            } else if (value == "hex") {
+                job.format = RomImage::Format::IntelHex;
+            } else if (value == "prg") {
+                job.format = RomImage::Format::Prg;
+            } else {
+                ok = false;
+            }
+        } else if (name == "--load") {
+            ok = ParseAddress(value, address);
+            job.load = address;
+        } else if (name == "--pc") {
+            ok = ParseAddress(value, job.pc);
+            job.set_pc = true;
+        } else if (name == "--cycles") {
+            char *end = nullptr;
+            job.cycles = std::strtoull(value.c_str(), &end, 10);
+            ok = !value.empty() && *end == '\0' && job.cycles > 0;
+        } else if (name == "--brk") {
+            ok = value == "halt" || value == "interrupt";
+            job.brk_halts = value == "halt";
+        } else if (name == "--gdb") {
+            job.gdb = value;
+            ok = !value.empty();
+        } else if (name == "--dump-mem") {
+            size_t colon = value.find(':');
+            Range range = {0, 0};
+            ok = colon != std::string::npos && ParseAddress(value.substr(0, colon), range.from) &&
+                 ParseAddress(value.substr(colon + 1), range.to) && range.from <= range.to;
+            job.dumps.push_back(range);
+        } else {
+            error = "unknown option " + name;
+            return false;
+        }
+        if (!ok) {
+            error = "bad value for " + name + ": " + value;
+            return false;
+        }
+    }
+    if (job.path.empty()) {
+        error = "no FILE given";
+        return false;
+    }
+    if (job.gdb_wait && job.gdb.empty()) {
+        error = "--gdb-wait needs --gdb";
+        return false;
+    }
+    return true;
+}
+
+// Boots the job's image in instance and runs it to completion.
+void Execute(Job &job, BatchRunner::Instance &instance) {
+    CPU &cpu = instance.Cpu;
+    Mem &mem = instance.Memory;
+    if (!job.image.Open(job.path.c_str(), job.format, job.load)) {
+        job.error = "cannot load";
+        return;
+    }
+    // Without --gdb, the stub never listens and Run is plain Execute.
+    GdbStub gdb;
+    if (!job.gdb.empty()) {
+        if (!gdb.Listen(job.gdb.c_str())) {
+            job.error = "cannot listen on " + job.gdb;
+            return;
+        }
+        std::cerr << job.path << ": gdb can attach at " << job.gdb << "\n";
+    }
+    job.loaded = true;
+    job.image.Boot(cpu, mem);
+    cpu.BrkHalts = job.brk_halts;
+    if (job.set_pc) {
+        cpu.PC = job.pc;
+    }
+    if (job.gdb_wait) {
+        gdb.Accept(true);
+    }
+
+    const s32 slice = job.gdb.empty() ? SLICE : GDB_SLICE;
+    auto began = std::chrono::steady_clock::now();
+    while (job.spent < job.cycles) {
+        s32 budget = static_cast<s32>(std::min<unsigned long long>(job.cycles - job.spent, slice));
+        CPU::ExecResult exec = gdb.Run(cpu, budget, mem, job.idle);
+        job.spent += static_cast<unsigned long long>(exec.CyclesConsumed);
+        job.instructions += exec.InstructionsRetired;
+        job.reason = exec.Reason;
+        instance.Result = exec;
+        if (exec.Reason != CPU::StopReason::Budget) {
+            break;
+        }
+    }
+    job.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+}
+
+const char *ReasonName(CPU::StopReason reason) {
+    switch (reason) {
+    case CPU::StopReason::Brk:
+        return "brk";
+    case CPU::StopReason::Illegal:
+        return "illegal";
+    case CPU::StopReason::Breakpoint:
+        return "breakpoint";
+    default:
+        return "budget";
+    }
+}
+
+std::string Quote(const std::string &text) {
+    std::string quoted = "\"";
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+            quoted += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escape[8];
+            std::snprintf(escape, sizeof escape, "\\u%04x", c);
+            quoted += escape;
+        } else {
+            quoted += c;
+        }
+    }
+    return quoted + "\"";
+}
+
+double PerSecond(double count, double seconds) {
+    return seconds > 0 ? count / seconds : 0;
+}
+
+// The job's result as a JSON object, each line starting with indent.
+std::string Json(const Job &job, const Mem &mem, const CPU &cpu, const std::string &indent) {
+    std::ostringstream out;
+    out << "{\n" << indent << "  \"image\": " << Quote(job.path) << ",\n";
+    if (!job.loaded) {
+        out << indent << "  \"error\": " << Quote(job.error) << "\n" << indent << "}";
+        return out.str();
+    }
+    char line[512];
+    std::snprintf(line, sizeof line,
+                  "%s  \"stop\": \"%s\",\n"
+                  "%s  \"pc\": %u,\n"
+                  "%s  \"cycles\": %llu,\n"
+                  "%s  \"instructions\": %llu,\n"
+                  "%s  \"seconds\": %.6f,\n"
+                  "%s  \"instructions_per_second\": %.0f,\n"
+                  "%s  \"emulated_mhz\": %.2f",
+                  indent.c_str(), ReasonName(job.reason), indent.c_str(), cpu.PC, indent.c_str(), job.spent,
+                  indent.c_str(), static_cast<unsigned long long>(job.instructions), indent.c_str(), job.seconds,
+                  indent.c_str(), PerSecond(static_cast<double>(job.instructions), job.seconds), indent.c_str(),
+                  PerSecond(static_cast<double>(job.spent), job.seconds) / 1e6);
+    out << line;
+    out << ",\n" << indent << "  \"idle_loops\": [";
+    bool first = true;
+    for (const auto &loop : job.idle.Loops) {
+        std::snprintf(line, sizeof line, "%s%s    {\"pc\": %u, \"iterations\": %llu, \"cycles\": %llu}",
+                      first ? "\n" : ",\n", indent.c_str(), loop.first,
+                      static_cast<unsigned long long>(loop.second.Iterations),
+                      static_cast<unsigned long long>(loop.second.Cycles));
+        out << line;
+        first = false;
+    }
+    out << (first ? "]" : "\n" + indent + "  ]");
+    if (job.dump_regs) {
+        std::snprintf(line, sizeof line,
+                      ",\n%s  \"registers\": {\"pc\": %u, \"sp\": %u, \"a\": %u, \"x\": %u, \"y\": %u, \"p\": %u}",
+                      indent.c_str(), cpu.PC, cpu.SP & 0xFF, cpu.A, cpu.X, cpu.Y, cpu.GetStatus());
+        out << line;
+    }
+    if (!job.dumps.empty()) {
+        out << ",\n" << indent << "  \"memory\": [";
+        for (size_t i = 0; i < job.dumps.size(); ++i) {
+            const Range &range = job.dumps[i];
+            out << (i ? ",\n" : "\n") << indent << "    {\"from\": " << range.from << ", \"to\": " << range.to
+                << ", \"data\": \"";
+            for (u32 address = range.from; address <= range.to; ++address) {
+                char hex[3];
+                std::snprintf(hex, sizeof hex, "%02X", mem.Read(static_cast<Word>(address)));
+                out << hex;
+            }
+            out << "\"}";
+        }
+        out << "\n" << indent << "  ]";
+    }
+    out << "\n" << indent << "}";
+    return out.str();
+}
+
+bool Failed(const Job &job) {
+    return !job.loaded || job.reason == CPU::StopReason::Illegal;
+}
+
+int Run(const std::vector<std::string> &args) {
+    Job job;
+    std::string error;
+    if (!ParseJob(args, job, error)) {
+        std::cerr << error << "\n" << USAGE;
+        return 2;
+    }
+    BatchRunner batch;
+    BatchRunner::Instance &instance = batch.Add();
+    Execute(job, instance);
+    std::cout << Json(job, instance.Memory, instance.Cpu, "") << "\n";
+    if (!job.loaded) {
+        std::cerr << job.path << ": " << job.error << "\n";
+    }
+    return Failed(job) ? 1 : 0;
+}
+
+// Splits line into words at whitespace; paths with spaces aren't supported.
+std::vector<std::string> Words(const std::string &line) {
+    std::istringstream in(line);
+    std::vector<std::string> words;
+    std::string word;
+    while (in >> word) {
+        words.push_back(word);
+    }
+    return words;
+}
+
+int Batch(const std::vector<std::string> &args) {
+    std::string manifest;
+    unsigned workers = 0;
+    bool ok = true;
+    for (const std::string &arg : args) {
+        if (arg.rfind("--jobs=", 0) == 0) {
+            workers = static_cast<unsigned>(std::strtoul(arg.c_str() + 7, nullptr, 10));
+        } else if (manifest.empty() && arg.rfind("--", 0) != 0) {
+            manifest = arg;
+        } else {
+            ok = false;
+        }
+    }
+    if (!ok || manifest.empty()) {
+        std::cerr << USAGE;
+        return 2;
+    }
+
+    std::ifstream in(manifest);
+    if (!in) {
+        std::cerr << "cannot read " << manifest << "\n";
+        return 1;
+    }
+    size_t slash = manifest.rfind('/');
+    std::string base = slash == std::string::npos ? "" : manifest.substr(0, slash + 1);
+
+    // Jobs hold RomImages, which can't move once loaded.
+    std::vector<std::unique_ptr<Job>> jobs;
+    std::string line;
+    for (int number = 1; std::getline(in, line); ++number) {
+        std::vector<std::string> words = Words(line);
+        if (words.empty() || words[0][0] == '#') {
+            continue;
+        }
+        auto job = std::make_unique<Job>();
+        std::string error;
+        if (!ParseJob(words, *job, error)) {
+            std::cerr << manifest << ":" << number << ": " << error << "\n";
+            return 2;
+        }
+        if (job->path[0] != '/') {
+            job->path = base + job->path;
+        }
+        jobs.push_back(std::move(job));
+    }
+
+    BatchRunner batch;
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        batch.Add();
+    }
+    if (workers == 0) {
+        workers = std::max(1u, std::thread::hardware_concurrency());
+    }
+    workers = static_cast<unsigned>(std::min<size_t>(workers, std::max<size_t>(1, jobs.size())));
+    auto began = std::chrono::steady_clock::now();
+    batch.ForEach([&jobs, &batch](size_t index) { Execute(*jobs[index], batch[index]); }, workers);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+
+    unsigned long long cycles = 0;
+    unsigned long long instructions = 0;
+    int status = 0;
+    std::cout << "{\n  \"jobs\": [";
+    for (size_t i = 0; i < jobs.size(); ++i) {
+        const Job &job = *jobs[i];
+        std::cout << (i ? ",\n    " : "\n    ") << Json(job, batch[i].Memory, batch[i].Cpu, "    ");
+        cycles += job.spent;
+        instructions += job.instructions;
+        if (Failed(job)) {
+            status = 1;
+        }
+    }
+    char totals[512];
+    std::snprintf(totals, sizeof totals,
+                  "\n  ],\n"
+                  "  \"workers\": %u,\n"
+                  "  \"cycles\": %llu,\n"
+                  "  \"instructions\": %llu,\n"
+                  "  \"seconds\": %.6f,\n"
+                  "  \"instructions_per_second\": %.0f,\n"
+                  "  \"emulated_mhz\": %.2f\n"
+                  "}\n",
+                  workers, cycles, instructions, seconds, PerSecond(static_cast<double>(instructions), seconds),
+                  PerSecond(static_cast<double>(cycles), seconds) / 1e6);
+    std::cout << totals;
+    return status;
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::string command = argc > 1 ? argv[1] : "";
+    std::vector<std::string> args(argv + std::min(argc, 2), argv + argc);
+    if (command == "run") {
+        return Run(args);
+    }
+    if (command == "batch") {
+        return Batch(args);
+    }
+    std::cerr << USAGE;
+    return 2;
+}
@@ -0,0 +1,155 @@
+// Runs a conformance test ROM, such as Klaus Dormann's 6502 functional test,
+// until it traps, and reports whether it trapped at the success address:
+//
+//   ./bin/functional_test FILE [--format=raw|hex|prg] [--address=HEX]
+//                         [--start=HEX] [--success=HEX]
+//                         [--engine=fast|cache|exact] [--cycles=N]
+//
+// Such ROMs signal both failure and success by jumping or branching to
+// themselves. The defaults suit the functional test's stock 64 KiB binary:
+// loaded at $0000, started at $0400, and passing at $3469. A rebuilt test
+// lists its own success address in the assembler listing. BRK runs as a
+// software interrupt, since the test exercises it.
+//
+// Exits 0 on success, 1 on a trap anywhere else, an illegal opcode or
+// running out of cycles, and 2 on bad arguments.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <string>
+#include "block_cache.hpp"
+#include "cycle_exact.hpp"
+#include "opcode_info.hpp"
+#include "rom_loader.hpp"
+
+namespace {
+
+// Short slices keep the cycles spent spinning in the trap out of the totals.
+constexpr s32 SLICE = 1 << 16;
+
+enum class Engine { Fast, Cache, Exact };
+
+struct Runner {
+    Engine engine;
+    BlockCache cache;
+
+    CPU::ExecResult Run(CPU &cpu, s32 cycles, Mem &mem) {
+        switch (engine) {
+        case Engine::Cache:
+            return cache.Execute(cpu, cycles, mem);
+        case Engine::Exact:
+            return CycleExact::Execute(cpu, cycles, mem);
+        default:
+            return cpu.Execute(cycles, mem);
+        }
+    }
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::string path;
+    RomImage::Format format = RomImage::Format::Detect;
+    s32 address = 0x0000;
+    Word start = 0x0400;
+    Word success = 0x3469;
+    Engine engine = Engine::Fast;
+    long long cycles = 1000000000;
+    bool ok = true;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--format=raw") {
+            format = RomImage::Format::Raw;
+        } else if (arg == "--format=hex") {
+            format = RomImage::Format::IntelHex;
+        } else if (arg == "--format=prg") {
+            format = RomImage::Format::Prg;
+        } else if (arg.rfind("--address=", 0) == 0) {
+            address = static_cast<s32>(std::strtol(arg.c_str() + 10, nullptr, 16) & 0xFFFF);
+        } else if (arg.rfind("--start=", 0) == 0) {
+            start = static_cast<Word>(std::strtol(arg.c_str() + 8, nullptr, 16));
+        } else if (arg.rfind("--success=", 0) == 0) {
+            success = static_cast<Word>(std::strtol(arg.c_str() + 10, nullptr, 16));
+        } else if (arg == "--engine=fast") {
+            engine = Engine::Fast;
+        } else if (arg == "--engine=cache") {
+            engine = Engine::Cache;
+        } else if (arg == "--engine=exact") {
+            engine = Engine::Exact;
+        } else if (arg.rfind("--cycles=", 0) == 0) {
+            cycles = std::strtoll(arg.c_str() + 9, nullptr, 10);
+        } else if (path.empty() && arg.rfind("--", 0) != 0) {
+            path = arg;
+        } else {
+            ok = false;
+        }
+    }
+    if (!ok || path.empty() || cycles <= 0) {
+        std::cerr << "usage: " << argv[0]
+                  << " FILE [--format=raw|hex|prg] [--address=HEX] [--start=HEX] [--success=HEX]"
+                     " [--engine=fast|cache|exact] [--cycles=N]\n";
+        return 2;
+    }
+
+    RomImage rom;
+    if (!rom.Open(path.c_str(), format, address)) {
+        std::cerr << "cannot load " << path << "\n";
+        return 1;
+    }
+    // The block cache is large; keep it off the stack.
+    auto runner = std::make_unique<Runner>();
+    runner->engine = engine;
+    Mem mem;
+    CPU cpu;
+    cpu.BrkHalts = false;
+    rom.Boot(cpu, mem);
+    cpu.PC = start;
+
+    // After each slice, step one instruction: a trap leaves PC where it was.
+    CPU::ExecResult exec;
+    u64 instructions = 0;
+    long long spent = 0;
+    bool trapped = false;
+    auto began = std::chrono::steady_clock::now();
+    while (spent < cycles) {
+        exec = runner->Run(cpu, static_cast<s32>(std::min<long long>(cycles - spent, SLICE)), mem);
+        instructions += exec.InstructionsRetired;
+        spent += exec.CyclesConsumed;
+        if (exec.Reason != CPU::StopReason::Budget) {
+            break;
+        }
+        Word pc = cpu.PC;
+        exec = runner->Run(cpu, 1, mem);
+        instructions += exec.InstructionsRetired;
+        spent += exec.CyclesConsumed;
+        if (exec.Reason != CPU::StopReason::Budget) {
+            break;
+        }
+        if (cpu.PC == pc) {
+            trapped = true;
+            break;
+        }
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - began).count();
+
+    bool passed = trapped && cpu.PC == success;
+    if (trapped) {
+        std::printf("%s: trapped at %04X (%s)\n", passed ? "PASS" : "FAIL", cpu.PC,
+                    Disassemble(mem.Read(cpu.PC), static_cast<Word>(mem.Read(cpu.PC + 1) | mem.Read(cpu.PC + 2) << 8),
+                                cpu.PC)
+                        .c_str());
+    } else if (exec.Reason == CPU::StopReason::Illegal) {
+        std::printf("FAIL: illegal opcode %02X at %04X\n", mem.Read(cpu.PC), cpu.PC);
+    } else {
+        std::printf("FAIL: no trap within %lld cycles, PC=%04X\n", cycles, cpu.PC);
+    }
+    std::printf("A=%02X X=%02X Y=%02X SP=%02X P=%02X\n", cpu.A, cpu.X, cpu.Y, cpu.SP & 0xFF, cpu.GetStatus());
+    std::printf("%llu instructions, %lld cycles in %.3f s: %.1f M instructions/s, %.1f MHz\n",
+                static_cast<unsigned long long>(instructions), spent, seconds, instructions / seconds / 1e6,
+                spent / seconds / 1e6);
+    return passed ? 0 : 1;
+}
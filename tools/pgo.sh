@@ -0,0 +1,98 @@
+#!/bin/sh
+# Builds the emulator with profile-guided and link-time optimisation, and
+# measures what that gains over a plain Release build:
+#
+#   tools/pgo.sh [BUILD_DIR] [--min-time=SECONDS] [--rounds=N]
+#
+#   BUILD_DIR/release   the plain Release build, as the baseline
+#   BUILD_DIR/pgo       built instrumented, trained by running every bench
+#                       kernel and instruction family, then rebuilt in place
+#                       with the profile and LTO
+#
+# The benchmarks then run on both builds, alternating, --rounds times each
+# (default 3) for --min-time seconds (default 0.5). The best ns per emulated
+# instruction of each is compared, and the geometric mean of the speedups is
+# printed last. The optimised programs are left in BUILD_DIR/pgo/bin.
+#
+# BUILD_DIR defaults to build-pgo. CMAKE_GENERATOR and CXX are honoured as by
+# cmake. Clang needs llvm-profdata on the PATH to merge its profiles.
+
+set -eu
+
+source_dir=$(cd "$(dirname "$0")/.." && pwd)
+build_dir=build-pgo
+min_time=0.5
+rounds=3
+for arg in "$@"; do
+    case "$arg" in
+    --min-time=*) min_time=${arg#--min-time=} ;;
+    --rounds=*) rounds=${arg#--rounds=} ;;
+    --*) echo "usage: $0 [BUILD_DIR] [--min-time=SECONDS] [--rounds=N]" >&2; exit 2 ;;
+    *) build_dir=$arg ;;
+    esac
+done
+mkdir -p "$build_dir"
+build_dir=$(cd "$build_dir" && pwd)
+release=$build_dir/release
+pgo=$build_dir/pgo
+profiles=$pgo/pgo-data
+
+configure() {
+    dir=$1
+    shift
+    cmake -S "$source_dir" -B "$dir" -DCMAKE_BUILD_TYPE=Release -DCMAKE_RUNTIME_OUTPUT_DIRECTORY="$dir/bin" "$@" >/dev/null
+}
+
+build() {
+    cmake --build "$1" -j"$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 2)" >/dev/null
+}
+
+echo "== Release build"
+configure "$release" -DEMU6502_LTO=OFF -DEMU6502_PGO=
+build "$release"
+
+echo "== Instrumented build"
+rm -rf "$profiles"
+configure "$pgo" -DEMU6502_LTO=OFF -DEMU6502_PGO=GENERATE -DEMU6502_PGO_DIR="$profiles"
+build "$pgo"
+
+echo "== Training"
+"$pgo/bin/bench" --min-time=0.05 >/dev/null
+if ls "$profiles"/*.profraw >/dev/null 2>&1; then
+    llvm-profdata merge -output="$profiles/emu6502.profdata" "$profiles"/*.profraw
+fi
+
+echo "== Optimised build"
+configure "$pgo" -DEMU6502_LTO=ON -DEMU6502_PGO=USE -DEMU6502_PGO_DIR="$profiles"
+build "$pgo"
+
+echo "== Measuring"
+# Keeps the lowest ns/instruction seen for each benchmark in $2.
+best() {
+    "$1" --min-time="$min_time" | awk 'NR > 2 { print $1, $7 }' >>"$2"
+}
+rm -f "$build_dir/release.txt" "$build_dir/pgo.txt"
+i=0
+while [ "$i" -lt "$rounds" ]; do
+    best "$release/bin/bench" "$build_dir/release.txt"
+    best "$pgo/bin/bench" "$build_dir/pgo.txt"
+    i=$((i + 1))
+done
+
+awk '
+    FNR == 1 { file++ }
+    { if (!(($1, file) in ns) || $2 < ns[$1, file]) ns[$1, file] = $2; names[$1] = 1 }
+    END {
+        printf "%-28s %12s %12s %8s\n", "Benchmark", "Release ns", "PGO+LTO ns", "Speedup"
+        n = 0; logs = 0
+        for (name in names) order[++n] = name
+        for (i = 1; i <= n; i++) for (j = i + 1; j <= n; j++) if (order[j] < order[i]) { t = order[i]; order[i] = order[j]; order[j] = t }
+        for (i = 1; i <= n; i++) {
+            name = order[i]
+            speedup = ns[name, 1] / ns[name, 2]
+            logs += log(speedup)
+            printf "%-28s %12.3f %12.3f %7.2fx\n", name, ns[name, 1], ns[name, 2], speedup
+        }
+        printf "%-28s %12s %12s %7.2fx\n", "geometric mean", "", "", exp(logs / n)
+    }' "$build_dir/release.txt" "$build_dir/pgo.txt"
+echo "Optimised programs: $pgo/bin"
@@ -0,0 +1,104 @@
+// Prints a trace file written by Tracer (include/trace.hpp) as text, one
+// retired instruction per line with the registers it left behind:
+//
+//   cycle     PC    bytes     instruction       A  X  Y  SP flags
+//
+//   ./bin/trace_decode FILE [--skip=N] [--limit=N] [--pc=ADDR]
+//
+// --skip and --limit select a range of records; --pc keeps only the
+// instructions at one address (hex).
+
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "opcode_info.hpp"
+#include "trace.hpp"
+
+namespace {
+
+std::string Flags(Byte p) {
+    const char names[] = "NV-BDIZC";
+    std::string flags;
+    for (int bit = 7; bit >= 0; --bit) {
+        bool set = p & (1 << bit);
+        flags += set ? names[7 - bit] : static_cast<char>(std::tolower(names[7 - bit]));
+    }
+    return flags;
+}
+
+void Print(const TraceRecord &r) {
+    Byte length = DispatchTable[r.Opcode].Length;
+    char bytes[16];
+    if (length == 1) {
+        std::snprintf(bytes, sizeof bytes, "%02X", r.Opcode);
+    } else if (length == 2) {
+        std::snprintf(bytes, sizeof bytes, "%02X %02X", r.Opcode, r.Operand & 0xFF);
+    } else {
+        std::snprintf(bytes, sizeof bytes, "%02X %02X %02X", r.Opcode, r.Operand & 0xFF, r.Operand >> 8);
+    }
+    std::printf("%10llu  %04X  %-8s  %-16s  %02X %02X %02X  %02X %s\n",
+                static_cast<unsigned long long>(r.Cycle()), r.PC, bytes,
+                Disassemble(r.Opcode, r.Operand, r.PC).c_str(), r.A, r.X, r.Y, r.SP, Flags(r.P).c_str());
+}
+
+} // namespace
+
+int main(int argc, char **argv) {
+    std::string path;
+    unsigned long long skip = 0;
+    unsigned long long limit = ~0ull;
+    long pc = -1;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg.rfind("--skip=", 0) == 0) {
+            skip = std::strtoull(arg.c_str() + 7, nullptr, 10);
+        } else if (arg.rfind("--limit=", 0) == 0) {
+            limit = std::strtoull(arg.c_str() + 8, nullptr, 10);
+        } else if (arg.rfind("--pc=", 0) == 0) {
+            pc = std::strtol(arg.c_str() + 5, nullptr, 16);
+        } else if (path.empty() && arg.rfind("--", 0) != 0) {
+            path = arg;
+        } else {
+            path.clear();
+            break;
+        }
+    }
+    if (path.empty()) {
+        std::cerr << "usage: " << argv[0] << " FILE [--skip=N] [--limit=N] [--pc=ADDR]\n";
+        return 2;
+    }
+
+    std::FILE *file = std::fopen(path.c_str(), "rb");
+    if (!file) {
+        std::cerr << "cannot open " << path << "\n";
+        return 1;
+    }
+    if (!TraceFile::ReadHeader(file)) {
+        std::cerr << path << " is not a version " << TraceFile::VERSION << " trace\n";
+        std::fclose(file);
+        return 1;
+    }
+
+    std::printf("%10s  %-4s  %-8s  %-16s  %-2s %-2s %-2s  %-2s %s\n", "cycle", "PC", "bytes", "instruction", "A",
+                "X", "Y", "SP", "flags");
+    std::vector<Byte> buffer(4096 * TraceRecord::SIZE);
+    unsigned long long index = 0;
+    unsigned long long shown = 0;
+    size_t got;
+    while (shown < limit && (got = std::fread(buffer.data(), TraceRecord::SIZE, 4096, file)) > 0) {
+        for (size_t i = 0; i < got && shown < limit; ++i, ++index) {
+            TraceRecord r = TraceRecord::Decode(&buffer[i * TraceRecord::SIZE]);
+            if (index < skip || (pc >= 0 && r.PC != pc)) {
+                continue;
+            }
+            Print(r);
+            shown++;
+        }
+    }
+    std::fclose(file);
+    return 0;
+}